@@ -12,36 +12,40 @@
 #include "Engine.h"
 
 // Animated object class constructor.
-AnimatedObject::AnimatedObject( char *meshName, char *meshPath, unsigned long type ) : SceneObject( type, meshName, meshPath, false )
+AnimatedObject::AnimatedObject( char *meshName, char *meshPath, unsigned long type ) : SceneObject( type, meshName, meshPath )
 {
-	// Create a clone of the mesh's animation controller.
+	// The mesh and its clips are shared with every other object using them, so
+	// the object only keeps its own playback state and pose. Each object poses
+	// the mesh before rendering it, so it can't be drawn instanced.
+	SetInstanced( false );
+
+	// Create the object's pose and hand it to the animation system.
 	if( GetMesh() != NULL )
-		GetMesh()->CloneAnimationController( &m_animationController );
+	{
+		m_animation = new AnimationInstance( GetMesh()->GetSkeleton() );
+		g_engine->GetAnimationSystem()->Add( m_animation );
+	}
 
 	// No mesh exist, so clear pointer 
 	else
-		m_animationController = NULL;
+		m_animation = NULL;
 
-	// Set the track speed on both tracks to full speed.
-	if( m_animationController != NULL )
-	{
-		m_animationController->SetTrackSpeed( 0, 1.0f );
-		m_animationController->SetTrackSpeed( 1, 1.0f );
-	}
-
-	// Clear the variables used for animation.
-	m_currentTrack = 0;
-	m_currentTime = 0.0f;
+	// Start the frame counter at random so that objects updated at the same
+	// reduced rate are spread over different frames.
+	m_animationElapsed = 0.0f;
+	m_animationFrame = rand();
+	m_fullRateScreenSize = ANIMATION_FULL_RATE_SCREEN_SIZE;
+	m_maxUpdateInterval = ANIMATION_MAX_UPDATE_INTERVAL;
 
 }
 
 // Animated object class destructor.
 AnimatedObject::~AnimatedObject()
 {
-	if( m_animationController )
+	if( m_animation != NULL )
 	{
-		m_animationController ->Release();
-		m_animationController = NULL;
+		g_engine->GetAnimationSystem()->Remove( m_animation );
+		SAFE_DELETE( m_animation );
 	}
 
 }
@@ -52,86 +56,97 @@ void AnimatedObject::Update( float elapsed, bool addVelocity )
 	// Allow the base scene object to update.
 	SceneObject::Update( elapsed, addVelocity );
 
-	// Check if the object has an animation controller.
-	if( m_animationController )
-	{
-		// Advance the object's animation controller.
-		m_animationController->AdvanceTime( elapsed, this );
+	if( m_animation == NULL )
+		return;
 
-		// Keep track of the current time for animation purposes.
-		m_currentTime += elapsed;
-	}
+	// Keep the time until the pose is next updated, so a throttled or frozen
+	// animation catches up when it is.
+	m_animationElapsed += elapsed;
 
-	// Update the mesh.
-	if( GetMesh() != NULL )
-		GetMesh()->Update();
+	// Freeze the pose while the object isn't drawn.
+	if( GetVisible() == false || GetCulled() == true )
+		return;
 
-}
+	// Update the pose of smaller objects less often, halving the rate each
+	// time the object's size on screen halves.
+	unsigned long interval = 1;
+	while( interval < m_maxUpdateInterval && GetScreenSize() * interval < m_fullRateScreenSize )
+		interval *= 2;
 
-// Plays the given animation with the given transition time.-
-void AnimatedObject::PlayAnimation( unsigned int animation, float transitionTime, bool loop )
-{
-	// Ensure object has a valid animation controller.
-	if( m_animationController == NULL )
+	if( ++m_animationFrame % interval != 0 )
 		return;
 
-	// Ensure the transition time is always greater than zero.
-	if( transitionTime <= 0.0f )
-		transitionTime = 0.000001f;
+	// Move the animation along. The pose itself is evaluated later by the
+	// animation system, along with every other animated object.
+	m_animation->Advance( m_animationElapsed );
+	m_animationElapsed = 0.0f;
 
-	// Find which track to play the new animation on.
-	unsigned int newTrack = ( m_currentTrack == 0 ? 1 : 0 );
+}
 
-	// Get a pointer to the animation set to play.
-	ID3DXAnimationSet *as;
-	m_animationController->GetAnimationSet( animation, &as );
+// Renders the object in its current pose. The pose is applied to the shared
+// mesh just before it is drawn.
+void AnimatedObject::Render( D3DXMATRIX *world )
+{
+	if( m_animation != NULL )
+		GetMesh()->ApplyPose( m_animation->GetBoneMatrices() );
 
-	// Set the animation set to the new track.
-	m_animationController->SetTrackAnimationSet( newTrack, as );
+	SceneObject::Render( world );
 
-	// Clear all the events that are currently set on the tracks.
-	m_animationController->UnkeyAllTrackEvents( m_currentTrack );
-	m_animationController->UnkeyAllTrackEvents( newTrack );
+}
 
-	// Check if this animation should be looped or only played once.
-	if( loop == true )
-	{
-		// Transition the new track in over the specified transition time period.
-		m_animationController->KeyTrackEnable( m_currentTrack, false, m_currentTime + transitionTime );
-		m_animationController->KeyTrackWeight( m_currentTrack, 0.0f, m_currentTime, transitionTime, D3DXTRANSITION_LINEAR );
-		m_animationController->SetTrackEnable( newTrack, true );
-		m_animationController->KeyTrackWeight( newTrack, 1.0f, m_currentTime, transitionTime, D3DXTRANSITION_LINEAR );
-	}
-	else
-	{
-		// Stop the current track, and start the new track without transitioning.
-		m_animationController->SetTrackEnable( m_currentTrack, false );
-		m_animationController->SetTrackWeight( m_currentTrack, 0.0f );
-		m_animationController->SetTrackEnable( newTrack, true );
-		m_animationController->SetTrackWeight( newTrack, 1.0f );
-		m_animationController->SetTrackPosition( newTrack, 0.0f );
-		m_animationController->KeyTrackEnable( newTrack, false, m_currentTime + as->GetPeriod() );
-	}
+// Returns the bone matrices of the object's current pose and their number.
+D3DXMATRIX *AnimatedObject::GetPose( unsigned long *totalBones )
+{
+	if( m_animation == NULL )
+		return SceneObject::GetPose( totalBones );
 
-	// Release the pointer to the animation set.
-	as->Release();
+	*totalBones = m_animation->GetSkeleton()->totalBones;
+	return m_animation->GetBoneMatrices();
+}
 
-	// The new track is now the current track.
-	m_currentTrack = newTrack;
+// Plays the given animation with the given transition time.
+void AnimatedObject::PlayAnimation( unsigned int animation, float transitionTime, bool loop )
+{
+	// Ensure object has a valid animation clip to play.
+	if( m_animation == NULL || GetMesh()->GetClip( animation ) == NULL )
+		return;
+
+	m_animation->Play( GetMesh()->GetClip( animation ), transitionTime, loop );
 
 }
 
+// Returns a pointer to the object's animation playback state and pose.
+AnimationInstance *AnimatedObject::GetAnimationInstance()
+{
+	return m_animation;
+
+}
 
-// Returns a pointer to the object's animation controller.
-ID3DXAnimationController *AnimatedObject::GetAnimationController()
+// Returns the model space transformation of the named bone in the object's
+// current pose, or NULL if there is no such bone. This does not need the
+// mesh to be rendered, so it can be used for things like hit detection.
+D3DXMATRIX *AnimatedObject::GetBoneMatrix( char *name )
 {
-	return m_animationController;
+	if( m_animation == NULL )
+		return NULL;
+
+	// Bring the pose up to date first, as it may have been throttled or frozen.
+	if( m_animationElapsed > 0.0f )
+	{
+		m_animation->Advance( m_animationElapsed );
+		m_animationElapsed = 0.0f;
+	}
+	m_animation->Evaluate();
+
+	return m_animation->GetBoneMatrix( name );
 
 }
 
-// Animation callback handler.
-HRESULT CALLBACK AnimatedObject::HandleCallback( THIS_ UINT Track, LPVOID pCallbackData )
+// Sets the screen size at and above which the object's pose is updated every
+// frame, and the most frames allowed between updates when it is smaller.
+void AnimatedObject::SetAnimationLOD( float fullRateScreenSize, unsigned long maxUpdateInterval )
 {
-	return S_OK;
+	m_fullRateScreenSize = fullRateScreenSize;
+	m_maxUpdateInterval = max( maxUpdateInterval, 1UL );
 
 }
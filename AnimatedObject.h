@@ -14,24 +14,35 @@
 
 #define TYPE_ANIMATED_OBJECT 1
 
-class AnimatedObject : public SceneObject, public ID3DXAnimationCallbackHandler
+// Fraction of the screen height at and above which an object's pose is updated every frame.
+#define ANIMATION_FULL_RATE_SCREEN_SIZE 0.25f
+
+// Most frames between updates of the pose of a small or distant object.
+#define ANIMATION_MAX_UPDATE_INTERVAL 8
+
+class AnimatedObject : public SceneObject
 {
 public:
 	AnimatedObject( char *meshName, char *meshPath = "./", unsigned long type = TYPE_ANIMATED_OBJECT );
 	virtual ~AnimatedObject();
 
 	virtual void Update( float elapsed, bool addVelocity = true );
+	virtual void Render( D3DXMATRIX *world = NULL );
+
+	virtual D3DXMATRIX *GetPose( unsigned long *totalBones );
 
 	void PlayAnimation( unsigned int animation, float transitionTime, bool loop = true );
-	ID3DXAnimationController *GetAnimationController();
+	AnimationInstance *GetAnimationInstance();
+	D3DXMATRIX *GetBoneMatrix( char *name );
 
-private:
-	virtual HRESULT CALLBACK HandleCallback( THIS_ UINT Track, LPVOID pCallbackData );
+	void SetAnimationLOD( float fullRateScreenSize, unsigned long maxUpdateInterval );
 
 private:
-	ID3DXAnimationController *m_animationController;		// Mesh animation playback controller
-	unsigned int m_currentTrack;												// Current playing animation track
-	float m_currentTime;																// Animation timer
+	AnimationInstance *m_animation;					// Playback state and pose evaluated by the animation system
+	float m_animationElapsed;							// Time not yet passed on to the animation
+	unsigned long m_animationFrame;					// Counts the frames the pose could be updated on
+	float m_fullRateScreenSize;						// Screen size at and above which the pose is updated every frame
+	unsigned long m_maxUpdateInterval;				// Most frames between updates of the pose
 
 };
 
@@ -0,0 +1,730 @@
+// ************************************************************************
+//
+// File: AnimationSystem.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Samples, blends and evaluates skeletal animation for every animated object
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Animation clip class constructor. Reduces and compresses the given keys,
+// which are reduced in place and can be deleted once the clip is built.
+AnimationClip::AnimationClip( AnimationKeys *keys )
+{
+	m_name = new char[strlen( keys->name ) + 1];
+	strcpy( m_name, keys->name );
+	m_period = keys->period;
+	m_totalBones = keys->totalBones;
+
+	m_rotationStarts = new unsigned long[m_totalBones + 1];
+	m_translationStarts = new unsigned long[m_totalBones + 1];
+	m_scaleStarts = new unsigned long[m_totalBones + 1];
+	ZeroMemory( m_rotationStarts, sizeof( unsigned long ) * ( m_totalBones + 1 ) );
+	ZeroMemory( m_translationStarts, sizeof( unsigned long ) * ( m_totalBones + 1 ) );
+	ZeroMemory( m_scaleStarts, sizeof( unsigned long ) * ( m_totalBones + 1 ) );
+
+	m_translationMins = new D3DXVECTOR3[max( m_totalBones, 1UL )];
+	m_translationExtents = new D3DXVECTOR3[max( m_totalBones, 1UL )];
+	m_scaleMins = new D3DXVECTOR3[max( m_totalBones, 1UL )];
+	m_scaleExtents = new D3DXVECTOR3[max( m_totalBones, 1UL )];
+	m_translationsFull = new bool[max( m_totalBones, 1UL )];
+	m_scalesFull = new bool[max( m_totalBones, 1UL )];
+	m_translationValues = NULL;
+	m_scaleValues = NULL;
+
+	// Reduce the keys of every bone, counting those that remain.
+	for( unsigned long b = 0; b < m_totalBones; b++ )
+	{
+		if( keys->rotationCounts[b] > 0 )
+		{
+			// Keep neighbouring keys in the same hemisphere so they interpolate the short way round.
+			for( unsigned long k = 1; k < keys->rotationCounts[b]; k++ )
+				if( D3DXQuaternionDot( &keys->rotations[b][k - 1], &keys->rotations[b][k] ) < 0.0f )
+					keys->rotations[b][k] = -keys->rotations[b][k];
+
+			m_rotationStarts[b + 1] = ReduceRotations( keys->rotationTimes[b], keys->rotations[b], keys->rotationCounts[b] );
+		}
+
+		if( keys->translationCounts[b] > 0 )
+			m_translationStarts[b + 1] = ReduceVectors( keys->translationTimes[b], keys->translations[b], keys->translationCounts[b], ANIMATION_TRANSLATION_TOLERANCE );
+
+		if( keys->scaleCounts[b] > 0 )
+			m_scaleStarts[b + 1] = ReduceVectors( keys->scaleTimes[b], keys->scales[b], keys->scaleCounts[b], ANIMATION_SCALE_TOLERANCE );
+	}
+
+	// Turn the counts into the index of each bone's first key.
+	for( unsigned long b = 0; b < m_totalBones; b++ )
+	{
+		m_rotationStarts[b + 1] += m_rotationStarts[b];
+		m_translationStarts[b + 1] += m_translationStarts[b];
+		m_scaleStarts[b + 1] += m_scaleStarts[b];
+	}
+
+	m_rotationTimes = new unsigned short[max( m_rotationStarts[m_totalBones], 1UL )];
+	m_rotations = new CompressedKey[max( m_rotationStarts[m_totalBones], 1UL )];
+	m_translationTimes = new unsigned short[max( m_translationStarts[m_totalBones], 1UL )];
+	m_translations = new CompressedKey[max( m_translationStarts[m_totalBones], 1UL )];
+	m_scaleTimes = new unsigned short[max( m_scaleStarts[m_totalBones], 1UL )];
+	m_scales = new CompressedKey[max( m_scaleStarts[m_totalBones], 1UL )];
+
+	// Compress the remaining keys, storing each time as a fraction of the period.
+	float timeScale = m_period > 0.0f ? 65535.0f / m_period : 0.0f;
+	for( unsigned long b = 0; b < m_totalBones; b++ )
+	{
+		unsigned long start = m_rotationStarts[b];
+		for( unsigned long k = 0; k < m_rotationStarts[b + 1] - start; k++ )
+		{
+			m_rotationTimes[start + k] = (unsigned short)min( max( keys->rotationTimes[b][k] * timeScale + 0.5f, 0.0f ), 65535.0f );
+			CompressRotation( &keys->rotations[b][k], &m_rotations[start + k] );
+		}
+
+		// Vectors whose range is too wide to compress are kept as they are.
+		start = m_translationStarts[b];
+		unsigned long count = m_translationStarts[b + 1] - start;
+		for( unsigned long k = 0; k < count; k++ )
+			m_translationTimes[start + k] = (unsigned short)min( max( keys->translationTimes[b][k] * timeScale + 0.5f, 0.0f ), 65535.0f );
+		m_translationsFull[b] = CompressVectors( keys->translations[b], count, ANIMATION_TRANSLATION_TOLERANCE, &m_translationMins[b], &m_translationExtents[b], &m_translations[start] ) == false;
+		if( m_translationsFull[b] == true )
+		{
+			if( m_translationValues == NULL )
+				m_translationValues = new D3DXVECTOR3[m_translationStarts[m_totalBones]];
+			memcpy( &m_translationValues[start], keys->translations[b], sizeof( D3DXVECTOR3 ) * count );
+		}
+
+		start = m_scaleStarts[b];
+		count = m_scaleStarts[b + 1] - start;
+		for( unsigned long k = 0; k < count; k++ )
+			m_scaleTimes[start + k] = (unsigned short)min( max( keys->scaleTimes[b][k] * timeScale + 0.5f, 0.0f ), 65535.0f );
+		m_scalesFull[b] = CompressVectors( keys->scales[b], count, ANIMATION_SCALE_TOLERANCE, &m_scaleMins[b], &m_scaleExtents[b], &m_scales[start] ) == false;
+		if( m_scalesFull[b] == true )
+		{
+			if( m_scaleValues == NULL )
+				m_scaleValues = new D3DXVECTOR3[m_scaleStarts[m_totalBones]];
+			memcpy( &m_scaleValues[start], keys->scales[b], sizeof( D3DXVECTOR3 ) * count );
+		}
+	}
+
+}
+
+// Animation clip class destructor.
+AnimationClip::~AnimationClip()
+{
+	SAFE_DELETE_ARRAY( m_name );
+
+	SAFE_DELETE_ARRAY( m_rotationStarts );
+	SAFE_DELETE_ARRAY( m_rotationTimes );
+	SAFE_DELETE_ARRAY( m_rotations );
+
+	SAFE_DELETE_ARRAY( m_translationStarts );
+	SAFE_DELETE_ARRAY( m_translationTimes );
+	SAFE_DELETE_ARRAY( m_translations );
+	SAFE_DELETE_ARRAY( m_translationMins );
+	SAFE_DELETE_ARRAY( m_translationExtents );
+	SAFE_DELETE_ARRAY( m_translationsFull );
+	SAFE_DELETE_ARRAY( m_translationValues );
+
+	SAFE_DELETE_ARRAY( m_scaleStarts );
+	SAFE_DELETE_ARRAY( m_scaleTimes );
+	SAFE_DELETE_ARRAY( m_scales );
+	SAFE_DELETE_ARRAY( m_scaleMins );
+	SAFE_DELETE_ARRAY( m_scaleExtents );
+	SAFE_DELETE_ARRAY( m_scalesFull );
+	SAFE_DELETE_ARRAY( m_scaleValues );
+
+}
+
+// Returns the name of the clip.
+char *AnimationClip::GetName()
+{
+	return m_name;
+}
+
+// Returns the length of the clip in seconds.
+float AnimationClip::GetPeriod()
+{
+	return m_period;
+}
+
+// Samples the given bone at the given time. Channels the clip has no keys for
+// are left as they were passed in, which should be the bone's bind pose.
+void AnimationClip::Sample( unsigned long bone, float time, D3DXQUATERNION *rotation, D3DXVECTOR3 *translation, D3DXVECTOR3 *scale )
+{
+	// Find the time in the same units as the keys.
+	float position = m_period > 0.0f ? time * 65535.0f / m_period : 0.0f;
+
+	unsigned long first = m_rotationStarts[bone];
+	unsigned long last = m_rotationStarts[bone + 1];
+	if( last > first )
+	{
+		unsigned long key = FindKey( m_rotationTimes, first, last, position );
+		if( key + 1 < last && m_rotationTimes[key + 1] > m_rotationTimes[key] )
+		{
+			D3DXQUATERNION from, to;
+			DecompressRotation( &m_rotations[key], &from );
+			DecompressRotation( &m_rotations[key + 1], &to );
+
+			float blend = ( position - m_rotationTimes[key] ) / ( m_rotationTimes[key + 1] - m_rotationTimes[key] );
+			D3DXQuaternionSlerp( rotation, &from, &to, min( max( blend, 0.0f ), 1.0f ) );
+		}
+		else
+			DecompressRotation( &m_rotations[key], rotation );
+	}
+
+	SampleVector( m_translationTimes, m_translations, m_translationsFull[bone] == true ? m_translationValues : NULL, m_translationStarts[bone], m_translationStarts[bone + 1], position, &m_translationMins[bone], &m_translationExtents[bone], translation );
+	SampleVector( m_scaleTimes, m_scales, m_scalesFull[bone] == true ? m_scaleValues : NULL, m_scaleStarts[bone], m_scaleStarts[bone + 1], position, &m_scaleMins[bone], &m_scaleExtents[bone], scale );
+
+}
+
+// Removes every rotation key that can be rebuilt by interpolating the keys
+// either side of it to within the rotation tolerance. The remaining keys are
+// moved to the front of the arrays and their number is returned.
+unsigned long AnimationClip::ReduceRotations( float *times, D3DXQUATERNION *rotations, unsigned long count )
+{
+	// Two unit rotations are within the tolerance when the cosine of half the
+	// angle between them is at least this.
+	float threshold = (float)cos( ANIMATION_ROTATION_TOLERANCE * 0.5f );
+
+	// Keep the first key, and drop each key after it for as long as the
+	// skipped keys can all be rebuilt from the last kept key and the next one.
+	unsigned long kept = 1;
+	unsigned long anchor = 0;
+	for( unsigned long k = 1; k + 1 < count; k++ )
+	{
+		bool drop = true;
+		for( unsigned long j = anchor + 1; j <= k && drop == true; j++ )
+		{
+			D3DXQUATERNION rotation;
+			D3DXQuaternionSlerp( &rotation, &rotations[anchor], &rotations[k + 1], ( times[j] - times[anchor] ) / ( times[k + 1] - times[anchor] ) );
+			drop = fabs( D3DXQuaternionDot( &rotation, &rotations[j] ) ) >= threshold;
+		}
+
+		if( drop == true )
+			continue;
+
+		times[kept] = times[k];
+		rotations[kept] = rotations[k];
+		kept++;
+		anchor = k;
+	}
+
+	// Keep the last key, unless the whole channel holds a single rotation.
+	if( count > 1 )
+	{
+		times[kept] = times[count - 1];
+		rotations[kept] = rotations[count - 1];
+		kept++;
+	}
+
+	if( kept == 2 && fabs( D3DXQuaternionDot( &rotations[0], &rotations[1] ) ) >= threshold )
+		kept = 1;
+
+	return kept;
+}
+
+// Removes every vector key that can be rebuilt by interpolating the keys
+// either side of it to within the given tolerance. The remaining keys are
+// moved to the front of the arrays and their number is returned.
+unsigned long AnimationClip::ReduceVectors( float *times, D3DXVECTOR3 *vectors, unsigned long count, float tolerance )
+{
+	unsigned long kept = 1;
+	unsigned long anchor = 0;
+	for( unsigned long k = 1; k + 1 < count; k++ )
+	{
+		bool drop = true;
+		for( unsigned long j = anchor + 1; j <= k && drop == true; j++ )
+		{
+			D3DXVECTOR3 vector;
+			D3DXVec3Lerp( &vector, &vectors[anchor], &vectors[k + 1], ( times[j] - times[anchor] ) / ( times[k + 1] - times[anchor] ) );
+			vector -= vectors[j];
+			drop = D3DXVec3LengthSq( &vector ) <= tolerance * tolerance;
+		}
+
+		if( drop == true )
+			continue;
+
+		times[kept] = times[k];
+		vectors[kept] = vectors[k];
+		kept++;
+		anchor = k;
+	}
+
+	if( count > 1 )
+	{
+		times[kept] = times[count - 1];
+		vectors[kept] = vectors[count - 1];
+		kept++;
+	}
+
+	D3DXVECTOR3 difference = vectors[kept - 1] - vectors[0];
+	if( kept == 2 && D3DXVec3LengthSq( &difference ) <= tolerance * tolerance )
+		kept = 1;
+
+	return kept;
+}
+
+// Compresses the given unit rotation by dropping its largest component.
+void AnimationClip::CompressRotation( D3DXQUATERNION *rotation, CompressedKey *key )
+{
+	float components[4] = { rotation->x, rotation->y, rotation->z, rotation->w };
+
+	// Find the largest component, and flip the rotation so it is positive.
+	unsigned long largest = 0;
+	for( unsigned long c = 1; c < 4; c++ )
+		if( fabs( components[c] ) > fabs( components[largest] ) )
+			largest = c;
+
+	float sign = components[largest] < 0.0f ? -1.0f : 1.0f;
+
+	// The other components lie between plus and minus the square root of a half.
+	unsigned long v = 0;
+	for( unsigned long c = 0; c < 4; c++ )
+	{
+		if( c == largest )
+			continue;
+
+		float value = ( components[c] * sign * 0.70710678f + 0.5f ) * 32767.0f + 0.5f;
+		key->values[v++] = (unsigned short)min( max( value, 0.0f ), 32767.0f );
+	}
+
+	key->values[0] |= (unsigned short)( ( largest & 1 ) << 15 );
+	key->values[1] |= (unsigned short)( ( largest >> 1 ) << 15 );
+
+}
+
+// Rebuilds a unit rotation from the given compressed key.
+void AnimationClip::DecompressRotation( CompressedKey *key, D3DXQUATERNION *rotation )
+{
+	unsigned long largest = ( key->values[0] >> 15 ) | ( ( key->values[1] >> 15 ) << 1 );
+
+	float components[4];
+	float sum = 0.0f;
+	unsigned long v = 0;
+	for( unsigned long c = 0; c < 4; c++ )
+	{
+		if( c == largest )
+			continue;
+
+		components[c] = ( ( key->values[v++] & 0x7FFF ) / 32767.0f - 0.5f ) * 1.41421356f;
+		sum += components[c] * components[c];
+	}
+
+	components[largest] = (float)sqrt( max( 1.0f - sum, 0.0f ) );
+
+	*rotation = D3DXQUATERNION( components[0], components[1], components[2], components[3] );
+
+}
+
+// Compresses the given vectors as fractions of the range they cover, which is
+// returned. Returns false, leaving the keys unset, if rounding to sixteen bits
+// over that range could move a vector further than the given tolerance.
+bool AnimationClip::CompressVectors( D3DXVECTOR3 *vectors, unsigned long count, float tolerance, D3DXVECTOR3 *min, D3DXVECTOR3 *extent, CompressedKey *keys )
+{
+	*min = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	*extent = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	if( count == 0 )
+		return true;
+
+	// Find the range of the vectors.
+	D3DXVECTOR3 max = vectors[0];
+	*min = vectors[0];
+	for( unsigned long k = 1; k < count; k++ )
+	{
+		D3DXVec3Minimize( min, min, &vectors[k] );
+		D3DXVec3Maximize( &max, &max, &vectors[k] );
+	}
+	*extent = max - *min;
+
+	// Each component is off by at most half a step of its range.
+	D3DXVECTOR3 error = *extent * ( 0.5f / 65535.0f );
+	if( D3DXVec3LengthSq( &error ) > tolerance * tolerance )
+		return false;
+
+	// Store each component as a fraction of its range.
+	for( unsigned long k = 0; k < count; k++ )
+	{
+		keys[k].values[0] = extent->x > 0.0f ? (unsigned short)( ( vectors[k].x - min->x ) / extent->x * 65535.0f + 0.5f ) : 0;
+		keys[k].values[1] = extent->y > 0.0f ? (unsigned short)( ( vectors[k].y - min->y ) / extent->y * 65535.0f + 0.5f ) : 0;
+		keys[k].values[2] = extent->z > 0.0f ? (unsigned short)( ( vectors[k].z - min->z ) / extent->z * 65535.0f + 0.5f ) : 0;
+	}
+
+	return true;
+}
+
+// Rebuilds a vector from the given compressed key and the range it was compressed within.
+void AnimationClip::DecompressVector( CompressedKey *key, D3DXVECTOR3 *min, D3DXVECTOR3 *extent, D3DXVECTOR3 *vector )
+{
+	vector->x = min->x + extent->x * ( key->values[0] / 65535.0f );
+	vector->y = min->y + extent->y * ( key->values[1] / 65535.0f );
+	vector->z = min->z + extent->z * ( key->values[2] / 65535.0f );
+
+}
+
+// Returns the index of the last key at or before the given position, or the first key if there is none.
+unsigned long AnimationClip::FindKey( unsigned short *times, unsigned long first, unsigned long last, float position )
+{
+	unsigned long low = first;
+	unsigned long high = last - 1;
+	while( low < high )
+	{
+		unsigned long middle = ( low + high + 1 ) / 2;
+		if( times[middle] <= position )
+			low = middle;
+		else
+			high = middle - 1;
+	}
+
+	return low;
+}
+
+// Interpolates the given range of vector keys at the given position, reading
+// the full float values instead of the compressed keys if they are given. The
+// value is left alone if the range is empty.
+void AnimationClip::SampleVector( unsigned short *times, CompressedKey *keys, D3DXVECTOR3 *values, unsigned long first, unsigned long last, float position, D3DXVECTOR3 *min, D3DXVECTOR3 *extent, D3DXVECTOR3 *value )
+{
+	if( last == first )
+		return;
+
+	unsigned long key = FindKey( times, first, last, position );
+	if( key + 1 < last && times[key + 1] > times[key] )
+	{
+		D3DXVECTOR3 from, to;
+		if( values != NULL )
+		{
+			from = values[key];
+			to = values[key + 1];
+		}
+		else
+		{
+			DecompressVector( &keys[key], min, extent, &from );
+			DecompressVector( &keys[key + 1], min, extent, &to );
+		}
+
+		float blend = ( position - times[key] ) / ( times[key + 1] - times[key] );
+		D3DXVec3Lerp( value, &from, &to, min( max( blend, 0.0f ), 1.0f ) );
+	}
+	else if( values != NULL )
+		*value = values[key];
+	else
+		DecompressVector( &keys[key], min, extent, value );
+
+}
+
+// Animation instance class constructor. The pose starts out in the bind pose.
+AnimationInstance::AnimationInstance( Skeleton *skeleton )
+{
+	m_skeleton = skeleton;
+
+	for( unsigned long t = 0; t < MAX_ANIMATION_TRACKS; t++ )
+	{
+		m_tracks[t].clip = NULL;
+		m_tracks[t].time = 0.0f;
+		m_tracks[t].speed = 1.0f;
+		m_tracks[t].weight = 0.0f;
+		m_tracks[t].fade = 0.0f;
+		m_tracks[t].loop = true;
+	}
+	m_currentTrack = 0;
+
+	// Start every bone in the bind pose. Bones that aren't required are never
+	// evaluated again, so they keep it.
+	m_boneMatrices = new D3DXMATRIX[max( m_skeleton->totalBones, 1UL )];
+	for( unsigned long b = 0; b < m_skeleton->totalBones; b++ )
+	{
+		BuildMatrix( &m_boneMatrices[b], &m_skeleton->bindRotations[b], &m_skeleton->bindTranslations[b], &m_skeleton->bindScales[b] );
+		if( m_skeleton->parents[b] != -1 )
+			D3DXMatrixMultiply( &m_boneMatrices[b], &m_boneMatrices[b], &m_boneMatrices[m_skeleton->parents[b]] );
+	}
+	m_dirty = false;
+
+}
+
+// Animation instance class destructor.
+AnimationInstance::~AnimationInstance()
+{
+	SAFE_DELETE_ARRAY( m_boneMatrices );
+
+}
+
+// Plays the given clip. A looping clip is faded in over the given transition
+// time while the current one fades out, otherwise the clip replaces the
+// current one straight away and holds its last frame once it finishes.
+void AnimationInstance::Play( AnimationClip *clip, float transitionTime, bool loop )
+{
+	// Play the new clip on the track that is not current.
+	AnimationTrack *current = &m_tracks[m_currentTrack];
+	m_currentTrack = ( m_currentTrack + 1 ) % MAX_ANIMATION_TRACKS;
+	AnimationTrack *next = &m_tracks[m_currentTrack];
+
+	next->clip = clip;
+	next->time = 0.0f;
+	next->speed = 1.0f;
+	next->loop = loop;
+
+	if( loop == true && transitionTime > 0.0f )
+	{
+		current->fade = -current->weight / transitionTime;
+		next->weight = 0.0f;
+		next->fade = 1.0f / transitionTime;
+	}
+	else
+	{
+		current->clip = NULL;
+		current->weight = 0.0f;
+		current->fade = 0.0f;
+		next->weight = 1.0f;
+		next->fade = 0.0f;
+	}
+
+	m_dirty = true;
+
+}
+
+// Moves every track along by the given elapsed time.
+void AnimationInstance::Advance( float elapsed )
+{
+	for( unsigned long t = 0; t < MAX_ANIMATION_TRACKS; t++ )
+	{
+		AnimationTrack *track = &m_tracks[t];
+		if( track->clip == NULL )
+			continue;
+
+		// Move the track along its clip, wrapping around or holding at the end.
+		float period = track->clip->GetPeriod();
+		float time = track->time + elapsed * track->speed;
+		if( track->loop == true && period > 0.0f )
+			time = fmod( time, period );
+		else if( time > period )
+			time = period;
+
+		if( time != track->time )
+		{
+			track->time = time;
+			m_dirty = true;
+		}
+
+		// Fade the track's weight, dropping the track once it has faded out.
+		if( track->fade != 0.0f )
+		{
+			track->weight += track->fade * elapsed;
+			if( track->weight >= 1.0f )
+			{
+				track->weight = 1.0f;
+				track->fade = 0.0f;
+			}
+			else if( track->weight <= 0.0f )
+			{
+				track->clip = NULL;
+				track->weight = 0.0f;
+				track->fade = 0.0f;
+			}
+
+			m_dirty = true;
+		}
+	}
+
+}
+
+// Evaluates the pose if it has changed since it was last evaluated. The
+// tracks are sampled and blended into a local pose, which is then combined
+// down the flattened hierarchy into the model space bone matrices.
+void AnimationInstance::Evaluate()
+{
+	if( m_dirty == false )
+		return;
+
+	unsigned long totalBones = m_skeleton->totalBones;
+
+	// The blended local pose only lives until the bone matrices are built.
+	FrameAllocator *allocator = g_engine->GetFrameAllocator();
+	unsigned long marker = allocator->GetMarker();
+	D3DXQUATERNION *rotations = allocator->AllocateArray< D3DXQUATERNION >( totalBones );
+	D3DXVECTOR3 *translations = allocator->AllocateArray< D3DXVECTOR3 >( totalBones );
+	D3DXVECTOR3 *scales = allocator->AllocateArray< D3DXVECTOR3 >( totalBones );
+	ZeroMemory( rotations, sizeof( D3DXQUATERNION ) * totalBones );
+	ZeroMemory( translations, sizeof( D3DXVECTOR3 ) * totalBones );
+	ZeroMemory( scales, sizeof( D3DXVECTOR3 ) * totalBones );
+
+	// Accumulate the weighted pose of every playing track.
+	float totalWeight = 0.0f;
+	for( unsigned long t = 0; t < MAX_ANIMATION_TRACKS; t++ )
+	{
+		AnimationTrack *track = &m_tracks[t];
+		if( track->clip == NULL || track->weight <= 0.0f )
+			continue;
+
+		totalWeight += track->weight;
+		for( unsigned long b = 0; b < totalBones; b++ )
+		{
+			if( m_skeleton->required[b] == false )
+				continue;
+
+			D3DXQUATERNION rotation = m_skeleton->bindRotations[b];
+			D3DXVECTOR3 translation = m_skeleton->bindTranslations[b];
+			D3DXVECTOR3 scale = m_skeleton->bindScales[b];
+			track->clip->Sample( b, track->time, &rotation, &translation, &scale );
+
+			// Keep the rotations in the same hemisphere so they blend the short way round.
+			float weight = track->weight;
+			if( D3DXQuaternionDot( &rotations[b], &rotation ) < 0.0f )
+				weight = -weight;
+
+			rotations[b] += rotation * weight;
+			translations[b] += translation * track->weight;
+			scales[b] += scale * track->weight;
+		}
+	}
+
+	// Normalise the blend, falling back to the bind pose when nothing is playing.
+	for( unsigned long b = 0; b < totalBones; b++ )
+	{
+		if( m_skeleton->required[b] == false )
+			continue;
+
+		if( totalWeight <= 0.0f )
+		{
+			rotations[b] = m_skeleton->bindRotations[b];
+			translations[b] = m_skeleton->bindTranslations[b];
+			scales[b] = m_skeleton->bindScales[b];
+			continue;
+		}
+
+		D3DXQuaternionNormalize( &rotations[b], &rotations[b] );
+		translations[b] /= totalWeight;
+		scales[b] /= totalWeight;
+	}
+
+	// Build each bone's local matrix and combine it with its parent's, which
+	// is always evaluated first. A required bone's parent is always required.
+	for( unsigned long b = 0; b < totalBones; b++ )
+	{
+		if( m_skeleton->required[b] == false )
+			continue;
+
+		BuildMatrix( &m_boneMatrices[b], &rotations[b], &translations[b], &scales[b] );
+		if( m_skeleton->parents[b] != -1 )
+			D3DXMatrixMultiply( &m_boneMatrices[b], &m_boneMatrices[b], &m_boneMatrices[m_skeleton->parents[b]] );
+	}
+
+	allocator->FreeToMarker( marker );
+	m_dirty = false;
+
+}
+
+// Returns the skeleton the pose is built for.
+Skeleton *AnimationInstance::GetSkeleton()
+{
+	return m_skeleton;
+}
+
+// Returns the given track.
+AnimationTrack *AnimationInstance::GetTrack( unsigned long track )
+{
+	return &m_tracks[track % MAX_ANIMATION_TRACKS];
+}
+
+// Returns the model space transformation of every bone, in skeleton order.
+D3DXMATRIX *AnimationInstance::GetBoneMatrices()
+{
+	return m_boneMatrices;
+}
+
+// Returns the model space transformation of the bone with the given name, or NULL if there is none.
+D3DXMATRIX *AnimationInstance::GetBoneMatrix( const char *name )
+{
+	long bone = m_skeleton->GetBone( name );
+	if( bone == -1 )
+		return NULL;
+
+	return &m_boneMatrices[bone];
+}
+
+// Returns true if the pose needs to be evaluated.
+bool AnimationInstance::GetDirty()
+{
+	return m_dirty;
+}
+
+// Builds a local transformation from the given scale, then rotation, then translation.
+void AnimationInstance::BuildMatrix( D3DXMATRIX *matrix, D3DXQUATERNION *rotation, D3DXVECTOR3 *translation, D3DXVECTOR3 *scale )
+{
+	D3DXMatrixRotationQuaternion( matrix, rotation );
+	matrix->_11 *= scale->x; matrix->_12 *= scale->x; matrix->_13 *= scale->x;
+	matrix->_21 *= scale->y; matrix->_22 *= scale->y; matrix->_23 *= scale->y;
+	matrix->_31 *= scale->z; matrix->_32 *= scale->z; matrix->_33 *= scale->z;
+	matrix->_41 = translation->x;
+	matrix->_42 = translation->y;
+	matrix->_43 = translation->z;
+
+}
+
+// Animation system class constructor.
+AnimationSystem::AnimationSystem( unsigned long capacity )
+{
+	m_capacity = max( capacity, 1UL );
+	m_instances = new AnimationInstance*[m_capacity];
+	m_totalInstances = 0;
+
+}
+
+// Animation system class destructor. The instances belong to their objects.
+AnimationSystem::~AnimationSystem()
+{
+	SAFE_DELETE_ARRAY( m_instances );
+
+}
+
+// Adds the given instance to be evaluated each update.
+void AnimationSystem::Add( AnimationInstance *instance )
+{
+	if( m_totalInstances == m_capacity )
+	{
+		m_capacity *= 2;
+		AnimationInstance **instances = new AnimationInstance*[m_capacity];
+		memcpy( instances, m_instances, sizeof( AnimationInstance* ) * m_totalInstances );
+		SAFE_DELETE_ARRAY( m_instances );
+		m_instances = instances;
+	}
+
+	m_instances[m_totalInstances++] = instance;
+
+}
+
+// Removes the given instance by moving the last instance into its place.
+void AnimationSystem::Remove( AnimationInstance *instance )
+{
+	for( unsigned long i = 0; i < m_totalInstances; i++ )
+	{
+		if( m_instances[i] != instance )
+			continue;
+
+		m_instances[i] = m_instances[--m_totalInstances];
+		return;
+	}
+
+}
+
+// Evaluates the pose of every instance that has changed.
+void AnimationSystem::Update()
+{
+	g_engine->GetJobSystem()->ParallelFor( EvaluateInstances, this, m_totalInstances );
+
+}
+
+// Returns the number of instances in the system.
+unsigned long AnimationSystem::GetTotalInstances()
+{
+	return m_totalInstances;
+}
+
+// Evaluates the given range of instances.
+void AnimationSystem::EvaluateInstances( void *data, unsigned long start, unsigned long end )
+{
+	AnimationSystem *animationSystem = (AnimationSystem*)data;
+
+	for( unsigned long i = start; i < end; i++ )
+		animationSystem->m_instances[i]->Evaluate();
+
+}
@@ -0,0 +1,298 @@
+// ************************************************************************
+//
+// File: AnimationSystem.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Samples, blends and evaluates skeletal animation for every animated object
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef ANIMATION_SYSTEM_H
+#define ANIMATION_SYSTEM_H
+
+// Number of instances the system can hold before it first has to grow.
+#define ANIMATION_SYSTEM_CAPACITY 64
+
+// Number of tracks each instance can blend between.
+#define MAX_ANIMATION_TRACKS 2
+
+// Largest errors allowed when removing keys from a clip. Rotations are in
+// radians, translations and scales in the units of the mesh.
+#define ANIMATION_ROTATION_TOLERANCE 0.005f
+#define ANIMATION_TRANSLATION_TOLERANCE 0.001f
+#define ANIMATION_SCALE_TOLERANCE 0.001f
+
+// Compressed key structure, three sixteen bit values holding either a rotation
+// or a vector. A rotation drops its largest component, which is rebuilt from
+// the other three, and stores the rest in fifteen bits each with the index of
+// the dropped component in the top bits of the first two values. A vector is
+// stored as a fraction of the range covered by its bone's keys. If that range
+// is too wide for sixteen bits to stay within the tolerance, the bone's keys
+// are kept as full floats instead.
+struct CompressedKey
+{
+	unsigned short values[3];		// Compressed components
+
+};
+
+// Skeleton structure, a bone hierarchy flattened into arrays. Every bone is
+// stored after its parent so the whole hierarchy can be updated in one loop.
+struct Skeleton
+{
+	unsigned long totalBones;					// Number of bones
+	char **names;									// Name of each bone
+	long *parents;									// Index of each bone's parent, or -1 for a root bone
+	D3DXQUATERNION *bindRotations;		// Rotation of each bone when it is not animated
+	D3DXVECTOR3 *bindTranslations;		// Translation of each bone when it is not animated
+	D3DXVECTOR3 *bindScales;				// Scale of each bone when it is not animated
+	bool *required;									// Indicates if each bone affects anything that uses the pose
+
+	// Skeleton structure constructor
+	Skeleton( unsigned long bones )
+	{
+		totalBones = bones;
+		names = new char*[max( bones, 1UL )];
+		parents = new long[max( bones, 1UL )];
+		bindRotations = new D3DXQUATERNION[max( bones, 1UL )];
+		bindTranslations = new D3DXVECTOR3[max( bones, 1UL )];
+		bindScales = new D3DXVECTOR3[max( bones, 1UL )];
+		required = new bool[max( bones, 1UL )];
+
+		for( unsigned long b = 0; b < totalBones; b++ )
+		{
+			names[b] = NULL;
+			parents[b] = -1;
+			required[b] = true;
+		}
+	}
+
+	// Skeleton structure destructor
+	~Skeleton()
+	{
+		for( unsigned long b = 0; b < totalBones; b++ )
+			SAFE_DELETE_ARRAY( names[b] );
+
+		SAFE_DELETE_ARRAY( names );
+		SAFE_DELETE_ARRAY( parents );
+		SAFE_DELETE_ARRAY( bindRotations );
+		SAFE_DELETE_ARRAY( bindTranslations );
+		SAFE_DELETE_ARRAY( bindScales );
+		SAFE_DELETE_ARRAY( required );
+	}
+
+	// Returns the index of the bone with the given name, or -1 if there is none
+	long GetBone( const char *name )
+	{
+		for( unsigned long b = 0; b < totalBones; b++ )
+			if( names[b] != NULL && strcmp( names[b], name ) == 0 )
+				return (long)b;
+
+		return -1;
+	}
+
+};
+
+// Animation keys structure, the uncompressed keys of a clip for each bone of
+// the skeleton it animates, with times in seconds. Clips are built from these
+// rather than from any file format, so the importer that reads them is the
+// only part of the animation code that depends on where they came from.
+struct AnimationKeys
+{
+	char *name;									// Name of the clip
+	float period;									// Length of the clip in seconds
+	unsigned long totalBones;				// Number of bones in the skeleton
+
+	unsigned long *rotationCounts;		// Number of rotation keys of each bone
+	float **rotationTimes;					// Time of each bone's rotation keys, or NULL if it has none
+	D3DXQUATERNION **rotations;		// Value of each bone's rotation keys
+
+	unsigned long *translationCounts;	// Number of translation keys of each bone
+	float **translationTimes;				// Time of each bone's translation keys, or NULL if it has none
+	D3DXVECTOR3 **translations;		// Value of each bone's translation keys
+
+	unsigned long *scaleCounts;			// Number of scale keys of each bone
+	float **scaleTimes;						// Time of each bone's scale keys, or NULL if it has none
+	D3DXVECTOR3 **scales;				// Value of each bone's scale keys
+
+	// Animation keys structure constructor, every bone starts out without keys
+	AnimationKeys( const char *clipName, float clipPeriod, unsigned long bones )
+	{
+		name = new char[strlen( clipName ) + 1];
+		strcpy( name, clipName );
+		period = clipPeriod;
+		totalBones = bones;
+
+		rotationCounts = new unsigned long[max( bones, 1UL )];
+		rotationTimes = new float*[max( bones, 1UL )];
+		rotations = new D3DXQUATERNION*[max( bones, 1UL )];
+		translationCounts = new unsigned long[max( bones, 1UL )];
+		translationTimes = new float*[max( bones, 1UL )];
+		translations = new D3DXVECTOR3*[max( bones, 1UL )];
+		scaleCounts = new unsigned long[max( bones, 1UL )];
+		scaleTimes = new float*[max( bones, 1UL )];
+		scales = new D3DXVECTOR3*[max( bones, 1UL )];
+
+		for( unsigned long b = 0; b < totalBones; b++ )
+		{
+			rotationCounts[b] = translationCounts[b] = scaleCounts[b] = 0;
+			rotationTimes[b] = translationTimes[b] = scaleTimes[b] = NULL;
+			rotations[b] = NULL;
+			translations[b] = scales[b] = NULL;
+		}
+	}
+
+	// Animation keys structure destructor
+	~AnimationKeys()
+	{
+		for( unsigned long b = 0; b < totalBones; b++ )
+		{
+			SAFE_DELETE_ARRAY( rotationTimes[b] );
+			SAFE_DELETE_ARRAY( rotations[b] );
+			SAFE_DELETE_ARRAY( translationTimes[b] );
+			SAFE_DELETE_ARRAY( translations[b] );
+			SAFE_DELETE_ARRAY( scaleTimes[b] );
+			SAFE_DELETE_ARRAY( scales[b] );
+		}
+
+		SAFE_DELETE_ARRAY( name );
+		SAFE_DELETE_ARRAY( rotationCounts );
+		SAFE_DELETE_ARRAY( rotationTimes );
+		SAFE_DELETE_ARRAY( rotations );
+		SAFE_DELETE_ARRAY( translationCounts );
+		SAFE_DELETE_ARRAY( translationTimes );
+		SAFE_DELETE_ARRAY( translations );
+		SAFE_DELETE_ARRAY( scaleCounts );
+		SAFE_DELETE_ARRAY( scaleTimes );
+		SAFE_DELETE_ARRAY( scales );
+	}
+
+};
+
+// Animation clip class. The keys of every bone are packed into shared arrays
+// for each channel, with a bone's keys found from its start index. Bones and
+// channels without keys keep their bind pose. Keys that can be rebuilt from
+// their neighbours within the tolerances are removed when the clip is built,
+// and the rest are compressed, with times stored as a fraction of the period.
+// A clip is built once per mesh and shared by every object playing it.
+class AnimationClip
+{
+public:
+	AnimationClip( AnimationKeys *keys );
+	virtual ~AnimationClip();
+
+	char *GetName();
+	float GetPeriod();
+
+	void Sample( unsigned long bone, float time, D3DXQUATERNION *rotation, D3DXVECTOR3 *translation, D3DXVECTOR3 *scale );
+
+private:
+	static unsigned long ReduceRotations( float *times, D3DXQUATERNION *rotations, unsigned long count );
+	static unsigned long ReduceVectors( float *times, D3DXVECTOR3 *vectors, unsigned long count, float tolerance );
+
+	static void CompressRotation( D3DXQUATERNION *rotation, CompressedKey *key );
+	static void DecompressRotation( CompressedKey *key, D3DXQUATERNION *rotation );
+	static bool CompressVectors( D3DXVECTOR3 *vectors, unsigned long count, float tolerance, D3DXVECTOR3 *min, D3DXVECTOR3 *extent, CompressedKey *keys );
+	static void DecompressVector( CompressedKey *key, D3DXVECTOR3 *min, D3DXVECTOR3 *extent, D3DXVECTOR3 *vector );
+
+	static unsigned long FindKey( unsigned short *times, unsigned long first, unsigned long last, float position );
+	static void SampleVector( unsigned short *times, CompressedKey *keys, D3DXVECTOR3 *values, unsigned long first, unsigned long last, float position, D3DXVECTOR3 *min, D3DXVECTOR3 *extent, D3DXVECTOR3 *value );
+
+private:
+	char *m_name;													// Name of the clip
+	float m_period;													// Length of the clip in seconds
+	unsigned long m_totalBones;								// Number of bones in the skeleton the clip was built for
+
+	unsigned long *m_rotationStarts;						// Index of each bone's first rotation key, plus one past the last bone
+	unsigned short *m_rotationTimes;						// Time of every rotation key
+	CompressedKey *m_rotations;								// Value of every rotation key
+
+	unsigned long *m_translationStarts;					// Index of each bone's first translation key, plus one past the last bone
+	unsigned short *m_translationTimes;					// Time of every translation key
+	CompressedKey *m_translations;							// Value of every translation key
+	D3DXVECTOR3 *m_translationMins;						// Smallest translation of each bone
+	D3DXVECTOR3 *m_translationExtents;					// Range of the translations of each bone
+	bool *m_translationsFull;									// Indicates if each bone's translations are kept as full floats
+	D3DXVECTOR3 *m_translationValues;					// Full float translations, or NULL if no bone needs them
+
+	unsigned long *m_scaleStarts;							// Index of each bone's first scale key, plus one past the last bone
+	unsigned short *m_scaleTimes;							// Time of every scale key
+	CompressedKey *m_scales;									// Value of every scale key
+	D3DXVECTOR3 *m_scaleMins;								// Smallest scale of each bone
+	D3DXVECTOR3 *m_scaleExtents;							// Range of the scales of each bone
+	bool *m_scalesFull;											// Indicates if each bone's scales are kept as full floats
+	D3DXVECTOR3 *m_scaleValues;							// Full float scales, or NULL if no bone needs them
+
+};
+
+// Animation track structure, the playback state of a single clip.
+struct AnimationTrack
+{
+	AnimationClip *clip;				// Clip being played, or NULL when the track is unused
+	float time;							// Position in the clip in seconds
+	float speed;							// Playback speed, where one is full speed
+	float weight;						// Weight of the track when blended with the others
+	float fade;							// Change in weight per second
+	bool loop;							// Indicates if the clip loops rather than holding its last frame
+
+};
+
+// Animation instance class, the playback state and resulting pose of one
+// animated object. Advancing the tracks only marks the pose dirty, it is
+// evaluated later along with every other instance by the animation system.
+// Only the bones the skeleton marks as required are evaluated, the rest keep
+// their bind pose.
+class AnimationInstance
+{
+public:
+	AnimationInstance( Skeleton *skeleton );
+	virtual ~AnimationInstance();
+
+	void Play( AnimationClip *clip, float transitionTime, bool loop = true );
+	void Advance( float elapsed );
+	void Evaluate();
+
+	Skeleton *GetSkeleton();
+	AnimationTrack *GetTrack( unsigned long track );
+	D3DXMATRIX *GetBoneMatrices();
+	D3DXMATRIX *GetBoneMatrix( const char *name );
+	bool GetDirty();
+
+private:
+	static void BuildMatrix( D3DXMATRIX *matrix, D3DXQUATERNION *rotation, D3DXVECTOR3 *translation, D3DXVECTOR3 *scale );
+
+private:
+	Skeleton *m_skeleton;													// Skeleton the pose is built for
+	AnimationTrack m_tracks[MAX_ANIMATION_TRACKS];		// Tracks being blended
+	unsigned long m_currentTrack;										// Track the last clip was played on
+	D3DXMATRIX *m_boneMatrices;										// Model space transformation of each bone
+	bool m_dirty;																// Indicates if the pose needs to be evaluated
+
+};
+
+// Animation system class. Every instance is evaluated in one pass by Update,
+// with the instances spread across the job system's threads.
+class AnimationSystem
+{
+public:
+	AnimationSystem( unsigned long capacity = ANIMATION_SYSTEM_CAPACITY );
+	virtual ~AnimationSystem();
+
+	void Add( AnimationInstance *instance );
+	void Remove( AnimationInstance *instance );
+
+	void Update();
+
+	unsigned long GetTotalInstances();
+
+private:
+	static void EvaluateInstances( void *data, unsigned long start, unsigned long end );
+
+private:
+	AnimationInstance **m_instances;			// Instances to evaluate
+	unsigned long m_totalInstances;				// Number of instances in the array
+	unsigned long m_capacity;						// Number of instances the array can hold
+
+};
+
+#endif
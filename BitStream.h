@@ -0,0 +1,145 @@
+// ************************************************************************
+//
+// File: BitStream.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Packs values into a buffer using only as many bits as they need
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef BIT_STREAM_H
+#define BIT_STREAM_H
+
+// Bit stream structure, reads or writes values bit by bit over a buffer it
+// does not own. Bits fill each byte from its lowest bit up. Going past the
+// end of the buffer sets the error flag, after which nothing more is read or
+// written, so a whole message can be read before checking it once.
+struct BitStream
+{
+	unsigned char *data;			// Buffer being read or written
+	unsigned long size;				// Size of the buffer in bytes
+	unsigned long position;		// Next bit to read or write
+	bool error;							// Indicates the stream ran past the end of its buffer
+
+	// Bit stream constructor
+	BitStream( void *buffer, unsigned long bytes )
+	{
+		data = ( unsigned char* ) buffer;
+		size = bytes;
+		position = 0;
+		error = false;
+	}
+
+	// Writes the lowest given number of bits of the value, up to 32
+	void WriteBits( unsigned long value, unsigned long bits )
+	{
+		if( error == true || position + bits > size * 8 )
+		{
+			error = true;
+			return;
+		}
+
+		while( bits > 0 )
+		{
+			unsigned long offset = position & 7;
+			unsigned long count = min( 8 - offset, bits );
+			unsigned char part = (unsigned char)( ( value & ( ( 1UL << count ) - 1 ) ) << offset );
+
+			if( offset == 0 )
+				data[position >> 3] = part;
+			else
+				data[position >> 3] |= part;
+
+			value >>= count;
+			bits -= count;
+			position += count;
+		}
+	}
+
+	// Reads the given number of bits, up to 32. Returns zero once in error
+	unsigned long ReadBits( unsigned long bits )
+	{
+		if( error == true || position + bits > size * 8 )
+		{
+			error = true;
+			return 0;
+		}
+
+		unsigned long value = 0;
+		unsigned long shift = 0;
+
+		while( bits > 0 )
+		{
+			unsigned long offset = position & 7;
+			unsigned long count = min( 8 - offset, bits );
+
+			value |= ( ( data[position >> 3] >> offset ) & ( ( 1UL << count ) - 1 ) ) << shift;
+
+			shift += count;
+			bits -= count;
+			position += count;
+		}
+
+		return value;
+	}
+
+	// Writes a flag as a single bit
+	void WriteBool( bool value )
+	{
+		WriteBits( value == true ? 1 : 0, 1 );
+	}
+
+	// Reads a flag written as a single bit
+	bool ReadBool()
+	{
+		return ReadBits( 1 ) != 0;
+	}
+
+	// Writes an unsigned value as its number of significant bits followed by
+	// those bits, so small values take few bits
+	void WriteUnsigned( unsigned long value )
+	{
+		unsigned long bits = 0;
+		while( bits < 32 && ( value >> bits ) != 0 )
+			bits++;
+
+		WriteBits( bits, 6 );
+		WriteBits( value, bits );
+	}
+
+	// Reads an unsigned value written by WriteUnsigned
+	unsigned long ReadUnsigned()
+	{
+		unsigned long bits = ReadBits( 6 );
+		if( bits > 32 )
+		{
+			error = true;
+			return 0;
+		}
+
+		return ReadBits( bits );
+	}
+
+	// Writes a signed value, interleaving the signs so small values of either sign take few bits
+	void WriteSigned( long value )
+	{
+		WriteUnsigned( ( (unsigned long)value << 1 ) ^ (unsigned long)( value >> 31 ) );
+	}
+
+	// Reads a signed value written by WriteSigned
+	long ReadSigned()
+	{
+		unsigned long value = ReadUnsigned();
+		return (long)( value >> 1 ) ^ -(long)( value & 1 );
+	}
+
+	// Returns the number of bytes the bits written so far take up
+	unsigned long GetBytes()
+	{
+		return ( position + 7 ) >> 3;
+	}
+
+};
+
+#endif
@@ -29,6 +29,121 @@ struct BoundingSphere
 
 };
 
+// Bounds table structure, the bounding volumes of many objects stored as
+// separate arrays of each component so they can be culled together.
+struct BoundsTable
+{
+	float *centerX;					// Sphere centres along the x axis
+	float *centerY;					// Sphere centres along the y axis
+	float *centerZ;					// Sphere centres along the z axis
+	float *radius;						// Sphere radii
+	D3DXVECTOR3 *min;			// Minimum corners of the boxes
+	D3DXVECTOR3 *max;			// Maximum corners of the boxes
+	bool *visible;						// Result of the last cull of each entry
+
+	unsigned long total;				// Number of entries in the table
+	unsigned long maxEntries;		// Number of entries the arrays can hold
+
+	// Bounds table constructor
+	BoundsTable()
+	{
+		centerX = centerY = centerZ = radius = NULL;
+		min = max = NULL;
+		visible = NULL;
+		maxEntries = 0;
+		Destroy();
+	}
+
+	// Bounds table destructor
+	~BoundsTable()
+	{
+		Destroy();
+	}
+
+	// Makes sure the table can hold the given number of entries, dropping its contents if it must grow.
+	// Callers that grow it often leave their own room to spare
+	void Reserve( unsigned long entries )
+	{
+		if( entries <= maxEntries )
+			return;
+
+		Destroy();
+
+		maxEntries = entries;
+		centerX = new float[maxEntries];
+		centerY = new float[maxEntries];
+		centerZ = new float[maxEntries];
+		radius = new float[maxEntries];
+		min = new D3DXVECTOR3[maxEntries];
+		max = new D3DXVECTOR3[maxEntries];
+		visible = new bool[maxEntries];
+	}
+
+	// Removes every entry
+	void Clear()
+	{
+		total = 0;
+	}
+
+	// Adds the given volume to the end of the table and returns its index. The table must have room for it
+	unsigned long Add( BoundingBox *box, BoundingSphere *sphere )
+	{
+		centerX[total] = sphere->center.x;
+		centerY[total] = sphere->center.y;
+		centerZ[total] = sphere->center.z;
+		radius[total] = sphere->radius;
+		min[total] = box->min;
+		max[total] = box->max;
+		visible[total] = false;
+
+		return total++;
+	}
+
+	// Marks the spheres in the given range visible if they are inside all of the given planes
+	void CullSpheres( D3DXPLANE *planes, unsigned long totalPlanes, unsigned long start, unsigned long end )
+	{
+		for( unsigned long e = start; e < end; e++ )
+			visible[e] = true;
+
+		// Test one plane at a time across the whole range, so the inner loop has no branches
+		for( unsigned long p = 0; p < totalPlanes; p++ )
+		{
+			float a = planes[p].a;
+			float b = planes[p].b;
+			float c = planes[p].c;
+			float d = planes[p].d;
+
+			for( unsigned long e = start; e < end; e++ )
+				visible[e] &= a * centerX[e] + b * centerY[e] + c * centerZ[e] + d >= -radius[e];
+		}
+	}
+
+	// Returns the sphere of the given entry
+	BoundingSphere GetSphere( unsigned long entry )
+	{
+		BoundingSphere sphere;
+		sphere.center = D3DXVECTOR3( centerX[entry], centerY[entry], centerZ[entry] );
+		sphere.radius = radius[entry];
+
+		return sphere;
+	}
+
+	// Destroys the table's arrays
+	void Destroy()
+	{
+		SAFE_DELETE_ARRAY( centerX );
+		SAFE_DELETE_ARRAY( centerY );
+		SAFE_DELETE_ARRAY( centerZ );
+		SAFE_DELETE_ARRAY( radius );
+		SAFE_DELETE_ARRAY( min );
+		SAFE_DELETE_ARRAY( max );
+		SAFE_DELETE_ARRAY( visible );
+		maxEntries = 0;
+		total = 0;
+	}
+
+};
+
 class BoundVolume
 {
 public :
@@ -53,8 +168,8 @@ public :
 	D3DXVECTOR3 GetEllipsoidRadius();
 
 private:
-	BoundingBox *m_box;									// Bounding volume of box
-	BoundingSphere *m_sphere;						// Bounding volume of sphere
+	BoundingBox m_box;									// Bounding volume of box
+	BoundingSphere m_sphere;						// Bounding volume of sphere
 
 	D3DXVECTOR3 m_originalMin;				// Bounding box's original min point
 	D3DXVECTOR3 m_originalMax;				// Bounding box's original max point
@@ -363,9 +363,12 @@ inline void CollideWithScene( CollisionData *data, Vertex *vertices, SceneFace *
 		CheckFace( data, vertex0, vertex1, vertex2 );
 	}
 
-	// Create a list of hit ghost objects and a list of the distances to them.
-	LinkedList< SceneObject > *ghostHits = new LinkedList< SceneObject >;
-	LinkedList< float > *ghostDistances = new LinkedList< float >;
+	// Take room for the hit ghost objects and the distances to them from the thread's frame allocator.
+	FrameAllocator *allocator = g_engine->GetFrameAllocator();
+	unsigned long marker = allocator->GetMarker();
+	SceneObject **ghostHits = allocator->AllocateArray< SceneObject* >( objects->GetTotalElements() );
+	float *ghostDistances = allocator->AllocateArray< float >( objects->GetTotalElements() );
+	unsigned long totalGhostHits = 0;
 
 	// Variables used for the following object collision check.
 	D3DXVECTOR3 translation, velocity, vectorColliderObject, vectorObjectCollider, vectorObjectRadius;
@@ -410,8 +413,9 @@ inline void CollideWithScene( CollisionData *data, Vertex *vertices, SceneFace *
 					// If both object's are allowed to register collisions, then store a pointer to the hit object and the distance to hit it.
 					if( nextObject->GetIgnoreCollisions() == false && data->object->GetIgnoreCollisions() == false )
 					{
-						ghostHits->Add( nextObject );
-						ghostDistances->Add( &distToCollision );
+						ghostHits[totalGhostHits] = nextObject;
+						ghostDistances[totalGhostHits] = distToCollision;
+						totalGhostHits++;
 					}
 				}
 				else
@@ -434,25 +438,20 @@ inline void CollideWithScene( CollisionData *data, Vertex *vertices, SceneFace *
 		nextObject = objects->GetNext( nextObject );
 	}
 
-	// Iterate through the list of hit ghost objects and their collision distances.
-	ghostHits->Iterate( true );
-	ghostDistances->Iterate( true );
-	while( ghostHits->Iterate() != NULL && ghostDistances->Iterate() != NULL )
+	// Go through the hit ghost objects and their collision distances.
+	for( unsigned long g = 0; g < totalGhostHits; g++ )
 	{
 		// If the distance to hit the ghost object is less than the distance to the closets real collision, then the ghost object has been hit.
-		if( *ghostDistances->GetCurrent() < data->distance )
+		if( ghostDistances[g] < data->distance )
 		{
 			// Register the collision between both objects.
-			ghostHits->GetCurrent()->CollisionOccurred( data->object, data->frameStamp );
-			data->object->CollisionOccurred( ghostHits->GetCurrent(), data->frameStamp );
+			ghostHits[g]->CollisionOccurred( data->object, data->frameStamp );
+			data->object->CollisionOccurred( ghostHits[g], data->frameStamp );
 		}
 	}
 
-	// Destroy the ghost hits and distances lists.
-	ghostHits->ClearPointers();
-	SAFE_DELETE( ghostHits );
-	ghostDistances->ClearPointers();
-	SAFE_DELETE( ghostDistances );
+	// Release the ghost hits and distances.
+	allocator->FreeToMarker( marker );
 
 	// If no collision occured, then just move the full velocity vector.
 	if( data->collisionFound == false )
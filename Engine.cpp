@@ -174,6 +174,15 @@ Engine::Engine( EngineSetup *setup )
 	m_fpsFont = new Font();
 
 
+	// Create job system
+	m_jobSystem = new JobSystem();
+
+	// Create transform system before any scene objects
+	m_transformSystem = new TransformSystem();
+
+	// Create animation system before any animated objects
+	m_animationSystem = new AnimationSystem();
+
 	// Create linked list states
 	m_states = new LinkedList< State >;
 	m_currentState = NULL;
@@ -190,13 +199,19 @@ Engine::Engine( EngineSetup *setup )
 	m_input = new Input( m_window );
 
 	// Create network object
-	m_network = new Network( m_setup ->guid, m_setup ->HandleNetworkMessage );
+	m_network = new Network( m_setup ->guid, HandleNetworkMessage, m_setup ->networkTransport );
 
 	// Create sound system
 	m_soundSystem = new SoundSystem( m_setup ->scale );
 
 	// Create scene manager
-	m_sceneManager = new SceneManager( m_setup ->scale, m_setup ->spawnerPath );
+	m_sceneManager = new SceneManager( m_setup ->scale, m_setup ->spawnerPath, m_setup ->threadedCulling );
+
+	// Create replication of networked objects
+	m_replication = new Replication();
+
+	// Create prediction of the local player's movement
+	m_prediction = new Prediction();
 
 	// Seed random number generator with current time
 	srand( timeGetTime( ) );
@@ -220,6 +235,10 @@ Engine::~Engine()
 		if( m_currentState != NULL )
 			m_currentState ->Close();
 
+		// Destroy prediction and replication before the objects they refer to
+		SAFE_DELETE( m_prediction );
+		SAFE_DELETE( m_replication );
+
 		// Destry scene manager
 		SAFE_DELETE( m_sceneManager );
 
@@ -241,6 +260,15 @@ Engine::~Engine()
 		// Destroy all materials 
 		SAFE_DELETE( m_materialManager );
 
+		// Destroy animation system once every animated object is gone
+		SAFE_DELETE( m_animationSystem );
+
+		// Destroy transform system once every scene object is gone
+		SAFE_DELETE( m_transformSystem );
+
+		// Destroy job system once nothing else can queue jobs
+		SAFE_DELETE( m_jobSystem );
+
 		// Destroy resources from scripts
 		SAFE_DELETE( m_scriptManager );
 
@@ -302,6 +330,9 @@ void Engine::Run()
 			// If no messages are waiting, check if application is active 
 			else if( !m_deactive )
 			{
+				// Release the memory used by the last frame
+				m_jobSystem ->GetFrameAllocator() ->Reset();
+
 				// Calculate elapsed time to process frame
 				unsigned long currentTime = timeGetTime();
 				static unsigned long lastTime = currentTime;
@@ -371,6 +402,15 @@ void Engine::Run()
 				if( m_stateChanged == true )
 					continue;
 
+				// Send the input commands or the controlled objects' states
+				m_prediction ->Update();
+
+				// Send the state of the networked objects to the other players
+				m_replication ->Update();
+
+				// Send the network messages batched this frame
+				m_network ->Flush();
+
 				// Begin scene
 				m_device ->Clear( 0, NULL, viewer.viewClearFlags, 0, 1.0f, 0 );
 
@@ -543,6 +583,34 @@ ResourceManager< Mesh > *Engine::GetMeshManager()
 
 }
 
+// Return pointer to job system
+JobSystem *Engine::GetJobSystem()
+{
+	return m_jobSystem;
+
+}
+
+// Return pointer to calling thread's frame allocator
+FrameAllocator *Engine::GetFrameAllocator()
+{
+	return m_jobSystem ->GetFrameAllocator();
+
+}
+
+// Return pointer to transform system
+TransformSystem *Engine::GetTransformSystem()
+{
+	return m_transformSystem;
+
+}
+
+// Return pointer to animation system
+AnimationSystem *Engine::GetAnimationSystem()
+{
+	return m_animationSystem;
+
+}
+
 // Return pointer to input object
 Input *Engine::GetInput()
 {
@@ -571,3 +639,30 @@ SceneManager *Engine::GetSceneManager()
 
 }
 
+// Return pointer to replication
+Replication *Engine::GetReplication()
+{
+	return m_replication;
+
+}
+
+// Return pointer to prediction
+Prediction *Engine::GetPrediction()
+{
+	return m_prediction;
+
+}
+
+// Network message handler given to the network, for the messages without a
+// handler in its message table. Replication and prediction keep track of the players from
+// them before they are passed on to the game's handler.
+void Engine::HandleNetworkMessage( ReceivedMessage *msg )
+{
+	g_engine ->m_replication ->HandleNetworkMessage( msg );
+	g_engine ->m_prediction ->HandleNetworkMessage( msg );
+
+	if( g_engine ->m_setup ->HandleNetworkMessage != NULL )
+		g_engine ->m_setup ->HandleNetworkMessage( msg );
+
+}
+
@@ -38,7 +38,12 @@
 #include <stdio.h>					// Standard input/output
 #include <string.h>				// Handle strings
 #include <tchar.h>					// Text string datatype
+#include <atomic>					// Atomic counters shared between threads
+#include <mutex>					// Locks shared between threads
+#include <condition_variable>	// Waking sleeping threads
+#include <thread>					// Portable threads
 #include <windowsx.h>        // Generate window
+#include <new>						// Placement new
 
 // Direct X files
 #include <d3dx9.h>				// D3DX Libraray
@@ -56,15 +61,24 @@
 // Engine files
 #include "Resource.h"
 #include "LinkedList.h"
+#include "FrameAllocator.h"
+#include "JobSystem.h"
 #include "ResourceManagement.h"
 #include "Geometry.h"
 #include "Font.h"
 #include "Scripting.h"
 #include "DeviceEnumeration.h"
 #include "Input.h"
+#include "ReceiveBufferPool.h"
+#include "BitStream.h"
 #include "Network.h"
+#include "Serialization.h"
+#include "NetworkTransport.h"
+#include "UdpTransport.h"
 #include "SoundSystem.h"
 #include "BoundVolume.h"
+#include "TransformSystem.h"
+#include "AnimationSystem.h"
 #include "Material.h"
 #include "Mesh.h"
 #include "SceneObject.h"
@@ -72,8 +86,13 @@
 #include "SpawnerObject.h"
 #include "ViewFrustrum.h"
 #include "RenderCache.h"
+#include "InstanceCache.h"
+#include "OcclusionBuffer.h"
+#include "PotentiallyVisibleSet.h"
 #include "SceneManager.h"
 #include "CollisionDetection.h"
+#include "Replication.h"
+#include "Prediction.h"
 #include "State.h"
 
 // Engine setup structure
@@ -85,9 +104,11 @@ struct EngineSetup
 	float scale;																																// Unit scale in meters/unit
 	unsigned char totalBackBuffers;																							// Number of back buffers used
 	void ( *HandleNetworkMessage ) ( ReceivedMessage *msg );										// Network messege handler
+	unsigned long networkTransport;																						// Transport the network runs on
 	void ( *StateSetup ) ();																											// State setup function
 	void ( *CreateMaterialResource ) ( Material **resource, char *name, char *path );		// Material resource creation
 	char *spawnerPath;																												// Locates the path for spawner object scripts
+	bool threadedCulling;																											// Cull each frame with the job system while the next is updated, drawing it a frame late
 
 	// Engine setup constructor
 	EngineSetup()
@@ -100,9 +121,11 @@ struct EngineSetup
 		scale = 1.0f;
 		totalBackBuffers = 1;
 		HandleNetworkMessage = NULL;
+		networkTransport = NETWORK_TRANSPORT_DIRECTPLAY;
 		StateSetup = NULL;
 		CreateMaterialResource = NULL;
 		spawnerPath ="./";
+		threadedCulling = false;
 	}
 
 };
@@ -134,10 +157,19 @@ class Engine
 		ResourceManager< Material > *GetMaterialManager();
 		ResourceManager< Mesh > *GetMeshManager();
 
+		JobSystem *GetJobSystem();
+		FrameAllocator *GetFrameAllocator();
+		TransformSystem *GetTransformSystem();
+		AnimationSystem *GetAnimationSystem();
 		Input *GetInput();
 		Network *GetNetwork();
 		SoundSystem *GetSoundSystem();
 		SceneManager *GetSceneManager();
+		Replication *GetReplication();
+		Prediction *GetPrediction();
+
+	private:
+		static void HandleNetworkMessage( ReceivedMessage *msg );
 
 	private:
 
@@ -163,10 +195,15 @@ class Engine
 		ResourceManager< Material > *m_materialManager;     // Material manager
 		ResourceManager< Mesh > *m_meshManager;				// Mesh manager
 
+		JobSystem *m_jobSystem;														// Job system shared by the engine
+		TransformSystem *m_transformSystem;									// Transforms of every scene object
+		AnimationSystem *m_animationSystem;									// Poses of every animated object
 		Input *m_input;																		// Input object
 		Network *m_network;															// Network object
 		SoundSystem *m_soundSystem;										// Sound system object
 		SceneManager *m_sceneManager;									// Scene manager object
+		Replication *m_replication;											// Replicates networked objects to the other players
+		Prediction *m_prediction;												// Predicts the local player's movement ahead of the host
 };
 
 // Have global access to other header and source files
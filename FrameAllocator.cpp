@@ -0,0 +1,114 @@
+// ************************************************************************
+//
+// File: FrameAllocator.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Linear allocator for memory that only lives until the end of a frame
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Frame allocator class constructor.
+FrameAllocator::FrameAllocator( unsigned long size )
+{
+	m_size = m_baseSize = max( size, 16UL );
+	m_buffer = new char[m_size];
+	m_used = 0;
+	m_peak = 0;
+	m_resets = 0;
+
+	m_overflow = NULL;
+	m_overflowSize = 0;
+
+}
+
+// Frame allocator class destructor.
+FrameAllocator::~FrameAllocator()
+{
+	Reset();
+
+	SAFE_DELETE_ARRAY( m_buffer );
+
+}
+
+// Returns memory for the given number of bytes, aligned to the given power of two.
+void *FrameAllocator::Allocate( unsigned long size, unsigned long alignment )
+{
+	// Take the memory from the buffer if it fits.
+	ULONG_PTR address = ( (ULONG_PTR)( m_buffer + m_used ) + alignment - 1 ) & ~(ULONG_PTR)( alignment - 1 );
+	if( address + size <= (ULONG_PTR)( m_buffer + m_size ) )
+	{
+		m_used = (unsigned long)( address + size - (ULONG_PTR)m_buffer );
+		m_peak = max( m_peak, m_used );
+		return (void*)address;
+	}
+
+	// Otherwise take a block from the heap for the rest of the frame. The
+	// buffer grows to cover these on the next reset.
+	unsigned long blockSize = sizeof( FrameBlock ) + size + alignment;
+	FrameBlock *block = (FrameBlock*)new char[blockSize];
+	block->next = m_overflow;
+	m_overflow = block;
+	m_overflowSize += blockSize;
+
+	address = ( (ULONG_PTR)( block + 1 ) + alignment - 1 ) & ~(ULONG_PTR)( alignment - 1 );
+	return (void*)address;
+}
+
+// Returns a marker to the current top of the buffer.
+unsigned long FrameAllocator::GetMarker()
+{
+	return m_used;
+}
+
+// Frees everything allocated from the buffer since the given marker was taken.
+// Overflow blocks are kept until the next reset.
+void FrameAllocator::FreeToMarker( unsigned long marker )
+{
+	if( marker < m_used )
+		m_used = marker;
+
+}
+
+// Frees everything allocated since the last reset.
+void FrameAllocator::Reset()
+{
+	// Free the overflow blocks.
+	while( m_overflow != NULL )
+	{
+		FrameBlock *next = m_overflow->next;
+		delete[] (char*)m_overflow;
+		m_overflow = next;
+	}
+
+	// If the buffer ran out, grow it so the same amount fits next time.
+	if( m_overflowSize > 0 )
+	{
+		m_size += m_overflowSize;
+		SAFE_DELETE_ARRAY( m_buffer );
+		m_buffer = new char[m_size];
+		m_overflowSize = 0;
+		m_peak = 0;
+		m_resets = 0;
+	}
+
+	// If a grown buffer has stayed under half used for a while, trim it back
+	// to twice what was used, but never below its original size.
+	else if( m_size > m_baseSize && ++m_resets >= FRAME_ALLOCATOR_TRIM_INTERVAL )
+	{
+		if( m_peak < m_size / 2 )
+		{
+			m_size = max( m_baseSize, m_peak * 2 );
+			SAFE_DELETE_ARRAY( m_buffer );
+			m_buffer = new char[m_size];
+		}
+
+		m_peak = 0;
+		m_resets = 0;
+	}
+
+	m_used = 0;
+
+}
@@ -0,0 +1,63 @@
+// ************************************************************************
+//
+// File: FrameAllocator.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Linear allocator for memory that only lives until the end of a frame
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef FRAME_ALLOCATOR_H
+#define FRAME_ALLOCATOR_H
+
+// Default size of a frame allocator's buffer.
+#define FRAME_ALLOCATOR_SIZE 65536
+
+// Number of resets over which a grown buffer's use is watched before it is trimmed.
+#define FRAME_ALLOCATOR_TRIM_INTERVAL 300
+
+// Frame block structure, a heap block used once the buffer is full.
+struct FrameBlock
+{
+	FrameBlock *next;		// Next block allocated this frame
+
+};
+
+// Frame allocator class. Allocations are taken from the front of a single
+// buffer and are never freed individually, the whole buffer is released at
+// once by Reset. Objects are not constructed or destroyed. A buffer that grew
+// to fit a busy frame is trimmed back towards its original size once it has
+// gone unused by half for a while.
+class FrameAllocator
+{
+public:
+	FrameAllocator( unsigned long size = FRAME_ALLOCATOR_SIZE );
+	virtual ~FrameAllocator();
+
+	void *Allocate( unsigned long size, unsigned long alignment = 16 );
+
+	// Allocates room for the given number of objects of the given type.
+	template< class Type > Type *AllocateArray( unsigned long count )
+	{
+		return (Type*)Allocate( sizeof( Type ) * max( count, 1UL ), __alignof( Type ) );
+	}
+
+	unsigned long GetMarker();
+	void FreeToMarker( unsigned long marker );
+	void Reset();
+
+private:
+	char *m_buffer;												// Buffer allocations are taken from
+	unsigned long m_size;										// Size of the buffer
+	unsigned long m_baseSize;								// Size the buffer was created with, never trimmed below
+	unsigned long m_used;										// Number of bytes taken from the front of the buffer
+	unsigned long m_peak;										// Most bytes used at once since the buffer was last resized
+	unsigned long m_resets;									// Number of resets since the buffer was last resized
+
+	FrameBlock *m_overflow;								// Blocks taken from the heap after the buffer filled up
+	unsigned long m_overflowSize;							// Total size of the overflow blocks
+
+};
+
+#endif
@@ -0,0 +1,389 @@
+// ************************************************************************
+//
+// File: InstanceCache.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Render every instance of a shared mesh with a single draw call
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Vertex shader used to transform and light each instance with its own world
+// matrix. The world matrix arrives through the second stream as four rows.
+// It lights like the fixed function pipeline does with the sun alone, so the
+// instances are only drawn with it while no other light is enabled.
+static const char g_instancingShaderSource[] =
+	"float4x4 viewProjection;\n"
+	"float4x4 view;\n"
+	"float3 cameraPosition;\n"
+	"float3 lightDirection;\n"
+	"float4 lightDiffuse;\n"
+	"float4 lightSpecular;\n"
+	"float4 lightAmbient;\n"
+	"float4 ambient;\n"
+	"float4 materialDiffuse;\n"
+	"float4 materialSpecular;\n"
+	"float4 materialAmbient;\n"
+	"float4 materialEmissive;\n"
+	"float materialPower;\n"
+	"float fogDensity;\n"
+	"struct VS_INPUT\n"
+	"{\n"
+	"	float3 position : POSITION;\n"
+	"	float3 normal : NORMAL;\n"
+	"	float2 texture0 : TEXCOORD0;\n"
+	"	float4 world0 : TEXCOORD1;\n"
+	"	float4 world1 : TEXCOORD2;\n"
+	"	float4 world2 : TEXCOORD3;\n"
+	"	float4 world3 : TEXCOORD4;\n"
+	"};\n"
+	"struct VS_OUTPUT\n"
+	"{\n"
+	"	float4 position : POSITION;\n"
+	"	float4 diffuse : COLOR0;\n"
+	"	float4 specular : COLOR1;\n"
+	"	float2 texture0 : TEXCOORD0;\n"
+	"	float fog : FOG;\n"
+	"};\n"
+	"VS_OUTPUT main( VS_INPUT input )\n"
+	"{\n"
+	"	VS_OUTPUT output;\n"
+	"	float4x4 world = float4x4( input.world0, input.world1, input.world2, input.world3 );\n"
+	"	float4 worldPosition = mul( float4( input.position, 1.0f ), world );\n"
+	"	float3 normal = normalize( mul( input.normal, (float3x3)world ) );\n"
+	"	output.position = mul( worldPosition, viewProjection );\n"
+	"	float lit = dot( normal, -lightDirection );\n"
+	"	output.diffuse = materialEmissive + materialAmbient * ( ambient + lightAmbient ) + materialDiffuse * lightDiffuse * saturate( lit );\n"
+	"	output.diffuse.a = materialDiffuse.a;\n"
+	"	float3 halfway = normalize( normalize( cameraPosition - worldPosition.xyz ) - lightDirection );\n"
+	"	output.specular = lit > 0.0f ? materialSpecular * lightSpecular * pow( saturate( dot( normal, halfway ) ), materialPower ) : 0.0f;\n"
+	"	output.specular.a = 0.0f;\n"
+	"	output.texture0 = input.texture0;\n"
+	"	float depth = mul( worldPosition, view ).z * fogDensity;\n"
+	"	output.fog = exp( -depth * depth );\n"
+	"	return output;\n"
+	"}\n";
+
+// Instancing shader structure constructor.
+InstancingShader::InstancingShader( IDirect3DDevice9 *device )
+{
+	declaration = NULL;
+	shader = NULL;
+	constants = NULL;
+	supported = false;
+
+	// Hardware instancing is only available on devices supporting vertex shader 3.0.
+	D3DCAPS9 caps;
+	device->GetDeviceCaps( &caps );
+	if( caps.VertexShaderVersion < D3DVS_VERSION( 3, 0 ) )
+		return;
+
+	// The first stream carries the mesh's vertices, the second the instance world matrices.
+	D3DVERTEXELEMENT9 elements[] =
+	{
+		{ 0, 0, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_POSITION, 0 },
+		{ 0, 12, D3DDECLTYPE_FLOAT3, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_NORMAL, 0 },
+		{ 0, 24, D3DDECLTYPE_FLOAT2, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 0 },
+		{ 1, 0, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 1 },
+		{ 1, 16, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 2 },
+		{ 1, 32, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 3 },
+		{ 1, 48, D3DDECLTYPE_FLOAT4, D3DDECLMETHOD_DEFAULT, D3DDECLUSAGE_TEXCOORD, 4 },
+		D3DDECL_END()
+	};
+
+	if( FAILED( device->CreateVertexDeclaration( elements, &declaration ) ) )
+		return;
+
+	// Compile the instancing vertex shader.
+	ID3DXBuffer *code = NULL;
+	if( FAILED( D3DXCompileShader( g_instancingShaderSource, sizeof( g_instancingShaderSource ) - 1, NULL, NULL, "main", "vs_2_0", 0, &code, NULL, &constants ) ) )
+		return;
+
+	// Create the vertex shader from the compiled code.
+	if( SUCCEEDED( device->CreateVertexShader( (DWORD*)code->GetBufferPointer(), &shader ) ) )
+		supported = true;
+
+	code->Release();
+}
+
+// Instancing shader structure destructor.
+InstancingShader::~InstancingShader()
+{
+	if( constants )
+	{
+		constants->Release();
+		constants = NULL;
+	}
+
+	if( shader )
+	{
+		shader->Release();
+		shader = NULL;
+	}
+
+	if( declaration )
+	{
+		declaration->Release();
+		declaration = NULL;
+	}
+}
+
+// Instance cache class constructor.
+InstanceCache::InstanceCache( IDirect3DDevice9 *device, Mesh *mesh, unsigned long lod, InstancingShader *shader )
+{
+	m_device = device;
+	m_shader = shader;
+
+	// Hold a reference to the mesh so it outlives every object sharing it.
+	m_mesh = mesh;
+	m_mesh->IncRef();
+
+	// Get the mesh for the cache's level of detail.
+	m_lod = lod;
+	m_lodMesh = m_mesh->GetLOD( m_lod );
+
+	// Store the attribute table of the level of detail mesh.
+	m_lodMesh->GetAttributeTable( NULL, &m_totalAttributeGroups );
+	m_attributeTable = new D3DXATTRIBUTERANGE[m_totalAttributeGroups];
+	m_lodMesh->GetAttributeTable( m_attributeTable, NULL );
+
+	m_instances = NULL;
+	m_totalInstances = 0;
+	m_maxInstances = 0;
+
+	m_instanceBuffer = NULL;
+	m_instanceBufferSize = 0;
+}
+
+// Instance cache class destructor.
+InstanceCache::~InstanceCache()
+{
+	// Release the instance stream.
+	if( m_instanceBuffer )
+	{
+		m_instanceBuffer->Release();
+		m_instanceBuffer = NULL;
+	}
+
+	SAFE_DELETE_ARRAY( m_instances );
+	SAFE_DELETE_ARRAY( m_attributeTable );
+
+	// Release the reference to the mesh.
+	g_engine->GetMeshManager()->Remove( &m_mesh );
+}
+
+// Inform the instance cache that gathering is about to begin.
+void InstanceCache::Begin()
+{
+	m_totalInstances = 0;
+}
+
+// Add an instance of the mesh with the given world matrix.
+void InstanceCache::AddInstance( D3DXMATRIX *world )
+{
+	// Grow the instance array if it is full.
+	if( m_totalInstances == m_maxInstances )
+	{
+		m_maxInstances = m_maxInstances == 0 ? 16 : m_maxInstances * 2;
+
+		D3DXMATRIX *instances = new D3DXMATRIX[m_maxInstances];
+		if( m_instances != NULL )
+			memcpy( instances, m_instances, sizeof( D3DXMATRIX ) * m_totalInstances );
+
+		SAFE_DELETE_ARRAY( m_instances );
+		m_instances = instances;
+	}
+
+	m_instances[m_totalInstances++] = *world;
+}
+
+// Inform the instance cache that gathering has completed, then draw the instances.
+void InstanceCache::End()
+{
+	// Check if there are any instances to render.
+	if( m_totalInstances == 0 )
+		return;
+
+	// A single instance gains nothing from the instancing setup, and the
+	// shader can only light the instances as the scene does with the sun alone.
+	if( m_shader->supported == true && m_totalInstances > 1 && IsLightingReproducible() == true )
+		RenderInstanced();
+	else
+		RenderIndividually();
+}
+
+// Get the mesh being drawn by the instance cache.
+Mesh *InstanceCache::GetMesh()
+{
+	return m_mesh;
+}
+
+// Get the level of detail being drawn by the instance cache.
+unsigned long InstanceCache::GetLOD()
+{
+	return m_lod;
+}
+
+// Check if the instancing shader lights the same as the fixed function
+// pipeline would, which takes lighting on with a directional sun and no other light.
+bool InstanceCache::IsLightingReproducible()
+{
+	unsigned long lighting;
+	m_device->GetRenderState( D3DRS_LIGHTING, &lighting );
+	if( lighting == FALSE )
+		return false;
+
+	D3DLIGHT9 sun;
+	BOOL enabled = FALSE;
+	if( FAILED( m_device->GetLight( 0, &sun ) ) || FAILED( m_device->GetLightEnable( 0, &enabled ) ) || enabled == FALSE || sun.Type != D3DLIGHT_DIRECTIONAL )
+		return false;
+
+	D3DCAPS9 caps;
+	m_device->GetDeviceCaps( &caps );
+	for( unsigned long l = 1; l < caps.MaxActiveLights; l++ )
+	{
+		// Lights that were never set cannot be enabled.
+		enabled = FALSE;
+		if( SUCCEEDED( m_device->GetLightEnable( l, &enabled ) ) && enabled == TRUE )
+			return false;
+	}
+
+	return true;
+}
+
+// Draw all the instances with one call per attribute group.
+void InstanceCache::RenderInstanced()
+{
+	// Recreate the instance stream if it is too small.
+	if( m_instanceBufferSize < m_totalInstances )
+	{
+		if( m_instanceBuffer )
+		{
+			m_instanceBuffer->Release();
+			m_instanceBuffer = NULL;
+		}
+
+		m_instanceBufferSize = m_maxInstances;
+		if( FAILED( m_device->CreateVertexBuffer( m_instanceBufferSize * sizeof( D3DXMATRIX ), D3DUSAGE_DYNAMIC | D3DUSAGE_WRITEONLY, 0, D3DPOOL_DEFAULT, &m_instanceBuffer, NULL ) ) )
+		{
+			m_instanceBufferSize = 0;
+			RenderIndividually();
+			return;
+		}
+	}
+
+	// Copy the instance world matrices into the instance stream.
+	void *instances;
+	m_instanceBuffer->Lock( 0, m_totalInstances * sizeof( D3DXMATRIX ), &instances, D3DLOCK_DISCARD );
+	memcpy( instances, m_instances, m_totalInstances * sizeof( D3DXMATRIX ) );
+	m_instanceBuffer->Unlock();
+
+	// Get the current view, projection, sun light, and fog settings so the
+	// instances are lit and fogged the same as the rest of the scene.
+	D3DXMATRIX view, projection, viewProjection;
+	m_device->GetTransform( D3DTS_VIEW, &view );
+	m_device->GetTransform( D3DTS_PROJECTION, &projection );
+	D3DXMatrixMultiply( &viewProjection, &view, &projection );
+
+	D3DXMATRIX inverseView;
+	D3DXMatrixInverse( &inverseView, NULL, &view );
+	D3DXVECTOR3 camera( inverseView._41, inverseView._42, inverseView._43 );
+
+	D3DLIGHT9 sun;
+	m_device->GetLight( 0, &sun );
+
+	unsigned long ambient, specularEnabled;
+	m_device->GetRenderState( D3DRS_AMBIENT, &ambient );
+	m_device->GetRenderState( D3DRS_SPECULARENABLE, &specularEnabled );
+	D3DXCOLOR ambientColour( ambient );
+
+	unsigned long fogEnabled, fogDensity;
+	m_device->GetRenderState( D3DRS_FOGENABLE, &fogEnabled );
+	m_device->GetRenderState( D3DRS_FOGDENSITY, &fogDensity );
+	float density = fogEnabled ? *(float*)&fogDensity : 0.0f;
+
+	m_shader->constants->SetMatrix( m_device, "viewProjection", &viewProjection );
+	m_shader->constants->SetMatrix( m_device, "view", &view );
+	m_shader->constants->SetFloatArray( m_device, "cameraPosition", (float*)&camera, 3 );
+	m_shader->constants->SetFloatArray( m_device, "lightDirection", (float*)&sun.Direction, 3 );
+	m_shader->constants->SetFloatArray( m_device, "lightDiffuse", (float*)&sun.Diffuse, 4 );
+	m_shader->constants->SetFloatArray( m_device, "lightSpecular", (float*)&sun.Specular, 4 );
+	m_shader->constants->SetFloatArray( m_device, "lightAmbient", (float*)&sun.Ambient, 4 );
+	m_shader->constants->SetFloatArray( m_device, "ambient", (float*)&ambientColour, 4 );
+
+	// Get the mesh's vertex and index buffers.
+	IDirect3DVertexBuffer9 *vertexBuffer;
+	IDirect3DIndexBuffer9 *indexBuffer;
+	m_lodMesh->GetVertexBuffer( &vertexBuffer );
+	m_lodMesh->GetIndexBuffer( &indexBuffer );
+
+	// Set the mesh stream to repeat for every instance and step the instance stream once per instance.
+	m_device->SetVertexDeclaration( m_shader->declaration );
+	m_device->SetVertexShader( m_shader->shader );
+	m_device->SetStreamSource( 0, vertexBuffer, 0, VERTEX_FVF_SIZE );
+	m_device->SetStreamSourceFreq( 0, D3DSTREAMSOURCE_INDEXEDDATA | m_totalInstances );
+	m_device->SetStreamSource( 1, m_instanceBuffer, 0, sizeof( D3DXMATRIX ) );
+	m_device->SetStreamSourceFreq( 1, D3DSTREAMSOURCE_INSTANCEDATA | 1 );
+	m_device->SetIndices( indexBuffer );
+
+	// Render each attribute group for all instances at once.
+	for( unsigned long a = 0; a < m_totalAttributeGroups; a++ )
+	{
+		Material *material = m_mesh->GetStaticMesh()->materials == NULL ? NULL : m_mesh->GetStaticMesh()->materials[m_attributeTable[a].AttribId];
+
+		// Set the material and texture.
+		if( material != NULL )
+		{
+			m_shader->constants->SetFloatArray( m_device, "materialDiffuse", (float*)&material->GetLighting()->Diffuse, 4 );
+			m_shader->constants->SetFloatArray( m_device, "materialAmbient", (float*)&material->GetLighting()->Ambient, 4 );
+			m_shader->constants->SetFloatArray( m_device, "materialEmissive", (float*)&material->GetLighting()->Emissive, 4 );
+			m_shader->constants->SetFloat( m_device, "fogDensity", material->GetIgnoreFog() == true ? 0.0f : density );
+
+			// Without a specular power there is no highlight, as with fixed function
+			D3DXCOLOR specular = material->GetLighting()->Specular;
+			if( specularEnabled == FALSE || material->GetLighting()->Power <= 0.0f )
+				specular = D3DXCOLOR( 0.0f, 0.0f, 0.0f, 0.0f );
+
+			m_shader->constants->SetFloatArray( m_device, "materialSpecular", (float*)&specular, 4 );
+			m_shader->constants->SetFloat( m_device, "materialPower", material->GetLighting()->Power );
+			m_device->SetTexture( 0, material->GetTexture() );
+		}
+		else
+		{
+			D3DXCOLOR white( 1.0f, 1.0f, 1.0f, 1.0f );
+			D3DXCOLOR black( 0.0f, 0.0f, 0.0f, 0.0f );
+			m_shader->constants->SetFloatArray( m_device, "materialDiffuse", (float*)&white, 4 );
+			m_shader->constants->SetFloatArray( m_device, "materialAmbient", (float*)&white, 4 );
+			m_shader->constants->SetFloatArray( m_device, "materialEmissive", (float*)&black, 4 );
+			m_shader->constants->SetFloatArray( m_device, "materialSpecular", (float*)&black, 4 );
+			m_shader->constants->SetFloat( m_device, "materialPower", 0.0f );
+			m_shader->constants->SetFloat( m_device, "fogDensity", density );
+			m_device->SetTexture( 0, NULL );
+		}
+
+		m_device->DrawIndexedPrimitive( D3DPT_TRIANGLELIST, 0, m_attributeTable[a].VertexStart, m_attributeTable[a].VertexCount, m_attributeTable[a].FaceStart * 3, m_attributeTable[a].FaceCount );
+	}
+
+	// Restore the device to non-instanced, fixed function rendering.
+	m_device->SetStreamSourceFreq( 0, 1 );
+	m_device->SetStreamSourceFreq( 1, 1 );
+	m_device->SetStreamSource( 1, NULL, 0, 0 );
+	m_device->SetVertexShader( NULL );
+	m_device->SetFVF( VERTEX_FVF );
+
+	// Release the mesh's buffers.
+	vertexBuffer->Release();
+	indexBuffer->Release();
+}
+
+// Draw the instances one at a time on devices without hardware instancing.
+void InstanceCache::RenderIndividually()
+{
+	for( unsigned long i = 0; i < m_totalInstances; i++ )
+	{
+		m_device->SetTransform( D3DTS_WORLD, &m_instances[i] );
+		m_mesh->RenderLOD( m_lod );
+	}
+}
@@ -0,0 +1,66 @@
+// ************************************************************************
+//
+// File: InstanceCache.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Render every instance of a shared mesh with a single draw call
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef INSTANCE_CACHE_H
+#define INSTANCE_CACHE_H
+
+// Instancing shader structure
+struct InstancingShader
+{
+	IDirect3DVertexDeclaration9 *declaration;		// Vertex declaration combining the mesh and instance streams
+	IDirect3DVertexShader9 *shader;						// Vertex shader that applies the per-instance world matrix
+	ID3DXConstantTable *constants;						// Constant table for the vertex shader
+	bool supported;												// Indicates if the device supports hardware instancing
+
+	InstancingShader( IDirect3DDevice9 *device );
+	virtual ~InstancingShader();
+
+};
+
+class InstanceCache
+{
+public:
+	InstanceCache( IDirect3DDevice9 *device, Mesh *mesh, unsigned long lod, InstancingShader *shader );
+	virtual ~InstanceCache();
+
+	void Begin();
+
+	void AddInstance( D3DXMATRIX *world );
+
+	void End();
+
+	Mesh *GetMesh();
+	unsigned long GetLOD();
+
+private:
+	bool IsLightingReproducible();
+	void RenderInstanced();
+	void RenderIndividually();
+
+private:
+	IDirect3DDevice9 *m_device;								// Direct3D device pointer
+	Mesh *m_mesh;													// Shared mesh drawn by the cache
+	unsigned long m_lod;											// Level of detail of the mesh drawn by the cache
+	ID3DXMesh *m_lodMesh;										// Mesh for the cache's level of detail
+	InstancingShader *m_shader;								// Shader used for hardware instancing
+
+	D3DXATTRIBUTERANGE *m_attributeTable;			// Attribute table of the level of detail mesh
+	unsigned long m_totalAttributeGroups;				// Total number of attribute groups
+
+	D3DXMATRIX *m_instances;								// World matrices of the instances gathered this frame
+	unsigned long m_totalInstances;						// Total number of instances gathered this frame
+	unsigned long m_maxInstances;						// Capacity of the instance array
+
+	IDirect3DVertexBuffer9 *m_instanceBuffer;		// Per-instance stream of world matrices
+	unsigned long m_instanceBufferSize;				// Number of world matrices the stream can hold
+
+};
+
+#endif
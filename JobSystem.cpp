@@ -0,0 +1,279 @@
+// ***********************************************************************
+//
+// File: JobSystem.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Work stealing job scheduler shared by the whole engine
+// Date: 10-19-26
+//
+// ***********************************************************************
+
+#include "Engine.h"
+
+// Job system the calling thread belongs to, and its index in it.
+thread_local JobSystem *JobSystem::t_owner = NULL;
+thread_local unsigned long JobSystem::t_index = 0;
+
+// Jobs and transient memory of a thread outside the job system, which runs its jobs itself.
+thread_local Job JobSystem::t_outsideJobs[MAX_OUTSIDE_JOBS];
+thread_local unsigned long JobSystem::t_outsideAllocated = 0;
+thread_local FrameAllocator JobSystem::t_outsideAllocator;
+
+// Job system class constructor. The thread creating the job system becomes
+// thread zero, and by default one worker is started for every other core.
+JobSystem::JobSystem( unsigned long totalWorkers ) : m_sleepingWorkers( 0 ), m_exit( false )
+{
+	if( totalWorkers == 0 )
+	{
+		unsigned long cores = std::thread::hardware_concurrency();
+		totalWorkers = cores > 1 ? cores - 1 : 0;
+	}
+
+	m_totalThreads = totalWorkers + 1;
+
+	// Create a queue and a ring of jobs for every thread.
+	m_queues = new JobQueue[m_totalThreads];
+	m_jobs = new Job[m_totalThreads * MAX_JOBS_PER_THREAD];
+	m_allocatedJobs = new unsigned long[m_totalThreads];
+	memset( m_allocatedJobs, 0, sizeof( unsigned long ) * m_totalThreads );
+	m_frameAllocators = new FrameAllocator[m_totalThreads];
+
+	// The creating thread takes the first index.
+	t_owner = this;
+	t_index = 0;
+
+	// Start the workers, each with the next index.
+	m_threads = new std::thread[totalWorkers];
+	for( unsigned long t = 0; t < totalWorkers; t++ )
+		m_threads[t] = std::thread( WorkerThread, this, t + 1 );
+
+}
+
+// Job system class destructor.
+JobSystem::~JobSystem()
+{
+	// Wake every worker and wait for them to stop.
+	m_exit = true;
+	{
+		std::lock_guard< std::mutex > guard( m_wakeLock );
+		m_wake.notify_all();
+	}
+	for( unsigned long t = 0; t < m_totalThreads - 1; t++ )
+		m_threads[t].join();
+
+	if( t_owner == this )
+		t_owner = NULL;
+
+	SAFE_DELETE_ARRAY( m_threads );
+	SAFE_DELETE_ARRAY( m_frameAllocators );
+	SAFE_DELETE_ARRAY( m_allocatedJobs );
+	SAFE_DELETE_ARRAY( m_jobs );
+	SAFE_DELETE_ARRAY( m_queues );
+
+}
+
+// Creates a job from the calling thread's ring. If a parent is given, it will
+// not finish until the new job has. A thread outside the job system takes the
+// job from a ring of its own, and runs it itself. A job may be kept across
+// frames, so if the ring has come round to a job that is still unfinished,
+// other jobs are run until it is done rather than overwriting it.
+Job *JobSystem::CreateJob( JobFunction function, void *data, Job *parent, unsigned long start, unsigned long end )
+{
+	Job *job = NULL;
+	if( IsJobThread() == true )
+		job = &m_jobs[t_index * MAX_JOBS_PER_THREAD + ( m_allocatedJobs[t_index]++ & ( MAX_JOBS_PER_THREAD - 1 ) )];
+	else
+		job = &t_outsideJobs[t_outsideAllocated++ & ( MAX_OUTSIDE_JOBS - 1 )];
+
+	Wait( job );
+
+	job->function = function;
+	job->data = data;
+	job->start = start;
+	job->end = end;
+	job->parent = parent;
+	job->unfinished = 1;
+
+	if( parent != NULL )
+		parent->unfinished++;
+
+	return job;
+}
+
+// Queues the given job on the calling thread. If the thread's queue is full,
+// or the thread is outside the job system, the job is run at once instead.
+void JobSystem::Run( Job *job )
+{
+	if( IsJobThread() == false || m_queues[t_index].Push( job ) == false )
+	{
+		Execute( job );
+		return;
+	}
+
+	// Wake a worker if any are waiting. Taking the lock makes sure a worker
+	// that has just announced it is going to sleep is waiting before it is woken.
+	if( m_sleepingWorkers > 0 )
+	{
+		std::lock_guard< std::mutex > guard( m_wakeLock );
+		m_wake.notify_one();
+	}
+
+}
+
+// Waits for the given job and its children to finish, running other jobs in
+// the meantime. A thread outside the job system only waits.
+void JobSystem::Wait( Job *job )
+{
+	while( IsFinished( job ) == false )
+	{
+		Job *next = IsJobThread() == true ? GetJob() : NULL;
+		if( next != NULL )
+			Execute( next );
+		else
+			std::this_thread::yield();
+	}
+
+}
+
+// Returns true if the given job and its children have finished.
+bool JobSystem::IsFinished( Job *job )
+{
+	return job->unfinished == 0;
+}
+
+// Runs the given function over the range zero to count, split into batches
+// spread across the threads. Returns once every batch has finished.
+void JobSystem::ParallelFor( JobFunction function, void *data, unsigned long count, unsigned long batchSize )
+{
+	if( count == 0 )
+		return;
+
+	// A thread outside the job system cannot queue the batches, so it runs them all.
+	if( IsJobThread() == false )
+	{
+		function( data, 0, count );
+		return;
+	}
+
+	// By default give each thread a few batches so the stealing can balance them.
+	if( batchSize == 0 )
+		batchSize = max( 1UL, count / ( m_totalThreads * 4 ) );
+
+	// Don't queue more batches than the ring can hold.
+	if( ( count + batchSize - 1 ) / batchSize > MAX_JOBS_PER_THREAD / 2 )
+		batchSize = ( count + MAX_JOBS_PER_THREAD / 2 - 1 ) / ( MAX_JOBS_PER_THREAD / 2 );
+
+	Job *root = CreateJob( NULL, NULL );
+	for( unsigned long start = 0; start < count; start += batchSize )
+		Run( CreateJob( function, data, root, start, min( start + batchSize, count ) ) );
+
+	// The root has nothing to do itself, so finish it and wait for its children.
+	Finish( root );
+	Wait( root );
+
+}
+
+// Returns the number of threads running jobs, including the calling thread.
+unsigned long JobSystem::GetTotalThreads()
+{
+	return m_totalThreads;
+}
+
+// Returns the calling thread's frame allocator. The creating thread's
+// allocator is reset by the engine each frame, a worker's is reset after each
+// job it takes. A thread outside the job system is given one of its own,
+// which it resets itself.
+FrameAllocator *JobSystem::GetFrameAllocator()
+{
+	if( IsJobThread() == false )
+		return &t_outsideAllocator;
+
+	return &m_frameAllocators[t_index];
+}
+
+// Entry point of the worker threads.
+void JobSystem::WorkerThread( JobSystem *jobSystem, unsigned long index )
+{
+	t_owner = jobSystem;
+	t_index = index;
+
+	while( true )
+	{
+		Job *job = jobSystem->GetJob();
+		if( job != NULL )
+		{
+			jobSystem->Execute( job );
+			jobSystem->m_frameAllocators[index].Reset();
+			continue;
+		}
+
+		if( jobSystem->m_exit == true )
+			break;
+
+		// Look once more after announcing the worker is going to sleep, so a
+		// job queued in between is not missed.
+		{
+			std::unique_lock< std::mutex > lock( jobSystem->m_wakeLock );
+			jobSystem->m_sleepingWorkers++;
+			job = jobSystem->GetJob();
+			if( job == NULL && jobSystem->m_exit == false )
+				jobSystem->m_wake.wait( lock );
+			jobSystem->m_sleepingWorkers--;
+		}
+
+		if( job != NULL )
+		{
+			jobSystem->Execute( job );
+			jobSystem->m_frameAllocators[index].Reset();
+		}
+	}
+
+}
+
+// Takes a job from the calling thread's queue, or steals one from another thread.
+Job *JobSystem::GetJob()
+{
+	unsigned long thread = t_index;
+
+	Job *job = m_queues[thread].Pop();
+	if( job != NULL )
+		return job;
+
+	for( unsigned long t = 1; t < m_totalThreads; t++ )
+	{
+		job = m_queues[( thread + t ) % m_totalThreads].Steal();
+		if( job != NULL )
+			return job;
+	}
+
+	return NULL;
+}
+
+// Runs the given job and marks it finished.
+void JobSystem::Execute( Job *job )
+{
+	if( job->function != NULL )
+		job->function( job->data, job->start, job->end );
+
+	Finish( job );
+
+}
+
+// Marks one unfinished part of the given job as done, finishing its parent
+// once the job is complete. The parent is read first, as the moment the job
+// is finished its slot may be taken for another.
+void JobSystem::Finish( Job *job )
+{
+	Job *parent = job->parent;
+
+	if( --job->unfinished == 0 && parent != NULL )
+		Finish( parent );
+
+}
+
+// Returns true if the calling thread created the job system or is one of its
+// workers, and so has a queue, a ring of jobs and an allocator of its own.
+bool JobSystem::IsJobThread()
+{
+	return t_owner == this;
+}
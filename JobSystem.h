@@ -0,0 +1,138 @@
+// ***********************************************************************
+//
+// File: JobSystem.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Work stealing job scheduler shared by the whole engine
+// Date: 10-19-26
+//
+// ***********************************************************************
+
+#ifndef JOB_SYSTEM_H
+#define JOB_SYSTEM_H
+
+// Number of jobs each thread can have in flight. Must be a power of two.
+#define MAX_JOBS_PER_THREAD 4096
+
+// Number of jobs a thread outside the job system can have in flight. Must be a power of two.
+#define MAX_OUTSIDE_JOBS 64
+
+// Function run by a job over the given range.
+typedef void ( *JobFunction )( void *data, unsigned long start, unsigned long end );
+
+// Job structure
+struct Job
+{
+	JobFunction function;						// Function to run, or NULL for a job that only groups its children
+	void *data;										// Data passed to the function
+	unsigned long start;							// Start of the range passed to the function
+	unsigned long end;								// End of the range passed to the function
+	Job *parent;										// Job that is not finished until this one is
+	std::atomic< long > unfinished;		// Number of unfinished jobs, including this one and its children
+
+	// Job constructor, a job starts out finished so its slot is free
+	Job() : unfinished( 0 )
+	{
+	}
+
+};
+
+// Job queue structure, a double ended queue the owner works from the bottom of
+// while other threads steal from the top.
+struct JobQueue
+{
+	std::mutex lock;											// Guards the queue
+	Job *jobs[MAX_JOBS_PER_THREAD];			// Ring of queued jobs
+	long top;													// Next job to be stolen
+	long bottom;												// Next free slot for the owner
+
+	// Job queue constructor
+	JobQueue()
+	{
+		top = bottom = 0;
+	}
+
+	// Owner adds a job, returns false if the queue is full
+	bool Push( Job *job )
+	{
+		std::lock_guard< std::mutex > guard( lock );
+		if( bottom - top >= MAX_JOBS_PER_THREAD )
+			return false;
+
+		jobs[bottom & ( MAX_JOBS_PER_THREAD - 1 )] = job;
+		bottom++;
+
+		return true;
+	}
+
+	// Owner takes its most recent job
+	Job *Pop()
+	{
+		std::lock_guard< std::mutex > guard( lock );
+		if( bottom == top )
+			return NULL;
+
+		bottom--;
+		return jobs[bottom & ( MAX_JOBS_PER_THREAD - 1 )];
+	}
+
+	// Another thread takes the oldest job
+	Job *Steal()
+	{
+		std::lock_guard< std::mutex > guard( lock );
+		if( bottom == top )
+			return NULL;
+
+		return jobs[top++ & ( MAX_JOBS_PER_THREAD - 1 )];
+	}
+
+};
+
+// Job system class
+class JobSystem
+{
+public:
+	JobSystem( unsigned long totalWorkers = 0 );
+	virtual ~JobSystem();
+
+	Job *CreateJob( JobFunction function, void *data, Job *parent = NULL, unsigned long start = 0, unsigned long end = 0 );
+	void Run( Job *job );
+	void Wait( Job *job );
+	bool IsFinished( Job *job );
+
+	void ParallelFor( JobFunction function, void *data, unsigned long count, unsigned long batchSize = 0 );
+
+	unsigned long GetTotalThreads();
+
+	FrameAllocator *GetFrameAllocator();
+
+private:
+	static void WorkerThread( JobSystem *jobSystem, unsigned long index );
+
+	Job *GetJob();
+	void Execute( Job *job );
+	void Finish( Job *job );
+	bool IsJobThread();
+
+private:
+	unsigned long m_totalThreads;						// Number of threads, the calling thread plus the workers
+	std::thread *m_threads;									// Worker threads
+	JobQueue *m_queues;										// One queue per thread
+	Job *m_jobs;													// Pool of jobs, a ring for each thread
+	unsigned long *m_allocatedJobs;					// Number of jobs each thread has taken from its ring
+	FrameAllocator *m_frameAllocators;				// Allocator for each thread's transient memory
+
+	static thread_local JobSystem *t_owner;		// Job system the calling thread belongs to, if any
+	static thread_local unsigned long t_index;	// Index of the calling thread in its job system
+	static thread_local Job t_outsideJobs[MAX_OUTSIDE_JOBS];		// Ring of jobs for a thread outside the job system
+	static thread_local unsigned long t_outsideAllocated;				// Number of jobs taken from the outside ring
+	static thread_local FrameAllocator t_outsideAllocator;			// Allocator for a thread outside the job system
+
+	std::mutex m_wakeLock;									// Guards workers going to sleep
+	std::condition_variable m_wake;					// Wakes sleeping workers when jobs are added
+	std::atomic< long > m_sleepingWorkers;		// Number of workers waiting for jobs
+	std::atomic< bool > m_exit;							// Tells the workers to stop
+
+};
+
+#endif
@@ -15,8 +15,106 @@
 #ifndef LINKED_LIST_H
 #define LINKED_LIST_H
 
-// Linked list class
-template < class Type > class LinkedList
+// Number of elements in the first chunk an element pool allocates
+#define ELEMENT_POOL_CHUNK 8
+
+// Maximum number of elements in a single chunk of an element pool
+#define ELEMENT_POOL_MAX_CHUNK 256
+
+// Heap allocator class, gives each list element its own heap block
+class HeapAllocator
+{
+	public:
+
+		// Allocate a block of the given size
+		void *Allocate( size_t size )
+		{
+			return new char[size];
+
+		}
+
+		// Free a block
+		void Free( void *block )
+		{
+			delete[] ( char* ) block;
+
+		}
+};
+
+// Element pool class, hands out fixed size blocks carved from larger chunks and
+// keeps freed blocks on a free list for reuse. Chunks are only returned to the
+// heap when the pool is destroyed.
+class ElementPool
+{
+	public:
+
+		// Element pool constructor
+		ElementPool()
+		{
+			m_free = NULL;
+			m_chunks = NULL;
+			m_chunkSize = ELEMENT_POOL_CHUNK;
+
+		}
+
+		// Element pool destructor
+		~ElementPool()
+		{
+			// Free all the chunks
+			while( m_chunks != NULL )
+			{
+				void *next = *( void** ) m_chunks;
+				delete[] ( char* ) m_chunks;
+				m_chunks = next;
+			}
+
+		}
+
+		// Allocate a block of the given size. Every block taken from a pool must be the same size
+		void *Allocate( size_t size )
+		{
+			// Carve a new chunk up when the free list runs out
+			if( m_free == NULL )
+			{
+				// Blocks must be able to hold the free list's pointer
+				size = max( size, sizeof( void* ) );
+
+				// The first pointer of each chunk links it to the last chunk
+				char *chunk = new char[sizeof( void* ) + size * m_chunkSize];
+				*( void** ) chunk = m_chunks;
+				m_chunks = chunk;
+
+				for( unsigned long b = 0; b < m_chunkSize; b++ )
+					Free( chunk + sizeof( void* ) + size * b );
+
+				// Grow the chunks as the list does
+				m_chunkSize = min( m_chunkSize * 2, ( unsigned long ) ELEMENT_POOL_MAX_CHUNK );
+			}
+
+			void *block = m_free;
+			m_free = *( void** ) m_free;
+
+			return block;
+
+		}
+
+		// Return a block to the free list
+		void Free( void *block )
+		{
+			*( void** ) block = m_free;
+			m_free = block;
+
+		}
+
+	private:
+			void *m_free;		// First free block
+			void *m_chunks;		// Last chunk allocated
+			unsigned long m_chunkSize;		// Number of blocks in the next chunk
+};
+
+// Linked list class. Elements are allocated through the given allocator, which
+// must provide Allocate( size ) and Free( block ). Each list owns its allocator.
+template < class Type, class Allocator = ElementPool > class LinkedList
 {
 	public:
 
@@ -74,14 +172,14 @@ template < class Type > class LinkedList
 			// First element creates new list
 			if( m_first == NULL )
 			{
-				m_first = new Element( element );
+				m_first = CreateElement( element );
 				m_last = m_first;
 			}
 
 			// Extend the list if the first element exists
 			else
 			{
-				m_last -> next = new Element( element );
+				m_last -> next = CreateElement( element );
 				m_last -> next -> prev = m_last;
 				m_last  = m_last -> next;
 			}
@@ -102,7 +200,7 @@ template < class Type > class LinkedList
 			// Check if next element exists
 			if( m_temp == NULL )
 			{
-				m_first = new Element( element );
+				m_first = CreateElement( element );
 				m_first -> next = nextElement;
 				nextElement -> prev = m_first;
 
@@ -113,7 +211,7 @@ template < class Type > class LinkedList
 			// Insert next element into the list
 			else
 			{
-				m_temp -> next = new Element( element );
+				m_temp -> next = CreateElement( element );
 				m_temp -> next -> prev = m_temp;
 				m_temp -> next -> next = nextElement;
 				nextElement -> prev = m_temp -> next;
@@ -154,7 +252,7 @@ template < class Type > class LinkedList
 							m_last -> next = NULL;
 					}
 
-					SAFE_DELETE( m_temp );
+					DestroyElement( m_temp );
 
 					*element = NULL;
 
@@ -177,7 +275,7 @@ template < class Type > class LinkedList
 				m_temp = m_last;
 				m_last = m_last -> prev;
 
-				SAFE_DELETE( m_temp );
+				DestroyElement( m_temp );
 			}
 
 			m_first = m_last = m_iterate = m_temp = NULL;
@@ -195,7 +293,7 @@ template < class Type > class LinkedList
 				m_temp -> data = NULL;
 				m_last = m_last -> prev;
 
-				SAFE_DELETE( m_temp );
+				DestroyElement( m_temp );
 			}
 
 			m_first = m_last = m_iterate = m_temp = NULL;
@@ -236,7 +334,7 @@ template < class Type > class LinkedList
 
 					m_temp -> data = NULL;
 
-					SAFE_DELETE( m_temp );
+					DestroyElement( m_temp );
 
 					*element = NULL;
 
@@ -395,6 +493,29 @@ template < class Type > class LinkedList
 		}
 
 	private:
+
+		// Create a new element from the allocator
+		Element *CreateElement( Type *element )
+		{
+			return new( m_allocator.Allocate( sizeof( Element ) ) ) Element( element );
+
+		}
+
+		// Destroy an element and return it to the allocator
+		void DestroyElement( Element *&element )
+		{
+			if( element == NULL )
+				return;
+
+			element -> ~Element();
+			m_allocator.Free( element );
+			element = NULL;
+
+		}
+
+	private:
+			Allocator m_allocator;		// Allocates the list's elements
+
 			Element *m_first;		// First element in list
 			Element *m_last;		// Last element in list
 			Element *m_iterate; // Iterate through list
@@ -194,20 +194,30 @@ Mesh::Mesh( char *name, char *path ) : Resource< Mesh >( name, path )
 
 	// Load the mesh's frame hierarchy.
 	AllocateHierarchy ah;
-	D3DXLoadMeshHierarchyFromX( GetFilename(), D3DXMESH_MANAGED, g_engine->GetDevice(), &ah, NULL, (D3DXFRAME**)&m_firstFrame, &m_animationController );
-
-	// Disable all the animation tracks initially.
-	if( m_animationController != NULL )
-		for( unsigned long t = 0; t < m_animationController->GetMaxNumTracks(); ++t )
-			m_animationController->SetTrackEnable( t, false );
+	ID3DXAnimationController *animationController = NULL;
+	D3DXLoadMeshHierarchyFromX( GetFilename(), D3DXMESH_MANAGED, g_engine->GetDevice(), &ah, NULL, (D3DXFRAME**)&m_firstFrame, &animationController );
 
 	// Invalidate the bone transformation matrices array.
 	m_boneMatrices = NULL;
 	m_totalBoneMatrices = 0;
 
+	// The mesh is assumed to be static until a skinned mesh container is found.
+	m_skinned = false;
+
 	// Prepare the frame hierarchy.
 	PrepareFrame( m_firstFrame );
 
+	// Flatten the hierarchy and build the clips that animate it. Only the
+	// compressed clips are kept, so the animation controller is released.
+	PrepareSkeleton();
+	PrepareClips( animationController );
+
+	if( animationController )
+	{
+		animationController ->Release();
+		animationController = NULL;
+	}
+
 	// Allocate memory for the bone matrices.
 	m_boneMatrices = new D3DXMATRIX[m_totalBoneMatrices];
 
@@ -282,6 +292,9 @@ Mesh::Mesh( char *name, char *path ) : Resource< Mesh >( name, path )
 
 	m_staticMesh->originalMesh->UnlockVertexBuffer();
 	m_staticMesh->originalMesh->UnlockIndexBuffer();
+
+	// Build the mesh's level of detail chain.
+	PrepareLODs();
 }
 
 
@@ -298,16 +311,26 @@ Mesh::~Mesh()
 	m_refPoints->ClearPointers();
 	SAFE_DELETE( m_refPoints );
 
-	// Release the animation controller.
-	if( m_animationController )
-	{
-		m_animationController ->Release();
-		m_animationController = NULL;
-	}
+	// Destroy the clips and the skeleton.
+	for( unsigned long c = 0; c < m_totalClips; c++ )
+		SAFE_DELETE( m_clips[c] );
+	SAFE_DELETE_ARRAY( m_clips );
+	SAFE_DELETE_ARRAY( m_bones );
+	SAFE_DELETE( m_skeleton );
 
 	// Destroy the bone matrices.
 	SAFE_DELETE_ARRAY( m_boneMatrices );
 
+	// Release the reduced levels of detail. The first level is the static mesh.
+	for( unsigned long l = 1; l < m_totalLODs; l++ )
+	{
+		if( m_lods[l] )
+		{
+			m_lods[l]->Release();
+			m_lods[l] = NULL;
+		}
+	}
+
 	// Destroy the static mesh.
 	if( m_staticMesh )
 	{
@@ -334,10 +357,26 @@ Mesh::~Mesh()
 }
 
 
-// Updates the mesh.
+// Updates the final transformation of every frame from the frame hierarchy.
 void Mesh::Update()
 {
-	UpdateFrame( m_firstFrame );
+	// Parents come before their children, so each parent is always up to date.
+	for( unsigned long b = 0; b < m_skeleton->totalBones; b++ )
+	{
+		if( m_skeleton->parents[b] == -1 )
+			m_bones[b]->finalTransformationMatrix = m_bones[b]->TransformationMatrix;
+		else
+			D3DXMatrixMultiply( &m_bones[b]->finalTransformationMatrix, &m_bones[b]->TransformationMatrix, &m_bones[m_skeleton->parents[b]]->finalTransformationMatrix );
+	}
+}
+
+
+// Sets the final transformation of every frame from the given pose, which
+// holds a model space matrix for each bone of the mesh's skeleton.
+void Mesh::ApplyPose( D3DXMATRIX *boneMatrices )
+{
+	for( unsigned long b = 0; b < m_skeleton->totalBones; b++ )
+		m_bones[b]->finalTransformationMatrix = boneMatrices[b];
 }
 
 
@@ -348,13 +387,29 @@ void Mesh::Render()
 }
 
 
-// Create a clone of the mesh's animation controller.
-void Mesh::CloneAnimationController( ID3DXAnimationController **animationController )
+// Renders the given level of detail of the mesh.
+void Mesh::RenderLOD( unsigned long level )
 {
-	if( m_animationController )
-		m_animationController->CloneAnimationController( m_animationController->GetMaxNumAnimationOutputs(), m_animationController->GetMaxNumAnimationSets(), m_animationController->GetMaxNumTracks(), m_animationController->GetMaxNumEvents(), &*animationController );
-	else
-		*animationController = NULL;
+	// The full detail level (and skinned meshes) use the frame hierarchy.
+	if( level == 0 || level >= m_totalLODs )
+	{
+		RenderFrame( m_firstFrame );
+		return;
+	}
+
+	// Reduced levels share the static mesh's attribute ids and materials.
+	for( unsigned long m = 0; m < m_staticMesh->NumMaterials; m++ )
+	{
+		if( m_staticMesh->materials[m] )
+		{
+			g_engine->GetDevice()->SetMaterial( m_staticMesh->materials[m]->GetLighting() );
+			g_engine->GetDevice()->SetTexture( 0, m_staticMesh->materials[m]->GetTexture() );
+		}
+		else
+			g_engine->GetDevice()->SetTexture( 0, NULL );
+
+		m_lods[level]->DrawSubset( m );
+	}
 }
 
 
@@ -378,6 +433,47 @@ unsigned short *Mesh::GetIndices()
 	return m_indices;
 }
 
+// Returns true if any of the mesh's containers are skinned.
+bool Mesh::IsSkinned()
+{
+	return m_skinned;
+}
+
+// Returns the number of levels in the mesh's level of detail chain.
+unsigned long Mesh::GetTotalLODs()
+{
+	return m_totalLODs;
+}
+
+
+// Returns the mesh for the given level of detail.
+ID3DXMesh *Mesh::GetLOD( unsigned long level )
+{
+	if( level >= m_totalLODs )
+		return m_lods[m_totalLODs - 1];
+
+	return m_lods[level];
+}
+
+
+// Sets the projected screen size below which the given level of detail is used.
+void Mesh::SetLODScreenSize( unsigned long level, float screenSize )
+{
+	if( level < MAX_MESH_LODS )
+		m_lodScreenSizes[level] = screenSize;
+}
+
+
+// Returns the projected screen size below which the given level of detail is used.
+float Mesh::GetLODScreenSize( unsigned long level )
+{
+	if( level >= MAX_MESH_LODS )
+		return 0.0f;
+
+	return m_lodScreenSizes[level];
+}
+
+
 // Returns the list of frames in the mesh.
 LinkedList< Frame > *Mesh::GetFrameList()
 {
@@ -385,7 +481,10 @@ LinkedList< Frame > *Mesh::GetFrameList()
 }
 
 
-// Returns the frame with the given name.
+// Returns the frame with the given name. On an animated mesh the frame holds
+// the pose last applied to the mesh, which for a mesh shared by several
+// animated objects is the pose of whichever object was rendered last. Use
+// AnimatedObject::GetBoneMatrix for the pose of a particular object.
 Frame *Mesh::GetFrame( char *name )
 {
 	m_frames->Iterate( true );
@@ -397,7 +496,8 @@ Frame *Mesh::GetFrame( char *name )
 }
 
 
-// Returns the reference point wth the given name.
+// Returns the reference point wth the given name. As with GetFrame, on a
+// shared animated mesh it is posed by whichever object was rendered last.
 Frame *Mesh::GetReferencePoint( char *name )
 {
 	m_refPoints->Iterate( true );
@@ -409,6 +509,30 @@ Frame *Mesh::GetReferencePoint( char *name )
 }
 
 
+// Returns the mesh's frame hierarchy flattened into bones.
+Skeleton *Mesh::GetSkeleton()
+{
+	return m_skeleton;
+}
+
+
+// Returns the number of animation clips in the mesh.
+unsigned long Mesh::GetTotalClips()
+{
+	return m_totalClips;
+}
+
+
+// Returns the given animation clip, or NULL if there is no such clip.
+AnimationClip *Mesh::GetClip( unsigned long clip )
+{
+	if( clip >= m_totalClips )
+		return NULL;
+
+	return m_clips[clip];
+}
+
+
 // Prepares the given frame.
 void Mesh::PrepareFrame( Frame *frame )
 {
@@ -429,6 +553,9 @@ void Mesh::PrepareFrame( Frame *frame )
 		// Check if this mesh is a skinned mesh.
 		if( meshContainer->pSkinInfo != NULL )
 		{
+			// Indicate that the mesh has to be skinned before rendering.
+			m_skinned = true;
+
 			// Create the array of bone matrix pointers.
 			meshContainer->boneMatrixPointers = new D3DXMATRIX*[meshContainer->pSkinInfo->GetNumBones()];
 
@@ -476,21 +603,174 @@ void Mesh::PrepareFrame( Frame *frame )
 }
 
 
-// Updates the given frame's transformation matrices.
-void Mesh::UpdateFrame( Frame *frame, D3DXMATRIX *parentTransformationMatrix )
+// Flattens the frame hierarchy into the mesh's skeleton. The frames are
+// taken in the order they were prepared, which always places a frame after
+// its parent.
+void Mesh::PrepareSkeleton()
 {
-	if( parentTransformationMatrix != NULL )
-		D3DXMatrixMultiply( &frame->finalTransformationMatrix, &frame->TransformationMatrix, parentTransformationMatrix );
-	else
-		frame->finalTransformationMatrix = frame->TransformationMatrix;
+	m_skeleton = new Skeleton( m_frames->GetTotalElements() );
+	m_bones = new Frame*[max( m_skeleton->totalBones, 1UL )];
 
-	// Update the frame's siblings.
-	if( frame->pFrameSibling != NULL )
-		UpdateFrame( (Frame*)frame->pFrameSibling, parentTransformationMatrix );
+	unsigned long b = 0;
+	m_frames->Iterate( true );
+	while( m_frames->Iterate() )
+	{
+		Frame *frame = m_frames->GetCurrent();
+		m_bones[b] = frame;
 
-	// Update the frame's children.
-	if( frame->pFrameFirstChild != NULL )
-		UpdateFrame( (Frame*)frame->pFrameFirstChild, &frame->finalTransformationMatrix );
+		m_skeleton->names[b] = new char[strlen( frame->Name ) + 1];
+		strcpy( m_skeleton->names[b], frame->Name );
+
+		// Split the frame's transformation up so it can be blended with the clips.
+		D3DXMatrixDecompose( &m_skeleton->bindScales[b], &m_skeleton->bindRotations[b], &m_skeleton->bindTranslations[b], &frame->TransformationMatrix );
+
+		b++;
+	}
+
+	// Find the parent of each bone by following its parent's children.
+	for( unsigned long p = 0; p < m_skeleton->totalBones; p++ )
+		for( Frame *child = (Frame*)m_bones[p]->pFrameFirstChild; child != NULL; child = (Frame*)child->pFrameSibling )
+			for( unsigned long c = p + 1; c < m_skeleton->totalBones; c++ )
+				if( m_bones[c] == child )
+				{
+					m_skeleton->parents[c] = (long)p;
+					break;
+				}
+
+	// Only bones that skin a mesh, carry a mesh or are reference points affect
+	// what is drawn or looked up, so the rest need not be evaluated.
+	for( unsigned long b = 0; b < m_skeleton->totalBones; b++ )
+		m_skeleton->required[b] = m_bones[b]->pMeshContainer != NULL || strncmp( "rp_", m_bones[b]->Name, 3 ) == 0;
+
+	for( unsigned long b = 0; b < m_skeleton->totalBones; b++ )
+	{
+		MeshContainer *meshContainer = (MeshContainer*)m_bones[b]->pMeshContainer;
+		if( meshContainer == NULL || meshContainer->pSkinInfo == NULL )
+			continue;
+
+		for( unsigned long s = 0; s < meshContainer->pSkinInfo->GetNumBones(); s++ )
+		{
+			long bone = m_skeleton->GetBone( meshContainer->pSkinInfo->GetBoneName( s ) );
+			if( bone != -1 )
+				m_skeleton->required[bone] = true;
+		}
+	}
+
+	// A bone's parent is required whenever it is, and always comes before it.
+	for( unsigned long b = m_skeleton->totalBones; b > 0; b-- )
+		if( m_skeleton->required[b - 1] == true && m_skeleton->parents[b - 1] != -1 )
+			m_skeleton->required[m_skeleton->parents[b - 1]] = true;
+}
+
+
+// Builds a clip from each of the given animation controller's keyframed
+// animation sets. The clips keep the index of the set they were built from.
+void Mesh::PrepareClips( ID3DXAnimationController *animationController )
+{
+	m_clips = NULL;
+	m_totalClips = 0;
+
+	if( animationController == NULL )
+		return;
+
+	m_totalClips = animationController->GetNumAnimationSets();
+	m_clips = new AnimationClip*[max( m_totalClips, 1UL )];
+
+	for( unsigned long c = 0; c < m_totalClips; c++ )
+	{
+		m_clips[c] = NULL;
+
+		ID3DXAnimationSet *animationSet = NULL;
+		if( FAILED( animationController->GetAnimationSet( c, &animationSet ) ) )
+			continue;
+
+		// Only keyframed sets can be turned into clips.
+		ID3DXKeyframedAnimationSet *keyframedSet = NULL;
+		if( SUCCEEDED( animationSet->QueryInterface( IID_ID3DXKeyframedAnimationSet, (void**)&keyframedSet ) ) )
+		{
+			AnimationKeys *keys = ImportKeys( keyframedSet );
+			m_clips[c] = new AnimationClip( keys );
+			SAFE_DELETE( keys );
+
+			keyframedSet->Release();
+		}
+
+		animationSet->Release();
+	}
+}
+
+
+// Reads the keys of the given animation set for every bone of the skeleton it
+// animates. This is the only place clips touch D3DX's animation sets, the
+// clips themselves are built from the plain keys.
+AnimationKeys *Mesh::ImportKeys( ID3DXKeyframedAnimationSet *animationSet )
+{
+	AnimationKeys *keys = new AnimationKeys( animationSet->GetName(), (float)animationSet->GetPeriod(), m_skeleton->totalBones );
+
+	// The values are read back through the set rather than taken from the keys
+	// directly so they follow the same conventions the animation controller
+	// used when it played the set.
+	float ticksPerSecond = (float)animationSet->GetSourceTicksPerSecond();
+	D3DXVECTOR3 scale, translation;
+	D3DXQUATERNION rotation;
+	for( unsigned long a = 0; a < animationSet->GetNumAnimations(); a++ )
+	{
+		LPCSTR name = NULL;
+		animationSet->GetAnimationNameByIndex( a, &name );
+		long bone = name == NULL ? -1 : m_skeleton->GetBone( name );
+		if( bone == -1 || keys->rotationTimes[bone] != NULL || keys->translationTimes[bone] != NULL || keys->scaleTimes[bone] != NULL )
+			continue;
+
+		unsigned long count = animationSet->GetNumRotationKeys( a );
+		if( count > 0 )
+		{
+			D3DXKEY_QUATERNION *rotationKeys = new D3DXKEY_QUATERNION[count];
+			animationSet->GetRotationKeys( a, rotationKeys );
+			keys->rotationCounts[bone] = count;
+			keys->rotationTimes[bone] = new float[count];
+			keys->rotations[bone] = new D3DXQUATERNION[count];
+			for( unsigned long k = 0; k < count; k++ )
+			{
+				keys->rotationTimes[bone][k] = rotationKeys[k].Time / ticksPerSecond;
+				animationSet->GetSRT( keys->rotationTimes[bone][k], a, &scale, &keys->rotations[bone][k], &translation );
+			}
+			SAFE_DELETE_ARRAY( rotationKeys );
+		}
+
+		count = animationSet->GetNumTranslationKeys( a );
+		if( count > 0 )
+		{
+			D3DXKEY_VECTOR3 *translationKeys = new D3DXKEY_VECTOR3[count];
+			animationSet->GetTranslationKeys( a, translationKeys );
+			keys->translationCounts[bone] = count;
+			keys->translationTimes[bone] = new float[count];
+			keys->translations[bone] = new D3DXVECTOR3[count];
+			for( unsigned long k = 0; k < count; k++ )
+			{
+				keys->translationTimes[bone][k] = translationKeys[k].Time / ticksPerSecond;
+				animationSet->GetSRT( keys->translationTimes[bone][k], a, &scale, &rotation, &keys->translations[bone][k] );
+			}
+			SAFE_DELETE_ARRAY( translationKeys );
+		}
+
+		count = animationSet->GetNumScaleKeys( a );
+		if( count > 0 )
+		{
+			D3DXKEY_VECTOR3 *scaleKeys = new D3DXKEY_VECTOR3[count];
+			animationSet->GetScaleKeys( a, scaleKeys );
+			keys->scaleCounts[bone] = count;
+			keys->scaleTimes[bone] = new float[count];
+			keys->scales[bone] = new D3DXVECTOR3[count];
+			for( unsigned long k = 0; k < count; k++ )
+			{
+				keys->scaleTimes[bone][k] = scaleKeys[k].Time / ticksPerSecond;
+				animationSet->GetSRT( keys->scaleTimes[bone][k], a, &keys->scales[bone][k], &rotation, &translation );
+			}
+			SAFE_DELETE_ARRAY( scaleKeys );
+		}
+	}
+
+	return keys;
 }
 
 
@@ -550,4 +830,96 @@ void Mesh::RenderFrame( Frame *frame )
 	// Render the frame's children.
 	if( frame->pFrameFirstChild != NULL )
 		RenderFrame( (Frame*)frame->pFrameFirstChild );
+}
+
+
+// Builds the mesh's level of detail chain. Authored levels are loaded from
+// files named after the mesh with a _lod suffix (e.g. crate_lod1.x), which
+// must use the same materials as the full detail mesh. If none are found the
+// levels are generated by simplifying the static mesh.
+void Mesh::PrepareLODs()
+{
+	// The first level is always the full detail static mesh.
+	m_lods[0] = m_staticMesh->originalMesh;
+	m_lodScreenSizes[0] = 1.0f;
+	m_totalLODs = 1;
+
+	// Default screen sizes (fraction of the screen height covered by the mesh's
+	// bounding sphere) at which each reduced level takes over.
+	for( unsigned long l = 1; l < MAX_MESH_LODS; l++ )
+	{
+		m_lods[l] = NULL;
+		m_lodScreenSizes[l] = m_lodScreenSizes[l - 1] * 0.4f;
+	}
+
+	// Skinned meshes are always rendered at full detail.
+	if( m_skinned == true )
+		return;
+
+	// Find the extension in the mesh's name, so the suffix can be placed before it.
+	char *extension = strrchr( GetName(), '.' );
+	unsigned long baseLength = extension == NULL ? strlen( GetName() ) : extension - GetName();
+
+	// Load any authored levels of detail.
+	for( unsigned long l = 1; l < MAX_MESH_LODS; l++ )
+	{
+		char *filename = new char[strlen( GetPath() ) + strlen( GetName() ) + 8];
+		sprintf( filename, "%s%.*s_lod%lu%s", GetPath(), (int)baseLength, GetName(), l, extension == NULL ? "" : extension );
+
+		// Stop at the first level that does not exist.
+		FILE *file = fopen( filename, "r" );
+		if( file == NULL )
+		{
+			SAFE_DELETE_ARRAY( filename );
+			break;
+		}
+		fclose( file );
+
+		ID3DXBuffer *adjacencyBuffer;
+		if( FAILED( D3DXLoadMeshFromX( filename, D3DXMESH_MANAGED, g_engine->GetDevice(), &adjacencyBuffer, NULL, NULL, NULL, &m_lods[l] ) ) )
+		{
+			SAFE_DELETE_ARRAY( filename );
+			break;
+		}
+
+		// Sort the level by attribute so it can be drawn a subset at a time.
+		m_lods[l]->OptimizeInplace( D3DXMESHOPT_COMPACT | D3DXMESHOPT_ATTRSORT | D3DXMESHOPT_VERTEXCACHE, (DWORD*)adjacencyBuffer->GetBufferPointer(), NULL, NULL, NULL );
+		adjacencyBuffer->Release();
+
+		SAFE_DELETE_ARRAY( filename );
+		m_totalLODs++;
+	}
+
+	// Authored levels take priority over generated ones.
+	if( m_totalLODs > 1 )
+		return;
+
+	// Small meshes gain nothing from being simplified.
+	unsigned long totalFaces = m_staticMesh->originalMesh->GetNumFaces();
+	if( totalFaces < 256 )
+		return;
+
+	// Generate the adjacency of the static mesh for the simplifier.
+	DWORD *adjacency = new DWORD[totalFaces * 3];
+	m_staticMesh->originalMesh->GenerateAdjacency( 0.0001f, adjacency );
+
+	// Generate each level with half the faces of the previous one.
+	for( unsigned long l = 1; l < MAX_MESH_LODS; l++ )
+	{
+		if( FAILED( D3DXSimplifyMesh( m_staticMesh->originalMesh, adjacency, NULL, NULL, totalFaces >> l, D3DXMESHSIMP_FACE, &m_lods[l] ) ) )
+		{
+			m_lods[l] = NULL;
+			break;
+		}
+
+		// Sort the level by attribute so it can be drawn a subset at a time.
+		DWORD *lodAdjacency = new DWORD[m_lods[l]->GetNumFaces() * 3];
+		m_lods[l]->GenerateAdjacency( 0.0001f, lodAdjacency );
+		m_lods[l]->OptimizeInplace( D3DXMESHOPT_COMPACT | D3DXMESHOPT_ATTRSORT | D3DXMESHOPT_VERTEXCACHE, lodAdjacency, NULL, NULL, NULL );
+		SAFE_DELETE_ARRAY( lodAdjacency );
+
+		m_totalLODs++;
+	}
+
+	SAFE_DELETE_ARRAY( adjacency );
 }
\ No newline at end of file
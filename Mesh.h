@@ -15,6 +15,9 @@
 #ifndef MESH_H
 #define MESH_H
 
+// Maximum number of levels of detail in a mesh's chain, including the full detail mesh.
+#define MAX_MESH_LODS 4
+
 struct Frame: public D3DXFRAME
 {
 	D3DXMATRIX finalTransformationMatrix;		// End transformation once combined with parent
@@ -54,9 +57,9 @@ public:
 	virtual ~Mesh();
 
 	void Update();
+	void ApplyPose( D3DXMATRIX *boneMatrices );
 	void Render();
-
-	void CloneAnimationController( ID3DXAnimationController **animationController );
+	void RenderLOD( unsigned long level );
 
 	MeshContainer *GetStaticMesh();
 
@@ -64,20 +67,33 @@ public:
 
 	unsigned short *GetIndices();
 
+	bool IsSkinned();
+
+	unsigned long GetTotalLODs();
+	ID3DXMesh *GetLOD( unsigned long level );
+	void SetLODScreenSize( unsigned long level, float screenSize );
+	float GetLODScreenSize( unsigned long level );
+
 	LinkedList< Frame > *GetFrameList();
 	Frame *GetFrame( char *name );
 	Frame *GetReferencePoint( char *name );
 
+	Skeleton *GetSkeleton();
+	unsigned long GetTotalClips();
+	AnimationClip *GetClip( unsigned long clip );
+
 private:
 	void PrepareFrame( Frame *frame );
-	void UpdateFrame( Frame *frame, D3DXMATRIX *parentTransformationMatrix = NULL );
+	void PrepareSkeleton();
+	void PrepareClips( ID3DXAnimationController *animationController );
+	AnimationKeys *ImportKeys( ID3DXKeyframedAnimationSet *animationSet );
 	void RenderFrame( Frame *frame );
+	void PrepareLODs();
 
 
 
 private:
 	Frame *m_firstFrame;															// First frame in mesh hierarchy
-	ID3DXAnimationController *m_animationController;		// Animation controller
 
 	D3DXMATRIX *m_boneMatrices;										// Transformation bone matrices
 	unsigned long m_totalBoneMatrices;									// Number of bones in array
@@ -85,10 +101,20 @@ private:
 	MeshContainer *m_staticMesh;											// Static mesh
 	Vertex *m_vertices;																// Vertex array for static mesh
 	unsigned short *m_indices;													// Index array for static mesh
+	bool m_skinned;																	// Indicates if the mesh contains skinned mesh containers
+
+	ID3DXMesh *m_lods[MAX_MESH_LODS];										// Chain of reduced detail meshes, the first is the static mesh
+	float m_lodScreenSizes[MAX_MESH_LODS];								// Projected screen size below which each level is used
+	unsigned long m_totalLODs;													// Number of levels in the chain
 
 	LinkedList< Frame > *m_frames;										// Linked list of pointers to all frames to mesh
 	LinkedList< Frame > *m_refPoints;									// Linked list of pointers to all reference pointers to mesh
 
+	Skeleton *m_skeleton;															// Frame hierarchy flattened into bones
+	Frame **m_bones;																	// Frame each bone of the skeleton was built from
+	AnimationClip **m_clips;														// Clip built from each animation set, or NULL if the set has no keys
+	unsigned long m_totalClips;													// Number of animation sets
+
 };
 
 #endif
\ No newline at end of file
@@ -3,7 +3,7 @@
 // File: Network.cpp
 // Programmer: T.J. Eason
 // Project: Game Engine
-// Description: DirectPlay wrapper class to handle system network messages
+// Description: Network class to handle system network messages over DirectPlay, UDP or loopback transports
 // Reference: DirectX Manual & GameDev.net
 // Date: 3-3-10
 // Revision 1: 3-4-10
@@ -17,16 +17,12 @@
 #include "Engine.h"
 
 // Network class constructor
-Network::Network( GUID guid, void ( *HandleNetworkMessageFunction ) ( ReceivedMessage *msg ) )
+Network::Network( GUID guid, void ( *HandleNetworkMessageFunction ) ( ReceivedMessage *msg ), unsigned long transport )
 {
 	// Initiallize crtical section
 	InitializeCriticalSection( &m_sessionCS );
 	InitializeCriticalSection( &m_playerCS );
-	InitializeCriticalSection( &m_messageCS );
-
-	// Invalidate DirectPlay peer interface and devce
-	m_dpp = NULL;
-	m_device = NULL;
+	InitializeCriticalSection( &m_batchCS );
 
 	// Store game's GUID
 	memcpy( &m_guid, &guid, sizeof( GUID ) );
@@ -34,11 +30,31 @@ Network::Network( GUID guid, void ( *HandleNetworkMessageFunction ) ( ReceivedMe
 	// Create new session list
 	m_sessions = new LinkedList< SessionInfo >;
 
-	// Create new player list
-	m_players = new LinkedList< PlayerInfo >;
+	// No players in any slot yet
+	ZeroMemory( (void*)m_players, sizeof( m_players ) );
+	ZeroMemory( (void*)m_playerHashes, sizeof( m_playerHashes ) );
+	m_playerHash = m_playerHashes[0];
+	m_playerTombstones = 0;
+	m_spareRetired = 0;
+
+	// Create new list of destroyed players waiting to be deleted. The epoch
+	// starts at one so the one before it can be counted too
+	m_retiredPlayers = new LinkedList< PlayerInfo >;
+	m_playerEpoch = 1;
+	m_playerReaders[0] = m_playerReaders[1] = 0;
+
+	// Create new list of batches for sent messages
+	m_batches = new LinkedList< MessageBatch >;
+
+	// Create new network message queue. Transports report messages on their
+	// own threads, which add to it without waiting on Update.
+	m_messages = new MessageQueue;
+
+	// Create table of received message handlers
+	m_messageTable = new MessageTable;
 
-	// Create new network message list
-	m_messages = new LinkedList<ReceivedMessage >;
+	// Create pool of buffers for the received messages
+	m_receiveBuffers = new ReceiveBufferPool;
 
 	// Load network settings
 	Script *settings = new Script( "NetworkSettings.txt" );
@@ -65,21 +81,28 @@ Network::Network( GUID guid, void ( *HandleNetworkMessageFunction ) ( ReceivedMe
 	// Network not allowed to receive messages
 	m_receiveAllowed = false;
 
+	// No players until a session is hosted or joined
+	m_dpnidLocal = 0;
+	m_dpnidHost = 0;
+
 	// Set network message handler
 	HandleNetworkMessage = HandleNetworkMessageFunction;
 
-	// Create DirectPlay peer interface
-	CoCreateInstance( CLSID_DirectPlay8Peer, NULL, CLSCTX_INPROC, IID_IDirectPlay8Peer, ( void** ) &m_dpp );
-
-	// Initialize peer interface
-	m_dpp ->Initialize( ( PVOID ) this,  NetworkMessageHandler, DPNINITIALIZE_HINT_LANSESSION );
+	// Create the transport last, as it reads the settings above
+	switch( transport )
+	{
+	case NETWORK_TRANSPORT_UDP:
+		m_transport = new UdpTransport( this );
+		break;
 
-	// Create device address
-	CoCreateInstance( CLSID_DirectPlay8Address, NULL, CLSCTX_INPROC, IID_IDirectPlay8Address, ( LPVOID* ) &m_device );
+	case NETWORK_TRANSPORT_LOOPBACK:
+		m_transport = new LoopbackTransport( this );
+		break;
 
-	// Set up the device address
-	m_device ->SetSP( &CLSID_DP8SP_TCPIP );
-	m_device ->AddComponent( DPNA_KEY_PORT, &m_port, sizeof( DWORD ), DPNA_DATATYPE_DWORD );
+	default:
+		m_transport = new DirectPlayTransport( this );
+		break;
+	}
 
 }
 
@@ -109,58 +132,68 @@ Network::~Network()
 
 	SAFE_DELETE( settings );
 
-	// Release device address
-	if( m_device )
-	{
-		m_device ->Release();
-		m_device = NULL;
-	}
-
-	// Close DirectPlay peer interface
-	if( m_dpp != NULL )
-		m_dpp ->Close( DPNCLOSE_IMMEDIATE );
-
-	// Relase DirectPlay peer interface
-	if( m_dpp )
-	{
-		m_dpp ->Release();
-		m_dpp = NULL;
-	}
+	// Destroy the transport first so nothing reports to the lists below
+	SAFE_DELETE( m_transport );
 
 	// Destroy session list
 	SAFE_DELETE( m_sessions );
 
-	// Destroy player list
-	SAFE_DELETE( m_players );
+	// Destroy the players, both current and retired
+	ClearPlayers();
+	DeleteRetiredPlayers( true );
+	SAFE_DELETE( m_retiredPlayers );
 
-	// Destroy network message list
+	// Destroy the batches that were never flushed
+	SAFE_DELETE( m_batches );
+
+	// Destroy network message queue, giving back the buffers still in it
+	ClearMessages();
 	SAFE_DELETE( m_messages );
 
+	// Destroy receive buffer pool
+	SAFE_DELETE( m_receiveBuffers );
+
+	// Destroy table of received message handlers
+	SAFE_DELETE( m_messageTable );
+
 	// Delete critical sections
 	DeleteCriticalSection( &m_sessionCS );
 	DeleteCriticalSection( &m_playerCS );
-	DeleteCriticalSection( &m_messageCS );
+	DeleteCriticalSection( &m_batchCS );
 
 }
 
-// Update network to progress messages
+// Update network to progress messages. Sends the batched messages, deletes
+// the departed players no reader can still be using, then hands the received
+// messages to their handlers in the message table or to the network handler
 void Network::Update()
 {
-	EnterCriticalSection( &m_messageCS );
+	// Send anything batched since the last flush
+	Flush();
 
-	ReceivedMessage *message = m_messages ->GetFirst();
+	// Delete the players no thread can still be using
+	DeleteRetiredPlayers( false );
+
+	ReceivedMessage *message = m_messages ->Front();
 
 	unsigned long endTime = timeGetTime() + m_processingTime;
 
-	// Handle elapsed time for network messages
+	// Handle elapsed time for network messages. No lock is held while the
+	// handler runs, so the transport can keep adding messages.
 	while( endTime > timeGetTime() && message != NULL )
 	{
-		HandleNetworkMessage( message );
-		m_messages ->Remove( &message );
-		message = m_messages ->GetFirst();
-	}
+		// The player's batches are dropped here rather than by DestroyPlayer,
+		// which transports call holding their own locks
+		if( message ->msgid == MSGID_DESTROY_PLAYER && message ->buffer == NULL )
+			DropBatches( message ->dpnid );
 
-	LeaveCriticalSection( &m_messageCS );
+		if( m_messageTable ->Dispatch( message ) == false )
+			HandleNetworkMessage( message );
+
+		ReceiveBufferPool::Release( message ->buffer );
+		m_messages ->Remove();
+		message = m_messages ->Front();
+	}
 
 }
 
@@ -168,81 +201,36 @@ void Network::Update()
 void Network::EnumerateSessions()
 {
 	// Emply lists
-	m_players ->Empty();
-	m_messages ->Empty();
-	m_sessions ->Empty();
+	ClearPlayers();
+	ClearMessages();
 
-	// Prepare application description
-	DPN_APPLICATION_DESC description;
-	ZeroMemory( &description, sizeof( DPN_APPLICATION_DESC ) );
-	description.dwSize = sizeof( DPN_APPLICATION_DESC );
-	description.guidApplication = m_guid;
+	EnterCriticalSection( &m_sessionCS );
+	m_sessions ->Empty();
+	LeaveCriticalSection( &m_sessionCS );
 
-	// Synchronize enummerated sessions
-	m_dpp ->EnumHosts( &description, NULL, m_device, NULL, 0, 1, 0, 0, NULL, NULL, DPNENUMHOSTS_SYNC );
+	// The transport returns once the sessions have had time to answer
+	m_transport ->EnumerateSessions();
 
 }
 
 // Get a host session
 bool Network::Host( char *name, char *session, int players, void *playerData, unsigned long dataSize )
 {
-	WCHAR wide[MAX_PATH];
-
-	// Prepare player information
-	DPN_PLAYER_INFO player;
-	ZeroMemory( &player, sizeof( DPN_PLAYER_INFO ) );
-	player.dwSize = sizeof( DPN_PLAYER_INFO );
-	player.pvData =playerData;
-	player.dwInfoFlags = DPNINFO_NAME | DPNINFO_DATA;
-	mbstowcs( wide, name, MAX_PATH );
-	player.pwszName = wide;
-
-	// Setup player information
-	if( FAILED( m_dpp ->SetPeerInfo( &player, NULL, NULL, DPNSETPEERINFO_SYNC ) ) )
-		return false;
-
-	// Prepare application description
-	DPN_APPLICATION_DESC description;
-	ZeroMemory( &description, sizeof( DPN_APPLICATION_DESC ) );
-	description.dwSize = sizeof( DPN_APPLICATION_DESC );
-	description.guidApplication = m_guid;
-	description.dwMaxPlayers = players;
-	mbstowcs( wide, session, MAX_PATH );
-	description.pwszSessionName = wide;
-
-	// Host session
-	if( FAILED( m_dpp ->Host( &description, &m_device, 1, NULL, NULL, NULL, 0 ) ) )
-		return false;
-
-	return true;
+	return m_transport ->Host( name, session, players, playerData, dataSize );
 }
 
 // Join an enumerated session
 bool Network::Join( char *name, int session, void *playerData, unsigned long dataSize )
 {
-	WCHAR wide[MAX_PATH];
-
 	// Empty lists
-	m_players ->Empty();
-	m_messages ->Empty();
+	ClearPlayers();
+	ClearMessages();
+	ClearBatches();
 
 	// Ignore invalid sessions
 	if( session < 0 )
 		return false;
 
-	// Prepare player information
-	DPN_PLAYER_INFO player;
-	ZeroMemory( &player, sizeof( DPN_PLAYER_INFO ) );
-	player.dwSize = sizeof( DPN_PLAYER_INFO );
-	player.pvData =playerData;
-	player.dwInfoFlags = DPNINFO_NAME | DPNINFO_DATA;
-	mbstowcs( wide, name, MAX_PATH );
-	player.pwszName = wide;
-
-	// Setup player information
-	if( FAILED( m_dpp ->SetPeerInfo( &player, NULL, NULL, DPNSETPEERINFO_SYNC ) ) )
-		return false;
-
 	// Enter sessions linked list critical session
 	EnterCriticalSection( &m_sessionCS );
 
@@ -259,33 +247,26 @@ bool Network::Join( char *name, int session, void *playerData, unsigned long dat
 		}
 	}
 
-	// Join session
-	if( FAILED( m_dpp ->Connect(  &m_sessions ->GetCurrent() ->description, m_sessions ->GetCurrent() ->address, m_device, NULL, NULL, NULL, 0, NULL, NULL, NULL, DPNCONNECT_SYNC ) ) )
-	{
-		LeaveCriticalSection( &m_sessionCS );
-		return false;
-	}
+	SessionInfo *info = m_sessions ->GetCurrent();
 
-	// Exit session's linked list critical section
+	// Exit session's linked list critical section. The sessions are only
+	// destroyed by EnumerateSessions, and the transport may need to report
+	// more of them while it connects.
 	LeaveCriticalSection( &m_sessionCS );
 
-	return true;
+	// Join session
+	return m_transport ->Join( name, info, playerData, dataSize );
 
 }
 
 // Terminate current session
 void Network::Terminate()
 {
-	// Host only has permission to terminate session
-	if( m_dpnidHost == m_dpnidLocal )
-		m_dpp -> TerminateSession( NULL, 0, 0 );
-
-	// Close connection and uninitialize DirectPlay peer interface
-	if( m_dpp != NULL )
-		m_dpp ->Close( DPNCLOSE_IMMEDIATE );
+	// Send what was batched before leaving
+	Flush();
 
-	// Initialize DirectPlay peer interface
-	m_dpp ->Initialize( ( PVOID ) this, NetworkMessageHandler, DPNINITIALIZE_HINT_LANSESSION );
+	m_transport ->Terminate();
+	ClearBatches();
 
 }
 
@@ -313,27 +294,75 @@ SessionInfo *Network::GetNextSession( bool restart )
 
 }
 
-// Get player information 
+// Get player information. Takes no lock, but must be called from the thread
+// that calls Update. The player is not deleted before the next Update, even
+// if it leaves. Other threads use CopyPlayer
 PlayerInfo *Network::GetPlayer( DPNID dpnid )
 {
-	EnterCriticalSection( &m_playerCS );
+	unsigned long hash = GetPlayerHash( dpnid );
+	volatile long *table = m_playerHash;
+
+	// Follow the probe sequence until the player or an empty entry is found,
+	// stepping over the entries of players that have left
+	for( unsigned long p = 0; p < NETWORK_PLAYER_HASH_SIZE; p++ )
+	{
+		long entry = table[( hash + p ) & ( NETWORK_PLAYER_HASH_SIZE - 1 )];
+		if( entry == 0 )
+			return NULL;
+
+		if( entry > 0 )
+		{
+			PlayerInfo *player = m_players[entry - 1];
+			if( player != NULL && player ->dpnid == dpnid )
+				return player;
+		}
+	}
+
+	return NULL;
+
+}
+
+// Get the player in a slot, or NULL if the slot is free. A player keeps its
+// slot for as long as it is in the session.
+PlayerInfo *Network::GetPlayerBySlot( unsigned long slot )
+{
+	if( slot >= NETWORK_MAX_PLAYERS )
+		return NULL;
 
-	m_players ->Iterate( true );
+	return m_players[slot];
+
+}
 
-	// Search for player data through iterated list
-	while( m_players ->Iterate() )
+// Copy a player's information, name and data into the given player
+// information, which must be empty. Any thread can call it. Returns false if
+// the player is not in the session
+bool Network::CopyPlayer( DPNID dpnid, PlayerInfo *copy )
+{
+	long epoch = EnterPlayers();
+
+	PlayerInfo *player = GetPlayer( dpnid );
+	if( player != NULL )
 	{
-		// Retrieve current player's stats
-		if( m_players ->GetCurrent() ->dpnid == dpnid )
+		copy ->dpnid = player ->dpnid;
+		copy ->slot = player ->slot;
+
+		if( player ->name != NULL )
+		{
+			copy ->name = new char[strlen( player ->name ) + 1];
+			strcpy( copy ->name, player ->name );
+		}
+
+		if( player ->data != NULL && player ->size > 0 )
 		{
-			LeaveCriticalSection( &m_playerCS );
-			return m_players ->GetCurrent();
+			copy ->data = new BYTE[player ->size];
+			memcpy( copy ->data, player ->data, player ->size );
+			copy ->size = player ->size;
 		}
 	}
 
-	LeaveCriticalSection( &m_playerCS );
+	LeavePlayers( epoch );
 
-	return NULL;
+	return player != NULL;
 
 }
 
@@ -363,201 +392,608 @@ bool Network::isHost()
 		return false;
 }
 
-// Send network message
-void Network::Send( void *data, long size, DPNID dpnid, long flags )
+// Send network message. Messages are batched by destination and delivery
+// class, and a batch goes to the transport when it fills up or is flushed.
+// Returns false if the message is empty or too large for the transport
+bool Network::Send( void *data, long size, DPNID dpnid, long flags )
 {
-	DPNHANDLE hAsync;
-	DPN_BUFFER_DESC dpbd;
-
 	// Check buffer size
-	if ( ( dpbd.dwBufferSize = size ) == 0 )
-		return;
+	if( size <= 0 )
+		return false;
 
-	// Buffer message data
-	dpbd.pBufferData = ( BYTE* ) data;
-	
-	// Send message
-	m_dpp ->SendTo( dpnid, &dpbd, 1, m_sendTimeOut, NULL, &hAsync, flags | DPNSEND_NOCOMPLETE | DPNSEND_COALESCE ); 
+	// Frame the message with its size
+	unsigned char frame[5];
+	unsigned long frameSize = 0;
+	unsigned long remaining = size;
+
+	do
+	{
+		frame[frameSize] = (unsigned char)( remaining & 0x7F );
+		remaining >>= 7;
+		if( remaining != 0 )
+			frame[frameSize] |= 0x80;
+
+		frameSize++;
+	}
+	while( remaining != 0 );
+
+	// Refuse the message now rather than have the transport lose it
+	if( frameSize + size > m_transport ->GetMaxMessageSize() )
+		return false;
+
+	EnterCriticalSection( &m_batchCS );
 
+	// Find the batch for the message's destination and delivery class
+	MessageBatch *batch = NULL;
+
+	m_batches ->Iterate( true );
+	while( m_batches ->Iterate() )
+	{
+		if( m_batches ->GetCurrent() ->dpnid == dpnid && m_batches ->GetCurrent() ->flags == flags )
+		{
+			batch = m_batches ->GetCurrent();
+			break;
+		}
+	}
+
+	if( batch == NULL )
+		batch = m_batches ->Add( new MessageBatch( dpnid, flags ) );
+
+	// A player gets messages sent to everyone and to it alone in separate
+	// batches, so whatever is waiting in the other is sent first to keep them
+	// in the order they were sent. Only one of the two then holds messages
+	m_batches ->Iterate( true );
+	while( m_batches ->Iterate() )
+	{
+		MessageBatch *other = m_batches ->GetCurrent();
+		if( other == batch || other ->size == 0 || other ->flags != flags )
+			continue;
+
+		if( other ->dpnid == DPNID_ALL_PLAYERS_GROUP || dpnid == DPNID_ALL_PLAYERS_GROUP )
+		{
+			m_transport ->Send( other ->dpnid, other ->data, other ->size, other ->flags );
+			other ->size = 0;
+		}
+	}
+
+	// Send what is batched already if the message does not fit with it
+	if( batch ->size > 0 && batch ->size + frameSize + size > NETWORK_MAX_BATCH_SIZE )
+	{
+		m_transport ->Send( batch ->dpnid, batch ->data, batch ->size, batch ->flags );
+		batch ->size = 0;
+	}
+
+	// Messages too large for a batch are sent on their own
+	if( frameSize + size > NETWORK_MAX_BATCH_SIZE )
+	{
+		char *message = new char[frameSize + size];
+		memcpy( message, frame, frameSize );
+		memcpy( message + frameSize, data, size );
+
+		m_transport ->Send( dpnid, message, frameSize + size, flags );
+
+		SAFE_DELETE_ARRAY( message );
+	}
+	else
+	{
+		memcpy( batch ->data + batch ->size, frame, frameSize );
+		memcpy( batch ->data + batch ->size + frameSize, data, size );
+		batch ->size += frameSize + size;
+	}
+
+	LeaveCriticalSection( &m_batchCS );
+
+	return true;
 }
 
-// Network message handler
-HRESULT WINAPI Network::NetworkMessageHandler( PVOID context, DWORD msgid, PVOID data )
+// Send every batch of messages to the transport
+void Network::Flush()
 {
-	// Get pointer to call next network object
-	Network *network = ( Network* ) context;
+	EnterCriticalSection( &m_batchCS );
 
-	// Process incoming message based on type
-	switch( msgid )
+	m_batches ->Iterate( true );
+	while( m_batches ->Iterate() )
 	{
-	case DPN_MSGID_CREATE_PLAYER:
-		{
-			unsigned long size = 0;
-			DPN_PLAYER_INFO *info = NULL;
-			HRESULT hr = DPNERR_CONNECTING;
-			PDPNMSG_CREATE_PLAYER msgCreatePlayer = ( PDPNMSG_CREATE_PLAYER ) data;
-
-			// Create player information for new player
-			PlayerInfo *playerInfo = new PlayerInfo;
-			ZeroMemory( playerInfo, sizeof( PlayerInfo ) );
-			playerInfo ->dpnid = msgCreatePlayer ->dpnidPlayer;
-
-			// Keep calling GetPeerInfo() to try to connect
-			while( hr == DPNERR_CONNECTING )
-				hr = network ->m_dpp ->GetPeerInfo( playerInfo ->dpnid, info, &size, 0 );
-
-			// Check if GetPeerInfo() has returned size of DPN_PLAYER_INFO structure
-			if( hr == DPNERR_BUFFERTOOSMALL )
-			{
-				info = ( DPN_PLAYER_INFO* ) new BYTE[size];
-				ZeroMemory( info, size );
-				info ->dwSize = sizeof ( DPN_PLAYER_INFO );
-
-				// Try again using the correct size
-				if( SUCCEEDED( network ->m_dpp ->GetPeerInfo( playerInfo ->dpnid, info, &size, 0 ) ) )
-				{
-					// Store name of new player 
-					playerInfo ->name = new char[wcslen( info ->pwszName ) + 1];
-					ZeroMemory( playerInfo ->name, wcslen( info ->pwszName) + 1 );
-					wcstombs( playerInfo ->name, info ->pwszName, wcslen( info ->pwszName ) );
-
-					// Store player data
-					playerInfo ->data = new BYTE[info ->dwDataSize];
-					memcpy( playerInfo ->data, info ->pvData, info  ->dwDataSize );
-					playerInfo ->size = info ->dwDataSize;
-
-					// Store client details
-					if( info ->dwPlayerFlags & DPNPLAYER_LOCAL )
-						network ->m_dpnidLocal = playerInfo ->dpnid;
-
-					// Store host details
-					if( info ->dwPlayerFlags & DPNPLAYER_HOST )
-						network ->m_dpnidHost = playerInfo ->dpnid;
-				}
-
-				SAFE_DELETE_ARRAY( info );
-			}
+		MessageBatch *batch = m_batches ->GetCurrent();
+		if( batch ->size == 0 )
+			continue;
 
-			// Add new player to list 
-			EnterCriticalSection( &network ->m_playerCS );
-			network ->m_players ->Add( playerInfo );
-			LeaveCriticalSection( &network ->m_playerCS );
+		m_transport ->Send( batch ->dpnid, batch ->data, batch ->size, batch ->flags );
+		batch ->size = 0;
+	}
 
-			// Check if message handler exists
-			if( network ->HandleNetworkMessage == NULL )
-				break;
+	LeaveCriticalSection( &m_batchCS );
 
-			// Create a create player message
-			ReceivedMessage *message = new ReceivedMessage;
-			message ->msgid = MSGID_CREATE_PLAYER;
-			message ->dpnid = playerInfo ->dpnid;
+}
 
-			// Store message to be processed later
-			EnterCriticalSection( &network ->m_messageCS );
-			network ->m_messages ->Add( message );
-			LeaveCriticalSection( &network ->m_messageCS );
+// Get game's GUID
+GUID Network::GetGUID()
+{
+	return m_guid;
 
-			break;
-		}
+}
 
-	case DPN_MSGID_DESTROY_PLAYER:
-		{
-			// Find player to destroy and remove from list
-			EnterCriticalSection( &network ->m_playerCS );
-			
-			network ->m_players ->Iterate( true );
+// Get network communication port
+unsigned long Network::GetPort()
+{
+	return m_port;
 
-			// Search through list for player to destroy
-			while( network ->m_players ->Iterate() )
-			{
-				// Check status of player
-				if( network ->m_players ->GetCurrent() ->dpnid  == ( ( PDPNMSG_DESTROY_PLAYER )  data )  ->dpnidPlayer )
-				{
-					network ->m_players ->Remove(  ( PlayerInfo** ) network ->m_players  ->GetCurrent() );
-					break;
-				}
-			}
+}
 
-			LeaveCriticalSection( &network ->m_playerCS );
+// Get timeout for sent messages
+unsigned long Network::GetSendTimeOut()
+{
+	return m_sendTimeOut;
 
-			// Check message handler exists
-			if( network ->HandleNetworkMessage == NULL )
-				break;
+}
 
-			// Create a destroy player message
-			ReceivedMessage *message = new ReceivedMessage;
-	
-			message->msgid = MSGID_DESTROY_PLAYER;
-			message ->dpnid = ( ( PDPNMSG_DESTROY_PLAYER ) data )  ->dpnidPlayer;
+// Returns the table of received message handlers
+MessageTable *Network::GetMessageTable()
+{
+	return m_messageTable;
 
-			// Store message so it can be processed later
-			EnterCriticalSection( &network ->m_messageCS );
-			network ->m_messages ->Add( message );
-			LeaveCriticalSection( &network ->m_messageCS );
+}
 
-			break;
-		}
+// Returns the pool that received messages are kept in
+ReceiveBufferPool *Network::GetReceiveBuffers()
+{
+	return m_receiveBuffers;
 
-	case DPN_MSGID_ENUM_HOSTS_RESPONSE:
-		{
-			PDPNMSG_ENUM_HOSTS_RESPONSE response = ( PDPNMSG_ENUM_HOSTS_RESPONSE ) data;
+}
+
+// Add a session found by the transport to the list
+void Network::AddSession( SessionInfo *session )
+{
+	EnterCriticalSection( &m_sessionCS );
+	m_sessions ->Add( session );
+	LeaveCriticalSection( &m_sessionCS );
 
-			// Create new session information
-			SessionInfo *sessionInfo = new SessionInfo;
-			response ->pAddressSender ->Duplicate( &sessionInfo ->address );
-			memcpy( &sessionInfo ->description, response ->pApplicationDescription, sizeof( DPN_APPLICATION_DESC ) );
+}
 
-			// Add new session to the list
-			EnterCriticalSection( &network ->m_sessionCS );
-			network ->m_sessions ->Add( sessionInfo );
-			LeaveCriticalSection( &network ->m_sessionCS );
+// Add a player that has joined the session. Returns false if the player is
+// already in it or every player slot is taken
+bool Network::CreatePlayer( DPNID dpnid, char *name, void *data, unsigned long size, bool local, bool host )
+{
+	// Create player information for new player
+	PlayerInfo *playerInfo = new PlayerInfo;
+	playerInfo ->dpnid = dpnid;
 
+	// Store name of new player
+	if( name != NULL )
+	{
+		playerInfo ->name = new char[strlen( name ) + 1];
+		strcpy( playerInfo ->name, name );
+	}
+
+	// Store player data
+	if( data != NULL && size > 0 )
+	{
+		playerInfo ->data = new BYTE[size];
+		memcpy( playerInfo ->data, data, size );
+		playerInfo ->size = size;
+	}
+
+	// Add new player to a free slot and its ID to the hash
+	EnterCriticalSection( &m_playerCS );
+
+	long vacant = -1;
+	for( long s = 0; s < NETWORK_MAX_PLAYERS && vacant < 0; s++ )
+	{
+		if( m_players[s] == NULL )
+			vacant = s;
+	}
+
+	// Follow the whole probe sequence, so a player already in the session is
+	// found, and reuse the first entry of a player that has left, or else the
+	// empty entry ending the sequence
+	unsigned long hash = GetPlayerHash( dpnid );
+	long entry = -1;
+	bool duplicate = false;
+	for( unsigned long p = 0; p < NETWORK_PLAYER_HASH_SIZE; p++ )
+	{
+		unsigned long index = ( hash + p ) & ( NETWORK_PLAYER_HASH_SIZE - 1 );
+		long current = m_playerHash[index];
+
+		if( current > 0 && m_players[current - 1] ->dpnid == dpnid )
+		{
+			duplicate = true;
 			break;
 		}
 
-	case DPN_MSGID_RECEIVE:
-		{
-			// Check if message handler exists
-			if( network ->HandleNetworkMessage == NULL )
-				break;
+		if( current <= 0 && entry < 0 )
+			entry = index;
 
-			// Check if network is allowed to receive messages
-			if( network ->m_receiveAllowed == false )
-				break;
+		if( current == 0 )
+			break;
+	}
 
-			// Create receive message
-			ReceivedMessage *message = new ReceivedMessage;
-			memcpy( message, ( ( PDPNMSG_RECEIVE ) data ) ->pReceiveData, ( ( PDPNMSG_RECEIVE ) data ) ->dwReceiveDataSize );
+	// Player is already in the session, or the session holds as many players as it can
+	if( duplicate == true || vacant < 0 || entry < 0 )
+	{
+		LeaveCriticalSection( &m_playerCS );
+		SAFE_DELETE( playerInfo );
+		return false;
+	}
+
+	if( m_playerHash[entry] < 0 )
+		m_playerTombstones--;
+
+	// Fill the slot before the hash leads readers to it
+	playerInfo ->slot = vacant;
+	InterlockedExchangePointer( (void* volatile*)&m_players[vacant], playerInfo );
+	InterlockedExchange( &m_playerHash[entry], vacant + 1 );
+
+	LeaveCriticalSection( &m_playerCS );
+
+	// Store client details
+	if( local == true )
+		m_dpnidLocal = dpnid;
+
+	// Store host details
+	if( host == true )
+		m_dpnidHost = dpnid;
+
+	// Check if message handler exists
+	if( HandleNetworkMessage == NULL )
+		return true;
+
+	// Create a create player message and store it to be processed later
+	MessageSlot *slot = m_messages ->Reserve();
+	if( slot == NULL )
+		return true;
+
+	slot ->message.msgid = MSGID_CREATE_PLAYER;
+	slot ->message.dpnid = dpnid;
+	m_messages ->Commit( slot );
+
+	return true;
+}
 
-			// Store message to be process later
-			EnterCriticalSection( &network ->m_messageCS );
-			network ->m_messages ->Add( message );
-			LeaveCriticalSection( &network ->m_messageCS );
+// Remove a player that has left the session. Its hash entry is marked as left
+// and the player retired, to be deleted once no reader can still be using it
+void Network::DestroyPlayer( DPNID dpnid )
+{
+	// Find player to destroy and remove it from its slot
+	EnterCriticalSection( &m_playerCS );
 
+	unsigned long hash = GetPlayerHash( dpnid );
+	for( unsigned long p = 0; p < NETWORK_PLAYER_HASH_SIZE; p++ )
+	{
+		unsigned long index = ( hash + p ) & ( NETWORK_PLAYER_HASH_SIZE - 1 );
+		long entry = m_playerHash[index];
+		if( entry == 0 )
+			break;
+
+		// Mark the entry as left, so probes for other players carry on past it
+		if( entry > 0 && m_players[entry - 1] ->dpnid == dpnid )
+		{
+			InterlockedExchange( &m_playerHash[index], -1 );
+			m_playerTombstones++;
+			RetirePlayer( m_players[entry - 1] );
 			break;
 		}
+	}
+
+	LeaveCriticalSection( &m_playerCS );
+
+	// Check message handler exists
+	if( HandleNetworkMessage == NULL )
+		return;
+
+	// Create a destroy player message and store it so it can be processed later
+	MessageSlot *slot = m_messages ->Reserve();
+	if( slot == NULL )
+		return;
+
+	slot ->message.msgid = MSGID_DESTROY_PLAYER;
+	slot ->message.dpnid = dpnid;
+	m_messages ->Commit( slot );
+
+}
+
+// Queue the batch of messages received from another player, copying it into
+// a receive buffer. The transport names the sender from the connection, never
+// from the message. Returns false if the queue has no room for the batch, so
+// a reliable transport can leave it unacknowledged to be sent again
+bool Network::ReceiveMessage( DPNID sender, void *data, unsigned long size )
+{
+	// Check if message handler exists
+	if( HandleNetworkMessage == NULL )
+		return true;
+
+	// Check if network is allowed to receive messages
+	if( m_receiveAllowed == false )
+		return true;
+
+	char *buffer = m_receiveBuffers ->Allocate( size );
+	memcpy( buffer, data, size );
+
+	return ReceiveMessage( sender, buffer, buffer, size );
+
+}
+
+// Queue the batch of messages received from another player that is already in
+// a buffer from the receive buffer pool. The data must lie within the buffer,
+// which the network now owns and releases once the messages have been handled.
+// Returns false, having queued none of the batch, if the queue has no room
+// for all of it. Batches the network is not receiving are dropped as handled
+bool Network::ReceiveMessage( DPNID sender, char *buffer, void *data, unsigned long size )
+{
+	// Check if message handler exists and the network is allowed to receive messages
+	if( HandleNetworkMessage == NULL || m_receiveAllowed == false )
+	{
+		ReceiveBufferPool::Release( buffer );
+		return true;
+	}
+
+	// Count the messages in the batch first, up to any bad frame. Every
+	// message starts with the message ID and player ID, so anything shorter
+	// cannot be dispatched and is left out
+	unsigned char *frame = ( unsigned char* ) data;
+	unsigned long remaining = size;
+	unsigned long length = 0;
+	long count = 0;
+
+	while( ReadFrame( &frame, &remaining, &length ) == true )
+		if( length >= 8 )
+			count++;
+
+	// Reserve a slot for every message before queueing any, so other threads
+	// receiving at the same time cannot take them
+	long position = 0;
+	if( m_messages ->Reserve( count, &position ) == false )
+	{
+		ReceiveBufferPool::Release( buffer );
+		return false;
+	}
+
+	// Split the batch into its messages, which each hold the buffer
+	frame = ( unsigned char* ) data;
+	remaining = size;
+
+	while( ReadFrame( &frame, &remaining, &length ) == true )
+	{
+		if( length < 8 )
+			continue;
+
+		ReceiveBufferPool::AddReference( buffer );
+		QueueMessage( m_messages ->GetSlot( position++ ), sender, buffer, frame - length, length );
+	}
+
+	ReceiveBufferPool::Release( buffer );
+
+	return true;
+
+}
+
+// Read the size of the next message in a batch and step over the message.
+// Returns false at the end of the batch or at a bad frame, which ends it
+bool Network::ReadFrame( unsigned char **frame, unsigned long *remaining, unsigned long *length )
+{
+	unsigned long shift = 0;
+	bool more = true;
+
+	*length = 0;
+
+	while( more == true && *remaining > 0 && shift < 35 )
+	{
+		*length |= (unsigned long)( **frame & 0x7F ) << shift;
+		more = ( **frame & 0x80 ) != 0;
+		shift += 7;
+		( *frame )++;
+		( *remaining )--;
+	}
+
+	if( more == true || *length > *remaining )
+		return false;
+
+	*frame += *length;
+	*remaining -= *length;
+
+	return true;
+
+}
+
+// Queue a single received message held in the given receive buffer, which is
+// released once the message has been handled, in a slot already reserved
+void Network::QueueMessage( MessageSlot *slot, DPNID sender, char *buffer, void *data, unsigned long size )
+{
+	// The header is read out so the message can be dispatched on it, while
+	// the rest of the message is read in place. It is always the 32 bit
+	// message ID and player ID, whatever the sender's word size or byte order
+	BitStream header( data, size );
+	slot ->message.msgid = header.ReadBits( 32 );
+	slot ->message.dpnid = header.ReadBits( 32 );
+
+	slot ->message.data = ( char* ) data;
+	slot ->message.size = size;
+	slot ->message.buffer = buffer;
+	slot ->message.sender = sender;
+	m_messages ->Commit( slot );
+
+}
 
-	case DPN_MSGID_TERMINATE_SESSION:
+// Queue the end of the session
+void Network::TerminateSession()
+{
+	// Check if message handler exists
+	if( HandleNetworkMessage == NULL )
+		return;
+
+	// Create terminate session message and store it to be processed later
+	MessageSlot *slot = m_messages ->Reserve();
+	if( slot == NULL )
+		return;
+
+	slot ->message.msgid = MSGID_TERMINATE_SESSION;
+	m_messages ->Commit( slot );
+
+}
+
+// Discard the messages batched for a player that has left, which has nowhere to receive them
+void Network::DropBatches( DPNID dpnid )
+{
+	EnterCriticalSection( &m_batchCS );
+
+	MessageBatch *batch = m_batches ->GetFirst();
+	while( batch != NULL )
+	{
+		MessageBatch *next = m_batches ->GetNext( batch );
+		if( batch ->dpnid == dpnid )
+			m_batches ->Remove( &batch );
+
+		batch = next;
+	}
+
+	LeaveCriticalSection( &m_batchCS );
+
+}
+
+// Discard the messages batched but not yet sent
+void Network::ClearBatches()
+{
+	EnterCriticalSection( &m_batchCS );
+	m_batches ->Empty();
+	LeaveCriticalSection( &m_batchCS );
+
+}
+
+// Remove every player from the session
+void Network::ClearPlayers()
+{
+	EnterCriticalSection( &m_playerCS );
+
+	for( unsigned long h = 0; h < NETWORK_PLAYER_HASH_SIZE; h++ )
+		InterlockedExchange( &m_playerHash[h], 0 );
+	m_playerTombstones = 0;
+
+	for( unsigned long s = 0; s < NETWORK_MAX_PLAYERS; s++ )
+	{
+		if( m_players[s] != NULL )
+			RetirePlayer( m_players[s] );
+	}
+
+	LeaveCriticalSection( &m_playerCS );
+
+}
+
+// Free a player's slot and keep the player until no thread can still be
+// using it. Must be called inside the player critical section
+void Network::RetirePlayer( PlayerInfo *player )
+{
+	InterlockedExchangePointer( (void* volatile*)&m_players[player ->slot], NULL );
+
+	player ->retired = m_playerEpoch;
+	m_retiredPlayers ->Add( player );
+
+}
+
+// Delete the retired players no reader can still be using, or all of them.
+// Readers that entered an epoch before the current one may still hold
+// players retired before it, while readers of the current epoch entered
+// after those players left the hash. So once the previous epoch has no
+// readers left, everything retired before the current epoch is deleted and
+// the epoch moves on, freeing the previous epoch's count for the next one
+void Network::DeleteRetiredPlayers( bool all )
+{
+	EnterCriticalSection( &m_playerCS );
+
+	long epoch = m_playerEpoch;
+	if( all == false && m_playerReaders[( epoch - 1 ) & 1] != 0 )
+	{
+		LeaveCriticalSection( &m_playerCS );
+		return;
+	}
+
+	// Players are retired in order, so the oldest are always first
+	PlayerInfo *player = m_retiredPlayers ->GetFirst();
+	while( player != NULL && ( all == true || player ->retired < epoch ) )
+	{
+		m_retiredPlayers ->Remove( &player );
+		player = m_retiredPlayers ->GetFirst();
+	}
+
+	// The spare hash was last current before this epoch too, so it is free to rebuild
+	if( m_spareRetired < epoch && m_playerTombstones > NETWORK_PLAYER_HASH_SIZE / 4 )
+		CompactPlayerHash();
+
+	InterlockedExchange( &m_playerEpoch, epoch + 1 );
+
+	LeaveCriticalSection( &m_playerCS );
+
+}
+
+// Rebuild the hash in the spare without the entries of players that have
+// left, once enough build up, and make it current. The hash is read without
+// the player lock, so readers still probing the old one find what it held,
+// and it only becomes the spare once its readers have left the way retired
+// players are deleted. Must be called inside the player critical section
+void Network::CompactPlayerHash()
+{
+	volatile long *table = m_playerHash == m_playerHashes[0] ? m_playerHashes[1] : m_playerHashes[0];
+	ZeroMemory( (void*)table, sizeof( long ) * NETWORK_PLAYER_HASH_SIZE );
+
+	for( unsigned long s = 0; s < NETWORK_MAX_PLAYERS; s++ )
+	{
+		if( m_players[s] == NULL )
+			continue;
+
+		unsigned long hash = GetPlayerHash( m_players[s] ->dpnid );
+		for( unsigned long p = 0; p < NETWORK_PLAYER_HASH_SIZE; p++ )
 		{
-			// Check if message handler exists
-			if( network ->HandleNetworkMessage == NULL )
+			unsigned long index = ( hash + p ) & ( NETWORK_PLAYER_HASH_SIZE - 1 );
+			if( table[index] == 0 )
+			{
+				table[index] = s + 1;
 				break;
+			}
+		}
+	}
 
-			// Create terminate session message
-			ReceivedMessage *message = new ReceivedMessage;
-			message ->msgid = MSGID_TERMINATE_SESSION;
+	InterlockedExchangePointer( (void* volatile*)&m_playerHash, (void*)table );
+	m_playerTombstones = 0;
+	m_spareRetired = m_playerEpoch;
 
-			// Store message to be processed later
-			EnterCriticalSection( &network ->m_messageCS );
-			network ->m_messages ->Add( message );
-			LeaveCriticalSection( &network ->m_messageCS );
+}
 
-			break;
-		}
+// Count the calling thread in as a reader of the players, returning the
+// epoch it was counted in. The epoch is checked again once counted, so a
+// reader is never counted in an epoch that has already moved on
+long Network::EnterPlayers()
+{
+	while( true )
+	{
+		long epoch = m_playerEpoch;
+		InterlockedIncrement( &m_playerReaders[epoch & 1] );
+
+		if( m_playerEpoch == epoch )
+			return epoch;
+
+		InterlockedDecrement( &m_playerReaders[epoch & 1] );
 	}
 
-	return S_OK;
+}
+
+// Count a reader of the players out of the epoch it entered
+void Network::LeavePlayers( long epoch )
+{
+	InterlockedDecrement( &m_playerReaders[epoch & 1] );
 
 }
 
+// Returns where a player's probe sequence starts in the hash
+unsigned long Network::GetPlayerHash( DPNID dpnid )
+{
+	return ( (unsigned long)dpnid * 2654435761UL ) & ( NETWORK_PLAYER_HASH_SIZE - 1 );
+}
 
+// Remove all queued messages without handling them. Must be called from the thread that calls Update
+void Network::ClearMessages()
+{
+	while( m_messages ->Front() != NULL )
+	{
+		ReceiveBufferPool::Release( m_messages ->Front() ->buffer );
+		m_messages ->Remove();
+	}
+
+}
@@ -3,7 +3,7 @@
 // File: Network.h
 // Programmer: T.J. Eason
 // Project: Game Engine
-// Description: DirectPlay wrapper class to handle system network messages
+// Description: Network class to handle system network messages over DirectPlay, UDP or loopback transports
 // Date: 3-3-10
 // Revision 1: 3-9-10
 // Revision 2: 3-11-10
@@ -20,6 +20,32 @@
 #define MSGID_DESTROY_PLAYER 0x12002
 #define MSGID_TERMINATE_SESSION 0x12003
 
+// Transports the network can run on
+#define NETWORK_TRANSPORT_DIRECTPLAY 0
+#define NETWORK_TRANSPORT_UDP 1
+#define NETWORK_TRANSPORT_LOOPBACK 2
+
+// Delivery classes given to Send. They are DirectPlay's own flags, so they
+// mean the same on every transport. Unreliable sequenced messages are dropped
+// when a newer one has already arrived from the same player, whatever the
+// message IDs of the two, as DirectPlay does. So each such message should
+// carry the whole state it describes rather than build on the one before.
+#define NETWORK_UNRELIABLE_SEQUENCED 0
+#define NETWORK_RELIABLE_UNORDERED ( DPNSEND_GUARANTEED | DPNSEND_NONSEQUENTIAL )
+#define NETWORK_RELIABLE_ORDERED DPNSEND_GUARANTEED
+
+// Most players a session can hold, each kept in its own slot. Must be a power of two.
+#define NETWORK_MAX_PLAYERS 256
+
+// Number of entries in the hash from player IDs to slots. Must be a power of two.
+#define NETWORK_PLAYER_HASH_SIZE 512
+
+// Largest batch of messages sent at once, so a batch fits in a single UDP packet.
+#define NETWORK_MAX_BATCH_SIZE 1152
+
+class NetworkTransport;
+class MessageTable;
+
 // Network message structure
 struct NetworkMessage
 {
@@ -28,18 +54,202 @@ struct NetworkMessage
 
 };
 
-// Receive message structure
+// Receive message structure. Messages from other players keep their contents
+// in a pooled receive buffer of whatever size arrived, which the handler reads
+// in place through data. The buffer goes back to the pool once the handler
+// returns, so the handler must copy anything it wants to keep. The dpnid in
+// the header is whatever the sender wrote, while sender is the player the
+// transport received the message from, which the sender cannot forge.
 struct ReceivedMessage : public NetworkMessage
 {
-	char data[32];		// Message data
+	char *data;					// Message as it was sent, starting with its NetworkMessage header
+	unsigned long size;		// Size of the message data in bytes
+	char *buffer;				// Receive buffer holding the data, NULL for system messages
+	DPNID sender;				// Player the message was received from, zero for system messages
+
+};
+
+// Message batch structure, the messages sent to one destination in one
+// delivery class since the last flush. Each message is framed by its size,
+// written seven bits to a byte with the top bit set on all but the last.
+struct MessageBatch
+{
+	DPNID dpnid;										// Player or group the messages are sent to
+	long flags;											// Send flags of the messages
+	char data[NETWORK_MAX_BATCH_SIZE];		// Framed messages
+	unsigned long size;								// Number of bytes of framed messages
+
+	// Message batch constructor
+	MessageBatch( DPNID destination, long sendFlags )
+	{
+		dpnid = destination;
+		flags = sendFlags;
+		size = 0;
+	}
+
+};
+
+// Number of received messages that can wait to be handled. Must be a power of two.
+#define NETWORK_MESSAGE_QUEUE_SIZE 1024
+
+// Message slot structure
+struct MessageSlot
+{
+	ReceivedMessage message;		// Message held in the slot
+	volatile long sequence;			// Position the slot can next be reserved or removed at
+
+};
+
+// Message queue structure, a bounded ring of preallocated messages. Any number
+// of transport threads reserve and commit slots at once without locking,
+// while a single thread removes them in order. A slot's sequence equals the
+// queue position it is free for, is one past it once committed, and moves on
+// a whole lap of the ring when removed.
+struct MessageQueue
+{
+	MessageSlot slots[NETWORK_MESSAGE_QUEUE_SIZE];		// Ring of messages
+	volatile long tail;														// Next position to reserve
+	volatile long head;														// Next position to remove
+
+	// Message queue constructor
+	MessageQueue()
+	{
+		for( long s = 0; s < NETWORK_MESSAGE_QUEUE_SIZE; s++ )
+			slots[s].sequence = s;
+
+		tail = head = 0;
+	}
+
+	// Any thread reserves a slot to fill, returns NULL if the queue is full
+	MessageSlot *Reserve()
+	{
+		long position = tail;
+
+		while( true )
+		{
+			MessageSlot *slot = &slots[position & ( NETWORK_MESSAGE_QUEUE_SIZE - 1 )];
+			long difference = slot ->sequence - position;
+
+			// The slot is free, so try to claim its position
+			if( difference == 0 )
+			{
+				long claimed = InterlockedCompareExchange( &tail, position + 1, position );
+				if( claimed == position )
+				{
+					ZeroMemory( &slot ->message, sizeof( ReceivedMessage ) );
+					return slot;
+				}
+
+				position = claimed;
+			}
+
+			// The slot still holds a message from the last lap
+			else if( difference < 0 )
+				return NULL;
+
+			// Another thread claimed the position first
+			else
+				position = tail;
+		}
+	}
+
+	// Any thread reserves a run of slots to fill at once, returns false if the
+	// queue has no room for all of them. Slots are freed in order, so the run
+	// is free once its last slot is. Each slot is then taken with GetSlot
+	bool Reserve( long count, long *first )
+	{
+		if( count > NETWORK_MESSAGE_QUEUE_SIZE )
+			return false;
+
+		long position = tail;
+
+		while( count > 0 )
+		{
+			MessageSlot *last = &slots[( position + count - 1 ) & ( NETWORK_MESSAGE_QUEUE_SIZE - 1 )];
+			long difference = last ->sequence - ( position + count - 1 );
+
+			// The run is free, so try to claim its positions
+			if( difference == 0 )
+			{
+				long claimed = InterlockedCompareExchange( &tail, position + count, position );
+				if( claimed == position )
+					break;
+
+				position = claimed;
+			}
+
+			// The last slot still holds a message from the last lap
+			else if( difference < 0 )
+				return false;
+
+			// Another thread claimed some of the positions first
+			else
+				position = tail;
+		}
+
+		*first = position;
+
+		return true;
+	}
+
+	// Returns a slot of a run reserved at once, emptied to be filled
+	MessageSlot *GetSlot( long position )
+	{
+		MessageSlot *slot = &slots[position & ( NETWORK_MESSAGE_QUEUE_SIZE - 1 )];
+		ZeroMemory( &slot ->message, sizeof( ReceivedMessage ) );
+
+		return slot;
+	}
+
+	// The reserving thread hands a filled slot to the consumer
+	void Commit( MessageSlot *slot )
+	{
+		InterlockedExchange( &slot ->sequence, slot ->sequence + 1 );
+	}
+
+	// Consumer looks at the oldest message, returns NULL if it has not been committed yet
+	ReceivedMessage *Front()
+	{
+		MessageSlot *slot = &slots[head & ( NETWORK_MESSAGE_QUEUE_SIZE - 1 )];
+		if( slot ->sequence - ( head + 1 ) != 0 )
+			return NULL;
+
+		return &slot ->message;
+	}
+
+	// Consumer frees the oldest message's slot for the next lap
+	void Remove()
+	{
+		MessageSlot *slot = &slots[head & ( NETWORK_MESSAGE_QUEUE_SIZE - 1 )];
+		InterlockedExchange( &slot ->sequence, head + NETWORK_MESSAGE_QUEUE_SIZE );
+		head++;
+	}
 
 };
 
-// Session information structure
+// Session information structure. Each transport derives its own session
+// structure holding whatever it needs to join the session.
 struct SessionInfo
 {
-	IDirectPlay8Address *address;						// Session network address
-	DPN_APPLICATION_DESC description;		// Application description
+	char *name;								// Session name
+	unsigned long totalPlayers;		// Number of players in the session when it was found
+	unsigned long maxPlayers;			// Most players the session allows, or zero for no limit
+
+	// Session info constructor
+	SessionInfo()
+	{
+		name = NULL;
+		totalPlayers = 0;
+		maxPlayers = 0;
+
+	}
+
+	// Session info destructor
+	virtual ~SessionInfo()
+	{
+		SAFE_DELETE_ARRAY( name );
+
+	}
 
 };
 
@@ -50,6 +260,8 @@ struct PlayerInfo
 	char *name;					// Player's name
 	void *data;						// Player's data
 	unsigned long size;		// Data size
+	unsigned long slot;		// Slot the player is kept in for as long as it is in the session
+	long retired;				// Player epoch the player was destroyed in
 
 	// Player info constructor 
 	PlayerInfo()
@@ -58,6 +270,8 @@ struct PlayerInfo
 		name = NULL;
 		data = NULL;
 		size = 0;
+		slot = 0;
+		retired = 0;
 
 	}
 
@@ -71,11 +285,13 @@ struct PlayerInfo
 
 };
 
-// Network class
+// Network class. Keeps the sessions, players and messages, while the transport
+// moves them between machines and reports what it receives from any of its
+// threads. Sent messages are batched by destination until the next flush.
 class Network
 {
 public:
-	Network( GUID guid, void ( *HandleNetworkMessageFunction ) ( ReceivedMessage *msg ) );
+	Network( GUID guid, void ( *HandleNetworkMessageFunction ) ( ReceivedMessage *msg ), unsigned long transport = NETWORK_TRANSPORT_DIRECTPLAY );
 	virtual ~Network();
 
 	void Update();
@@ -92,21 +308,49 @@ public:
 	SessionInfo *GetNextSession( bool restart = false );
 
 	PlayerInfo *GetPlayer( DPNID dpnid );
+	PlayerInfo *GetPlayerBySlot( unsigned long slot );
+	bool CopyPlayer( DPNID dpnid, PlayerInfo *copy );
 
 	DPNID GetLocalID();
 	DPNID GetHostID();
 
 	bool isHost();
 
-	void Send( void *data, long size, DPNID dpnid = DPNID_ALL_PLAYERS_GROUP, long flags = 0 );
+	bool Send( void *data, long size, DPNID dpnid = DPNID_ALL_PLAYERS_GROUP, long flags = 0 );
+	template< class Type > bool SendEncoded( Type *message, DPNID dpnid = DPNID_ALL_PLAYERS_GROUP, long flags = 0 );
+	void Flush();
+
+	MessageTable *GetMessageTable();
+
+	GUID GetGUID();
+	unsigned long GetPort();
+	unsigned long GetSendTimeOut();
+	ReceiveBufferPool *GetReceiveBuffers();
+
+	void AddSession( SessionInfo *session );
+	bool CreatePlayer( DPNID dpnid, char *name, void *data, unsigned long size, bool local, bool host );
+	void DestroyPlayer( DPNID dpnid );
+	bool ReceiveMessage( DPNID sender, void *data, unsigned long size );
+	bool ReceiveMessage( DPNID sender, char *buffer, void *data, unsigned long size );
+	void TerminateSession();
 
 private:
-	static HRESULT WINAPI NetworkMessageHandler( PVOID context, DWORD msgid, PVOID data );
+	void ClearMessages();
+	void DropBatches( DPNID dpnid );
+	void ClearBatches();
+	void ClearPlayers();
+	void RetirePlayer( PlayerInfo *player );
+	void DeleteRetiredPlayers( bool all );
+	void CompactPlayerHash();
+	long EnterPlayers();
+	void LeavePlayers( long epoch );
+	unsigned long GetPlayerHash( DPNID dpnid );
+	static bool ReadFrame( unsigned char **frame, unsigned long *remaining, unsigned long *length );
+	void QueueMessage( MessageSlot *slot, DPNID sender, char *buffer, void *data, unsigned long size );
 
 private:
 	GUID m_guid;																						// Game specific GUID
-	IDirectPlay8Peer *m_dpp;																	// DirectPlay peer interface
-	IDirectPlay8Address *m_device;														// DirectPlay device address
+	NetworkTransport *m_transport;															// Transport carrying the session
 
 	unsigned long m_port;																			// Network communication port
 	unsigned long m_sendTimeOut;															// Timeout messaging
@@ -119,15 +363,26 @@ private:
 	
 	LinkedList< SessionInfo > *m_sessions;											// Linked list of enumerated sessions
 
-	CRITICAL_SECTION m_playerCS;													// Player list for critical session
+	CRITICAL_SECTION m_playerCS;													// Guards changes to the players
 
-	LinkedList< PlayerInfo > *m_players;													// Linked list of players
+	PlayerInfo * volatile m_players[NETWORK_MAX_PLAYERS];							// Players by slot
+	volatile long m_playerHashes[2][NETWORK_PLAYER_HASH_SIZE];				// Current hash and the spare it is rebuilt into
+	volatile long * volatile m_playerHash;													// Slot plus one of the player each entry is for, zero if empty or -1 if removed
+	unsigned long m_playerTombstones;													// Number of entries in the current hash marked removed
+	long m_spareRetired;																			// Player epoch the spare hash was last current in
+	LinkedList< PlayerInfo > *m_retiredPlayers;										// Destroyed players waiting to be deleted, oldest first
+	volatile long m_playerEpoch;																// Current player epoch
+	volatile long m_playerReaders[2];															// Number of readers in the current and previous player epochs
 
 	bool m_receiveAllowed;																		// Checks if network is available to receive messages
 
-	CRITICAL_SECTION m_messageCS;												// Network messages through critical session
+	CRITICAL_SECTION m_batchCS;														// Batch list critical section
+
+	LinkedList< MessageBatch > *m_batches;										// Batches of sent messages waiting to be flushed
 
-	LinkedList< ReceivedMessage > *m_messages;								// Linked list of network messages
+	MessageQueue *m_messages;														// Network messages waiting to be handled
+	MessageTable *m_messageTable;													// Handlers of received messages by message ID
+	ReceiveBufferPool *m_receiveBuffers;												// Buffers the received messages are kept in
 
 	void ( *HandleNetworkMessage ) (ReceivedMessage *msg );		// Pointer to network message handler
 
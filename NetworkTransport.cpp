@@ -0,0 +1,550 @@
+// ***********************************************************************
+//
+// File: NetworkTransport.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Transports that carry the network's sessions, players and messages
+// Reference: DirectX Manual & GameDev.net
+// Date: 10-19-26
+//
+// ***********************************************************************
+
+#include "Engine.h"
+
+// Loopback registry structure, every loopback transport in the process and the
+// lock that guards them. It is created before any transport can be.
+static struct LoopbackRegistry
+{
+	CRITICAL_SECTION lock;					// Guards every loopback transport and session
+	LoopbackTransport *first;				// First loopback transport in the process
+	DPNID nextID;								// ID given to the next player to host or join
+
+	// Loopback registry constructor
+	LoopbackRegistry()
+	{
+		InitializeCriticalSection( &lock );
+		first = NULL;
+		nextID = 1;
+
+	}
+
+	// Loopback registry destructor
+	~LoopbackRegistry()
+	{
+		DeleteCriticalSection( &lock );
+
+	}
+
+} g_loopback;
+
+// Network transport class constructor
+NetworkTransport::NetworkTransport( Network *network )
+{
+	m_network = network;
+
+}
+
+// Network transport class destructor
+NetworkTransport::~NetworkTransport()
+{
+
+}
+
+// Returns the largest message Send can carry. Unless a transport says
+// otherwise, messages of any size are carried whole
+unsigned long NetworkTransport::GetMaxMessageSize()
+{
+	return 0xFFFFFFFF;
+
+}
+
+// DirectPlay transport class constructor
+DirectPlayTransport::DirectPlayTransport( Network *network ) : NetworkTransport( network )
+{
+	// Invalidate DirectPlay peer interface and devce
+	m_dpp = NULL;
+	m_device = NULL;
+
+	// Create DirectPlay peer interface
+	CoCreateInstance( CLSID_DirectPlay8Peer, NULL, CLSCTX_INPROC, IID_IDirectPlay8Peer, ( void** ) &m_dpp );
+
+	// Initialize peer interface
+	m_dpp ->Initialize( ( PVOID ) this,  NetworkMessageHandler, DPNINITIALIZE_HINT_LANSESSION );
+
+	// Create device address
+	CoCreateInstance( CLSID_DirectPlay8Address, NULL, CLSCTX_INPROC, IID_IDirectPlay8Address, ( LPVOID* ) &m_device );
+
+	// Set up the device address
+	DWORD port = m_network ->GetPort();
+	m_device ->SetSP( &CLSID_DP8SP_TCPIP );
+	m_device ->AddComponent( DPNA_KEY_PORT, &port, sizeof( DWORD ), DPNA_DATATYPE_DWORD );
+
+}
+
+// DirectPlay transport class destructor
+DirectPlayTransport::~DirectPlayTransport()
+{
+	// Release device address
+	if( m_device )
+	{
+		m_device ->Release();
+		m_device = NULL;
+	}
+
+	// Close DirectPlay peer interface
+	if( m_dpp != NULL )
+		m_dpp ->Close( DPNCLOSE_IMMEDIATE );
+
+	// Relase DirectPlay peer interface
+	if( m_dpp )
+	{
+		m_dpp ->Release();
+		m_dpp = NULL;
+	}
+
+}
+
+// Enumerate local network sessions
+void DirectPlayTransport::EnumerateSessions()
+{
+	// Prepare application description
+	DPN_APPLICATION_DESC description;
+	ZeroMemory( &description, sizeof( DPN_APPLICATION_DESC ) );
+	description.dwSize = sizeof( DPN_APPLICATION_DESC );
+	description.guidApplication = m_network ->GetGUID();
+
+	// Synchronize enummerated sessions
+	m_dpp ->EnumHosts( &description, NULL, m_device, NULL, 0, 1, 0, 0, NULL, NULL, DPNENUMHOSTS_SYNC );
+
+}
+
+// Host a session
+bool DirectPlayTransport::Host( char *name, char *session, int players, void *playerData, unsigned long dataSize )
+{
+	WCHAR wide[MAX_PATH];
+
+	// Setup player information
+	if( SetPeerInfo( name, playerData, dataSize ) == false )
+		return false;
+
+	// Prepare application description
+	DPN_APPLICATION_DESC description;
+	ZeroMemory( &description, sizeof( DPN_APPLICATION_DESC ) );
+	description.dwSize = sizeof( DPN_APPLICATION_DESC );
+	description.guidApplication = m_network ->GetGUID();
+	description.dwMaxPlayers = players;
+	mbstowcs( wide, session, MAX_PATH );
+	description.pwszSessionName = wide;
+
+	// Host session
+	if( FAILED( m_dpp ->Host( &description, &m_device, 1, NULL, NULL, NULL, 0 ) ) )
+		return false;
+
+	return true;
+}
+
+// Join an enumerated session
+bool DirectPlayTransport::Join( char *name, SessionInfo *session, void *playerData, unsigned long dataSize )
+{
+	// Setup player information
+	if( SetPeerInfo( name, playerData, dataSize ) == false )
+		return false;
+
+	DirectPlaySession *host = ( DirectPlaySession* ) session;
+
+	// Join session
+	if( FAILED( m_dpp ->Connect( &host ->description, host ->address, m_device, NULL, NULL, NULL, 0, NULL, NULL, NULL, DPNCONNECT_SYNC ) ) )
+		return false;
+
+	return true;
+
+}
+
+// Terminate current session
+void DirectPlayTransport::Terminate()
+{
+	// Host only has permission to terminate session
+	if( m_network ->isHost() == true )
+		m_dpp -> TerminateSession( NULL, 0, 0 );
+
+	// Close connection and uninitialize DirectPlay peer interface
+	if( m_dpp != NULL )
+		m_dpp ->Close( DPNCLOSE_IMMEDIATE );
+
+	// Initialize DirectPlay peer interface
+	m_dpp ->Initialize( ( PVOID ) this, NetworkMessageHandler, DPNINITIALIZE_HINT_LANSESSION );
+
+}
+
+// Send network message
+void DirectPlayTransport::Send( DPNID dpnid, void *data, unsigned long size, long flags )
+{
+	DPNHANDLE hAsync;
+	DPN_BUFFER_DESC dpbd;
+
+	// Buffer message data
+	dpbd.dwBufferSize = size;
+	dpbd.pBufferData = ( BYTE* ) data;
+
+	// Send message
+	m_dpp ->SendTo( dpnid, &dpbd, 1, m_network ->GetSendTimeOut(), NULL, &hAsync, flags | DPNSEND_NOCOMPLETE );
+
+}
+
+// DirectPlay message handler
+HRESULT WINAPI DirectPlayTransport::NetworkMessageHandler( PVOID context, DWORD msgid, PVOID data )
+{
+	// Get pointer to the transport receiving the message
+	DirectPlayTransport *transport = ( DirectPlayTransport* ) context;
+
+	// Process incoming message based on type
+	switch( msgid )
+	{
+	case DPN_MSGID_CREATE_PLAYER:
+		{
+			unsigned long size = 0;
+			DPN_PLAYER_INFO *info = NULL;
+			HRESULT hr = DPNERR_CONNECTING;
+			DPNID dpnid = ( ( PDPNMSG_CREATE_PLAYER ) data ) ->dpnidPlayer;
+
+			// Keep calling GetPeerInfo() to try to connect
+			while( hr == DPNERR_CONNECTING )
+				hr = transport ->m_dpp ->GetPeerInfo( dpnid, info, &size, 0 );
+
+			// Check if GetPeerInfo() has returned size of DPN_PLAYER_INFO structure
+			if( hr == DPNERR_BUFFERTOOSMALL )
+			{
+				info = ( DPN_PLAYER_INFO* ) new BYTE[size];
+				ZeroMemory( info, size );
+				info ->dwSize = sizeof ( DPN_PLAYER_INFO );
+
+				// Try again using the correct size
+				if( SUCCEEDED( transport ->m_dpp ->GetPeerInfo( dpnid, info, &size, 0 ) ) )
+				{
+					// Convert name of new player
+					char *name = new char[wcslen( info ->pwszName ) + 1];
+					ZeroMemory( name, wcslen( info ->pwszName) + 1 );
+					wcstombs( name, info ->pwszName, wcslen( info ->pwszName ) );
+
+					transport ->m_network ->CreatePlayer( dpnid, name, info ->pvData, info ->dwDataSize, ( info ->dwPlayerFlags & DPNPLAYER_LOCAL ) != 0, ( info ->dwPlayerFlags & DPNPLAYER_HOST ) != 0 );
+
+					SAFE_DELETE_ARRAY( name );
+					SAFE_DELETE_ARRAY( info );
+					break;
+				}
+
+				SAFE_DELETE_ARRAY( info );
+			}
+
+			// Add the player even without its details
+			transport ->m_network ->CreatePlayer( dpnid, NULL, NULL, 0, false, false );
+
+			break;
+		}
+
+	case DPN_MSGID_DESTROY_PLAYER:
+		{
+			transport ->m_network ->DestroyPlayer( ( ( PDPNMSG_DESTROY_PLAYER ) data ) ->dpnidPlayer );
+
+			break;
+		}
+
+	case DPN_MSGID_ENUM_HOSTS_RESPONSE:
+		{
+			PDPNMSG_ENUM_HOSTS_RESPONSE response = ( PDPNMSG_ENUM_HOSTS_RESPONSE ) data;
+
+			// Create new session information
+			DirectPlaySession *session = new DirectPlaySession;
+			response ->pAddressSender ->Duplicate( &session ->address );
+			memcpy( &session ->description, response ->pApplicationDescription, sizeof( DPN_APPLICATION_DESC ) );
+			session ->totalPlayers = session ->description.dwCurrentPlayers;
+			session ->maxPlayers = session ->description.dwMaxPlayers;
+
+			// Copy the session's name, as the description's strings only last as long as the response
+			if( session ->description.pwszSessionName != NULL )
+			{
+				session ->name = new char[wcslen( session ->description.pwszSessionName ) + 1];
+				ZeroMemory( session ->name, wcslen( session ->description.pwszSessionName ) + 1 );
+				wcstombs( session ->name, session ->description.pwszSessionName, wcslen( session ->description.pwszSessionName ) );
+			}
+
+			session ->description.pwszSessionName = NULL;
+			session ->description.pwszPassword = NULL;
+			session ->description.pvReservedData = NULL;
+			session ->description.pvApplicationReservedData = NULL;
+
+			// Add new session to the list
+			transport ->m_network ->AddSession( session );
+
+			break;
+		}
+
+	case DPN_MSGID_RECEIVE:
+		{
+			PDPNMSG_RECEIVE receive = ( PDPNMSG_RECEIVE ) data;
+			transport ->m_network ->ReceiveMessage( receive ->dpnidSender, receive ->pReceiveData, receive ->dwReceiveDataSize );
+
+			break;
+		}
+
+	case DPN_MSGID_TERMINATE_SESSION:
+		{
+			transport ->m_network ->TerminateSession();
+
+			break;
+		}
+	}
+
+	return S_OK;
+
+}
+
+// Set the local player's name and data
+bool DirectPlayTransport::SetPeerInfo( char *name, void *playerData, unsigned long dataSize )
+{
+	WCHAR wide[MAX_PATH];
+
+	// Prepare player information
+	DPN_PLAYER_INFO player;
+	ZeroMemory( &player, sizeof( DPN_PLAYER_INFO ) );
+	player.dwSize = sizeof( DPN_PLAYER_INFO );
+	player.pvData = playerData;
+	player.dwDataSize = dataSize;
+	player.dwInfoFlags = DPNINFO_NAME | DPNINFO_DATA;
+	mbstowcs( wide, name, MAX_PATH );
+	player.pwszName = wide;
+
+	// Setup player information
+	if( FAILED( m_dpp ->SetPeerInfo( &player, NULL, NULL, DPNSETPEERINFO_SYNC ) ) )
+		return false;
+
+	return true;
+
+}
+
+// Loopback transport class constructor
+LoopbackTransport::LoopbackTransport( Network *network ) : NetworkTransport( network )
+{
+	m_host = NULL;
+	m_session = NULL;
+	m_maxPlayers = 0;
+	m_dpnid = 0;
+	m_name = NULL;
+	m_data = NULL;
+	m_dataSize = 0;
+
+	// Add the transport to the process's list
+	EnterCriticalSection( &g_loopback.lock );
+	m_next = g_loopback.first;
+	g_loopback.first = this;
+	LeaveCriticalSection( &g_loopback.lock );
+
+}
+
+// Loopback transport class destructor
+LoopbackTransport::~LoopbackTransport()
+{
+	Terminate();
+
+	// Remove the transport from the process's list
+	EnterCriticalSection( &g_loopback.lock );
+
+	LoopbackTransport **link = &g_loopback.first;
+	while( *link != this )
+		link = &( *link ) ->m_next;
+	*link = m_next;
+
+	LeaveCriticalSection( &g_loopback.lock );
+
+	SAFE_DELETE_ARRAY( m_name );
+	SAFE_DELETE_ARRAY( m_data );
+
+}
+
+// Find the sessions hosted by other loopback transports of the same game
+void LoopbackTransport::EnumerateSessions()
+{
+	EnterCriticalSection( &g_loopback.lock );
+
+	for( LoopbackTransport *host = g_loopback.first; host != NULL; host = host ->m_next )
+	{
+		if( host ->m_host != host || IsEqualGUID( host ->m_network ->GetGUID(), m_network ->GetGUID() ) == false )
+			continue;
+
+		LoopbackSession *session = new LoopbackSession;
+		session ->host = host;
+		session ->name = new char[strlen( host ->m_session ) + 1];
+		strcpy( session ->name, host ->m_session );
+		session ->maxPlayers = host ->m_maxPlayers;
+
+		// Count the players in the session
+		for( LoopbackTransport *player = g_loopback.first; player != NULL; player = player ->m_next )
+			if( player ->m_host == host )
+				session ->totalPlayers++;
+
+		m_network ->AddSession( session );
+	}
+
+	LeaveCriticalSection( &g_loopback.lock );
+
+}
+
+// Host a session
+bool LoopbackTransport::Host( char *name, char *session, int players, void *playerData, unsigned long dataSize )
+{
+	Terminate();
+
+	EnterCriticalSection( &g_loopback.lock );
+
+	SetLocalPlayer( name, playerData, dataSize );
+	m_session = new char[strlen( session ) + 1];
+	strcpy( m_session, session );
+	m_maxPlayers = players;
+	m_dpnid = g_loopback.nextID++;
+	m_host = this;
+
+	m_network ->CreatePlayer( m_dpnid, m_name, m_data, m_dataSize, true, true );
+
+	LeaveCriticalSection( &g_loopback.lock );
+
+	return true;
+}
+
+// Join an enumerated session
+bool LoopbackTransport::Join( char *name, SessionInfo *session, void *playerData, unsigned long dataSize )
+{
+	Terminate();
+
+	EnterCriticalSection( &g_loopback.lock );
+
+	LoopbackTransport *host = ( ( LoopbackSession* ) session ) ->host;
+
+	// Make sure the host still exists and is still hosting
+	LoopbackTransport *transport = g_loopback.first;
+	while( transport != NULL && transport != host )
+		transport = transport ->m_next;
+
+	if( transport == NULL || host ->m_host != host )
+	{
+		LeaveCriticalSection( &g_loopback.lock );
+		return false;
+	}
+
+	// Check the session has room
+	unsigned long totalPlayers = 0;
+	for( transport = g_loopback.first; transport != NULL; transport = transport ->m_next )
+		if( transport ->m_host == host )
+			totalPlayers++;
+
+	if( host ->m_maxPlayers != 0 && totalPlayers >= host ->m_maxPlayers )
+	{
+		LeaveCriticalSection( &g_loopback.lock );
+		return false;
+	}
+
+	SetLocalPlayer( name, playerData, dataSize );
+	m_dpnid = g_loopback.nextID++;
+
+	// The new player learns of itself and everyone already in the session,
+	// and they all learn of the new player
+	m_network ->CreatePlayer( m_dpnid, m_name, m_data, m_dataSize, true, false );
+
+	for( transport = g_loopback.first; transport != NULL; transport = transport ->m_next )
+	{
+		if( transport ->m_host != host )
+			continue;
+
+		m_network ->CreatePlayer( transport ->m_dpnid, transport ->m_name, transport ->m_data, transport ->m_dataSize, false, transport == host );
+		transport ->m_network ->CreatePlayer( m_dpnid, m_name, m_data, m_dataSize, false, false );
+	}
+
+	m_host = host;
+
+	LeaveCriticalSection( &g_loopback.lock );
+
+	return true;
+
+}
+
+// Terminate current session
+void LoopbackTransport::Terminate()
+{
+	EnterCriticalSection( &g_loopback.lock );
+
+	if( m_host != NULL )
+	{
+		for( LoopbackTransport *transport = g_loopback.first; transport != NULL; transport = transport ->m_next )
+		{
+			if( transport ->m_host != m_host || transport == this )
+				continue;
+
+			// When the host leaves the session ends for everyone
+			if( m_host == this )
+			{
+				transport ->Leave();
+				transport ->m_network ->TerminateSession();
+			}
+
+			// Otherwise the others are told the player has gone
+			else
+				transport ->m_network ->DestroyPlayer( m_dpnid );
+		}
+
+		Leave();
+	}
+
+	LeaveCriticalSection( &g_loopback.lock );
+
+}
+
+// Send network message
+void LoopbackTransport::Send( DPNID dpnid, void *data, unsigned long size, long flags )
+{
+	EnterCriticalSection( &g_loopback.lock );
+
+	if( m_host != NULL )
+	{
+		// Messages for the host go straight to it
+		if( dpnid == m_host ->m_dpnid )
+			m_host ->m_network ->ReceiveMessage( m_dpnid, data, size );
+
+		// Everything else goes to every matching player in the session, including the local one
+		else
+		{
+			for( LoopbackTransport *transport = g_loopback.first; transport != NULL; transport = transport ->m_next )
+				if( transport ->m_host == m_host && ( dpnid == DPNID_ALL_PLAYERS_GROUP || transport ->m_dpnid == dpnid ) )
+					transport ->m_network ->ReceiveMessage( m_dpnid, data, size );
+		}
+	}
+
+	LeaveCriticalSection( &g_loopback.lock );
+
+}
+
+// Store the local player's name and data so they can be given to the other players
+void LoopbackTransport::SetLocalPlayer( char *name, void *playerData, unsigned long dataSize )
+{
+	SAFE_DELETE_ARRAY( m_name );
+	SAFE_DELETE_ARRAY( m_data );
+
+	m_name = new char[strlen( name ) + 1];
+	strcpy( m_name, name );
+
+	m_dataSize = playerData != NULL ? dataSize : 0;
+	if( m_dataSize > 0 )
+	{
+		m_data = new char[m_dataSize];
+		memcpy( m_data, playerData, m_dataSize );
+	}
+
+}
+
+// Leave the current session. Must be called inside the loopback lock
+void LoopbackTransport::Leave()
+{
+	SAFE_DELETE_ARRAY( m_session );
+	m_maxPlayers = 0;
+	m_dpnid = 0;
+	m_host = NULL;
+
+}
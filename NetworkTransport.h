@@ -0,0 +1,146 @@
+// ***********************************************************************
+//
+// File: NetworkTransport.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Transports that carry the network's sessions, players and messages
+// Date: 10-19-26
+//
+// ***********************************************************************
+
+#ifndef NETWORK_TRANSPORT_H
+#define NETWORK_TRANSPORT_H
+
+// Network transport class. A transport finds, hosts and joins sessions and
+// moves messages between the players in them, reporting everything it
+// receives back to the network that owns it.
+class NetworkTransport
+{
+public:
+	NetworkTransport( Network *network );
+	virtual ~NetworkTransport();
+
+	virtual void EnumerateSessions() = 0;
+
+	virtual bool Host( char *name, char *session, int players, void *playerData, unsigned long dataSize ) = 0;
+	virtual bool Join( char *name, SessionInfo *session, void *playerData, unsigned long dataSize ) = 0;
+
+	virtual void Terminate() = 0;
+
+	virtual void Send( DPNID dpnid, void *data, unsigned long size, long flags ) = 0;
+
+	virtual unsigned long GetMaxMessageSize();
+
+protected:
+	Network *m_network;		// Network the transport reports to
+
+};
+
+// DirectPlay session structure
+struct DirectPlaySession : public SessionInfo
+{
+	IDirectPlay8Address *address;						// Session network address
+	DPN_APPLICATION_DESC description;		// Application description
+
+	// DirectPlay session constructor
+	DirectPlaySession()
+	{
+		address = NULL;
+		ZeroMemory( &description, sizeof( DPN_APPLICATION_DESC ) );
+
+	}
+
+	// DirectPlay session destructor
+	virtual ~DirectPlaySession()
+	{
+		if( address )
+		{
+			address ->Release();
+			address = NULL;
+		}
+
+	}
+
+};
+
+// DirectPlay transport class, a peer to peer session over DirectPlay 8.
+class DirectPlayTransport : public NetworkTransport
+{
+public:
+	DirectPlayTransport( Network *network );
+	virtual ~DirectPlayTransport();
+
+	virtual void EnumerateSessions();
+
+	virtual bool Host( char *name, char *session, int players, void *playerData, unsigned long dataSize );
+	virtual bool Join( char *name, SessionInfo *session, void *playerData, unsigned long dataSize );
+
+	virtual void Terminate();
+
+	virtual void Send( DPNID dpnid, void *data, unsigned long size, long flags );
+
+private:
+	static HRESULT WINAPI NetworkMessageHandler( PVOID context, DWORD msgid, PVOID data );
+
+	bool SetPeerInfo( char *name, void *playerData, unsigned long dataSize );
+
+private:
+	IDirectPlay8Peer *m_dpp;						// DirectPlay peer interface
+	IDirectPlay8Address *m_device;			// DirectPlay device address
+
+};
+
+class LoopbackTransport;
+
+// Loopback session structure
+struct LoopbackSession : public SessionInfo
+{
+	LoopbackTransport *host;		// Transport hosting the session
+
+	// Loopback session constructor
+	LoopbackSession()
+	{
+		host = NULL;
+
+	}
+
+};
+
+// Loopback transport class. Connects networks within the same process without
+// going through a socket, so a host and hundreds of simulated clients can be
+// run together on one machine. Everything is delivered immediately on the
+// sending thread, and one lock guards every loopback session in the process.
+class LoopbackTransport : public NetworkTransport
+{
+public:
+	LoopbackTransport( Network *network );
+	virtual ~LoopbackTransport();
+
+	virtual void EnumerateSessions();
+
+	virtual bool Host( char *name, char *session, int players, void *playerData, unsigned long dataSize );
+	virtual bool Join( char *name, SessionInfo *session, void *playerData, unsigned long dataSize );
+
+	virtual void Terminate();
+
+	virtual void Send( DPNID dpnid, void *data, unsigned long size, long flags );
+
+private:
+	void SetLocalPlayer( char *name, void *playerData, unsigned long dataSize );
+	void Leave();
+
+private:
+	LoopbackTransport *m_next;							// Next transport in the process
+	LoopbackTransport *m_host;							// Transport hosting the session joined, or NULL when not in a session
+
+	char *m_session;											// Name of the session being hosted
+	unsigned long m_maxPlayers;							// Most players the hosted session allows, or zero for no limit
+
+	DPNID m_dpnid;												// ID of the local player
+	char *m_name;												// Name of the local player
+	char *m_data;												// Data of the local player
+	unsigned long m_dataSize;								// Size of the local player's data
+
+};
+
+#endif
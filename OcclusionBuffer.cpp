@@ -0,0 +1,272 @@
+// ************************************************************************
+//
+// File: OcclusionBuffer.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Software depth rasterizer and hierarchical depth buffer for occlusion culling
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Occlusion buffer class constructor.
+OcclusionBuffer::OcclusionBuffer( unsigned long width, unsigned long height )
+{
+	D3DXMatrixIdentity( &m_viewProjection );
+	m_empty = true;
+
+	// Create each level of the pyramid, halving the size until it reaches a single texel.
+	m_totalLevels = 0;
+	while( m_totalLevels < MAX_OCCLUSION_LEVELS )
+	{
+		m_widths[m_totalLevels] = width;
+		m_heights[m_totalLevels] = height;
+		m_levels[m_totalLevels] = new float[width * height];
+		m_totalLevels++;
+
+		if( width == 1 && height == 1 )
+			break;
+
+		width = ( width + 1 ) / 2;
+		height = ( height + 1 ) / 2;
+	}
+
+}
+
+// Occlusion buffer class destructor.
+OcclusionBuffer::~OcclusionBuffer()
+{
+	for( unsigned long l = 0; l < m_totalLevels; l++ )
+		SAFE_DELETE_ARRAY( m_levels[l] );
+
+}
+
+// Clears the buffer ready for the occluders of a new frame.
+void OcclusionBuffer::Begin( D3DXMATRIX *viewProjection )
+{
+	m_viewProjection = *viewProjection;
+	m_empty = true;
+
+	// Clear the rasterized level to the far plane.
+	for( unsigned long p = 0; p < m_widths[0] * m_heights[0]; p++ )
+		m_levels[0][p] = 1.0f;
+
+}
+
+// Rasterizes the depth of the given world space triangle into the buffer.
+void OcclusionBuffer::RasterizeTriangle( D3DXVECTOR3 *vertex0, D3DXVECTOR3 *vertex1, D3DXVECTOR3 *vertex2 )
+{
+	// Transform the vertices into clip space.
+	D3DXVECTOR4 clip[3];
+	D3DXVec3Transform( &clip[0], vertex0, &m_viewProjection );
+	D3DXVec3Transform( &clip[1], vertex1, &m_viewProjection );
+	D3DXVec3Transform( &clip[2], vertex2, &m_viewProjection );
+
+	// Ignore the triangle if it is entirely outside one of the side planes.
+	if( clip[0].x > clip[0].w && clip[1].x > clip[1].w && clip[2].x > clip[2].w )
+		return;
+	if( clip[0].x < -clip[0].w && clip[1].x < -clip[1].w && clip[2].x < -clip[2].w )
+		return;
+	if( clip[0].y > clip[0].w && clip[1].y > clip[1].w && clip[2].y > clip[2].w )
+		return;
+	if( clip[0].y < -clip[0].w && clip[1].y < -clip[1].w && clip[2].y < -clip[2].w )
+		return;
+
+	// Clip the triangle against the near plane, which can leave a quad.
+	D3DXVECTOR4 polygon[4];
+	unsigned long totalVertices = 0;
+	for( unsigned long v = 0; v < 3; v++ )
+	{
+		D3DXVECTOR4 *current = &clip[v];
+		D3DXVECTOR4 *next = &clip[( v + 1 ) % 3];
+
+		if( current->z >= 0.0f )
+			polygon[totalVertices++] = *current;
+
+		if( ( current->z >= 0.0f ) != ( next->z >= 0.0f ) )
+			polygon[totalVertices++] = *current + ( *next - *current ) * ( current->z / ( current->z - next->z ) );
+	}
+
+	if( totalVertices < 3 )
+		return;
+
+	// Project the clipped polygon onto the screen and rasterize it as a fan.
+	D3DXVECTOR3 screen[4];
+	for( unsigned long v = 0; v < totalVertices; v++ )
+		screen[v] = ProjectToScreen( &polygon[v] );
+
+	for( unsigned long v = 1; v + 1 < totalVertices; v++ )
+		RasterizeScreenTriangle( &screen[0], &screen[v], &screen[v + 1] );
+
+}
+
+// Builds the hierarchical depth pyramid from the rasterized buffer.
+void OcclusionBuffer::End()
+{
+	// Each texel stores the furthest depth of the four texels beneath it.
+	for( unsigned long l = 1; l < m_totalLevels; l++ )
+	{
+		float *source = m_levels[l - 1];
+		unsigned long sourceWidth = m_widths[l - 1];
+		unsigned long sourceHeight = m_heights[l - 1];
+
+		for( unsigned long y = 0; y < m_heights[l]; y++ )
+		{
+			unsigned long y0 = y * 2;
+			unsigned long y1 = min( y0 + 1, sourceHeight - 1 );
+
+			for( unsigned long x = 0; x < m_widths[l]; x++ )
+			{
+				unsigned long x0 = x * 2;
+				unsigned long x1 = min( x0 + 1, sourceWidth - 1 );
+
+				float depth = max( source[y0 * sourceWidth + x0], source[y0 * sourceWidth + x1] );
+				depth = max( depth, source[y1 * sourceWidth + x0] );
+				depth = max( depth, source[y1 * sourceWidth + x1] );
+
+				m_levels[l][y * m_widths[l] + x] = depth;
+			}
+		}
+	}
+
+}
+
+// Returns true if any part of the given world space box may be visible.
+bool OcclusionBuffer::IsBoxVisible( D3DXVECTOR3 min, D3DXVECTOR3 max )
+{
+	// Nothing can be hidden by an empty buffer.
+	if( m_empty == true )
+		return true;
+
+	// Find the screen rectangle and nearest depth covered by the box's corners.
+	float minX = (float)m_widths[0];
+	float minY = (float)m_heights[0];
+	float maxX = 0.0f;
+	float maxY = 0.0f;
+	float minZ = 1.0f;
+	for( char c = 0; c < 8; c++ )
+	{
+		D3DXVECTOR3 corner( c & 1 ? max.x : min.x, c & 2 ? max.y : min.y, c & 4 ? max.z : min.z );
+		D3DXVECTOR4 clip;
+		D3DXVec3Transform( &clip, &corner, &m_viewProjection );
+
+		// A box crossing the near plane surrounds the viewer, so it cannot be hidden.
+		if( clip.z < 0.0f || clip.w <= 0.0f )
+			return true;
+
+		D3DXVECTOR3 screen = ProjectToScreen( &clip );
+		minX = min( minX, screen.x );
+		minY = min( minY, screen.y );
+		maxX = max( maxX, screen.x );
+		maxY = max( maxY, screen.y );
+		minZ = min( minZ, screen.z );
+	}
+
+	// Clamp the rectangle to the buffer. Boxes off the screen are left to the view frustum.
+	long x0 = max( 0L, (long)minX );
+	long y0 = max( 0L, (long)minY );
+	long x1 = min( (long)m_widths[0] - 1, (long)maxX );
+	long y1 = min( (long)m_heights[0] - 1, (long)maxY );
+	if( x0 > x1 || y0 > y1 )
+		return true;
+
+	// Pick the finest level where the rectangle covers no more than two by two texels.
+	unsigned long level = 0;
+	while( level + 1 < m_totalLevels && ( ( x1 >> level ) - ( x0 >> level ) > 1 || ( y1 >> level ) - ( y0 >> level ) > 1 ) )
+		level++;
+
+	// The box is visible if any texel it covers has an occluder further away
+	// than it. The occluders include the box's own faces, which can lie on its
+	// nearest corner, so the box is tested a little nearer than it is.
+	minZ -= OCCLUSION_DEPTH_BIAS;
+	for( long y = y0 >> level; y <= y1 >> level; y++ )
+		for( long x = x0 >> level; x <= x1 >> level; x++ )
+			if( m_levels[level][y * m_widths[level] + x] > minZ )
+				return true;
+
+	return false;
+}
+
+// Returns the width of the rasterized buffer.
+unsigned long OcclusionBuffer::GetWidth()
+{
+	return m_widths[0];
+}
+
+// Returns the height of the rasterized buffer.
+unsigned long OcclusionBuffer::GetHeight()
+{
+	return m_heights[0];
+}
+
+// Rasterizes the depth of a triangle that has already been projected onto the screen.
+void OcclusionBuffer::RasterizeScreenTriangle( D3DXVECTOR3 *vertex0, D3DXVECTOR3 *vertex1, D3DXVECTOR3 *vertex2 )
+{
+	// Ignore triangles with no area on the screen.
+	float area = ( vertex1->x - vertex0->x ) * ( vertex2->y - vertex0->y ) - ( vertex1->y - vertex0->y ) * ( vertex2->x - vertex0->x );
+	if( fabs( area ) < 0.0001f )
+		return;
+
+	// Find the triangle's bounding rectangle on the buffer.
+	long minX = max( 0L, (long)floor( min( vertex0->x, min( vertex1->x, vertex2->x ) ) ) );
+	long minY = max( 0L, (long)floor( min( vertex0->y, min( vertex1->y, vertex2->y ) ) ) );
+	long maxX = min( (long)m_widths[0] - 1, (long)ceil( max( vertex0->x, max( vertex1->x, vertex2->x ) ) ) );
+	long maxY = min( (long)m_heights[0] - 1, (long)ceil( max( vertex0->y, max( vertex1->y, vertex2->y ) ) ) );
+	if( minX > maxX || minY > maxY )
+		return;
+
+	m_empty = false;
+
+	// Edge functions are divided by the area so that the inside is always positive,
+	// which also turns them into the barycentric weights of each vertex.
+	float invArea = 1.0f / area;
+	float stepX0 = ( vertex1->y - vertex2->y ) * invArea;
+	float stepY0 = ( vertex2->x - vertex1->x ) * invArea;
+	float stepX1 = ( vertex2->y - vertex0->y ) * invArea;
+	float stepY1 = ( vertex0->x - vertex2->x ) * invArea;
+	float stepX2 = ( vertex0->y - vertex1->y ) * invArea;
+	float stepY2 = ( vertex1->x - vertex0->x ) * invArea;
+
+	// Evaluate the edge functions at the centre of the first pixel.
+	float px = (float)minX + 0.5f;
+	float py = (float)minY + 0.5f;
+	float row0 = ( ( vertex2->x - vertex1->x ) * ( py - vertex1->y ) - ( vertex2->y - vertex1->y ) * ( px - vertex1->x ) ) * invArea;
+	float row1 = ( ( vertex0->x - vertex2->x ) * ( py - vertex2->y ) - ( vertex0->y - vertex2->y ) * ( px - vertex2->x ) ) * invArea;
+	float row2 = ( ( vertex1->x - vertex0->x ) * ( py - vertex0->y ) - ( vertex1->y - vertex0->y ) * ( px - vertex0->x ) ) * invArea;
+
+	for( long y = minY; y <= maxY; y++ )
+	{
+		float *depth = &m_levels[0][y * m_widths[0]];
+		float weight0 = row0;
+		float weight1 = row1;
+		float weight2 = row2;
+
+		for( long x = minX; x <= maxX; x++ )
+		{
+			// Keep the nearest depth of any pixel inside the triangle.
+			if( weight0 >= 0.0f && weight1 >= 0.0f && weight2 >= 0.0f )
+			{
+				float z = weight0 * vertex0->z + weight1 * vertex1->z + weight2 * vertex2->z;
+				if( z < depth[x] )
+					depth[x] = z;
+			}
+
+			weight0 += stepX0;
+			weight1 += stepX1;
+			weight2 += stepX2;
+		}
+
+		row0 += stepY0;
+		row1 += stepY1;
+		row2 += stepY2;
+	}
+
+}
+
+// Projects the given clip space position onto the buffer, keeping its depth.
+D3DXVECTOR3 OcclusionBuffer::ProjectToScreen( D3DXVECTOR4 *clip )
+{
+	float invW = 1.0f / clip->w;
+	return D3DXVECTOR3( ( clip->x * invW * 0.5f + 0.5f ) * m_widths[0], ( 0.5f - clip->y * invW * 0.5f ) * m_heights[0], clip->z * invW );
+}
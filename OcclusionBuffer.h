@@ -0,0 +1,52 @@
+// ************************************************************************
+//
+// File: OcclusionBuffer.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Software depth rasterizer and hierarchical depth buffer for occlusion culling
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef OCCLUSION_BUFFER_H
+#define OCCLUSION_BUFFER_H
+
+// Maximum number of levels in the hierarchical depth pyramid.
+#define MAX_OCCLUSION_LEVELS 12
+
+// Depth a box is moved towards the viewer when tested, so faces rasterized from inside it can never hide it.
+#define OCCLUSION_DEPTH_BIAS 0.0001f
+
+class OcclusionBuffer
+{
+public:
+	OcclusionBuffer( unsigned long width, unsigned long height );
+	virtual ~OcclusionBuffer();
+
+	void Begin( D3DXMATRIX *viewProjection );
+
+	void RasterizeTriangle( D3DXVECTOR3 *vertex0, D3DXVECTOR3 *vertex1, D3DXVECTOR3 *vertex2 );
+
+	void End();
+
+	bool IsBoxVisible( D3DXVECTOR3 min, D3DXVECTOR3 max );
+
+	unsigned long GetWidth();
+	unsigned long GetHeight();
+
+private:
+	void RasterizeScreenTriangle( D3DXVECTOR3 *vertex0, D3DXVECTOR3 *vertex1, D3DXVECTOR3 *vertex2 );
+	D3DXVECTOR3 ProjectToScreen( D3DXVECTOR4 *clip );
+
+private:
+	D3DXMATRIX m_viewProjection;										// View projection matrix of the current frame
+	bool m_empty;																	// Indicates if nothing has been rasterized this frame
+
+	unsigned long m_totalLevels;												// Number of levels in the depth pyramid
+	unsigned long m_widths[MAX_OCCLUSION_LEVELS];			// Width of each level in the pyramid
+	unsigned long m_heights[MAX_OCCLUSION_LEVELS];			// Height of each level in the pyramid
+	float *m_levels[MAX_OCCLUSION_LEVELS];						// Depth of each level, the first is the rasterized buffer
+
+};
+
+#endif
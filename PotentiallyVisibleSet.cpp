@@ -0,0 +1,232 @@
+// ************************************************************************
+//
+// File: PotentiallyVisibleSet.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Precomputed sets of scene leaves visible from each cell of the scene
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Potentially visible set class constructor.
+PotentiallyVisibleSet::PotentiallyVisibleSet( D3DXVECTOR3 min, D3DXVECTOR3 max, float cellSize, unsigned long totalLeaves, unsigned long geometryHash )
+{
+	// Divide the given space up into a grid of cells.
+	m_origin = min;
+	m_cellSize = cellSize;
+	m_cellsX = max( 1UL, (unsigned long)ceil( ( max.x - min.x ) / cellSize ) );
+	m_cellsY = max( 1UL, (unsigned long)ceil( ( max.y - min.y ) / cellSize ) );
+	m_cellsZ = max( 1UL, (unsigned long)ceil( ( max.z - min.z ) / cellSize ) );
+	m_totalLeaves = totalLeaves;
+	m_geometryHash = geometryHash;
+
+	// Every cell starts with an empty set.
+	m_cellOffsets = new unsigned long[GetTotalCells() + 1];
+	ZeroMemory( m_cellOffsets, sizeof( unsigned long ) * ( GetTotalCells() + 1 ) );
+	m_maxRuns = GetTotalCells() * 4;
+	m_runs = new unsigned short[m_maxRuns];
+	m_totalRuns = 0;
+
+	// The viewer has not been placed yet.
+	m_viewerCell = -1;
+	m_visible = new bool[m_totalLeaves];
+
+}
+
+// Potentially visible set class destructor.
+PotentiallyVisibleSet::~PotentiallyVisibleSet()
+{
+	SAFE_DELETE_ARRAY( m_cellOffsets );
+	SAFE_DELETE_ARRAY( m_runs );
+	SAFE_DELETE_ARRAY( m_visible );
+
+}
+
+// Loads the sets from the given file. Returns false if the file is missing or was built for a different scene.
+bool PotentiallyVisibleSet::Load( char *filename )
+{
+	FILE *file = NULL;
+	if( ( file = fopen( filename, "rb" ) ) == NULL )
+		return false;
+
+	// Check the file's version, grid, leaves and geometry match the scene.
+	unsigned long header[6];
+	float cellSize;
+	if( fread( header, sizeof( unsigned long ), 6, file ) != 6 || fread( &cellSize, sizeof( float ), 1, file ) != 1 ||
+		header[0] != PVS_FILE_VERSION || header[1] != m_geometryHash || header[2] != m_totalLeaves ||
+		header[3] != m_cellsX || header[4] != m_cellsY || header[5] != m_cellsZ || cellSize != m_cellSize )
+	{
+		fclose( file );
+		return false;
+	}
+
+	// Read the cell offsets and the runs.
+	unsigned long totalRuns;
+	if( fread( &totalRuns, sizeof( unsigned long ), 1, file ) != 1 )
+	{
+		fclose( file );
+		return false;
+	}
+
+	SAFE_DELETE_ARRAY( m_runs );
+	m_maxRuns = max( totalRuns, 1UL );
+	m_runs = new unsigned short[m_maxRuns];
+	m_totalRuns = totalRuns;
+
+	bool loaded = fread( m_cellOffsets, sizeof( unsigned long ), GetTotalCells() + 1, file ) == GetTotalCells() + 1 && fread( m_runs, sizeof( unsigned short ), m_totalRuns, file ) == m_totalRuns;
+	fclose( file );
+
+	// Each cell's runs must follow the last cell's and end with the runs read.
+	if( loaded == true )
+	{
+		loaded = m_cellOffsets[0] == 0 && m_cellOffsets[GetTotalCells()] == m_totalRuns;
+		for( unsigned long c = 0; c < GetTotalCells() && loaded == true; c++ )
+			loaded = m_cellOffsets[c] <= m_cellOffsets[c + 1];
+	}
+
+	// Don't keep a partially read or corrupt file.
+	if( loaded == false )
+	{
+		ZeroMemory( m_cellOffsets, sizeof( unsigned long ) * ( GetTotalCells() + 1 ) );
+		m_totalRuns = 0;
+	}
+
+	m_viewerCell = -1;
+
+	return loaded;
+}
+
+// Saves the sets to the given file.
+bool PotentiallyVisibleSet::Save( char *filename )
+{
+	FILE *file = NULL;
+	if( ( file = fopen( filename, "wb" ) ) == NULL )
+		return false;
+
+	unsigned long header[6] = { PVS_FILE_VERSION, m_geometryHash, m_totalLeaves, m_cellsX, m_cellsY, m_cellsZ };
+	fwrite( header, sizeof( unsigned long ), 6, file );
+	fwrite( &m_cellSize, sizeof( float ), 1, file );
+	fwrite( &m_totalRuns, sizeof( unsigned long ), 1, file );
+	fwrite( m_cellOffsets, sizeof( unsigned long ), GetTotalCells() + 1, file );
+	fwrite( m_runs, sizeof( unsigned short ), m_totalRuns, file );
+
+	fclose( file );
+
+	return true;
+}
+
+// Returns the total number of cells in the grid.
+unsigned long PotentiallyVisibleSet::GetTotalCells()
+{
+	return m_cellsX * m_cellsY * m_cellsZ;
+}
+
+// Returns the minimum corner of the given cell.
+D3DXVECTOR3 PotentiallyVisibleSet::GetCellMin( unsigned long cell )
+{
+	unsigned long x = cell % m_cellsX;
+	unsigned long y = ( cell / m_cellsX ) % m_cellsY;
+	unsigned long z = cell / ( m_cellsX * m_cellsY );
+
+	return m_origin + D3DXVECTOR3( x * m_cellSize, y * m_cellSize, z * m_cellSize );
+}
+
+// Returns the length of each side of a cell.
+float PotentiallyVisibleSet::GetCellSize()
+{
+	return m_cellSize;
+}
+
+// Stores the set of leaves visible from the given cell. Cells must be set in order.
+void PotentiallyVisibleSet::SetCellVisibility( unsigned long cell, bool *visible )
+{
+	m_cellOffsets[cell] = m_totalRuns;
+
+	// Encode the set as alternating runs of hidden and visible leaves,
+	// starting with a hidden run. Runs too long for a single entry are split
+	// with an empty run of the other state between them.
+	bool state = false;
+	unsigned long length = 0;
+	for( unsigned long l = 0; l <= m_totalLeaves; l++ )
+	{
+		// Keep counting while the run continues.
+		if( l < m_totalLeaves && visible[l] == state && length < 0xFFFF )
+		{
+			length++;
+			continue;
+		}
+
+		// Make room for the run and a possible split.
+		if( m_totalRuns + 2 > m_maxRuns )
+		{
+			m_maxRuns *= 2;
+			unsigned short *runs = new unsigned short[m_maxRuns];
+			memcpy( runs, m_runs, sizeof( unsigned short ) * m_totalRuns );
+			SAFE_DELETE_ARRAY( m_runs );
+			m_runs = runs;
+		}
+
+		m_runs[m_totalRuns++] = (unsigned short)length;
+		if( l == m_totalLeaves )
+			break;
+
+		// A full run that continues is split, otherwise the state changes.
+		if( visible[l] == state )
+			m_runs[m_totalRuns++] = 0;
+		else
+			state = !state;
+
+		length = 1;
+	}
+
+	m_cellOffsets[cell + 1] = m_totalRuns;
+
+	// Force the viewer's set to be decoded again.
+	m_viewerCell = -1;
+
+}
+
+// Decodes the set of the cell containing the given viewer position.
+void PotentiallyVisibleSet::SetViewer( D3DXVECTOR3 viewer )
+{
+	// Find the cell the viewer is in.
+	D3DXVECTOR3 offset = ( viewer - m_origin ) / m_cellSize;
+	long cell = -1;
+	if( offset.x >= 0.0f && offset.y >= 0.0f && offset.z >= 0.0f && offset.x < m_cellsX && offset.y < m_cellsY && offset.z < m_cellsZ )
+		cell = (long)offset.x + (long)offset.y * m_cellsX + (long)offset.z * m_cellsX * m_cellsY;
+
+	// The set only needs decoding when the viewer changes cell.
+	if( cell == m_viewerCell )
+		return;
+
+	m_viewerCell = cell;
+	if( m_viewerCell == -1 )
+		return;
+
+	bool state = false;
+	unsigned long leaf = 0;
+	for( unsigned long r = m_cellOffsets[m_viewerCell]; r < m_cellOffsets[m_viewerCell + 1]; r++ )
+	{
+		for( unsigned long l = 0; l < m_runs[r] && leaf < m_totalLeaves; l++ )
+			m_visible[leaf++] = state;
+
+		state = !state;
+	}
+
+	// Anything not covered by the runs could not be seen.
+	while( leaf < m_totalLeaves )
+		m_visible[leaf++] = false;
+
+}
+
+// Returns true if the given leaf may be visible from the viewer's cell.
+bool PotentiallyVisibleSet::IsLeafVisible( unsigned long leaf )
+{
+	// Nothing is culled when the viewer is outside the grid.
+	if( m_viewerCell == -1 )
+		return true;
+
+	return m_visible[leaf];
+}
@@ -0,0 +1,62 @@
+// ************************************************************************
+//
+// File: PotentiallyVisibleSet.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Precomputed sets of scene leaves visible from each cell of the scene
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef POTENTIALLY_VISIBLE_SET_H
+#define POTENTIALLY_VISIBLE_SET_H
+
+// Number of points sampled along each axis of a cell, and of a scene leaf's bounds, when building the sets.
+#define PVS_CELL_SAMPLES 3
+#define PVS_LEAF_SAMPLES 4
+
+// Distance the sampled cells and leaves are grown by, so that a leaf is only
+// hidden when it stays hidden from a little beyond the cell.
+#define PVS_MARGIN 0.05f
+
+// Version of the sets' file, changed whenever its layout or the way the sets are built changes.
+#define PVS_FILE_VERSION 2
+
+class PotentiallyVisibleSet
+{
+public:
+	PotentiallyVisibleSet( D3DXVECTOR3 min, D3DXVECTOR3 max, float cellSize, unsigned long totalLeaves, unsigned long geometryHash );
+	virtual ~PotentiallyVisibleSet();
+
+	bool Load( char *filename );
+	bool Save( char *filename );
+
+	unsigned long GetTotalCells();
+	D3DXVECTOR3 GetCellMin( unsigned long cell );
+	float GetCellSize();
+
+	void SetCellVisibility( unsigned long cell, bool *visible );
+
+	void SetViewer( D3DXVECTOR3 viewer );
+	bool IsLeafVisible( unsigned long leaf );
+
+private:
+	D3DXVECTOR3 m_origin;												// Minimum corner of the cell grid
+	float m_cellSize;															// Length of each side of a cell
+	unsigned long m_cellsX;													// Number of cells along the x axis
+	unsigned long m_cellsY;													// Number of cells along the y axis
+	unsigned long m_cellsZ;													// Number of cells along the z axis
+	unsigned long m_totalLeaves;											// Number of scene leaves in each set
+	unsigned long m_geometryHash;										// Hash of the scene geometry the sets were built for
+
+	unsigned long *m_cellOffsets;											// Index of each cell's first run, plus one past the last cell
+	unsigned short *m_runs;													// Alternating hidden and visible run lengths of every cell
+	unsigned long m_totalRuns;												// Total number of runs
+	unsigned long m_maxRuns;												// Number of runs the array can hold
+
+	long m_viewerCell;															// Cell the viewer is in, or -1 when outside the grid
+	bool *m_visible;																// Decoded set of the viewer's cell
+
+};
+
+#endif
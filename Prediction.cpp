@@ -0,0 +1,406 @@
+// ************************************************************************
+//
+// File: Prediction.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Predicts the movement of the local player's object and reconciles it with the host's
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Prediction class constructor
+Prediction::Prediction()
+{
+	m_controlled = REPLICATION_INVALID_ID;
+	ZeroMemory( m_inputs, sizeof( m_inputs ) );
+	m_sequence = 0;
+	m_acknowledged = 0;
+	m_sent = 0;
+	m_lastSent = 0;
+
+	m_controllers = new LinkedList< InputController >;
+	m_lastState = 0;
+
+	// Register the handlers of the prediction messages
+	g_engine ->GetNetwork() ->GetMessageTable() ->Register( MSGID_INPUT, HandleInput );
+	g_engine ->GetNetwork() ->GetMessageTable() ->Register( MSGID_INPUT_STATE, HandleState );
+
+}
+
+// Prediction class destructor
+Prediction::~Prediction()
+{
+	g_engine ->GetNetwork() ->GetMessageTable() ->Unregister( MSGID_INPUT );
+	g_engine ->GetNetwork() ->GetMessageTable() ->Unregister( MSGID_INPUT_STATE );
+
+	SAFE_DELETE( m_controllers );
+
+}
+
+// Send the host the commands it has not acknowledged, or send the players the
+// state of the objects they control if this is the host
+void Prediction::Update()
+{
+	if( g_engine ->GetNetwork() ->isHost() == true )
+		SendStates();
+	else
+		SendInputs();
+
+}
+
+// Forget the controllers of players that leave and the commands of an ended session
+void Prediction::HandleNetworkMessage( ReceivedMessage *msg )
+{
+	switch( msg ->msgid )
+	{
+	case MSGID_DESTROY_PLAYER:
+		{
+			InputController *controller = m_controllers ->GetFirst();
+			while( controller != NULL )
+			{
+				InputController *next = m_controllers ->GetNext( controller );
+				if( controller ->dpnid == msg ->dpnid )
+					RemoveController( controller ->id );
+
+				controller = next;
+			}
+
+			break;
+		}
+
+	case MSGID_TERMINATE_SESSION:
+		{
+			ClearControllers();
+			SetControlled( m_controlled );
+
+			break;
+		}
+	}
+
+}
+
+// Set the networked object the local player controls, or REPLICATION_INVALID_ID for none
+void Prediction::SetControlled( unsigned long id )
+{
+	Replication *replication = g_engine ->GetReplication();
+
+	if( replication ->GetRegisteredObject( m_controlled ) != NULL )
+		replication ->GetRegisteredObject( m_controlled ) ->SetInputDriven( false );
+
+	m_controlled = id;
+
+	if( replication ->GetRegisteredObject( m_controlled ) != NULL )
+		replication ->GetRegisteredObject( m_controlled ) ->SetInputDriven( true );
+
+	// Start the commands over
+	ZeroMemory( m_inputs, sizeof( m_inputs ) );
+	m_sequence = 0;
+	m_acknowledged = 0;
+	m_sent = 0;
+
+}
+
+// Returns the network ID of the object the local player controls
+unsigned long Prediction::GetControlled()
+{
+	return m_controlled;
+}
+
+// Apply the local player's controls for this frame to the controlled object
+// at once. Unless this is the host, the command is also kept to be sent to
+// the host and replayed if the host disagrees
+void Prediction::Control( float elapsed, float drive, float strafe, float jump, D3DXVECTOR3 rotation )
+{
+	SceneObject *object = g_engine ->GetReplication() ->GetRegisteredObject( m_controlled );
+	if( object == NULL )
+		return;
+
+	InputCommand command;
+	command.elapsed = elapsed;
+	command.drive = drive;
+	command.strafe = strafe;
+	command.jump = jump;
+
+	// Rotations are wrapped to a single turn
+	for( unsigned long c = 0; c < 3; c++ )
+	{
+		float turns = rotation[c] / ( 2.0f * D3DX_PI );
+		command.rotation[c] = ( turns - floorf( turns ) ) * 2.0f * D3DX_PI;
+	}
+
+	// Predict with exactly what the host will receive
+	Quantize( &command );
+	Apply( object, &command );
+
+	if( g_engine ->GetNetwork() ->isHost() == true )
+		return;
+
+	m_sequence++;
+
+	PredictedInput *input = &m_inputs[m_sequence & ( PREDICTION_HISTORY - 1 )];
+	input ->sequence = m_sequence;
+	input ->command = command;
+	input ->translation = object ->GetTranslation();
+
+}
+
+// Allow a player to drive a networked object with its commands. Only the host's controllers are used
+void Prediction::SetController( unsigned long id, DPNID dpnid )
+{
+	InputController *controller = GetController( id );
+	if( controller == NULL )
+	{
+		controller = m_controllers ->Add( new InputController );
+		controller ->id = id;
+	}
+
+	controller ->dpnid = dpnid;
+	controller ->sequence = 0;
+	controller ->changed = false;
+	controller ->lastTime = timeGetTime();
+	controller ->budget = 0.0f;
+
+	SceneObject *object = g_engine ->GetReplication() ->GetRegisteredObject( id );
+	if( object != NULL )
+		object ->SetInputDriven( true );
+
+}
+
+// Stop a networked object being driven by a player's commands
+void Prediction::RemoveController( unsigned long id )
+{
+	InputController *controller = GetController( id );
+	if( controller == NULL )
+		return;
+
+	SceneObject *object = g_engine ->GetReplication() ->GetRegisteredObject( id );
+	if( object != NULL )
+		object ->SetInputDriven( false );
+
+	m_controllers ->Remove( &controller );
+
+}
+
+// Send the host the latest commands it has not acknowledged, if any were
+// issued since the last were sent. Otherwise they are sent again now and
+// then until acknowledged, as the message or the host's state may be lost,
+// or the host may have left commands over its time budget to apply later
+void Prediction::SendInputs()
+{
+	if( m_controlled == REPLICATION_INVALID_ID || m_acknowledged >= m_sequence )
+		return;
+
+	unsigned long now = timeGetTime();
+	if( m_sent == m_sequence && now - m_lastSent < PREDICTION_RESEND_INTERVAL )
+		return;
+
+	Network *network = g_engine ->GetNetwork();
+
+	unsigned long first = m_acknowledged + 1;
+	if( m_sequence - first >= PREDICTION_MAX_COMMANDS )
+		first = m_sequence - PREDICTION_MAX_COMMANDS + 1;
+
+	InputMessage input;
+	input.msgid = MSGID_INPUT;
+	input.dpnid = network ->GetLocalID();
+	input.id = m_controlled;
+	input.sequence = m_sequence;
+	input.count = m_sequence - first + 1;
+
+	for( long c = 0; c < input.count; c++ )
+		input.commands[c] = m_inputs[( first + c ) & ( PREDICTION_HISTORY - 1 )].command;
+
+	network ->SendEncoded( &input, network ->GetHostID(), NETWORK_UNRELIABLE_SEQUENCED );
+
+	m_sent = m_sequence;
+	m_lastSent = now;
+
+}
+
+// Send each player the state of the object it controls, once the interval since the last has passed
+void Prediction::SendStates()
+{
+	unsigned long now = timeGetTime();
+	if( now - m_lastState < PREDICTION_STATE_INTERVAL )
+		return;
+
+	m_lastState = now;
+
+	Network *network = g_engine ->GetNetwork();
+
+	m_controllers ->Iterate( true );
+	while( m_controllers ->Iterate() )
+	{
+		InputController *controller = m_controllers ->GetCurrent();
+		SceneObject *object = g_engine ->GetReplication() ->GetRegisteredObject( controller ->id );
+		if( controller ->changed == false || object == NULL || controller ->dpnid == network ->GetLocalID() )
+			continue;
+
+		InputStateMessage state;
+		state.msgid = MSGID_INPUT_STATE;
+		state.dpnid = network ->GetLocalID();
+		state.id = controller ->id;
+		state.sequence = controller ->sequence;
+		state.translation = object ->GetTranslation();
+		state.velocity = object ->GetVelocity();
+		state.touchingGround = object ->IsTouchingGround();
+
+		network ->SendEncoded( &state, controller ->dpnid, NETWORK_UNRELIABLE_SEQUENCED );
+
+		controller ->changed = false;
+	}
+
+}
+
+// Apply the commands of a player to the object it controls, skipping those already applied
+void Prediction::ReceiveInputs( InputMessage *input )
+{
+	if( g_engine ->GetNetwork() ->isHost() == false )
+		return;
+
+	// Only the player given control of the object may drive it. The message's
+	// dpnid is the player it was received from, whatever the player wrote
+	InputController *controller = GetController( input ->id );
+	if( controller == NULL || controller ->dpnid != input ->dpnid || input ->sequence < (unsigned long)input ->count )
+		return;
+
+	SceneObject *object = g_engine ->GetReplication() ->GetRegisteredObject( input ->id );
+	if( object == NULL )
+		return;
+
+	// Add the time that has passed since the commands last arrived to what
+	// the player may simulate, up to the allowance
+	unsigned long now = timeGetTime();
+	controller ->budget += ( now - controller ->lastTime ) / 1000.0f;
+	if( controller ->budget > PREDICTION_TIME_ALLOWANCE )
+		controller ->budget = PREDICTION_TIME_ALLOWANCE;
+
+	controller ->lastTime = now;
+
+	// Commands sent again that were all applied mean the player missed the
+	// state that acknowledged them, so it is sent again
+	if( input ->sequence <= controller ->sequence )
+		controller ->changed = true;
+
+	unsigned long first = input ->sequence - input ->count + 1;
+	for( long c = 0; c < input ->count; c++ )
+	{
+		if( first + c <= controller ->sequence )
+			continue;
+
+		// Leave the rest unapplied until the clock catches up
+		if( input ->commands[c].elapsed > controller ->budget )
+			break;
+
+		controller ->budget -= input ->commands[c].elapsed;
+		Apply( object, &input ->commands[c] );
+
+		controller ->sequence = first + c;
+		controller ->changed = true;
+	}
+
+}
+
+// Check the host's state against the prediction made for the same command,
+// and replay the commands the host has not applied yet if they differ
+void Prediction::ReceiveState( InputStateMessage *state )
+{
+	Network *network = g_engine ->GetNetwork();
+	if( network ->isHost() == true || state ->dpnid != network ->GetHostID() )
+		return;
+
+	// Ignore states older than the last or for commands never issued
+	if( state ->id != m_controlled || state ->sequence <= m_acknowledged || state ->sequence > m_sequence )
+		return;
+
+	m_acknowledged = state ->sequence;
+
+	SceneObject *object = g_engine ->GetReplication() ->GetRegisteredObject( m_controlled );
+	if( object == NULL )
+		return;
+
+	// Nothing to correct if the prediction was right
+	PredictedInput *predicted = &m_inputs[state ->sequence & ( PREDICTION_HISTORY - 1 )];
+	if( predicted ->sequence == state ->sequence )
+	{
+		D3DXVECTOR3 error = predicted ->translation - state ->translation;
+		if( D3DXVec3LengthSq( &error ) <= PREDICTION_TOLERANCE * PREDICTION_TOLERANCE )
+			return;
+	}
+
+	object ->SetTranslation( state ->translation );
+	object ->SetVelocity( state ->velocity );
+	object ->SetTouchingGroundFlag( state ->touchingGround );
+
+	// Replay the commands issued since, as long as they are still remembered
+	for( unsigned long sequence = m_acknowledged + 1; sequence <= m_sequence; sequence++ )
+	{
+		PredictedInput *input = &m_inputs[sequence & ( PREDICTION_HISTORY - 1 )];
+		if( input ->sequence != sequence )
+			continue;
+
+		Apply( object, &input ->command );
+		input ->translation = object ->GetTranslation();
+	}
+
+}
+
+// Message table handler of input commands, given them decoded
+void Prediction::HandleInput( InputMessage *input )
+{
+	g_engine ->GetPrediction() ->ReceiveInputs( input );
+
+}
+
+// Message table handler of the host's states, given them decoded
+void Prediction::HandleState( InputStateMessage *state )
+{
+	g_engine ->GetPrediction() ->ReceiveState( state );
+
+}
+
+// Apply a command's controls to an object and move it through the scene for the command's time
+void Prediction::Apply( SceneObject *object, InputCommand *command )
+{
+	object ->SetRotation( command ->rotation );
+	object ->Drive( command ->drive );
+	object ->Strafe( command ->strafe );
+	object ->Jump( command ->jump );
+
+	g_engine ->GetSceneManager() ->UpdateObject( object, command ->elapsed );
+
+}
+
+// Round a command to the values the host will decode, by writing it and reading it back
+void Prediction::Quantize( InputCommand *command )
+{
+	char buffer[32];
+
+	MessageWriter writer( buffer, sizeof( buffer ) );
+	command ->Serialize( &writer );
+
+	MessageReader reader( buffer, sizeof( buffer ) );
+	command ->Serialize( &reader );
+
+}
+
+// Returns the controller of the given networked object
+InputController *Prediction::GetController( unsigned long id )
+{
+	m_controllers ->Iterate( true );
+	while( m_controllers ->Iterate() )
+		if( m_controllers ->GetCurrent() ->id == id )
+			return m_controllers ->GetCurrent();
+
+	return NULL;
+}
+
+// Give every controlled object back to the scene manager
+void Prediction::ClearControllers()
+{
+	while( m_controllers ->GetFirst() != NULL )
+		RemoveController( m_controllers ->GetFirst() ->id );
+
+}
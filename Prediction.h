@@ -0,0 +1,202 @@
+// ************************************************************************
+//
+// File: Prediction.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Predicts the movement of the local player's object and reconciles it with the host's
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef PREDICTION_H
+#define PREDICTION_H
+
+// Prediction message IDs
+#define MSGID_INPUT 0x12006
+#define MSGID_INPUT_STATE 0x12007
+
+// Number of input commands remembered for replaying. Must be a power of two.
+#define PREDICTION_HISTORY 64
+
+// Most input commands sent in one message. Each message repeats the latest
+// commands not yet acknowledged, so a lost message costs nothing.
+#define PREDICTION_MAX_COMMANDS 16
+
+// Longest time in seconds a single input command can move its object for.
+#define PREDICTION_MAX_ELAPSED 0.25f
+
+// Largest drive, strafe or jump force an input command can carry.
+#define PREDICTION_MAX_FORCE 1000.0f
+
+// Furthest an input driven object's state can be from the origin on each axis, and fastest it can go.
+#define PREDICTION_WORLD_LIMIT 10000.0f
+#define PREDICTION_MAX_SPEED 1000.0f
+
+// Most simulated time in seconds a player's commands can build up ahead of the
+// host's clock, which covers commands delayed and then arriving together.
+#define PREDICTION_TIME_ALLOWANCE 0.5f
+
+// Time in milliseconds after which the commands the host has not acknowledged are sent again,
+// even if no command has been issued since.
+#define PREDICTION_RESEND_INTERVAL 100
+
+// Time in milliseconds between the host's states for each controlled object.
+#define PREDICTION_STATE_INTERVAL 50
+
+// Distance the predicted translation may differ from the host's before it is corrected.
+#define PREDICTION_TOLERANCE 0.01f
+
+// Input command structure, the controls applied to an object for one frame.
+struct InputCommand
+{
+	float elapsed;						// Time in seconds the command moves its object for
+	float drive;							// Force applied forwards/backwards
+	float strafe;							// Force applied right/left
+	float jump;								// Force applied upwards
+	D3DXVECTOR3 rotation;		// Rotation of the object, each axis between zero and a full turn
+
+	// Message schema
+	template< class Stream > void Serialize( Stream *stream )
+	{
+		stream ->Float( elapsed, 0.0f, PREDICTION_MAX_ELAPSED, 0.001f );
+		stream ->Float( drive, -PREDICTION_MAX_FORCE, PREDICTION_MAX_FORCE, 0.01f );
+		stream ->Float( strafe, -PREDICTION_MAX_FORCE, PREDICTION_MAX_FORCE, 0.01f );
+		stream ->Float( jump, -PREDICTION_MAX_FORCE, PREDICTION_MAX_FORCE, 0.01f );
+		stream ->Vector( rotation, 0.0f, D3DX_PI * 2.0f, 0.0001f );
+	}
+
+};
+
+// Input message structure, the latest input commands of an object sent to the host.
+struct InputMessage : public NetworkMessage
+{
+	unsigned long id;															// Network ID of the object the commands are for
+	unsigned long sequence;												// Sequence number of the last command
+	long count;																	// Number of commands
+	InputCommand commands[PREDICTION_MAX_COMMANDS];	// Commands, oldest first
+
+	// Message schema
+	template< class Stream > void Serialize( Stream *stream )
+	{
+		stream ->Unsigned( id );
+		stream ->Unsigned( sequence );
+		stream ->template Range< 1, PREDICTION_MAX_COMMANDS >( count );
+
+		for( long c = 0; c < count && c < PREDICTION_MAX_COMMANDS; c++ )
+			commands[c].Serialize( stream );
+	}
+
+};
+
+// Input state message structure, the host's state of an object after the last input command it applied.
+struct InputStateMessage : public NetworkMessage
+{
+	unsigned long id;						// Network ID of the object
+	unsigned long sequence;			// Sequence number of the last command applied
+	D3DXVECTOR3 translation;		// Translation of the object
+	D3DXVECTOR3 velocity;			// Velocity of the object
+	bool touchingGround;				// Indicates if the object is touching the ground
+
+	// Message schema
+	template< class Stream > void Serialize( Stream *stream )
+	{
+		stream ->Unsigned( id );
+		stream ->Unsigned( sequence );
+		stream ->Vector( translation, -PREDICTION_WORLD_LIMIT, PREDICTION_WORLD_LIMIT, 0.001f );
+		stream ->Vector( velocity, -PREDICTION_MAX_SPEED, PREDICTION_MAX_SPEED, 0.001f );
+		stream ->Bool( touchingGround );
+	}
+
+};
+
+// Predicted input structure, a command the local player issued and where it left the object.
+struct PredictedInput
+{
+	unsigned long sequence;			// Sequence number of the command, zero if unused
+	InputCommand command;			// Command applied
+	D3DXVECTOR3 translation;		// Translation of the object once the command was applied
+
+};
+
+// Input controller structure, a player whose input commands the host applies to an object.
+struct InputController
+{
+	unsigned long id;					// Network ID of the object the player controls
+	DPNID dpnid;						// Player the commands come from
+	unsigned long sequence;		// Sequence number of the last command applied, zero if none
+	bool changed;						// Indicates if commands were applied since the state was last sent
+	unsigned long lastTime;			// Time the player's commands were last received
+	float budget;						// Simulated time in seconds the player's commands may still use
+
+};
+
+// Prediction class. The object a player controls is input driven: the scene
+// manager's update leaves it alone, and it is moved once for each input
+// command through SceneManager::UpdateObject, with the same collision
+// detection as everything else.
+//
+// On the host, SetController names the player allowed to drive an object.
+// The player's commands are applied as they arrive, in order and only once,
+// and the resulting state is sent back to the player tagged with the last
+// command applied. Only the host's simulation counts. Commands are only taken
+// from the player the transport received them from, and together they can
+// only move the object for as long as has passed on the host's clock, give
+// or take the allowance. Commands over budget wait to be sent again.
+//
+// On the other machines, SetControlled names the local player's object and
+// Control moves it at once, so the player never waits on the round trip. The
+// commands are kept, and the latest not yet acknowledged are sent to the host
+// every update. When the host's state arrives, it is compared with where the
+// same command left the object here. If they differ, the object is put back
+// to the host's state and the commands the host has not yet applied are
+// replayed on top of it. Replayed commands report their collisions again.
+//
+// Replication does not apply snapshots to the controlled object, which only
+// the host's input states correct. On the host itself, Control simply applies
+// the command.
+class Prediction
+{
+public:
+	Prediction();
+	virtual ~Prediction();
+
+	void Update();
+
+	void HandleNetworkMessage( ReceivedMessage *msg );
+
+	void SetControlled( unsigned long id );
+	unsigned long GetControlled();
+	void Control( float elapsed, float drive, float strafe, float jump, D3DXVECTOR3 rotation );
+
+	void SetController( unsigned long id, DPNID dpnid );
+	void RemoveController( unsigned long id );
+
+private:
+	void SendInputs();
+	void SendStates();
+	void ReceiveInputs( InputMessage *input );
+	void ReceiveState( InputStateMessage *state );
+
+	static void HandleInput( InputMessage *input );
+	static void HandleState( InputStateMessage *state );
+
+	void Apply( SceneObject *object, InputCommand *command );
+	void Quantize( InputCommand *command );
+
+	InputController *GetController( unsigned long id );
+	void ClearControllers();
+
+private:
+	unsigned long m_controlled;											// Network ID of the object the local player controls
+	PredictedInput m_inputs[PREDICTION_HISTORY];				// Commands issued, by sequence number
+	unsigned long m_sequence;												// Sequence number of the last command issued
+	unsigned long m_acknowledged;										// Sequence number of the last command the host applied
+	unsigned long m_sent;														// Sequence number of the last command sent
+	unsigned long m_lastSent;												// Time the commands were last sent
+
+	LinkedList< InputController > *m_controllers;				// Players whose commands the host applies
+	unsigned long m_lastState;												// Time the host last sent the controlled objects' states
+
+};
+
+#endif
@@ -0,0 +1,131 @@
+// ************************************************************************
+//
+// File: ReceiveBufferPool.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Pool of variable sized buffers that received network messages are kept in
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Receive buffer pool class constructor
+ReceiveBufferPool::ReceiveBufferPool()
+{
+	for( unsigned long c = 0; c < RECEIVE_BUFFER_CLASSES; c++ )
+		InitializeSListHead( &m_free[c] );
+
+	InitializeCriticalSection( &m_slabCS );
+	m_slabs = NULL;
+
+}
+
+// Receive buffer pool class destructor
+ReceiveBufferPool::~ReceiveBufferPool()
+{
+	// Free all the slabs
+	while( m_slabs != NULL )
+	{
+		void *next = *( void** ) m_slabs;
+		VirtualFree( m_slabs, 0, MEM_RELEASE );
+		m_slabs = next;
+	}
+
+	DeleteCriticalSection( &m_slabCS );
+
+}
+
+// Returns a buffer that can hold at least the given number of bytes
+char *ReceiveBufferPool::Allocate( unsigned long size )
+{
+	// Find the smallest class the buffer fits in
+	unsigned long sizeClass = 0;
+	while( sizeClass < RECEIVE_BUFFER_CLASSES && ( (unsigned long)RECEIVE_BUFFER_MIN_SIZE << sizeClass ) < size )
+		sizeClass++;
+
+	ReceiveBufferHeader *header = NULL;
+
+	if( sizeClass < RECEIVE_BUFFER_CLASSES )
+	{
+		header = ( ReceiveBufferHeader* ) InterlockedPopEntrySList( &m_free[sizeClass] );
+		while( header == NULL && Grow( sizeClass ) == true )
+			header = ( ReceiveBufferHeader* ) InterlockedPopEntrySList( &m_free[sizeClass] );
+	}
+
+	// Buffers too large for any class, or for a class that could not grow, come straight from the heap
+	if( header == NULL )
+	{
+		sizeClass = RECEIVE_BUFFER_CLASSES;
+		header = ( ReceiveBufferHeader* ) new char[GetHeaderSize() + size];
+	}
+
+	header ->pool = this;
+	header ->sizeClass = sizeClass;
+	header ->references = 1;
+
+	return ( char* ) header + GetHeaderSize();
+}
+
+// Adds another holder to a buffer, which must then release it too. Can be called from any thread
+void ReceiveBufferPool::AddReference( char *buffer )
+{
+	InterlockedIncrement( &( ( ReceiveBufferHeader* ) ( buffer - GetHeaderSize() ) ) ->references );
+
+}
+
+// Releases a holder's reference to a buffer, giving it back to the pool it
+// came from once no holders are left. Can be called from any thread
+void ReceiveBufferPool::Release( char *buffer )
+{
+	if( buffer == NULL )
+		return;
+
+	ReceiveBufferHeader *header = ( ReceiveBufferHeader* ) ( buffer - GetHeaderSize() );
+	if( InterlockedDecrement( &header ->references ) > 0 )
+		return;
+
+	if( header ->sizeClass == RECEIVE_BUFFER_CLASSES )
+		delete[] ( char* ) header;
+	else
+		InterlockedPushEntrySList( &header ->pool ->m_free[header ->sizeClass], &header ->entry );
+
+}
+
+// Returns the size of a buffer's header, rounded up so the buffer after it stays aligned
+unsigned long ReceiveBufferPool::GetHeaderSize()
+{
+	return ( sizeof( ReceiveBufferHeader ) + MEMORY_ALLOCATION_ALIGNMENT - 1 ) & ~( MEMORY_ALLOCATION_ALIGNMENT - 1 );
+}
+
+// Carve a new slab into buffers of the given class, returns false if no slab could be allocated
+bool ReceiveBufferPool::Grow( unsigned long sizeClass )
+{
+	EnterCriticalSection( &m_slabCS );
+
+	// Another thread may have grown the class while this one waited
+	if( QueryDepthSList( &m_free[sizeClass] ) > 0 )
+	{
+		LeaveCriticalSection( &m_slabCS );
+		return true;
+	}
+
+	// The first bytes of each slab link it to the last slab
+	char *slab = ( char* ) VirtualAlloc( NULL, RECEIVE_BUFFER_SLAB_SIZE, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE );
+	if( slab == NULL )
+	{
+		LeaveCriticalSection( &m_slabCS );
+		return false;
+	}
+
+	*( void** ) slab = m_slabs;
+	m_slabs = slab;
+
+	unsigned long stride = GetHeaderSize() + ( (unsigned long)RECEIVE_BUFFER_MIN_SIZE << sizeClass );
+	for( unsigned long offset = MEMORY_ALLOCATION_ALIGNMENT; offset + stride <= RECEIVE_BUFFER_SLAB_SIZE; offset += stride )
+		InterlockedPushEntrySList( &m_free[sizeClass], &( ( ReceiveBufferHeader* ) ( slab + offset ) ) ->entry );
+
+	LeaveCriticalSection( &m_slabCS );
+
+	return true;
+}
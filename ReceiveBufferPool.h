@@ -0,0 +1,65 @@
+// ************************************************************************
+//
+// File: ReceiveBufferPool.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Pool of variable sized buffers that received network messages are kept in
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef RECEIVE_BUFFER_POOL_H
+#define RECEIVE_BUFFER_POOL_H
+
+// Size of the buffers in the smallest size class. Each class holds buffers
+// twice the size of the one before.
+#define RECEIVE_BUFFER_MIN_SIZE 64
+
+// Number of size classes, the largest holding 8192 byte buffers.
+#define RECEIVE_BUFFER_CLASSES 8
+
+// Size of each slab a class's buffers are carved from.
+#define RECEIVE_BUFFER_SLAB_SIZE 65536
+
+class ReceiveBufferPool;
+
+// Receive buffer header structure, stored in front of every buffer.
+struct ReceiveBufferHeader
+{
+	SLIST_ENTRY entry;						// Link in the free list of its class while the buffer is free
+	ReceiveBufferPool *pool;				// Pool the buffer belongs to
+	unsigned long sizeClass;				// Size class of the buffer, or RECEIVE_BUFFER_CLASSES if it came from the heap
+	volatile long references;				// Number of holders of the buffer
+
+};
+
+// Receive buffer pool class. Each size class keeps its free buffers on an
+// interlocked list, so buffers can be taken by the transport's threads and
+// given back by the network's update without locking. A class only takes the
+// lock when it runs out and carves up a new slab. Buffers larger than the
+// largest class come from the heap. A buffer can be shared, such as by the
+// messages batched in one packet, and goes back to the pool once every holder
+// has released it. Every buffer must be released before its pool is destroyed.
+class ReceiveBufferPool
+{
+public:
+	ReceiveBufferPool();
+	virtual ~ReceiveBufferPool();
+
+	char *Allocate( unsigned long size );
+	static void AddReference( char *buffer );
+	static void Release( char *buffer );
+
+private:
+	static unsigned long GetHeaderSize();
+
+	bool Grow( unsigned long sizeClass );
+
+private:
+	SLIST_HEADER m_free[RECEIVE_BUFFER_CLASSES];		// Free buffers of each size class
+	CRITICAL_SECTION m_slabCS;									// Guards adding slabs
+	void *m_slabs;														// Last slab allocated, which starts with a link to the one before
+
+};
+
+#endif
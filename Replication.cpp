@@ -0,0 +1,653 @@
+// ************************************************************************
+//
+// File: Replication.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Replicates the state of networked scene objects from the host to the other players
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Replication class constructor
+Replication::Replication()
+{
+	ZeroMemory( m_objects, sizeof( m_objects ) );
+
+	m_sequence = 0;
+	m_lastSnapshot = 0;
+	m_current = new ReplicationSnapshot;
+	m_empty = new ReplicationSnapshot;
+	m_clients = new LinkedList< ReplicationClient >;
+
+	m_relevantDistance = REPLICATION_RELEVANT_DISTANCE;
+	ZeroMemory( m_queryStamps, sizeof( m_queryStamps ) );
+	m_queryStamp = 0;
+
+	m_received = new ReplicationSnapshot[REPLICATION_SNAPSHOT_HISTORY];
+	m_lastReceived = 0;
+	ZeroMemory( m_shown, sizeof( m_shown ) );
+
+	// Register the handlers of the replication messages
+	g_engine ->GetNetwork() ->GetMessageTable() ->Register( MSGID_SNAPSHOT, HandleSnapshot );
+	g_engine ->GetNetwork() ->GetMessageTable() ->Register( MSGID_SNAPSHOT_ACK, HandleAck );
+
+}
+
+// Replication class destructor
+Replication::~Replication()
+{
+	g_engine ->GetNetwork() ->GetMessageTable() ->Unregister( MSGID_SNAPSHOT );
+	g_engine ->GetNetwork() ->GetMessageTable() ->Unregister( MSGID_SNAPSHOT_ACK );
+
+	SAFE_DELETE( m_current );
+	SAFE_DELETE( m_empty );
+	SAFE_DELETE( m_clients );
+	SAFE_DELETE_ARRAY( m_received );
+
+}
+
+// Send the players a snapshot once the interval since the last has passed. Only the host sends snapshots
+void Replication::Update()
+{
+	if( g_engine ->GetNetwork() ->isHost() == false || m_clients ->GetTotalElements() == 0 )
+		return;
+
+	unsigned long now = timeGetTime();
+	if( now - m_lastSnapshot < REPLICATION_SNAPSHOT_INTERVAL )
+		return;
+
+	m_lastSnapshot = now;
+
+	Capture();
+
+	m_clients ->Iterate( true );
+	while( m_clients ->Iterate() )
+		SendSnapshot( m_clients ->GetCurrent() );
+
+}
+
+// Keep track of the players from the network's system messages, which are
+// then passed on to the game
+void Replication::HandleNetworkMessage( ReceivedMessage *msg )
+{
+	switch( msg ->msgid )
+	{
+	case MSGID_CREATE_PLAYER:
+		{
+			if( msg ->dpnid != g_engine ->GetNetwork() ->GetLocalID() && GetClient( msg ->dpnid ) == NULL )
+				m_clients ->Add( new ReplicationClient( msg ->dpnid ) );
+
+			break;
+		}
+
+	case MSGID_DESTROY_PLAYER:
+		{
+			ReplicationClient *client = GetClient( msg ->dpnid );
+			if( client != NULL )
+				m_clients ->Remove( &client );
+
+			break;
+		}
+
+	case MSGID_TERMINATE_SESSION:
+		{
+			ClearClients();
+
+			break;
+		}
+	}
+
+}
+
+// Register a networked object under the given network ID, returns false if the ID is invalid or taken
+bool Replication::Register( unsigned long id, SceneObject *object )
+{
+	if( id >= REPLICATION_MAX_OBJECTS || m_objects[id] != NULL )
+		return false;
+
+	m_objects[id] = object;
+	m_shown[id] = false;
+
+	return true;
+}
+
+// Stop replicating the object with the given network ID. Must be called before the object is destroyed
+void Replication::Unregister( unsigned long id )
+{
+	if( id < REPLICATION_MAX_OBJECTS )
+		m_objects[id] = NULL;
+
+}
+
+// Returns the object registered under the given network ID
+SceneObject *Replication::GetRegisteredObject( unsigned long id )
+{
+	if( id >= REPLICATION_MAX_OBJECTS )
+		return NULL;
+
+	return m_objects[id];
+}
+
+// Set the networked object a player views the scene from. Only objects near
+// it are then sent to the player. REPLICATION_INVALID_ID sends every object
+void Replication::SetViewer( DPNID dpnid, unsigned long id )
+{
+	ReplicationClient *client = GetClient( dpnid );
+	if( client != NULL )
+		client ->viewer = id;
+
+}
+
+// Set the distance from a viewer within which objects are relevant
+void Replication::SetRelevantDistance( float distance )
+{
+	if( distance > 0.0f )
+		m_relevantDistance = distance;
+
+}
+
+// Returns the distance from a viewer within which objects are relevant
+float Replication::GetRelevantDistance()
+{
+	return m_relevantDistance;
+
+}
+
+// Capture the state of every networked object into a new snapshot, and add
+// each to the grid in cells as wide as the relevant distance
+void Replication::Capture()
+{
+	m_current ->sequence = ++m_sequence;
+
+	for( unsigned long b = 0; b < REPLICATION_GRID_BUCKETS; b++ )
+		m_gridHeads[b] = -1;
+
+	for( unsigned long id = 0; id < REPLICATION_MAX_OBJECTS; id++ )
+	{
+		if( m_objects[id] == NULL )
+		{
+			m_current ->states[id].present = false;
+			continue;
+		}
+
+		Quantize( &m_current ->states[id], m_objects[id] );
+
+		D3DXVECTOR3 velocity = m_objects[id] ->GetVelocity();
+		m_positions[id] = m_objects[id] ->GetTranslation();
+		m_speeds[id] = D3DXVec3Length( &velocity );
+
+		unsigned long bucket = GetBucket( (long)floorf( m_positions[id].x / m_relevantDistance ), (long)floorf( m_positions[id].y / m_relevantDistance ), (long)floorf( m_positions[id].z / m_relevantDistance ) );
+		m_gridNext[id] = m_gridHeads[bucket];
+		m_gridHeads[bucket] = id;
+	}
+
+}
+
+// Send the latest snapshot to a player, encoded against the last one it
+// acknowledged. Objects are written by priority until the snapshot is full
+void Replication::SendSnapshot( ReplicationClient *client )
+{
+	Network *network = g_engine ->GetNetwork();
+
+	// Use the acknowledged snapshot as the baseline while it is still remembered
+	ReplicationSnapshot *baseline = m_empty;
+	if( client ->acked != 0 && m_sequence - client ->acked < REPLICATION_SNAPSHOT_HISTORY &&
+		client ->snapshots[client ->acked & ( REPLICATION_SNAPSHOT_HISTORY - 1 )].sequence == client ->acked )
+		baseline = &client ->snapshots[client ->acked & ( REPLICATION_SNAPSHOT_HISTORY - 1 )];
+
+	// Keep what the player will rebuild from this snapshot, which starts as the baseline
+	ReplicationSnapshot *sent = &client ->snapshots[m_sequence & ( REPLICATION_SNAPSHOT_HISTORY - 1 )];
+	memcpy( sent ->states, baseline ->states, sizeof( sent ->states ) );
+	sent ->sequence = m_sequence;
+
+	// Build up the priority of the relevant objects that changed, and list those that are due
+	unsigned long ids[REPLICATION_MAX_OBJECTS];
+	float nearness[REPLICATION_MAX_OBJECTS];
+	unsigned long totalRelevant = GatherRelevant( client, ids, nearness );
+	unsigned long totalDue = 0;
+
+	for( unsigned long r = 0; r < totalRelevant; r++ )
+	{
+		unsigned long id = ids[r];
+		ReplicatedState *base = &baseline ->states[id];
+
+		client ->relevant[id] = m_sequence;
+
+		if( base ->present == true && GetChanges( &m_current ->states[id], base ) == 0 )
+		{
+			client ->priority[id] = 0.0f;
+			continue;
+		}
+
+		// Objects new to the player are due straight away
+		float priority = max( nearness[r] * nearness[r], REPLICATION_MIN_PRIORITY ) * ( 1.0f + m_speeds[id] * REPLICATION_SPEED_PRIORITY );
+		if( base ->present == false )
+			priority += 1.0f;
+
+		client ->priority[id] += priority;
+		if( client ->priority[id] < 1.0f )
+			continue;
+
+		// Insert the object into the due list, highest priority first
+		unsigned long d = totalDue++;
+		while( d > 0 && client ->priority[ids[d - 1]] < client ->priority[id] )
+		{
+			ids[d] = ids[d - 1];
+			d--;
+		}
+		ids[d] = id;
+	}
+
+	SnapshotMessage snapshot;
+	snapshot.msgid = MSGID_SNAPSHOT;
+	snapshot.dpnid = network ->GetLocalID();
+	snapshot.sequence = m_sequence;
+	snapshot.baseline = baseline ->sequence;
+
+	// The last byte is kept for the bit that ends the objects
+	char message[REPLICATION_MAX_SNAPSHOT_SIZE];
+	MessageWriter writer( message, REPLICATION_MAX_SNAPSHOT_SIZE - 1 );
+	writer.Header( &snapshot );
+	snapshot.Serialize( &writer );
+
+	BitStream &stream = writer.stream;
+	unsigned long count = 0;
+
+	// Remove the objects the player has that are gone or no longer relevant
+	for( unsigned long id = 0; id < REPLICATION_MAX_OBJECTS; id++ )
+	{
+		if( baseline ->states[id].present == false || client ->relevant[id] == m_sequence )
+			continue;
+
+		unsigned long position = stream.position;
+
+		stream.WriteBool( true );
+		stream.WriteBits( id, REPLICATION_OBJECT_ID_BITS );
+		stream.WriteBool( false );
+
+		if( stream.error == true )
+		{
+			stream.position = position;
+			stream.error = false;
+			break;
+		}
+
+		sent ->states[id].present = false;
+		client ->priority[id] = 0.0f;
+		count++;
+	}
+
+	// Write the due objects until they no longer fit, the rest keep their priority
+	for( unsigned long d = 0; d < totalDue; d++ )
+	{
+		unsigned long id = ids[d];
+		unsigned long position = stream.position;
+
+		stream.WriteBool( true );
+		stream.WriteBits( id, REPLICATION_OBJECT_ID_BITS );
+		stream.WriteBool( true );
+		Encode( &stream, &m_current ->states[id], &baseline ->states[id] );
+
+		if( stream.error == true )
+		{
+			stream.position = position;
+			stream.error = false;
+			break;
+		}
+
+		sent ->states[id] = m_current ->states[id];
+		client ->priority[id] = 0.0f;
+		count++;
+	}
+
+	// Nothing changed, so the player has nothing to acknowledge
+	if( count == 0 )
+		return;
+
+	stream.size++;
+	stream.WriteBool( false );
+
+	network ->Send( message, stream.GetBytes(), client ->dpnid, NETWORK_UNRELIABLE_SEQUENCED );
+
+}
+
+// Find the objects relevant to a player along with how near each is to its
+// viewer, from one at the viewer to zero at the relevant distance. Returns the
+// number found. Every object is relevant to a player without a viewer
+unsigned long Replication::GatherRelevant( ReplicationClient *client, unsigned long *ids, float *nearness )
+{
+	unsigned long total = 0;
+
+	if( client ->viewer >= REPLICATION_MAX_OBJECTS || m_current ->states[client ->viewer].present == false )
+	{
+		for( unsigned long id = 0; id < REPLICATION_MAX_OBJECTS; id++ )
+		{
+			if( m_current ->states[id].present == true )
+			{
+				ids[total] = id;
+				nearness[total] = 1.0f;
+				total++;
+			}
+		}
+
+		return total;
+	}
+
+	// Search the cells around the viewer's. Different cells can share a
+	// bucket, so objects already found by this query are skipped
+	D3DXVECTOR3 viewer = m_positions[client ->viewer];
+	long cellX = (long)floorf( viewer.x / m_relevantDistance );
+	long cellY = (long)floorf( viewer.y / m_relevantDistance );
+	long cellZ = (long)floorf( viewer.z / m_relevantDistance );
+
+	m_queryStamp++;
+
+	for( long x = cellX - 1; x <= cellX + 1; x++ )
+	{
+		for( long y = cellY - 1; y <= cellY + 1; y++ )
+		{
+			for( long z = cellZ - 1; z <= cellZ + 1; z++ )
+			{
+				for( long id = m_gridHeads[GetBucket( x, y, z )]; id != -1; id = m_gridNext[id] )
+				{
+					if( m_queryStamps[id] == m_queryStamp )
+						continue;
+
+					m_queryStamps[id] = m_queryStamp;
+
+					D3DXVECTOR3 offset = m_positions[id] - viewer;
+					float distance = D3DXVec3Length( &offset );
+					if( distance > m_relevantDistance )
+						continue;
+
+					ids[total] = id;
+					nearness[total] = 1.0f - distance / m_relevantDistance;
+					total++;
+				}
+			}
+		}
+	}
+
+	return total;
+}
+
+// Returns the grid bucket of the given cell
+unsigned long Replication::GetBucket( long x, long y, long z )
+{
+	return ( (unsigned long)x * 73856093 ^ (unsigned long)y * 19349663 ^ (unsigned long)z * 83492791 ) & ( REPLICATION_GRID_BUCKETS - 1 );
+}
+
+// Rebuild a snapshot from the host against its baseline, apply it to the networked objects and acknowledge it
+void Replication::ReceiveSnapshot( ReceivedMessage *msg )
+{
+	Network *network = g_engine ->GetNetwork();
+	if( network ->isHost() == true || msg ->sender != network ->GetHostID() )
+		return;
+
+	SnapshotMessage snapshot;
+	MessageReader reader( msg ->data, msg ->size );
+	reader.Header( &snapshot );
+	snapshot.Serialize( &reader );
+
+	if( reader.IsValid() == false )
+		return;
+
+	// Ignore snapshots older than the one already applied
+	if( snapshot.sequence <= m_lastReceived )
+		return;
+
+	// The baseline must still be remembered
+	ReplicationSnapshot *baseline = m_empty;
+	if( snapshot.baseline != 0 )
+	{
+		if( snapshot.sequence - snapshot.baseline >= REPLICATION_SNAPSHOT_HISTORY )
+			return;
+
+		baseline = &m_received[snapshot.baseline & ( REPLICATION_SNAPSHOT_HISTORY - 1 )];
+		if( baseline ->sequence != snapshot.baseline )
+			return;
+	}
+
+	// Find the snapshot applied last, unless this one is about to take its place
+	ReplicationSnapshot *previous = NULL;
+	if( m_lastReceived != 0 && ( m_lastReceived & ( REPLICATION_SNAPSHOT_HISTORY - 1 ) ) != ( snapshot.sequence & ( REPLICATION_SNAPSHOT_HISTORY - 1 ) ) )
+		previous = &m_received[m_lastReceived & ( REPLICATION_SNAPSHOT_HISTORY - 1 )];
+
+	ReplicationSnapshot *received = &m_received[snapshot.sequence & ( REPLICATION_SNAPSHOT_HISTORY - 1 )];
+	memcpy( received ->states, baseline ->states, sizeof( received ->states ) );
+	received ->sequence = 0;
+
+	BitStream &stream = reader.stream;
+	unsigned long id;
+
+	while( stream.ReadBool() == true && stream.error == false )
+	{
+		id = stream.ReadBits( REPLICATION_OBJECT_ID_BITS );
+
+		if( stream.ReadBool() == true )
+			Decode( &stream, &received ->states[id] );
+		else
+			received ->states[id].present = false;
+	}
+
+	if( stream.error == true )
+		return;
+
+	received ->sequence = snapshot.sequence;
+	m_lastReceived = snapshot.sequence;
+
+	// Apply the objects that differ from the snapshot applied last
+	for( id = 0; id < REPLICATION_MAX_OBJECTS; id++ )
+	{
+		ReplicatedState *state = &received ->states[id];
+		// The object the local player controls is corrected by its input states instead
+		if( m_objects[id] == NULL || id == g_engine ->GetPrediction() ->GetControlled() )
+			continue;
+
+		// An object the host removed is gone until it is sent again, which
+		// applies its whole state and so brings it back
+		if( state ->present == false )
+		{
+			if( m_shown[id] == true )
+			{
+				m_objects[id] ->SetVisible( false );
+				m_objects[id] ->SetEnabled( false );
+				m_shown[id] = false;
+			}
+
+			continue;
+		}
+
+		if( m_shown[id] == false || previous == NULL || previous ->states[id].present == false || GetChanges( state, &previous ->states[id] ) != 0 )
+			Apply( state, m_objects[id] );
+
+		m_shown[id] = true;
+	}
+
+	SnapshotAckMessage ack;
+	ack.msgid = MSGID_SNAPSHOT_ACK;
+	ack.dpnid = network ->GetLocalID();
+	ack.sequence = snapshot.sequence;
+	network ->SendEncoded( &ack, network ->GetHostID(), NETWORK_UNRELIABLE_SEQUENCED );
+
+}
+
+// Note the latest snapshot a player has acknowledged
+void Replication::ReceiveAck( SnapshotAckMessage *ack )
+{
+	if( g_engine ->GetNetwork() ->isHost() == false )
+		return;
+
+	ReplicationClient *client = GetClient( ack ->dpnid );
+	if( client != NULL && ack ->sequence <= m_sequence && ack ->sequence > client ->acked )
+		client ->acked = ack ->sequence;
+
+}
+
+// Message table handler of snapshots
+void Replication::HandleSnapshot( ReceivedMessage *msg )
+{
+	g_engine ->GetReplication() ->ReceiveSnapshot( msg );
+
+}
+
+// Message table handler of snapshot acknowledgements, given them decoded
+void Replication::HandleAck( SnapshotAckMessage *ack )
+{
+	g_engine ->GetReplication() ->ReceiveAck( ack );
+
+}
+
+// Write the fields of a state that differ from its baseline as deltas. Every
+// field is written if the object was not in the baseline
+void Replication::Encode( BitStream *stream, ReplicatedState *state, ReplicatedState *baseline )
+{
+	unsigned long changes = REPLICATION_FIELD_TRANSLATION | REPLICATION_FIELD_ROTATION | REPLICATION_FIELD_VELOCITY | REPLICATION_FIELD_FLAGS;
+	if( baseline ->present == true )
+		changes = GetChanges( state, baseline );
+
+	stream ->WriteBits( changes, 4 );
+
+	for( unsigned long c = 0; c < 3; c++ )
+	{
+		if( changes & REPLICATION_FIELD_TRANSLATION )
+			stream ->WriteSigned( state ->translation[c] - baseline ->translation[c] );
+		if( changes & REPLICATION_FIELD_ROTATION )
+			stream ->WriteSigned( (short)( state ->rotation[c] - baseline ->rotation[c] ) );
+		if( changes & REPLICATION_FIELD_VELOCITY )
+			stream ->WriteSigned( state ->velocity[c] - baseline ->velocity[c] );
+	}
+
+	if( changes & REPLICATION_FIELD_FLAGS )
+		stream ->WriteBits( state ->flags, 5 );
+
+}
+
+// Read the deltas written by Encode onto a state holding its baseline
+void Replication::Decode( BitStream *stream, ReplicatedState *state )
+{
+	unsigned long changes = stream ->ReadBits( 4 );
+
+	for( unsigned long c = 0; c < 3; c++ )
+	{
+		if( changes & REPLICATION_FIELD_TRANSLATION )
+			state ->translation[c] += stream ->ReadSigned();
+		if( changes & REPLICATION_FIELD_ROTATION )
+			state ->rotation[c] = (unsigned short)( state ->rotation[c] + stream ->ReadSigned() );
+		if( changes & REPLICATION_FIELD_VELOCITY )
+			state ->velocity[c] += stream ->ReadSigned();
+	}
+
+	if( changes & REPLICATION_FIELD_FLAGS )
+		state ->flags = (unsigned char)stream ->ReadBits( 5 );
+
+	state ->present = true;
+
+}
+
+// Returns the mask of the fields that differ between two states
+unsigned long Replication::GetChanges( ReplicatedState *state, ReplicatedState *baseline )
+{
+	unsigned long changes = 0;
+
+	for( unsigned long c = 0; c < 3; c++ )
+	{
+		if( state ->translation[c] != baseline ->translation[c] )
+			changes |= REPLICATION_FIELD_TRANSLATION;
+		if( state ->rotation[c] != baseline ->rotation[c] )
+			changes |= REPLICATION_FIELD_ROTATION;
+		if( state ->velocity[c] != baseline ->velocity[c] )
+			changes |= REPLICATION_FIELD_VELOCITY;
+	}
+
+	if( state ->flags != baseline ->flags )
+		changes |= REPLICATION_FIELD_FLAGS;
+
+	return changes;
+}
+
+// Quantize an object's state for sending
+void Replication::Quantize( ReplicatedState *state, SceneObject *object )
+{
+	D3DXVECTOR3 translation = object ->GetTranslation();
+	D3DXVECTOR3 rotation = object ->GetRotation();
+	D3DXVECTOR3 velocity = object ->GetVelocity();
+
+	for( unsigned long c = 0; c < 3; c++ )
+	{
+		state ->translation[c] = (long)floorf( translation[c] * REPLICATION_TRANSLATION_SCALE + 0.5f );
+		state ->velocity[c] = (long)floorf( velocity[c] * REPLICATION_VELOCITY_SCALE + 0.5f );
+
+		// Rotations are wrapped to a single turn
+		float turns = rotation[c] / ( 2.0f * D3DX_PI );
+		turns -= floorf( turns );
+		state ->rotation[c] = (unsigned short)(long)floorf( turns * 65536.0f + 0.5f );
+	}
+
+	state ->flags = 0;
+	if( object ->GetVisible() == true )
+		state ->flags |= REPLICATION_FLAG_VISIBLE;
+	if( object ->GetEnabled() == true )
+		state ->flags |= REPLICATION_FLAG_ENABLED;
+	if( object ->GetGhost() == true )
+		state ->flags |= REPLICATION_FLAG_GHOST;
+	if( object ->IsTouchingGround() == true )
+		state ->flags |= REPLICATION_FLAG_TOUCHING_GROUND;
+	if( object ->GetSleeping() == true )
+		state ->flags |= REPLICATION_FLAG_SLEEPING;
+
+	state ->present = true;
+
+}
+
+// Set an object to a received state
+void Replication::Apply( ReplicatedState *state, SceneObject *object )
+{
+	D3DXVECTOR3 translation, rotation, velocity;
+
+	for( unsigned long c = 0; c < 3; c++ )
+	{
+		translation[c] = state ->translation[c] / REPLICATION_TRANSLATION_SCALE;
+		rotation[c] = state ->rotation[c] * ( 2.0f * D3DX_PI / 65536.0f );
+		velocity[c] = state ->velocity[c] / REPLICATION_VELOCITY_SCALE;
+	}
+
+	object ->SetTranslation( translation );
+	object ->SetRotation( rotation );
+	object ->SetVelocity( velocity );
+
+	object ->SetVisible( ( state ->flags & REPLICATION_FLAG_VISIBLE ) != 0 );
+	object ->SetEnabled( ( state ->flags & REPLICATION_FLAG_ENABLED ) != 0 );
+	object ->SetGhost( ( state ->flags & REPLICATION_FLAG_GHOST ) != 0 );
+	object ->SetTouchingGroundFlag( ( state ->flags & REPLICATION_FLAG_TOUCHING_GROUND ) != 0 );
+
+	// Set after the velocity, which wakes the object
+	object ->SetSleeping( ( state ->flags & REPLICATION_FLAG_SLEEPING ) != 0 );
+
+}
+
+// Returns the client record of the given player
+ReplicationClient *Replication::GetClient( DPNID dpnid )
+{
+	m_clients ->Iterate( true );
+	while( m_clients ->Iterate() )
+		if( m_clients ->GetCurrent() ->dpnid == dpnid )
+			return m_clients ->GetCurrent();
+
+	return NULL;
+}
+
+// Forget the players and the snapshots received once the session ends
+void Replication::ClearClients()
+{
+	m_clients ->Empty();
+
+	for( unsigned long s = 0; s < REPLICATION_SNAPSHOT_HISTORY; s++ )
+		m_received[s].sequence = 0;
+
+	m_lastReceived = 0;
+	ZeroMemory( m_shown, sizeof( m_shown ) );
+
+}
@@ -0,0 +1,225 @@
+// ************************************************************************
+//
+// File: Replication.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Replicates the state of networked scene objects from the host to the other players
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef REPLICATION_H
+#define REPLICATION_H
+
+// Replication message IDs
+#define MSGID_SNAPSHOT 0x12004
+#define MSGID_SNAPSHOT_ACK 0x12005
+
+// Number of networked objects that can be registered, and the bits a network ID is sent in.
+#define REPLICATION_OBJECT_ID_BITS 8
+#define REPLICATION_MAX_OBJECTS ( 1 << REPLICATION_OBJECT_ID_BITS )
+
+// Network ID of no object.
+#define REPLICATION_INVALID_ID 0xFFFFFFFF
+
+// Number of snapshots remembered as baselines. Must be a power of two.
+#define REPLICATION_SNAPSHOT_HISTORY 32
+
+// Time in milliseconds between the host's snapshots.
+#define REPLICATION_SNAPSHOT_INTERVAL 50
+
+// Largest snapshot message sent, so it fits in a single UDP packet.
+#define REPLICATION_MAX_SNAPSHOT_SIZE 1024
+
+// Steps per unit translations and velocities are quantized to.
+#define REPLICATION_TRANSLATION_SCALE 100.0f
+#define REPLICATION_VELOCITY_SCALE 100.0f
+
+// Default distance from a player's viewer within which objects are relevant to the player.
+#define REPLICATION_RELEVANT_DISTANCE 100.0f
+
+// Number of buckets in the grid objects are found in. Must be a power of two.
+#define REPLICATION_GRID_BUCKETS 1024
+
+// Least priority a relevant object that changed gains each snapshot, so even
+// the furthest objects are sent at least every 1 / REPLICATION_MIN_PRIORITY snapshots.
+#define REPLICATION_MIN_PRIORITY 0.05f
+
+// Extra priority an object gains for each unit/second of its speed.
+#define REPLICATION_SPEED_PRIORITY 0.1f
+
+// Fields of a replicated state, used as the mask of the fields that changed
+#define REPLICATION_FIELD_TRANSLATION 1
+#define REPLICATION_FIELD_ROTATION 2
+#define REPLICATION_FIELD_VELOCITY 4
+#define REPLICATION_FIELD_FLAGS 8
+
+// Object flags carried in a replicated state
+#define REPLICATION_FLAG_VISIBLE 1
+#define REPLICATION_FLAG_ENABLED 2
+#define REPLICATION_FLAG_GHOST 4
+#define REPLICATION_FLAG_TOUCHING_GROUND 8
+#define REPLICATION_FLAG_SLEEPING 16
+
+// Snapshot message structure. It is followed in the same bit stream by the
+// objects that changed since the baseline, each behind a set bit, and ends with a clear bit.
+struct SnapshotMessage : public NetworkMessage
+{
+	unsigned long sequence;		// Sequence number of the snapshot
+	unsigned long baseline;		// Snapshot the objects were encoded against, or zero if none
+
+	// Message schema
+	template< class Stream > void Serialize( Stream *stream )
+	{
+		stream ->Unsigned( sequence );
+		stream ->Unsigned( baseline );
+	}
+
+};
+
+// Snapshot acknowledgement message structure
+struct SnapshotAckMessage : public NetworkMessage
+{
+	unsigned long sequence;		// Sequence number of the snapshot received
+
+	// Message schema
+	template< class Stream > void Serialize( Stream *stream )
+	{
+		stream ->Unsigned( sequence );
+	}
+
+};
+
+// Replicated state structure, an object's state quantized for sending.
+struct ReplicatedState
+{
+	long translation[3];						// Translation in steps of 1 / REPLICATION_TRANSLATION_SCALE units
+	unsigned short rotation[3];			// Rotation in 65536ths of a full turn
+	long velocity[3];							// Velocity in steps of 1 / REPLICATION_VELOCITY_SCALE units/second
+	unsigned char flags;					// Object flags
+	bool present;								// Indicates if the object is in the snapshot
+
+};
+
+// Replication snapshot structure, the state of every networked object at once.
+struct ReplicationSnapshot
+{
+	unsigned long sequence;													// Sequence number of the snapshot, zero if unused
+	ReplicatedState states[REPLICATION_MAX_OBJECTS];		// State of each object, by network ID
+
+	// Replication snapshot constructor
+	ReplicationSnapshot()
+	{
+		sequence = 0;
+		ZeroMemory( states, sizeof( states ) );
+	}
+
+};
+
+// Replication client structure, a player the host sends snapshots to. It
+// keeps every snapshot sent to the player as the player will decode it, so
+// whichever the player acknowledges can be used as the next baseline.
+struct ReplicationClient
+{
+	DPNID dpnid;																	// Player the snapshots are sent to
+	unsigned long acked;														// Latest snapshot the player acknowledged, zero if none
+	ReplicationSnapshot *snapshots;										// Snapshots sent to the player
+	unsigned long viewer;														// Network ID of the object the player views the scene from
+	float priority[REPLICATION_MAX_OBJECTS];						// Priority each object has built up since it was last sent
+	unsigned long relevant[REPLICATION_MAX_OBJECTS];			// Last snapshot each object was relevant to the player in
+
+	// Replication client constructor
+	ReplicationClient( DPNID id )
+	{
+		dpnid = id;
+		acked = 0;
+		snapshots = new ReplicationSnapshot[REPLICATION_SNAPSHOT_HISTORY];
+		viewer = REPLICATION_INVALID_ID;
+		ZeroMemory( priority, sizeof( priority ) );
+		ZeroMemory( relevant, sizeof( relevant ) );
+	}
+
+	// Replication client destructor
+	~ReplicationClient()
+	{
+		SAFE_DELETE_ARRAY( snapshots );
+	}
+
+};
+
+// Replication class. The game registers each networked scene object under the
+// same network ID on every machine. The host regularly captures the state of
+// them all and sends each player only the objects that changed since the last
+// snapshot the player acknowledged, with each field quantized and bit packed.
+// Players rebuild the snapshot from that baseline and apply it to their objects.
+//
+// Once the host gives a player a viewer, only objects within the relevant
+// distance of it are sent to that player, found through a hashed grid of the
+// captured objects. Each relevant object that changed builds up priority,
+// faster the nearer and quicker it is, and is sent once that reaches one.
+// Objects leaving the area are sent as removed, and objects that do not fit
+// in the snapshot keep their priority for the next. A player hides and
+// disables an object the host removes, until a snapshot carries it again.
+class Replication
+{
+public:
+	Replication();
+	virtual ~Replication();
+
+	void Update();
+
+	void HandleNetworkMessage( ReceivedMessage *msg );
+
+	bool Register( unsigned long id, SceneObject *object );
+	void Unregister( unsigned long id );
+	SceneObject *GetRegisteredObject( unsigned long id );
+
+	void SetViewer( DPNID dpnid, unsigned long id );
+	void SetRelevantDistance( float distance );
+	float GetRelevantDistance();
+
+private:
+	void Capture();
+	void SendSnapshot( ReplicationClient *client );
+	unsigned long GatherRelevant( ReplicationClient *client, unsigned long *ids, float *nearness );
+	unsigned long GetBucket( long x, long y, long z );
+	void ReceiveSnapshot( ReceivedMessage *msg );
+	void ReceiveAck( SnapshotAckMessage *ack );
+
+	static void HandleSnapshot( ReceivedMessage *msg );
+	static void HandleAck( SnapshotAckMessage *ack );
+
+	void Encode( BitStream *stream, ReplicatedState *state, ReplicatedState *baseline );
+	void Decode( BitStream *stream, ReplicatedState *state );
+	unsigned long GetChanges( ReplicatedState *state, ReplicatedState *baseline );
+
+	void Quantize( ReplicatedState *state, SceneObject *object );
+	void Apply( ReplicatedState *state, SceneObject *object );
+
+	ReplicationClient *GetClient( DPNID dpnid );
+	void ClearClients();
+
+private:
+	SceneObject *m_objects[REPLICATION_MAX_OBJECTS];			// Networked objects, by network ID
+
+	unsigned long m_sequence;													// Sequence number of the last snapshot captured
+	unsigned long m_lastSnapshot;												// Time the last snapshot was captured
+	ReplicationSnapshot *m_current;											// Last snapshot captured by the host
+	ReplicationSnapshot *m_empty;												// Snapshot with no objects, the baseline before any are acknowledged
+	LinkedList< ReplicationClient > *m_clients;							// Players the host sends snapshots to
+
+	float m_relevantDistance;														// Distance from a viewer within which objects are relevant
+	long m_gridHeads[REPLICATION_GRID_BUCKETS];						// First captured object in each grid bucket, or -1
+	long m_gridNext[REPLICATION_MAX_OBJECTS];						// Next captured object in the same bucket, or -1
+	D3DXVECTOR3 m_positions[REPLICATION_MAX_OBJECTS];		// Translation of each captured object
+	float m_speeds[REPLICATION_MAX_OBJECTS];						// Speed of each captured object
+	unsigned long m_queryStamps[REPLICATION_MAX_OBJECTS];	// Last grid query each object was found by
+	unsigned long m_queryStamp;													// Stamp of the current grid query
+
+	ReplicationSnapshot *m_received;											// Snapshots received from the host
+	unsigned long m_lastReceived;												// Sequence number of the latest snapshot received
+	bool m_shown[REPLICATION_MAX_OBJECTS];								// Indicates if each object was in the last snapshot applied
+
+};
+
+#endif
@@ -12,7 +12,7 @@
 #include "Engine.h"
 
 // Scene manager class constructor.
-SceneManager::SceneManager( float scale, char *spawnerPath )
+SceneManager::SceneManager( float scale, char *spawnerPath, bool threadedCulling )
 {
 	m_name = NULL;
 	m_scale = scale;
@@ -22,15 +22,21 @@ SceneManager::SceneManager( float scale, char *spawnerPath )
 	m_maxFaces = 0;
 	m_maxHalfSize = 0.0f;
 	m_frameStamp = 0;
+	m_sleepVelocity = 0.05f / m_scale;
+	m_sleepFrames = 30;
 
 	m_dynamicObjects = new LinkedList< SceneObject >;
 	m_occludingObjects = NULL;
 	m_visibleOccluders = NULL;
+	m_occlusionVolumes = NULL;
+	m_maxOccluders = 8;
 	m_playerSpawnPoints = NULL;
 	m_objectSpawners = NULL;
 	m_spawnerPath = spawnerPath;
 
 	m_firstLeaf = NULL;
+	m_totalLeaves = 0;
+	m_pvs = NULL;
 
 	m_sceneVertexBuffer = NULL;
 	m_vertices = NULL;
@@ -38,6 +44,26 @@ SceneManager::SceneManager( float scale, char *spawnerPath )
 
 	m_renderCaches = NULL;
 
+	m_instancingShader = new InstancingShader( g_engine->GetDevice() );
+	m_instanceCaches = NULL;
+
+	m_occlusionBuffer = NULL;
+	D3DXMatrixIdentity( &m_projection );
+	D3DXMatrixIdentity( &m_viewProjection );
+	m_maxOcclusionFaces = 0;
+	m_totalOcclusionFaces = 0;
+
+	m_lodScale = 1.0f;
+	m_lodHysteresis = 0.1f;
+
+	m_cullStamp = 0;
+	m_cullViewer = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	D3DXMatrixIdentity( &m_cullViewProjection );
+	m_drawFrame = NULL;
+	m_cullFrame = NULL;
+	m_threadedCulling = threadedCulling;
+	m_cullJob = NULL;
+
 	m_totalFaces = 0;
 	m_faces = NULL;
 	m_totalCollisionFaces = 0;
@@ -53,6 +79,9 @@ SceneManager::~SceneManager()
 	// Destroy dynamic objects list 
 	SAFE_DELETE( m_dynamicObjects );
 
+	// Destroy the shader used for instancing.
+	SAFE_DELETE( m_instancingShader );
+
 }
 
 // Loads a new scene from the given scene file.
@@ -106,6 +135,38 @@ void SceneManager::LoadScene( char *name, char *path )
 	m_maxFaces = *script->GetNumberData( "max_faces" );
 	m_maxHalfSize = *script->GetFloatData( "max_half_size" );
 
+	// Store the thresholds for putting resting objects to sleep, if the scene overrides them.
+	if( script->GetFloatData( "sleep_velocity" ) != NULL )
+		m_sleepVelocity = *script->GetFloatData( "sleep_velocity" ) / m_scale;
+	if( script->GetNumberData( "sleep_frames" ) != NULL )
+		m_sleepFrames = *script->GetNumberData( "sleep_frames" );
+
+	// Store the level of detail hysteresis, if the scene overrides it.
+	if( script->GetFloatData( "lod_hysteresis" ) != NULL )
+		m_lodHysteresis = *script->GetFloatData( "lod_hysteresis" );
+
+	// Create the occlusion buffer, using the scene's resolution and face budget if it has them.
+	unsigned long occlusionWidth = 256;
+	unsigned long occlusionHeight = 128;
+	m_maxOcclusionFaces = 2048;
+	if( script->GetNumberData( "occlusion_width" ) != NULL )
+		occlusionWidth = *script->GetNumberData( "occlusion_width" );
+	if( script->GetNumberData( "occlusion_height" ) != NULL )
+		occlusionHeight = *script->GetNumberData( "occlusion_height" );
+	if( script->GetNumberData( "occlusion_faces" ) != NULL )
+		m_maxOcclusionFaces = *script->GetNumberData( "occlusion_faces" );
+	m_occlusionBuffer = new OcclusionBuffer( occlusionWidth, occlusionHeight );
+
+	// Create the occlusion volumes for the largest occluders.
+	if( script->GetNumberData( "max_occluders" ) != NULL )
+		m_maxOccluders = *script->GetNumberData( "max_occluders" );
+	m_occlusionVolumes = new OcclusionVolumes( m_maxOccluders );
+
+	// Store the cell size of the potentially visible sets, if the scene uses them.
+	float pvsCellSize = 0.0f;
+	if( script->GetFloatData( "pvs_cell_size" ) != NULL )
+		pvsCellSize = *script->GetFloatData( "pvs_cell_size" );
+
 	// Load the scene's mesh.
 	m_mesh = g_engine->GetMeshManager()->Add( script->GetStringData( "mesh" ), script->GetStringData( "mesh_path" ) );
 
@@ -121,10 +182,17 @@ void SceneManager::LoadScene( char *name, char *path )
 
 	// Set the view frustum's projection matrix.
 	m_viewFrustum.SetProjectionMatrix( projection );
+	m_projection = projection;
+
+	// The projection's y scale turns a radius over distance into a fraction of the screen height.
+	m_lodScale = projection._22;
 
 	// Create the list of render caches.
 	m_renderCaches = new LinkedList< RenderCache >;
 
+	// Create the list of instance caches. They are added as shared meshes are rendered.
+	m_instanceCaches = new LinkedList< InstanceCache >;
+
 	// Search the mesh for unique materials.
 	for( unsigned long m = 0; m < m_mesh->GetStaticMesh()->NumMaterials; m++ )
 	{
@@ -288,6 +356,10 @@ void SceneManager::LoadScene( char *name, char *path )
 	m_faces = new SceneFace[m_totalFaces];
 	m_collisionFaces = new SceneFace*[m_totalFaces];
 
+	// Each render frame can hold every face in the scene.
+	for( char f = 0; f < 2; f++ )
+		m_renderFrames[f].faces = new unsigned long[m_totalFaces];
+
 	// Set the number of vertices.
 	m_totalVertices = m_totalFaces * 3;
 
@@ -369,6 +441,29 @@ void SceneManager::LoadScene( char *name, char *path )
 	// Recursively build the scene, starting with the first leaf.
 	RecursiveSceneBuild( m_firstLeaf, m_mesh->GetBoundingSphere() ->center, m_mesh->GetBoundingBox()->halfSize );
 
+	// Load the scene's potentially visible sets from the file stored next to
+	// the scene's script. If the file is missing or was built for different
+	// geometry, then build the sets and save them for next time.
+	if( pvsCellSize > 0.0f )
+	{
+		m_pvs = new PotentiallyVisibleSet( m_firstLeaf->GetBoundingBox()->min, m_firstLeaf->GetBoundingBox()->max, pvsCellSize, m_totalLeaves, GetGeometryHash() );
+
+		char *pvsFilename = new char[strlen( path ) + strlen( name ) + 5];
+		sprintf( pvsFilename, "%s%s", path, name );
+		char *extension = strrchr( pvsFilename, '.' );
+		if( extension != NULL && strpbrk( extension, "/\\" ) == NULL )
+			*extension = 0;
+		strcat( pvsFilename, ".pvs" );
+
+		if( m_pvs->Load( pvsFilename ) == false )
+		{
+			BuildPotentiallyVisibleSet();
+			m_pvs->Save( pvsFilename );
+		}
+
+		SAFE_DELETE_ARRAY( pvsFilename );
+	}
+
 	// Allow the render caches to prepare themselves.
 	m_renderCaches->Iterate( true );
 	while( m_renderCaches->Iterate() )
@@ -381,6 +476,15 @@ void SceneManager::LoadScene( char *name, char *path )
 // Destroys the currently loaded scene.
 void SceneManager::DestroyScene()
 {
+	// Finish culling and throw away the frame that was waiting to be drawn.
+	WaitForCulling();
+	m_drawFrame = NULL;
+	for( char f = 0; f < 2; f++ )
+	{
+		ReleaseRenderFrame( &m_renderFrames[f] );
+		m_renderFrames[f].Destroy();
+	}
+
 	// Destroy the array of collision faces.
 	SAFE_DELETE_ARRAY( m_collisionFaces );
 	m_totalCollisionFaces = 0;
@@ -392,6 +496,12 @@ void SceneManager::DestroyScene()
 	// Destroy the list of render caches.
 	SAFE_DELETE( m_renderCaches );
 
+	// Destroy the list of instance caches, releasing their shared meshes.
+	SAFE_DELETE( m_instanceCaches );
+
+	// Destroy the occlusion buffer.
+	SAFE_DELETE( m_occlusionBuffer );
+
 	// Release the scene's vertex buffer.
 //	SAFE_RELEASE( m_sceneVertexBuffer );
 	if( m_sceneVertexBuffer )
@@ -403,8 +513,10 @@ void SceneManager::DestroyScene()
 	m_vertices = NULL;
 	m_totalVertices = 0;
 
-	// Destroy the scene leaf hierarchy.
+	// Destroy the scene leaf hierarchy and its potentially visible sets.
 	SAFE_DELETE( m_firstLeaf );
+	SAFE_DELETE( m_pvs );
+	m_totalLeaves = 0;
 
 	// Destroy the object spawner list.
 	if( m_objectSpawners != NULL )
@@ -424,6 +536,7 @@ void SceneManager::DestroyScene()
 
 	SAFE_DELETE( m_visibleOccluders );
 	SAFE_DELETE( m_occludingObjects );
+	SAFE_DELETE( m_occlusionVolumes );
 
 	// Empty the list of dynamic objects.
 	m_dynamicObjects->Empty();
@@ -459,49 +572,102 @@ void SceneManager::Update( float elapsed, D3DXMATRIX *view )
 	// Update the view frustum.
 	m_viewFrustum.Update( view );
 
-	// Go through all the dynamic object's and update them.
+	// Store the view projection matrix for the occlusion buffer.
+	D3DXMatrixMultiply( &m_viewProjection, view, &m_projection );
+
+	// Go through all the dynamic object's and update them. Input driven
+	// objects are moved by their input commands instead.
 	m_dynamicObjects->Iterate( true );
 	while( m_dynamicObjects->Iterate() )
 	{
-		// Ignore the object if it is not enabled.
-		if( m_dynamicObjects->GetCurrent()->GetEnabled() == false )
+		if( m_dynamicObjects->GetCurrent()->GetInputDriven() == true )
 			continue;
 
-		// If this object is a ghost, then it cannot collided with anything.
-		// However, it still needs to be updated. Since objects receive their
-		// movement through the collision system, ghost objects will have to be
-		// allowed to update their movement manually.
-		if( m_dynamicObjects->GetCurrent()->GetGhost() == true )
-		{
-			m_dynamicObjects->GetCurrent()->Update( elapsed );
-			continue;
-		}
+		UpdateObject( m_dynamicObjects->GetCurrent(), elapsed );
+	}
 
-		// Objects without an ellipsoid radius cannot collide with anything.
-		if( m_dynamicObjects->GetCurrent()->GetEllipsoidRadius().x + m_dynamicObjects->GetCurrent()->GetEllipsoidRadius().y + m_dynamicObjects->GetCurrent()->GetEllipsoidRadius().z <= 0.0f )
-		{
-			m_dynamicObjects->GetCurrent()->Update( elapsed );
-			continue;
-		}
+	// Rebuild the transforms of every object that moved in one pass.
+	g_engine->GetTransformSystem()->Update();
+
+	// Evaluate the poses of every animated object across the job system.
+	g_engine->GetAnimationSystem()->Update();
+
+}
+
+// Updates a single dynamic object, moving it through the scene with collision
+// detection. Input driven objects are updated through here for each command.
+void SceneManager::UpdateObject( SceneObject *object, float elapsed )
+{
+	// Ignore the object if it is not enabled.
+	if( object->GetEnabled() == false )
+		return;
 
-		// Build the array of possible collision faces for the current object.
-		m_totalCollisionFaces = 0;
-		RecursiveBuildCollisionArray( m_firstLeaf, m_dynamicObjects->GetCurrent() );
+	// Without a scene there is nothing to collide with.
+	if( m_firstLeaf == NULL )
+	{
+		object->Update( elapsed );
+		return;
+	}
 
-		// Build the collision data for this object.
-		static CollisionData collisionData;
-		collisionData.scale = m_scale;
-		collisionData.elapsed = elapsed;
-		collisionData.frameStamp = m_frameStamp;
-		collisionData.object = m_dynamicObjects->GetCurrent();
-		collisionData.gravity = m_gravity * elapsed;
+	// If this object is a ghost, then it cannot collided with anything.
+	// However, it still needs to be updated. Since objects receive their
+	// movement through the collision system, ghost objects will have to be
+	// allowed to update their movement manually.
+	if( object->GetGhost() == true )
+	{
+		object->Update( elapsed );
+		return;
+	}
 
-		// Perform collision detection for this object.
-		PerformCollisionDetection( &collisionData, (Vertex*)m_vertices, m_collisionFaces, m_totalCollisionFaces, m_dynamicObjects );
+	// Objects without an ellipsoid radius cannot collide with anything.
+	if( object->GetEllipsoidRadius().x + object->GetEllipsoidRadius().y + object->GetEllipsoidRadius().z <= 0.0f )
+	{
+		object->Update( elapsed );
+		return;
+	}
+
+	// Sleeping objects skip collision detection until something wakes them.
+	if( object->GetSleeping() == true )
+	{
+		object->Update( elapsed, false );
+		return;
+	}
 
-		// Allow the object to update itself.
-		m_dynamicObjects->GetCurrent()->Update( elapsed, false );
+	// Build the array of possible collision faces for the current object.
+	D3DXVECTOR3 previousTranslation = object->GetTranslation();
+	m_totalCollisionFaces = 0;
+	RecursiveBuildCollisionArray( m_firstLeaf, object );
+
+	// Build the collision data for this object.
+	static CollisionData collisionData;
+	collisionData.scale = m_scale;
+	collisionData.elapsed = elapsed;
+	collisionData.frameStamp = m_frameStamp;
+	collisionData.object = object;
+	collisionData.gravity = m_gravity * elapsed;
+
+	// Perform collision detection for this object.
+	PerformCollisionDetection( &collisionData, (Vertex*)m_vertices, m_collisionFaces, m_totalCollisionFaces, m_dynamicObjects );
+
+	// Allow the object to update itself.
+	object->Update( elapsed, false );
+
+	// An object that is barely moving and has nothing left to fall onto is
+	// at rest. Once it has been at rest for long enough it goes to sleep.
+	D3DXVECTOR3 movement = object->GetTranslation() - previousTranslation;
+	float restSpeed = m_sleepVelocity * elapsed;
+	if( ( object->IsTouchingGround() == true || m_gravity == D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) ) && object->GetSpin() == D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) &&
+		D3DXVec3LengthSq( &object->GetVelocity() ) <= m_sleepVelocity * m_sleepVelocity && D3DXVec3LengthSq( &movement ) <= restSpeed * restSpeed )
+	{
+		object->SetRestFrames( object->GetRestFrames() + 1 );
+		if( object->GetRestFrames() >= m_sleepFrames )
+		{
+			object->SetSleeping( true );
+			object->Stop();
+		}
 	}
+	else
+		object->SetRestFrames( 0 );
 
 }
 
@@ -512,49 +678,216 @@ void SceneManager::Render( float elapsed, D3DXVECTOR3 viewer )
 	if( m_firstLeaf == NULL )
 		return;
 
+	// Without threaded culling, the frame is captured, culled and drawn in turn.
+	if( m_threadedCulling == false )
+	{
+		CaptureRenderFrame( &m_renderFrames[0], viewer );
+		Cull( &m_renderFrames[0] );
+		Submit( &m_renderFrames[0] );
+		return;
+	}
+
+	// Wait for the culling of the previous frame to finish, then draw it. This
+	// frame's objects have already been updated, so the image is one frame
+	// behind the simulation.
+	WaitForCulling();
+	if( m_drawFrame != NULL )
+		Submit( m_drawFrame );
+
+	// Capture this frame into the other buffer and start culling it. The job
+	// system's workers cull it while the next frame is updated.
+	RenderFrame *frame = &m_renderFrames[m_drawFrame == &m_renderFrames[0] ? 1 : 0];
+	CaptureRenderFrame( frame, viewer );
+	m_drawFrame = frame;
+	m_cullJob = g_engine->GetJobSystem()->CreateJob( CullJob, this );
+	g_engine->GetJobSystem()->Run( m_cullJob );
+
+}
+
+// Captures the state of the visible objects and the viewer for culling.
+void SceneManager::CaptureRenderFrame( RenderFrame *frame, D3DXVECTOR3 viewer )
+{
+	// Store the viewer for the frame.
+	m_cullStamp = m_frameStamp;
+	m_cullViewer = viewer;
+	m_cullFrustum = m_viewFrustum;
+	m_cullViewProjection = m_viewProjection;
+
+	// Let go of the meshes the frame held from its last capture.
+	ReleaseRenderFrame( frame );
+
+	// Make sure the frame can hold every object.
+	frame->Reserve( m_dynamicObjects->GetTotalElements() );
+
+	// Take a snapshot of every visible object.
+	frame->totalObjects = 0;
+	frame->totalPoses = 0;
+	frame->bounds.Clear();
+	m_dynamicObjects->Iterate( true );
+	while( m_dynamicObjects->Iterate() )
+	{
+		SceneObject *object = m_dynamicObjects->GetCurrent();
+		if( object->GetVisible() == false )
+			continue;
+
+		RenderSnapshot *snapshot = &frame->objects[frame->totalObjects++];
+		snapshot->object = object;
+		snapshot->world = *object->GetWorldMatrix();
+
+		// Hold a reference to the mesh, so it outlives the object changing or
+		// destroying it before the frame is drawn.
+		snapshot->mesh = object->GetMesh();
+		snapshot->sharedMesh = object->GetSharedMesh();
+		if( snapshot->mesh != NULL )
+			snapshot->mesh->IncRef();
+
+		// Copy the pose along with the world matrix, so both are drawn from the same frame.
+		D3DXMATRIX *pose = object->GetPose( &snapshot->totalBones );
+		if( pose != NULL && snapshot->totalBones > 0 )
+			snapshot->pose = frame->AddPose( pose, snapshot->totalBones );
+		else
+			snapshot->totalBones = 0;
+
+		frame->bounds.Add( object->GetBoundingBox(), object->GetBoundingSphere() );
+		snapshot->lod = object->GetLOD();
+
+		// Objects sharing a static mesh are drawn with the mesh's instance cache.
+		snapshot->instanced = object->GetInstanced() == true && object->GetSharedMesh() == true && snapshot->mesh != NULL && snapshot->mesh->IsSkinned() == false;
+	}
+
+}
+
+// Releases the references the given frame holds to its objects' meshes.
+void SceneManager::ReleaseRenderFrame( RenderFrame *frame )
+{
+	for( unsigned long o = 0; o < frame->totalObjects; o++ )
+		SceneObject::ReleaseMesh( &frame->objects[o].mesh, frame->objects[o].sharedMesh );
+
+	frame->totalObjects = 0;
+
+}
+
+// Determines the visible faces and objects of the given frame.
+void SceneManager::Cull( RenderFrame *frame )
+{
 	// Clear the list of visible occluders.
 	m_visibleOccluders->ClearPointers();
 
+	// Find the set of leaves that can be seen from the viewer's cell.
+	if( m_pvs != NULL )
+		m_pvs->SetViewer( m_cullViewer );
+
 	// Begin the process of determining the visible leaves in the scene. The
 	// first step involves checking the scene leaves against the view frustum.
-	RecursiveSceneFrustumCheck( m_firstLeaf, viewer );
+	RecursiveSceneFrustumCheck( m_firstLeaf, m_cullViewer );
 
 	// A list of potentially visible leaves and occluders has been determined
-	// after check against the view frustum. The next step is to go through and
-	// further refine the list of visible occluders through occlusion culling.
+	// after check against the view frustum. The occluders are sorted by the
+	// solid angle they cover, so only the largest are kept, and any occluder
+	// already hidden behind a larger one is dropped.
+	m_occlusionVolumes->Clear();
 	m_visibleOccluders->Iterate( true );
 	while( m_visibleOccluders->Iterate() )
 	{
 		// If the occluder's visible stamp does not not equal the current frame
 		// stamp then the occluder has been hidden somehow, so ignore it.
-		if( m_visibleOccluders->GetCurrent()->visibleStamp != m_frameStamp )
+		SceneOccluder *occluder = m_visibleOccluders->GetCurrent();
+		if( occluder->visibleStamp != m_cullStamp )
 			continue;
 
-		// Build the occluder's occlusion volume.
-		BuildOcclusionVolume( m_visibleOccluders->GetCurrent(), viewer );
-
-		// Iterate through the rest of the visible occluder's.
-		SceneOccluder *occludee = m_visibleOccluders->GetNext( m_visibleOccluders->GetCurrent() );
-		while( occludee != NULL )
+		// Hide the occluder if enough occluders have been kept, or if it is
+		// completely enclosed by the volume of a larger occluder.
+		if( m_occlusionVolumes->totalVolumes == m_maxOccluders || m_occlusionVolumes->IsBoxOccluded( occluder->GetBoundingBox()->min, occluder->GetBoundingBox()->max ) == true )
 		{
-			// If the occludee's bounding sphere is overlapping the occluder's
-			// volume and the occludee's bounding box is completely enclosed by
-			// the occluder's volume, then the occludee is hidden.
-			if( IsSphereOverlappingVolume( m_visibleOccluders->GetCurrent()->planes, occludee->translation, occludee->GetBoundingSphere()->radius ) == true )
-				if( IsBoxEnclosedByVolume( m_visibleOccluders->GetCurrent()->planes, occludee->GetBoundingBox()->min, occludee->GetBoundingBox()->max ) == true )
-					occludee->visibleStamp--;
-
-			occludee = m_visibleOccluders->GetNext( occludee );
+			occluder->visibleStamp--;
+			continue;
 		}
+
+		// Build the occluder's occlusion volume.
+		BuildOcclusionVolume( occluder, m_cullViewer );
+	}
+
+	// Rasterize the depth of the nearest visible geometry into the occlusion
+	// buffer. The kept occluders go first as they cover the most of the view,
+	// then the scene's own faces are added front to back until the face
+	// budget runs out.
+	m_occlusionBuffer->Begin( &m_cullViewProjection );
+	m_totalOcclusionFaces = 0;
+	m_visibleOccluders->Iterate( true );
+	while( m_visibleOccluders->Iterate() )
+	{
+		SceneOccluder *occluder = m_visibleOccluders->GetCurrent();
+		if( occluder->visibleStamp != m_cullStamp )
+			continue;
+
+		for( unsigned long f = 0; f < occluder->totalFaces && m_totalOcclusionFaces < m_maxOcclusionFaces; f++, m_totalOcclusionFaces++ )
+			m_occlusionBuffer->RasterizeTriangle( &occluder->vertices[occluder->indices[3 * f + 0]].translation, &occluder->vertices[occluder->indices[3 * f + 1]].translation, &occluder->vertices[occluder->indices[3 * f + 2]].translation );
 	}
+	RecursiveSceneOcclusionRaster( m_firstLeaf, m_cullViewer );
+	m_occlusionBuffer->End();
+
+	// Check the scene's leaves against the visible occluders, gathering the visible faces.
+	frame->totalFaces = 0;
+	RecursiveSceneOcclusionCheck( m_firstLeaf, frame );
+
+	// Cull the snapshots of the objects across the job system, then gather the visible ones.
+	m_cullFrame = frame;
+	g_engine->GetJobSystem()->ParallelFor( CullObjects, this, frame->totalObjects );
+
+	frame->totalVisibleObjects = 0;
+	for( unsigned long o = 0; o < frame->totalObjects; o++ )
+		if( frame->bounds.visible[o] == true )
+			frame->visibleObjects[frame->totalVisibleObjects++] = o;
+
+}
+
+// Culls the given range of object snapshots in the frame being culled.
+void SceneManager::CullObjects( void *data, unsigned long start, unsigned long end )
+{
+	SceneManager *sceneManager = (SceneManager*)data;
+	BoundsTable *bounds = &sceneManager->m_cullFrame->bounds;
+
+	// Check the whole range of bounding spheres against the view frustum at once.
+	bounds->CullSpheres( sceneManager->m_cullFrustum.GetPlanes(), VIEW_FRUSTUM_PLANES, start, end );
 
+	for( unsigned long o = start; o < end; o++ )
+	{
+		if( bounds->visible[o] == false )
+			continue;
+
+		RenderSnapshot *snapshot = &sceneManager->m_cullFrame->objects[o];
+		BoundingSphere sphere = bounds->GetSphere( o );
+		bounds->visible[o] = false;
+
+		// Ignore this object if its bounding sphere is inside an occlusion volume.
+		if( sceneManager->m_occlusionVolumes->IsSphereOccluded( sphere.center, sphere.radius ) == true )
+			continue;
+
+		// Ignore this object if it is hidden in the occlusion buffer.
+		if( sceneManager->m_occlusionBuffer->IsBoxVisible( bounds->min[o], bounds->max[o] ) == false )
+			continue;
+
+		// Select the object's level of detail from its size on screen.
+		snapshot->screenSize = sceneManager->GetScreenSize( &sphere, sceneManager->m_cullViewer );
+		if( snapshot->mesh != NULL )
+			snapshot->lod = sceneManager->SelectLOD( snapshot->mesh, snapshot->lod, snapshot->screenSize );
+
+		bounds->visible[o] = true;
+	}
+
+}
+
+// Draws the visible faces and objects of the given frame.
+void SceneManager::Submit( RenderFrame *frame )
+{
 	// Tell all the render caches to prepare for rendering.
 	m_renderCaches->Iterate( true );
 	while( m_renderCaches->Iterate() )
 		m_renderCaches->GetCurrent()->Begin();
 
-	// Check the scene's leaves against the visible occluders.
-	RecursiveSceneOcclusionCheck( m_firstLeaf );
+	// Send the visible faces to their render caches.
+	for( unsigned long f = 0; f < frame->totalFaces; f++ )
+		m_faces[frame->faces[f]].renderCache->RenderFace( m_faces[frame->faces[f]].vertex0, m_faces[frame->faces[f]].vertex1, m_faces[frame->faces[f]].vertex2 );
 
 	// Set an identity world transformation matrix to render around the origin.
 	D3DXMATRIX world;
@@ -571,58 +904,82 @@ void SceneManager::Render( float elapsed, D3DXVECTOR3 viewer )
 	while( m_renderCaches->Iterate() )
 		m_renderCaches->GetCurrent()->End();
 
-	// Iterate through the list of dynamic objects.
-	m_dynamicObjects->Iterate( true );
-	while( m_dynamicObjects->Iterate() )
-	{
-		// Check if the object is visible.
-		if( m_dynamicObjects->GetCurrent()->GetVisible() == false )
-			continue;
+	// Tell all the instance caches to prepare for gathering instances.
+	m_instanceCaches->Iterate( true );
+	while( m_instanceCaches->Iterate() )
+		m_instanceCaches->GetCurrent()->Begin();
 
-		// Check if the object's bounding sphere is inside the view frustum.
-		if( m_viewFrustum.IsSphereInside( m_dynamicObjects->GetCurrent()->GetBoundingSphere()->center, m_dynamicObjects->GetCurrent()->GetBoundingSphere()->radius ) == false )
-			continue;
+	// Let every captured object know whether it was culled, so that work
+	// such as animation can be reduced for objects that can't be seen.
+	for( unsigned long o = 0; o < frame->totalObjects; o++ )
+		if( frame->objects[o].object != NULL )
+			frame->objects[o].object->SetCulled( frame->bounds.visible[o] == false );
 
-		// Iterate through the list of visible occluders.
-		bool occluded = false;
-		m_visibleOccluders->Iterate( true );
-		while( m_visibleOccluders->Iterate() )
-		{
-			// Ignore hidden occluders.
-			if( m_visibleOccluders->GetCurrent()->visibleStamp != m_frameStamp )
-				continue;
+	// Go through the visible objects, drawing them where they were captured.
+	for( unsigned long o = 0; o < frame->totalVisibleObjects; o++ )
+	{
+		RenderSnapshot *snapshot = &frame->objects[frame->visibleObjects[o]];
 
-			occluded = true;
+		// Ignore objects removed from the scene since they were captured.
+		if( snapshot->object == NULL )
+			continue;
 
-			// Check the object's bounding sphere against the occlusion volume.
-			m_visibleOccluders->GetCurrent()->planes->Iterate( true );
-			while( m_visibleOccluders->GetCurrent()->planes->Iterate() )
-			{
-				if( D3DXPlaneDotCoord( m_visibleOccluders->GetCurrent()->planes->GetCurrent(), &m_dynamicObjects->GetCurrent()->GetBoundingSphere()->center ) < m_dynamicObjects->GetCurrent()->GetBoundingSphere()->radius )
-				{
-					occluded = false;
-					break;
-				}
-			}
+		snapshot->object->SetLOD( snapshot->lod );
+		snapshot->object->SetScreenSize( snapshot->screenSize );
 
-			// Break if the object is completely hidden by this occluder.
-			if( occluded == true )
-				break;
+		// Objects sharing a static mesh are gathered into the mesh's instance
+		// cache so that all of them can be drawn together.
+		if( snapshot->instanced == true )
+		{
+			GetInstanceCache( snapshot->mesh, snapshot->lod )->AddInstance( &snapshot->world );
+			continue;
 		}
 
-		// Ignore this object if it is occluded.
-		if( occluded == true )
+		// Animated objects are drawn in the pose they were captured in. The
+		// pose is applied here, so only the base class is asked to render.
+		if( snapshot->totalBones > 0 && snapshot->mesh == snapshot->object->GetMesh() )
+		{
+			snapshot->mesh->ApplyPose( &frame->poses[snapshot->pose] );
+			snapshot->object->SceneObject::Render( &snapshot->world );
 			continue;
+		}
 
 		// Render the object.
-		m_dynamicObjects->GetCurrent()->Render();
+		snapshot->object->Render( &snapshot->world );
 	}
 
+	// Tell all the instance caches to draw the instances they gathered.
+	m_instanceCaches->Iterate( true );
+	while( m_instanceCaches->Iterate() )
+		m_instanceCaches->GetCurrent()->End();
+
+}
+
+// Waits for the job culling the draw frame to finish, helping with jobs in the meantime.
+void SceneManager::WaitForCulling()
+{
+	if( m_cullJob == NULL )
+		return;
+
+	g_engine->GetJobSystem()->Wait( m_cullJob );
+	m_cullJob = NULL;
+
+}
+
+// Culls the draw frame as a job.
+void SceneManager::CullJob( void *data, unsigned long start, unsigned long end )
+{
+	SceneManager *sceneManager = (SceneManager*)data;
+	sceneManager->Cull( sceneManager->m_drawFrame );
+
 }
 
 // Adds the given object to the scene.
 SceneObject *SceneManager::AddObject( SceneObject *object )
 {
+	// Anything the new object lands in has to react to it.
+	WakeObjects( object->GetBoundingBox()->min, object->GetBoundingBox()->max );
+
 	return m_dynamicObjects->Add( object );
 
 }
@@ -630,10 +987,32 @@ SceneObject *SceneManager::AddObject( SceneObject *object )
 // Removes the given object from the scene.
 void SceneManager::RemoveObject( SceneObject **object )
 {
+	// The frames waiting to be drawn must no longer refer to the object.
+	WaitForCulling();
+	for( char f = 0; f < 2; f++ )
+		for( unsigned long o = 0; o < m_renderFrames[f].totalObjects; o++ )
+			if( m_renderFrames[f].objects[o].object == *object )
+				m_renderFrames[f].objects[o].object = NULL;
+
+	// Anything resting on the removed object has to fall.
+	WakeObjects( ( *object )->GetBoundingBox()->min, ( *object )->GetBoundingBox()->max );
+
 	m_dynamicObjects->ClearPointer( object );
 
 }
 
+// Wakes every sleeping object whose bounding box overlaps the given box. This
+// must be called whenever anything that objects may be resting on changes.
+void SceneManager::WakeObjects( D3DXVECTOR3 min, D3DXVECTOR3 max )
+{
+	// Walk the elements directly, so an iteration of the list in progress is not disturbed.
+	LinkedList< SceneObject >::Element *element = m_dynamicObjects->GetCompleteElement( m_dynamicObjects->GetFirst() );
+	for( ; element != NULL; element = element->next )
+		if( element->data->GetSleeping() == true && IsBoxInBox( element->data->GetBoundingBox()->min, element->data->GetBoundingBox()->max, min, max ) == true )
+			element->data->Wake();
+
+}
+
 // Returns a random player spawnpoint.
 SceneObject *SceneManager::GetRandomPlayerSpawnPoint()
 {
@@ -768,101 +1147,119 @@ bool SceneManager::RayIntersectScene( RayIntersectionResult *result, D3DXVECTOR3
 
 }
 
+// Returns the instance cache for the given shared mesh and level of detail, creating it if needed.
+InstanceCache *SceneManager::GetInstanceCache( Mesh *mesh, unsigned long lod )
+{
+	// Search the existing instance caches for the mesh.
+	m_instanceCaches->Iterate( true );
+	while( m_instanceCaches->Iterate() )
+		if( m_instanceCaches->GetCurrent()->GetMesh() == mesh && m_instanceCaches->GetCurrent()->GetLOD() == lod )
+			return m_instanceCaches->GetCurrent();
+
+	// This is the first time the mesh has been rendered at this level, so create its cache.
+	InstanceCache *cache = m_instanceCaches->Add( new InstanceCache( g_engine->GetDevice(), mesh, lod, m_instancingShader ) );
+	cache->Begin();
+
+	return cache;
+}
+
+// Returns the fraction of the screen height covered by the given bounding sphere.
+float SceneManager::GetScreenSize( BoundingSphere *sphere, D3DXVECTOR3 viewer )
+{
+	// A sphere around the viewer covers at least the whole screen.
+	float distance = D3DXVec3Length( &( sphere->center - viewer ) );
+	if( distance <= sphere->radius )
+		return m_lodScale;
+
+	return sphere->radius * m_lodScale / distance;
+}
+
+// Returns the level of detail an object with the given mesh, current level and screen size should be rendered with.
+unsigned long SceneManager::SelectLOD( Mesh *mesh, unsigned long lod, float screenSize )
+{
+	// Meshes without a chain always render at full detail.
+	if( mesh->GetTotalLODs() < 2 )
+		return 0;
+
+	// Keep the object within the mesh's chain.
+	if( lod >= mesh->GetTotalLODs() )
+		lod = mesh->GetTotalLODs() - 1;
+
+	// Move to a coarser level only once the object is clearly below its threshold.
+	while( lod + 1 < mesh->GetTotalLODs() && screenSize < mesh->GetLODScreenSize( lod + 1 ) * ( 1.0f - m_lodHysteresis ) )
+		lod++;
+
+	// Move to a finer level only once the object is clearly above the current threshold.
+	while( lod > 0 && screenSize > mesh->GetLODScreenSize( lod ) * ( 1.0f + m_lodHysteresis ) )
+		lod--;
+
+	return lod;
+}
+
 // Builds an occlusion volume for the given occluder.
 void SceneManager::BuildOcclusionVolume( SceneOccluder *occluder, D3DXVECTOR3 viewer )
 {
-	// Create a list of edges for the occluder's silhouette.
-	LinkedList< Edge > *edges = new LinkedList< Edge >;
+	// Take the silhouette's edges from the thread's frame allocator. Every
+	// visible face adds at most three, so this is the most that can be needed.
+	FrameAllocator *allocator = g_engine->GetFrameAllocator();
+	unsigned long marker = allocator->GetMarker();
+	Edge *edges = allocator->AllocateArray< Edge >( occluder->totalFaces * 3 );
+	unsigned long totalEdges = 0;
 
 	// Go through all the faces in the occluder's mesh.
 	for( unsigned long f = 0; f < occluder->totalFaces; f++ )
 	{
 		// Get the indices of this face.
-		unsigned short index0 = occluder->indices[3 * f + 0];
-		unsigned short index1 = occluder->indices[3 * f + 1];
-		unsigned short index2 = occluder->indices[3 * f + 2];
+		unsigned short indices[3];
+		indices[0] = occluder->indices[3 * f + 0];
+		indices[1] = occluder->indices[3 * f + 1];
+		indices[2] = occluder->indices[3 * f + 2];
 
 		// Find the angle between the face's normal and the vector point from
 		// viewer's position to the face's position. If the angle is less than
 		// 0, then the face is visible to the viewer.
-		if( D3DXVec3Dot( &occluder->vertices[index0].normal, &( occluder->vertices[index0].translation - viewer ) ) < 0.0f )
+		if( D3DXVec3Dot( &occluder->vertices[indices[0]].normal, &( occluder->vertices[indices[0]].translation - viewer ) ) >= 0.0f )
+			continue;
+
+		// Go through the face's edges.
+		for( char e = 0; e < 3; e++ )
 		{
-			// Check if the list of edges is empty.
-			if( edges->GetTotalElements() == 0 )
-			{
-				// Add all the edges for this face.
-				edges->Add( new Edge( &occluder->vertices[index0], &occluder->vertices[index1] ) );
-				edges->Add( new Edge( &occluder->vertices[index1], &occluder->vertices[index2] ) );
-				edges->Add( new Edge( &occluder->vertices[index2], &occluder->vertices[index0] ) );
-			}
-			else
-			{
-				Edge *found0 = NULL;
-				Edge *found1 = NULL;
-				Edge *found2 = NULL;
+			Vertex *vertex0 = &occluder->vertices[indices[e]];
+			Vertex *vertex1 = &occluder->vertices[indices[( e + 1 ) % 3]];
 
-				// Iterate through the list of edges.
-				edges->Iterate( true );
-				while( edges->Iterate() != NULL )
+			// Look for the same edge from a neighbouring visible face.
+			unsigned long found = totalEdges;
+			for( unsigned long i = 0; i < totalEdges; i++ )
+			{
+				if( ( edges[i].vertex0->translation == vertex0->translation && edges[i].vertex1->translation == vertex1->translation ) ||
+					( edges[i].vertex0->translation == vertex1->translation && edges[i].vertex1->translation == vertex0->translation ) )
 				{
-					// Check if the first edge of this face already exists.
-					if( ( edges->GetCurrent()->vertex0->translation == occluder->vertices[index0].translation && edges->GetCurrent()->vertex1->translation == occluder->vertices[index1].translation ) ||
-						( edges->GetCurrent()->vertex0->translation == occluder->vertices[index1].translation && edges->GetCurrent()->vertex1->translation == occluder->vertices[index0].translation ) )
-						found0 = edges->GetCurrent();
-
-					// Check if the second edge of this face already exists.
-					if( ( edges->GetCurrent()->vertex0->translation == occluder->vertices[index1].translation && edges->GetCurrent()->vertex1->translation == occluder->vertices[index2].translation ) ||
-						( edges->GetCurrent()->vertex0->translation == occluder->vertices[index2].translation && edges->GetCurrent()->vertex1->translation == occluder->vertices[index1].translation ) )
-						found1 = edges->GetCurrent();
-
-					// Check if the third edge of this face already exists.
-					if( ( edges->GetCurrent()->vertex0->translation == occluder->vertices[index2].translation && edges->GetCurrent()->vertex1->translation == occluder->vertices[index0].translation ) ||
-						( edges->GetCurrent()->vertex0->translation == occluder->vertices[index0].translation && edges->GetCurrent()->vertex1->translation == occluder->vertices[index2].translation ) )
-						found2 = edges->GetCurrent();
+					found = i;
+					break;
 				}
+			}
 
-				// If the first edge was found, remove it.
-				if( found0 != NULL )
-					edges->Remove( &found0 );
-			
-				//  Add first edge
-				else
-					edges->Add( new Edge( &occluder->vertices[index0], &occluder->vertices[index1] ) );
-
-				// If the second edge was found, remove it.
-				if( found1 != NULL )
-					edges->Remove( &found1 );
-
-				// Add second edge
-				else
-					edges->Add( new Edge( &occluder->vertices[index1], &occluder->vertices[index2] ) );
-
-				// If the thrid edge was found, remove it.
-				if( found2 != NULL )
-					edges->Remove( &found2 );
+			// A shared edge is inside the silhouette, so remove it by moving the last edge into its place.
+			if( found < totalEdges )
+				edges[found] = edges[--totalEdges];
 
-				// Add third edge
-				else
-					edges->Add( new Edge( &occluder->vertices[index2], &occluder->vertices[index0] ) );
-			}
+			// Otherwise add the edge.
+			else
+				edges[totalEdges++] = Edge( vertex0, vertex1 );
 		}
 	}
 
-	// Empty the occluder's list of planes.
-	occluder->planes->Empty();
-
 	// Create the front cap plane.
-	D3DXPLANE *plane = new D3DXPLANE;
-	D3DXPlaneFromPointNormal( plane, &occluder->translation, &( occluder->translation - viewer ) );
-	occluder->planes->Add( plane );
+	D3DXPLANE plane;
+	D3DXPlaneFromPointNormal( &plane, &occluder->translation, &( occluder->translation - viewer ) );
+	m_occlusionVolumes->AddPlane( &plane );
 
-	// Iterate through the list of edges.
-	edges->Iterate( true );
-	while( edges->Iterate() != NULL )
+	// Go through the silhouette's edges.
+	for( unsigned long e = 0; e < totalEdges; e++ )
 	{
 		// Get the position of the vertices in the edge.
-		D3DXVECTOR3 vertex1 = edges->GetCurrent()->vertex0->translation;
-		D3DXVECTOR3 vertex2 = edges->GetCurrent()->vertex1->translation;
+		D3DXVECTOR3 vertex1 = edges[e].vertex0->translation;
+		D3DXVECTOR3 vertex2 = edges[e].vertex1->translation;
 
 		// Calculate the position of the thrid vertex for creating the plane.
 		D3DXVECTOR3 dir = vertex1 - viewer;
@@ -870,18 +1267,23 @@ void SceneManager::BuildOcclusionVolume( SceneOccluder *occluder, D3DXVECTOR3 vi
 		D3DXVECTOR3 vertex3 = vertex1 + dir;
 
 		// Create a plane from this edge.
-		plane = new D3DXPLANE;
-		D3DXPlaneFromPoints( plane, &vertex1, &vertex2, &vertex3 );
-		occluder->planes->Add( plane );
+		D3DXPlaneFromPoints( &plane, &vertex1, &vertex2, &vertex3 );
+		m_occlusionVolumes->AddPlane( &plane );
 	}
 
-	// Destroy the list of edges.
-	SAFE_DELETE( edges );
+	// The occluder's planes are complete.
+	m_occlusionVolumes->EndVolume();
+
+	// Release the edges.
+	allocator->FreeToMarker( marker );
 }
 
 // Recursively builds the scene.
 void SceneManager::RecursiveSceneBuild( SceneLeaf *leaf, D3DXVECTOR3 translation, float halfSize )
 {
+	// Give the leaf the next index.
+	leaf->index = m_totalLeaves++;
+
 	// Build a bounding volume around this leaf.
 	leaf->SetBoundingBox( D3DXVECTOR3( translation.x - halfSize, translation.y - halfSize, translation.z - halfSize ), D3DXVECTOR3( translation.x + halfSize, translation.y + halfSize, translation.z + halfSize ) );
 	leaf->SetBoundingSphere( translation, (float)sqrt( halfSize * halfSize + halfSize * halfSize + halfSize * halfSize ) );
@@ -971,17 +1373,21 @@ void SceneManager::RecursiveSceneBuild( SceneLeaf *leaf, D3DXVECTOR3 translation
 // Recursively checks the scene's leaves against the view frustum.
 bool SceneManager::RecursiveSceneFrustumCheck( SceneLeaf *leaf, D3DXVECTOR3 viewer )
 {
+	// Ignore the leaf if it cannot be seen from the viewer's cell.
+	if( m_pvs != NULL && m_pvs->IsLeafVisible( leaf->index ) == false )
+		return false;
+
 	// Check if the leaf's bounding sphere is inside the view frustum.
-	if( m_viewFrustum.IsSphereInside( leaf->GetBoundingSphere()->center, leaf->GetBoundingSphere()->radius ) == false )
+	if( m_cullFrustum.IsSphereInside( leaf->GetBoundingSphere()->center, leaf->GetBoundingSphere()->radius ) == false )
 		return false;
 
 	// Check if the leaf's bounding box is inside the view frustum.
-	if( m_viewFrustum.IsBoxInside( leaf->GetBoundingBox()->min, leaf->GetBoundingBox()->max ) == false )
+	if( m_cullFrustum.IsBoxInside( leaf->GetBoundingBox()->min, leaf->GetBoundingBox()->max ) == false )
 		return false;
 
 	// Set the visible stamp on this leaf to the current frame stamp. This will
 	// indicate that the leaf may be visible this frame and may need rendering.
-	leaf->visibleStamp = m_frameStamp;
+	leaf->visibleStamp = m_cullStamp;
 
 	// Check if any of this leaf's children are visible.
 	char visibleChildren = 0;
@@ -1000,15 +1406,20 @@ bool SceneManager::RecursiveSceneFrustumCheck( SceneLeaf *leaf, D3DXVECTOR3 view
 	while( leaf->occluders->Iterate() )
 	{
 		// Check if the occluder's bounding sphere is inside the view frustum.
-		if( m_viewFrustum.IsSphereInside( leaf->occluders->GetCurrent()->translation, leaf->occluders->GetCurrent()->GetBoundingSphere()->radius ) == false )
+		if( m_cullFrustum.IsSphereInside( leaf->occluders->GetCurrent()->translation, leaf->occluders->GetCurrent()->GetBoundingSphere()->radius ) == false )
 			continue;
 
 		// Check if the occluder's bounding box is inside the view frustum.
-		if( m_viewFrustum.IsBoxInside( leaf->occluders->GetCurrent()->GetBoundingBox()->min, leaf->occluders->GetCurrent()->GetBoundingBox()->max ) == false )
+		if( m_cullFrustum.IsBoxInside( leaf->occluders->GetCurrent()->GetBoundingBox()->min, leaf->occluders->GetCurrent()->GetBoundingBox()->max ) == false )
 			continue;
 
-		// Calculate the distance between the occluder and the viewer.
-		leaf->occluders->GetCurrent()->distance = D3DXVec3Length( &( leaf->occluders->GetCurrent()->translation - viewer ) );
+		// Calculate the solid angle the occluder's bounding sphere covers from the viewer.
+		float distance = D3DXVec3Length( &( leaf->occluders->GetCurrent()->translation - viewer ) );
+		float radius = leaf->occluders->GetCurrent()->GetBoundingSphere()->radius;
+		if( distance <= radius )
+			leaf->occluders->GetCurrent()->solidAngle = 4.0f * D3DX_PI;
+		else
+			leaf->occluders->GetCurrent()->solidAngle = 2.0f * D3DX_PI * ( 1.0f - (float)sqrt( 1.0f - ( radius * radius ) / ( distance * distance ) ) );
 
 		// Iterate through the list of visible occluders.
 		m_visibleOccluders->Iterate( true );
@@ -1018,21 +1429,21 @@ bool SceneManager::RecursiveSceneFrustumCheck( SceneLeaf *leaf, D3DXVECTOR3 view
 			if( leaf->occluders->GetCurrent() == m_visibleOccluders->GetCurrent() )
 				break;
 
-			// If the new occluder is closer to the viewer than this occluder,
+			// If the new occluder covers more of the view than this occluder,
 			// then add it to the list before this occluder.
-			if( leaf->occluders->GetCurrent()->distance < m_visibleOccluders->GetCurrent()->distance )
+			if( leaf->occluders->GetCurrent()->solidAngle > m_visibleOccluders->GetCurrent()->solidAngle )
 			{
 				m_visibleOccluders->InsertBefore( leaf->occluders->GetCurrent(), m_visibleOccluders->GetCompleteElement( m_visibleOccluders->GetCurrent() ) );
-				leaf->occluders->GetCurrent()->visibleStamp = m_frameStamp;
+				leaf->occluders->GetCurrent()->visibleStamp = m_cullStamp;
 				break;
 			}
 		}
 
 		// If the occluder wasn't in the list or not added then add it now.
-		if( leaf->occluders->GetCurrent()->visibleStamp != m_frameStamp )
+		if( leaf->occluders->GetCurrent()->visibleStamp != m_cullStamp )
 		{
 			m_visibleOccluders->Add( leaf->occluders->GetCurrent() );
-			leaf->occluders->GetCurrent()->visibleStamp = m_frameStamp;
+			leaf->occluders->GetCurrent()->visibleStamp = m_cullStamp;
 		}
 	}
 
@@ -1040,46 +1451,85 @@ bool SceneManager::RecursiveSceneFrustumCheck( SceneLeaf *leaf, D3DXVECTOR3 view
 }
 
 // Recursively checks the scene's leaves against the occlusion volumes.
-void SceneManager::RecursiveSceneOcclusionCheck( SceneLeaf *leaf )
+void SceneManager::RecursiveSceneOcclusionCheck( SceneLeaf *leaf, RenderFrame *frame )
 {
 	// Ignore the leaf if it is not visible this frame.
-	if( leaf->visibleStamp != m_frameStamp )
+	if( leaf->visibleStamp != m_cullStamp )
 		return;
 
-	// Iterate through the list of visible occluders.
-	m_visibleOccluders->Iterate( true );
-	while( m_visibleOccluders->Iterate() )
-	{
-		// Ignore hidden occluders.
-		if( m_visibleOccluders->GetCurrent()->visibleStamp != m_frameStamp )
-			continue;
+	// If the leaf's bounding box is completely enclosed by any of the
+	// occlusion volumes, then the leaf is hidden, so ignore it.
+	if( m_occlusionVolumes->IsBoxOccluded( leaf->GetBoundingBox()->min, leaf->GetBoundingBox()->max ) == true )
+		return;
 
-		// If the leaf's bounding sphere is overlapping the occluder's volume
-		// and the leaf's bounding box is completely enclosed by the occluder's
-		// volume, then the leaf is hidden, so ignore it.
-		if( IsSphereOverlappingVolume( m_visibleOccluders->GetCurrent()->planes, leaf->GetBoundingSphere()->center, leaf->GetBoundingSphere()->radius ) == true )
-			if( IsBoxEnclosedByVolume( m_visibleOccluders->GetCurrent()->planes, leaf->GetBoundingBox()->min, leaf->GetBoundingBox()->max ) == true )
-				return;
-	}
+	// Ignore the leaf if it is hidden in the occlusion buffer.
+	if( m_occlusionBuffer->IsBoxVisible( leaf->GetBoundingBox()->min, leaf->GetBoundingBox()->max ) == false )
+		return;
 
 	// Check if any of this leaf's children are visible.
 	for( char c = 0; c < 8; c++ )
 		if( leaf->children[c] != NULL )
-			RecursiveSceneOcclusionCheck( leaf->children[c] );
+			RecursiveSceneOcclusionCheck( leaf->children[c], frame );
 
 	// Go through all the faces in the leaf.
 	for( unsigned long f = 0; f < leaf->totalFaces; f++ )
 	{
 		// Check this face's render stamp. If it is equal to the current frame
 		// stamp, then the face has already been rendered this frame.
-		if( m_faces[leaf->faces[f]].renderStamp == m_frameStamp )
+		if( m_faces[leaf->faces[f]].renderStamp == m_cullStamp )
 			continue;
 
 		// Set the face's render stamp to indicate that it has been rendered.
-		m_faces[leaf->faces[f]].renderStamp = m_frameStamp;
+		m_faces[leaf->faces[f]].renderStamp = m_cullStamp;
 
-		// Tell the face's render cache to render this face.
-		m_faces[leaf->faces[f]].renderCache->RenderFace( m_faces[leaf->faces[f]].vertex0, m_faces[leaf->faces[f]].vertex1, m_faces[leaf->faces[f]].vertex2 );
+		// Add the face to the frame's faces to be rendered.
+		frame->faces[frame->totalFaces++] = leaf->faces[f];
+	}
+
+}
+
+// Recursively rasterizes the faces of the visible leaves into the occlusion buffer, nearest first.
+void SceneManager::RecursiveSceneOcclusionRaster( SceneLeaf *leaf, D3DXVECTOR3 viewer )
+{
+	// Ignore the leaf if it is not visible or the face budget has run out.
+	if( leaf->visibleStamp != m_cullStamp || m_totalOcclusionFaces >= m_maxOcclusionFaces )
+		return;
+
+	// Sort the leaf's children by their distance from the viewer.
+	char order[8];
+	float distances[8];
+	char totalChildren = 0;
+	for( char c = 0; c < 8; c++ )
+	{
+		if( leaf->children[c] == NULL )
+			continue;
+
+		float distance = D3DXVec3LengthSq( &( leaf->children[c]->GetBoundingSphere()->center - viewer ) );
+		char i = totalChildren++;
+		while( i > 0 && distances[i - 1] > distance )
+		{
+			order[i] = order[i - 1];
+			distances[i] = distances[i - 1];
+			i--;
+		}
+		order[i] = c;
+		distances[i] = distance;
+	}
+
+	// Rasterize the nearest children first.
+	for( char c = 0; c < totalChildren; c++ )
+		RecursiveSceneOcclusionRaster( leaf->children[order[c]], viewer );
+
+	// Rasterize the faces in this leaf. Faces that rays pass through (such as
+	// glass) can be seen through, so they cannot hide anything.
+	for( unsigned long f = 0; f < leaf->totalFaces && m_totalOcclusionFaces < m_maxOcclusionFaces; f++ )
+	{
+		SceneFace *face = &m_faces[leaf->faces[f]];
+		if( face->renderCache->GetMaterial()->GetIgnoreRay() == true )
+			continue;
+
+		m_occlusionBuffer->RasterizeTriangle( &m_vertices[face->vertex0].translation, &m_vertices[face->vertex1].translation, &m_vertices[face->vertex2].translation );
+		m_totalOcclusionFaces++;
 	}
 
 }
@@ -1140,3 +1590,141 @@ void SceneManager::RecursiveBuildCollisionArray( SceneLeaf *leaf, SceneObject *o
 
 }
 
+// Builds the set of visible leaves for every cell of the potentially visible sets.
+void SceneManager::BuildPotentiallyVisibleSet()
+{
+	bool *visible = new bool[m_totalLeaves];
+	float size = m_pvs->GetCellSize();
+
+	for( unsigned long cell = 0; cell < m_pvs->GetTotalCells(); cell++ )
+	{
+		// Sample the cell on a grid spanning its bounds, corners included, grown by the margin.
+		D3DXVECTOR3 samples[PVS_CELL_SAMPLES * PVS_CELL_SAMPLES * PVS_CELL_SAMPLES];
+		D3DXVECTOR3 min = m_pvs->GetCellMin( cell ) - D3DXVECTOR3( PVS_MARGIN, PVS_MARGIN, PVS_MARGIN );
+		SampleBox( samples, PVS_CELL_SAMPLES, min, min + D3DXVECTOR3( size, size, size ) + D3DXVECTOR3( PVS_MARGIN, PVS_MARGIN, PVS_MARGIN ) * 2.0f );
+
+		// Find every leaf that can be seen from the samples.
+		RecursivePVSCheck( m_firstLeaf, samples, PVS_CELL_SAMPLES * PVS_CELL_SAMPLES * PVS_CELL_SAMPLES, visible );
+		m_pvs->SetCellVisibility( cell, visible );
+	}
+
+	SAFE_DELETE_ARRAY( visible );
+
+}
+
+// Recursively marks the scene leaves that can be seen from any of the given
+// sample points. A leaf is only hidden if every ray from the samples to
+// points spread over its bounds and to every one of its faces is blocked.
+bool SceneManager::RecursivePVSCheck( SceneLeaf *leaf, D3DXVECTOR3 *samples, unsigned long totalSamples, bool *visible )
+{
+	// A leaf is visible if any of its children are.
+	bool found = false;
+	for( char c = 0; c < 8; c++ )
+		if( leaf->children[c] != NULL )
+			if( RecursivePVSCheck( leaf->children[c], samples, totalSamples, visible ) == true )
+				found = true;
+
+	// A leaf containing one of the sample points, or within the margin of one, is always visible.
+	D3DXVECTOR3 margin( PVS_MARGIN, PVS_MARGIN, PVS_MARGIN );
+	D3DXVECTOR3 leafMin = leaf->GetBoundingBox()->min - margin;
+	D3DXVECTOR3 leafMax = leaf->GetBoundingBox()->max + margin;
+	for( unsigned long s = 0; s < totalSamples && found == false; s++ )
+		if( IsBoxInBox( samples[s], samples[s], leafMin, leafMax ) == true )
+			found = true;
+
+	// Otherwise cast rays from the sample points to a grid over the leaf's
+	// grown bounds, which also covers any objects in the leaf.
+	D3DXVECTOR3 targets[PVS_LEAF_SAMPLES * PVS_LEAF_SAMPLES * PVS_LEAF_SAMPLES];
+	SampleBox( targets, PVS_LEAF_SAMPLES, leafMin, leafMax );
+	for( unsigned long t = 0; t < PVS_LEAF_SAMPLES * PVS_LEAF_SAMPLES * PVS_LEAF_SAMPLES && found == false; t++ )
+		found = IsPointVisible( targets[t], samples, totalSamples );
+
+	// Then to every face of the leaf.
+	for( unsigned long f = 0; f < leaf->totalFaces && found == false; f++ )
+	{
+		SceneFace *face = &m_faces[leaf->faces[f]];
+		found = IsPointVisible( ( m_vertices[face->vertex0].translation + m_vertices[face->vertex1].translation + m_vertices[face->vertex2].translation ) / 3.0f, samples, totalSamples );
+	}
+
+	visible[leaf->index] = found;
+
+	return found;
+}
+
+// Returns true if the given point can be seen from any of the given sample points.
+bool SceneManager::IsPointVisible( D3DXVECTOR3 target, D3DXVECTOR3 *samples, unsigned long totalSamples )
+{
+	for( unsigned long s = 0; s < totalSamples; s++ )
+	{
+		// Stop short of the target by the margin, so the face it lies on doesn't block it.
+		D3DXVECTOR3 direction = target - samples[s];
+		float length = D3DXVec3Length( &direction );
+		if( length <= PVS_MARGIN )
+			return true;
+
+		direction /= length;
+		if( RecursiveSceneSegmentCheck( m_firstLeaf, samples[s], direction, length - PVS_MARGIN ) == false )
+			return true;
+	}
+
+	return false;
+}
+
+// Fills the given array with a grid of points spanning the given box, corners included.
+void SceneManager::SampleBox( D3DXVECTOR3 *points, unsigned long perAxis, D3DXVECTOR3 min, D3DXVECTOR3 max )
+{
+	D3DXVECTOR3 step = ( max - min ) / (float)( perAxis - 1 );
+
+	for( unsigned long z = 0; z < perAxis; z++ )
+		for( unsigned long y = 0; y < perAxis; y++ )
+			for( unsigned long x = 0; x < perAxis; x++ )
+				*points++ = min + D3DXVECTOR3( step.x * x, step.y * y, step.z * z );
+
+}
+
+// Returns a hash of the scene's vertices and faces, so saved data built for other geometry can be recognised.
+unsigned long SceneManager::GetGeometryHash()
+{
+	unsigned long hash = 2166136261UL;
+
+	for( unsigned long f = 0; f < m_totalFaces; f++ )
+	{
+		unsigned long vertices[3] = { m_faces[f].vertex0, m_faces[f].vertex1, m_faces[f].vertex2 };
+		for( char v = 0; v < 3; v++ )
+		{
+			unsigned char *bytes = (unsigned char*)&m_vertices[vertices[v]].translation;
+			for( unsigned long b = 0; b < sizeof( D3DXVECTOR3 ); b++ )
+				hash = ( hash ^ bytes[b] ) * 16777619UL;
+		}
+	}
+
+	return hash;
+}
+
+// Recursively checks if any face of the scene blocks the given line segment.
+bool SceneManager::RecursiveSceneSegmentCheck( SceneLeaf *leaf, D3DXVECTOR3 position, D3DXVECTOR3 direction, float length )
+{
+	// Check the segment's ray against the scene leaf.
+	if( D3DXBoxBoundProbe( &leaf->GetBoundingBox()->min, &leaf->GetBoundingBox()->max, &position, &direction ) == false )
+		return false;
+
+	// Recursively check the scene's children.
+	for( char c = 0; c < 8; c++ )
+		if( leaf->children[c] != NULL )
+			if( RecursiveSceneSegmentCheck( leaf->children[c], position, direction, length ) == true )
+				return true;
+
+	// Check the faces in this leaf. Faces that rays pass through don't block anything.
+	for( unsigned long f = 0; f < leaf->totalFaces; f++ )
+	{
+		SceneFace *face = &m_faces[leaf->faces[f]];
+		if( face->renderCache->GetMaterial()->GetIgnoreRay() == true )
+			continue;
+
+		float distance;
+		if( D3DXIntersectTri( &m_vertices[face->vertex0].translation, &m_vertices[face->vertex1].translation, &m_vertices[face->vertex2].translation, &position, &direction, NULL, NULL, &distance ) == TRUE && distance < length )
+			return true;
+	}
+
+	return false;
+}
\ No newline at end of file
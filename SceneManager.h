@@ -19,8 +19,7 @@ struct SceneOccluder : public BoundVolume
 	unsigned long totalFaces;						// Total number of faces in the occluder's mesh.
 	Vertex *vertices;										// Array containing the occluder's vertices transformed into world space.
 	unsigned short *indices;							// Array of indices into the vertex array.
-	LinkedList< D3DXPLANE > *planes;		// List of planes that define the occluded volume.
-	float distance;											// Distance between the viewer and the occluder.
+	float solidAngle;										// Solid angle the occluder covers as seen from the viewer.
 
 	// The scene occluder structure constructor.
 	SceneOccluder( D3DXVECTOR3 t, ID3DXMesh *mesh, D3DXMATRIX *world )
@@ -54,9 +53,6 @@ struct SceneOccluder : public BoundVolume
 		for( unsigned long v = 0; v < mesh->GetNumVertices(); v++ )
 			D3DXVec3TransformCoord( &vertices[v].translation, &vertices[v].translation, world );
 
-		// Create a list of planes for building the occlusion volume.
-		planes = new LinkedList< D3DXPLANE >;
-
 		// Create a bounding volume from the occluder's mesh.
 		BoundVolumeFromMesh( mesh );
 
@@ -71,8 +67,124 @@ struct SceneOccluder : public BoundVolume
 	{
 		SAFE_DELETE_ARRAY( vertices );
 		SAFE_DELETE_ARRAY( indices );
+	}
 
-		SAFE_DELETE( planes );
+};
+
+struct OcclusionVolumes
+{
+	float *a;									// Normal x component of every plane.
+	float *b;									// Normal y component of every plane.
+	float *c;									// Normal z component of every plane.
+	float *d;									// Distance of every plane.
+	unsigned long totalPlanes;		// Total number of planes in all the volumes.
+	unsigned long maxPlanes;		// Number of planes the arrays can hold.
+	unsigned long *volumeEnds;		// Index one past the last plane of each volume.
+	unsigned long totalVolumes;	// Total number of volumes.
+	unsigned long maxVolumes;		// Maximum number of volumes that can be kept.
+
+	// The occlusion volumes structure constructor.
+	OcclusionVolumes( unsigned long volumes )
+	{
+		maxVolumes = volumes;
+		volumeEnds = new unsigned long[maxVolumes];
+
+		maxPlanes = maxVolumes * 16;
+		a = new float[maxPlanes];
+		b = new float[maxPlanes];
+		c = new float[maxPlanes];
+		d = new float[maxPlanes];
+
+		Clear();
+	}
+
+	// The occlusion volumes structure destructor.
+	virtual ~OcclusionVolumes()
+	{
+		SAFE_DELETE_ARRAY( a );
+		SAFE_DELETE_ARRAY( b );
+		SAFE_DELETE_ARRAY( c );
+		SAFE_DELETE_ARRAY( d );
+		SAFE_DELETE_ARRAY( volumeEnds );
+	}
+
+	// Removes all the volumes.
+	void Clear()
+	{
+		totalPlanes = 0;
+		totalVolumes = 0;
+	}
+
+	// Adds a plane to the volume currently being built.
+	void AddPlane( D3DXPLANE *plane )
+	{
+		// Grow the arrays if they are full.
+		if( totalPlanes == maxPlanes )
+		{
+			maxPlanes *= 2;
+			float **arrays[4] = { &a, &b, &c, &d };
+			for( char i = 0; i < 4; i++ )
+			{
+				float *grown = new float[maxPlanes];
+				memcpy( grown, *arrays[i], sizeof( float ) * totalPlanes );
+				SAFE_DELETE_ARRAY( *arrays[i] );
+				*arrays[i] = grown;
+			}
+		}
+
+		// Planes are normalized so that distances can be compared against radii.
+		D3DXPLANE normalized;
+		D3DXPlaneNormalize( &normalized, plane );
+		a[totalPlanes] = normalized.a;
+		b[totalPlanes] = normalized.b;
+		c[totalPlanes] = normalized.c;
+		d[totalPlanes] = normalized.d;
+		totalPlanes++;
+	}
+
+	// Finishes the volume currently being built.
+	void EndVolume()
+	{
+		volumeEnds[totalVolumes++] = totalPlanes;
+	}
+
+	// Returns true if the given sphere is completely inside any of the volumes.
+	bool IsSphereOccluded( D3DXVECTOR3 center, float radius )
+	{
+		unsigned long p = 0;
+		for( unsigned long v = 0; v < totalVolumes; v++ )
+		{
+			unsigned long end = volumeEnds[v];
+			while( p < end && a[p] * center.x + b[p] * center.y + c[p] * center.z + d[p] >= radius )
+				p++;
+
+			if( p == end )
+				return true;
+
+			p = end;
+		}
+
+		return false;
+	}
+
+	// Returns true if the given box is completely inside any of the volumes.
+	bool IsBoxOccluded( D3DXVECTOR3 min, D3DXVECTOR3 max )
+	{
+		unsigned long p = 0;
+		for( unsigned long v = 0; v < totalVolumes; v++ )
+		{
+			// Only the corner furthest behind each plane needs to be checked.
+			unsigned long end = volumeEnds[v];
+			while( p < end && a[p] * ( a[p] >= 0.0f ? min.x : max.x ) + b[p] * ( b[p] >= 0.0f ? min.y : max.y ) + c[p] * ( c[p] >= 0.0f ? min.z : max.z ) + d[p] >= 0.0f )
+				p++;
+
+			if( p == end )
+				return true;
+
+			p = end;
+		}
+
+		return false;
 	}
 
 };
@@ -80,6 +192,7 @@ struct SceneOccluder : public BoundVolume
 struct SceneLeaf : public BoundVolume
 {
 	SceneLeaf *children[8];									// Array of child scene leaf pointers.
+	unsigned long index;										// Index of the scene leaf in the potentially visible sets.
 	unsigned long visibleStamp;							// Indicates if the scene leaf is visible in the current frame.
 	LinkedList< SceneOccluder > *occluders;		// List of scene occluders in the scene leaf.
 	unsigned long totalFaces;								// Total number of faces in the scene leaf.
@@ -91,6 +204,7 @@ struct SceneLeaf : public BoundVolume
 		for( char c = 0; c < 8; c++)
 			children[c] = NULL;
 
+		index = 0;
 		occluders = new LinkedList< SceneOccluder >;
 		totalFaces = 0;
 		faces = NULL;
@@ -116,6 +230,103 @@ struct SceneFace : public IndexedFace
 
 };
 
+struct RenderSnapshot
+{
+	SceneObject *object;			// Pointer to the object, or NULL if it was removed since the snapshot.
+	Mesh *mesh;							// Mesh the object is rendered with, referenced until the frame is captured again.
+	bool sharedMesh;					// Indicates if the mesh came from the mesh manager.
+	unsigned long pose;				// Index of the object's first bone matrix in the frame's poses.
+	unsigned long totalBones;		// Number of bone matrices in the object's pose, zero if it has none.
+	D3DXMATRIX world;				// The object's world matrix.
+	unsigned long lod;					// Level of detail the object is rendered with.
+	float screenSize;					// Fraction of the screen height covered by the object.
+	bool instanced;						// Indicates if the object is drawn by its mesh's instance cache.
+
+};
+
+struct RenderFrame
+{
+	RenderSnapshot *objects;						// Snapshots of the visible objects.
+	BoundsTable bounds;								// World space bounds of each snapshot, and whether it passed culling.
+	unsigned long totalObjects;					// Total number of object snapshots.
+	unsigned long maxObjects;					// Number of snapshots the arrays can hold.
+	unsigned long *visibleObjects;				// Indices of the snapshots that passed culling.
+	unsigned long totalVisibleObjects;		// Total number of snapshots that passed culling.
+	unsigned long *faces;							// Indices of the scene faces that passed culling.
+	unsigned long totalFaces;						// Total number of scene faces that passed culling.
+	D3DXMATRIX *poses;								// Bone matrices of the animated objects, as they were captured.
+	unsigned long totalPoses;						// Total number of bone matrices captured.
+	unsigned long maxPoses;						// Number of bone matrices the array can hold.
+
+	// The render frame structure constructor.
+	RenderFrame()
+	{
+		objects = NULL;
+		visibleObjects = NULL;
+		faces = NULL;
+		poses = NULL;
+		maxObjects = 0;
+		Destroy();
+	}
+
+	// The render frame structure destructor.
+	virtual ~RenderFrame()
+	{
+		Destroy();
+	}
+
+	// Makes sure the frame can hold the given number of objects.
+	void Reserve( unsigned long total )
+	{
+		if( total <= maxObjects )
+			return;
+
+		SAFE_DELETE_ARRAY( objects );
+		SAFE_DELETE_ARRAY( visibleObjects );
+
+		maxObjects = total * 2;
+		objects = new RenderSnapshot[maxObjects];
+		visibleObjects = new unsigned long[maxObjects];
+		bounds.Reserve( maxObjects );
+	}
+
+	// Copies the given bone matrices into the frame and returns the index of the first.
+	unsigned long AddPose( D3DXMATRIX *bones, unsigned long total )
+	{
+		// Grow the array if it is full, keeping the poses already captured.
+		if( totalPoses + total > maxPoses )
+		{
+			maxPoses = ( totalPoses + total ) * 2;
+			D3DXMATRIX *grown = new D3DXMATRIX[maxPoses];
+			memcpy( grown, poses, sizeof( D3DXMATRIX ) * totalPoses );
+			SAFE_DELETE_ARRAY( poses );
+			poses = grown;
+		}
+
+		memcpy( &poses[totalPoses], bones, sizeof( D3DXMATRIX ) * total );
+		totalPoses += total;
+
+		return totalPoses - total;
+	}
+
+	// Destroys the frame's arrays.
+	void Destroy()
+	{
+		SAFE_DELETE_ARRAY( objects );
+		SAFE_DELETE_ARRAY( visibleObjects );
+		SAFE_DELETE_ARRAY( faces );
+		SAFE_DELETE_ARRAY( poses );
+		bounds.Destroy();
+		maxObjects = 0;
+		totalPoses = 0;
+		maxPoses = 0;
+		totalObjects = 0;
+		totalVisibleObjects = 0;
+		totalFaces = 0;
+	}
+
+};
+
 struct RayIntersectionResult
 {
 	Material *material;				// Pointer to the material of the intersected face.
@@ -137,7 +348,7 @@ struct RayIntersectionResult
 class SceneManager
 {
 public:
-	SceneManager( float scale, char *spawnerPath );
+	SceneManager( float scale, char *spawnerPath, bool threadedCulling = false );
 	virtual ~SceneManager();
 
 	void LoadScene( char *name, char *path = "./" );
@@ -145,10 +356,12 @@ public:
 	bool IsLoaded();
 
 	void Update( float elapsed, D3DXMATRIX *view = NULL );
+	void UpdateObject( SceneObject *object, float elapsed );
 	void Render( float elapsed, D3DXVECTOR3 viewer );
 
 	SceneObject *AddObject( SceneObject *object );
 	void RemoveObject( SceneObject **object );
+	void WakeObjects( D3DXVECTOR3 min, D3DXVECTOR3 max );
 
 	SceneObject *GetRandomPlayerSpawnPoint();
 	SceneObject *GetSpawnPointByID( long id );
@@ -159,14 +372,34 @@ public:
 	bool RayIntersectScene( RayIntersectionResult *result, D3DXVECTOR3 rayPosition, D3DXVECTOR3 rayDirection, bool checkScene = true, SceneObject *thisObject = NULL, bool checkObjects = false );
 
 private:
+	void CaptureRenderFrame( RenderFrame *frame, D3DXVECTOR3 viewer );
+	void ReleaseRenderFrame( RenderFrame *frame );
+	void Cull( RenderFrame *frame );
+	void Submit( RenderFrame *frame );
+	void WaitForCulling();
+	static void CullJob( void *data, unsigned long start, unsigned long end );
+	static void CullObjects( void *data, unsigned long start, unsigned long end );
+
 	void BuildOcclusionVolume( SceneOccluder *occluder, D3DXVECTOR3 viewer );
 
 	void RecursiveSceneBuild( SceneLeaf *leaf, D3DXVECTOR3 translation, float halfSize );
 	bool RecursiveSceneFrustumCheck( SceneLeaf *leaf, D3DXVECTOR3 viewer );
-	void RecursiveSceneOcclusionCheck( SceneLeaf *leaf );
+	void RecursiveSceneOcclusionCheck( SceneLeaf *leaf, RenderFrame *frame );
+	void RecursiveSceneOcclusionRaster( SceneLeaf *leaf, D3DXVECTOR3 viewer );
 	void RecursiveSceneRayCheck( SceneLeaf *leaf, RayIntersectionResult *result, D3DXVECTOR3 rayPosition, D3DXVECTOR3 rayDirection, float *hitDistance );
 	void RecursiveBuildCollisionArray( SceneLeaf *leaf, SceneObject *object );
 
+	void BuildPotentiallyVisibleSet();
+	bool RecursivePVSCheck( SceneLeaf *leaf, D3DXVECTOR3 *samples, unsigned long totalSamples, bool *visible );
+	bool IsPointVisible( D3DXVECTOR3 target, D3DXVECTOR3 *samples, unsigned long totalSamples );
+	void SampleBox( D3DXVECTOR3 *points, unsigned long perAxis, D3DXVECTOR3 min, D3DXVECTOR3 max );
+	unsigned long GetGeometryHash();
+	bool RecursiveSceneSegmentCheck( SceneLeaf *leaf, D3DXVECTOR3 position, D3DXVECTOR3 direction, float length );
+
+	InstanceCache *GetInstanceCache( Mesh *mesh, unsigned long lod );
+	float GetScreenSize( BoundingSphere *sphere, D3DXVECTOR3 viewer );
+	unsigned long SelectLOD( Mesh *mesh, unsigned long lod, float screenSize );
+
 private:
 	char *m_name;																	// Name of the scene.
 	float m_scale;																	// Scene scale in meters/unit.
@@ -177,16 +410,32 @@ private:
 	unsigned long m_maxFaces;											// Maximum number of faces per scene leaf.
 	float m_maxHalfSize;														// Maximum half size of a scene leaf.
 	unsigned long m_frameStamp;										// Current frame time stamp.
+	float m_sleepVelocity;													// Speed in units/second below which an object is at rest.
+	unsigned long m_sleepFrames;											// Number of frames an object must be at rest before it sleeps.
+
+	RenderFrame m_renderFrames[2];										// Double buffered frames, one is culled while the other is captured.
+	RenderFrame *m_drawFrame;												// Frame being culled or waiting to be drawn.
+	unsigned long m_cullStamp;												// Frame stamp of the frame being culled.
+	D3DXVECTOR3 m_cullViewer;											// Viewer position of the frame being culled.
+	ViewFrustum m_cullFrustum;												// View frustum of the frame being culled.
+	D3DXMATRIX m_cullViewProjection;									// View projection matrix of the frame being culled.
+	RenderFrame *m_cullFrame;												// Frame whose objects are being culled.
+	bool m_threadedCulling;														// Indicates if frames are culled by a job while the next is updated.
+	Job *m_cullJob;																	// Job culling the draw frame, or NULL if none is running.
 
 	LinkedList< SceneObject > *m_dynamicObjects;			// Linked list of dynamic objects.
 	LinkedList< SceneOccluder > *m_occludingObjects;	// Linked list of occluding objects.
 	LinkedList< SceneOccluder > *m_visibleOccluders;	// Linked list of visible occluders each frame.
+	OcclusionVolumes *m_occlusionVolumes;						// Occlusion volumes of the occluders kept each frame.
+	unsigned long m_maxOccluders;										// Maximum number of occluders kept each frame.
 
 	LinkedList< SceneObject > *m_playerSpawnPoints;	// Linked list of player spawn points.
 	LinkedList< SpawnerObject > *m_objectSpawners;	// Linked list of object spawners.
 	char *m_spawnerPath;														// Path used for loading the spawner object scripts.
 
 	SceneLeaf *m_firstLeaf;													// The first scene leaf in the scene hierarchy.
+	unsigned long m_totalLeaves;											// Total number of scene leaves in the scene hierarchy.
+	PotentiallyVisibleSet *m_pvs;											// Precomputed sets of leaves visible from each cell, if the scene has them.
 
 	IDirect3DVertexBuffer9 *m_sceneVertexBuffer;			// Vertex buffer for all the vertices in the scene.
 	Vertex *m_vertices;															// Pointer for accessing the vertices in the vertex buffer.
@@ -194,6 +443,18 @@ private:
 
 	LinkedList< RenderCache > *m_renderCaches;			// Linked list of render caches.
 
+	InstancingShader *m_instancingShader;						// Shader shared by the instance caches.
+	LinkedList< InstanceCache > *m_instanceCaches;		// Linked list of instance caches, one per shared mesh and level of detail.
+
+	OcclusionBuffer *m_occlusionBuffer;									// Software depth buffer the nearest occluders are rasterized into.
+	D3DXMATRIX m_projection;													// Projection matrix used for the scene.
+	D3DXMATRIX m_viewProjection;											// Combined view and projection matrix of the current frame.
+	unsigned long m_maxOcclusionFaces;									// Maximum number of faces rasterized into the occlusion buffer each frame.
+	unsigned long m_totalOcclusionFaces;								// Number of faces rasterized into the occlusion buffer this frame.
+
+	float m_lodScale;															// Converts bounding sphere radius over distance into screen size.
+	float m_lodHysteresis;													// Fraction a screen size must pass a threshold by to change level.
+
 	unsigned long m_totalFaces;											// Total number of faces in the scene.
 	SceneFace *m_faces;														// Array of faces in the scene.
 	unsigned long m_totalCollisionFaces;							// Total number of possible collision faces.
@@ -17,18 +17,15 @@ SceneObject::SceneObject( unsigned long type, char *meshName, char *meshPath, bo
 	// Set object's type
 	SetType( type );
 
-	// Zero scene object's translation and rotation.
-	SetTranslation( 0.0f, 0.0f, 0.0f );
-	SetRotation( 0.0f, 0.0f, 0.0f );
+	// Take a transform from the engine. It starts at the origin with no
+	// rotation, so the object initially faces into the positive z-axis.
+	g_engine->GetTransformSystem()->Add( this, &m_transform );
+	m_viewVersion = -1;
 
 	// Set object at rest.
 	SetVelocity( 0.0f, 0.0f, 0.0f );
 	SetSpin( 0.0f, 0.0f, 0.0f );
 
-	// Object is initially facing into the positive z-axis.
-	m_forward = D3DXVECTOR3( 0.0f, 0.0f, 1.0f );
-	m_right = D3DXVECTOR3( 1.0f, 0.0f, 0.0f );
-
 	// Initially the object has no friction.
 	m_friction = 0.0f;
 
@@ -44,6 +41,23 @@ SceneObject::SceneObject( unsigned long type, char *meshName, char *meshPath, bo
 	// Initially the object is not touching the ground.
 	m_touchingGround = false;
 
+	// Objects start awake.
+	m_sleeping = false;
+	m_restFrames = 0;
+
+	// Objects are moved by the scene manager unless input commands drive them.
+	m_inputDriven = false;
+
+	// Objects sharing a mesh are drawn with its other instances by default.
+	m_instanced = true;
+
+	// Render the object at full detail until the scene manager selects otherwise.
+	m_lod = 0;
+
+	// Objects count as drawn and filling the screen until the scene manager culls them.
+	m_culled = false;
+	m_screenSize = 1.0f;
+
 	// Set the object's mesh.
 	m_mesh = NULL;
 	SetMesh( meshName, meshPath, sharedMesh );
@@ -54,12 +68,10 @@ SceneObject::SceneObject( unsigned long type, char *meshName, char *meshPath, bo
 SceneObject::~SceneObject()
 {
 	// Destroy object's mesh.
-	if( m_sharedMesh == true )
-		g_engine->GetMeshManager()->Remove( &m_mesh );
+	ReleaseMesh( &m_mesh, m_sharedMesh );
 
-	// Allow object's mesh to exist.
-	else
-		SAFE_DELETE( m_mesh );
+	// Return the object's transform.
+	g_engine->GetTransformSystem()->Remove( m_transform );
 
 }
 
@@ -72,40 +84,19 @@ void SceneObject::Update( float elapsed, bool addVelocity )
 	// Move the object.
 	m_velocity *= friction;
 
-	// Check if there is velecity to to be added into the translation
-	if( addVelocity == true )
-	{
-		D3DXVECTOR3 velocity = m_velocity * elapsed;
-		AddTranslation( velocity.x, velocity.y, velocity.z );
-	}
+	// Check if there is velecity to to be added into the translation. Objects
+	// at rest leave their transform untouched, so it is not rebuilt.
+	if( addVelocity == true && m_velocity != D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) )
+		AddTranslation( m_velocity * elapsed );
 
 	// Spin the object.
 	m_spin *= friction;
-	D3DXVECTOR3 spin = m_spin * elapsed;
-	AddRotation( spin.x, spin.y, spin.z );
-
-	// Update the object's world matrix.
-	D3DXMatrixMultiply( &m_worldMatrix, &m_rotationMatrix, &m_translationMatrix );
-
-	// Create a view matrix for the object.
-	D3DXMatrixInverse( &m_viewMatrix, NULL, &m_worldMatrix );
-
-	// Update the object's forward vector.
-	m_forward.x = (float)sin( m_rotation.y );
-	m_forward.y = (float)-tan( m_rotation.x );
-	m_forward.z = (float)cos( m_rotation.y );
-	D3DXVec3Normalize( &m_forward, &m_forward );
+	if( m_spin != D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) )
+		AddRotation( m_spin * elapsed );
 
-	// Update the object's right vector.
-	m_right.x = (float)cos( m_rotation.y );
-	m_right.y = (float)tan( m_rotation.z );
-	m_right.z = (float)-sin( m_rotation.y );
-	D3DXVec3Normalize( &m_right, &m_right );
-
-	// Update the object's bounding volume using the translation matrix only.
-	// This will maintain an axis aligned bounding box around the object in
-	// world space rather than the object's local space.
-	RepositionBoundVolume( &m_translationMatrix );
+	// The world matrix, direction vectors and bounding volume are rebuilt by
+	// the transform system, either with every other moved object once the
+	// scene has updated or as soon as one of them is asked for.
 
 }
 
@@ -119,14 +110,21 @@ void SceneObject::Render( D3DXMATRIX *world )
 
 	// Check if the object's world tranformation matrix has been overridden.
 	if( world == NULL )
-		g_engine->GetDevice()->SetTransform( D3DTS_WORLD, &m_worldMatrix );
+		g_engine->GetDevice()->SetTransform( D3DTS_WORLD, GetWorldMatrix() );
 
 	// Set the object's alternative internal world matrix 
 	else
 		g_engine->GetDevice()->SetTransform( D3DTS_WORLD, world );
 
-	// Render the object's mesh.
-	m_mesh->Render();
+	// Render the object's mesh at its current level of detail.
+	m_mesh->RenderLOD( m_lod );
+}
+
+// Returns the object's bone matrices and their number, or NULL if it has no pose.
+D3DXMATRIX *SceneObject::GetPose( unsigned long *totalBones )
+{
+	*totalBones = 0;
+	return NULL;
 }
 
 // Some object collides with the other object.
@@ -139,7 +137,10 @@ void SceneObject::CollisionOccurred( SceneObject *object, unsigned long collisio
 // Applies the given force to the object in the forwards/backwards direction.
 void SceneObject::Drive( float force, bool lockYAxis )
 {
-	D3DXVECTOR3 realForce = m_forward * force;
+	D3DXVECTOR3 realForce = GetForwardVector() * force;
+
+	if( force != 0.0f )
+		Wake();
 
 	m_velocity.x += realForce.x;
 	m_velocity.z += realForce.z;
@@ -153,6 +154,9 @@ void SceneObject::Drive( float force, bool lockYAxis )
 void SceneObject::Jump( float force )
 {
 	D3DXVECTOR3  realForce = m_upward * force;
+
+	if( force != 0.0f )
+		Wake();
 	
 	m_velocity.y += realForce.y;
 	m_velocity.z += realForce.z;
@@ -161,7 +165,10 @@ void SceneObject::Jump( float force )
 // Applies the given force to the object in the right/left direction.
 void SceneObject::Strafe( float force, bool lockYAxis )
 {
-	D3DXVECTOR3 realForce = m_right * force;
+	D3DXVECTOR3 realForce = GetRightVector() * force;
+
+	if( force != 0.0f )
+		Wake();
 
 	m_velocity.x += realForce.x;
 	m_velocity.z += realForce.z;
@@ -183,136 +190,93 @@ void SceneObject::Stop()
 // Sets the object's translation.
 void SceneObject::SetTranslation( float x, float y, float z )
 {
-	m_translation.x = x;
-	m_translation.y = y;
-	m_translation.z = z;
-
-	D3DXMatrixTranslation( &m_translationMatrix, m_translation.x, m_translation.y, m_translation.z );
+	g_engine->GetTransformSystem()->SetTranslation( m_transform, D3DXVECTOR3( x, y, z ) );
 
 }
 
 // Sets the object's translation.
 void SceneObject::SetTranslation( D3DXVECTOR3 translation )
 {
-	m_translation = translation;
-
-	D3DXMatrixTranslation( &m_translationMatrix, m_translation.x, m_translation.y, m_translation.z );
+	g_engine->GetTransformSystem()->SetTranslation( m_transform, translation );
 
 }
 
 // Adds the given translation to the object's current translation.
 void SceneObject::AddTranslation( float x, float y, float z )
 {
-	m_translation.x += x;
-	m_translation.y += y;
-	m_translation.z += z;
-
-	D3DXMatrixTranslation( &m_translationMatrix, m_translation.x, m_translation.y, m_translation.z );
+	AddTranslation( D3DXVECTOR3( x, y, z ) );
 
 }
 
 // Adds the given translation to the object's current translation.
 void SceneObject::AddTranslation( D3DXVECTOR3 translation )
 {
-	m_translation += translation;
-
-	D3DXMatrixTranslation( &m_translationMatrix, m_translation.x, m_translation.y, m_translation.z );
+	TransformSystem *transforms = g_engine->GetTransformSystem();
+	transforms->SetTranslation( m_transform, transforms->GetTranslation( m_transform ) + translation );
 }
 
 // Returns the object's translation.
 D3DXVECTOR3 SceneObject::GetTranslation()
 {
-	return m_translation;
+	return g_engine->GetTransformSystem()->GetTranslation( m_transform );
 }
 
 // Sets the object's rotation.
 void SceneObject::SetRotation( float x, float y, float z )
 {
-	m_rotation.x = x;
-	m_rotation.y = y;
-	m_rotation.z = z;
-
-	D3DXMATRIX rotationX, rotationY;
-	D3DXMatrixRotationX( &rotationX, m_rotation.x );
-	D3DXMatrixRotationY( &rotationY, m_rotation.y );
-	D3DXMatrixRotationZ( &m_rotationMatrix, m_rotation.z );
-	D3DXMatrixMultiply( &m_rotationMatrix, &m_rotationMatrix, &rotationX );
-	D3DXMatrixMultiply( &m_rotationMatrix, &m_rotationMatrix, &rotationY );
+	g_engine->GetTransformSystem()->SetRotation( m_transform, D3DXVECTOR3( x, y, z ) );
 }
 
 // Sets the object's rotation.
 void SceneObject::SetRotation( D3DXVECTOR3 rotation )
 {
-	m_rotation = rotation;
-
-	D3DXMATRIX rotationX, rotationY;
-	D3DXMatrixRotationX( &rotationX, m_rotation.x );
-	D3DXMatrixRotationY( &rotationY, m_rotation.y );
-	D3DXMatrixRotationZ( &m_rotationMatrix, m_rotation.z );
-	D3DXMatrixMultiply( &m_rotationMatrix, &m_rotationMatrix, &rotationX );
-	D3DXMatrixMultiply( &m_rotationMatrix, &m_rotationMatrix, &rotationY );
+	g_engine->GetTransformSystem()->SetRotation( m_transform, rotation );
 
 }
 
 // Adds the given rotation to the object's current rotation.
 void SceneObject::AddRotation( float x, float y, float z )
 {
-	m_rotation.x += x;
-	m_rotation.y += y;
-	m_rotation.z += z;
-
-	D3DXMATRIX rotationX, rotationY;
-	D3DXMatrixRotationX( &rotationX, m_rotation.x );
-	D3DXMatrixRotationY( &rotationY, m_rotation.y );
-	D3DXMatrixRotationZ( &m_rotationMatrix, m_rotation.z );
-	D3DXMatrixMultiply( &m_rotationMatrix, &m_rotationMatrix, &rotationX );
-	D3DXMatrixMultiply( &m_rotationMatrix, &m_rotationMatrix, &rotationY );
+	AddRotation( D3DXVECTOR3( x, y, z ) );
 
 }
 
 // Adds the given rotation to the object's current rotation.
 void SceneObject::AddRotation( D3DXVECTOR3 rotation )
 {
-	m_rotation += rotation;
-
-	D3DXMATRIX rotationX, rotationY;
-	D3DXMatrixRotationX( &rotationX, m_rotation.x );
-	D3DXMatrixRotationY( &rotationY, m_rotation.y );
-	D3DXMatrixRotationZ( &m_rotationMatrix, m_rotation.z );
-	D3DXMatrixMultiply( &m_rotationMatrix, &m_rotationMatrix, &rotationX );
-	D3DXMatrixMultiply( &m_rotationMatrix, &m_rotationMatrix, &rotationY );
+	TransformSystem *transforms = g_engine->GetTransformSystem();
+	transforms->SetRotation( m_transform, transforms->GetRotation( m_transform ) + rotation );
 
 }
 
 // Returns the object's rotation.
 D3DXVECTOR3 SceneObject::GetRotation()
 {
-	return m_rotation;
+	return g_engine->GetTransformSystem()->GetRotation( m_transform );
 
 }
 
 // Sets the object's velocity.
 void SceneObject::SetVelocity( float x, float y, float z )
 {
-	m_velocity.x = x;
-	m_velocity.y = y;
-	m_velocity.z = z;
+	SetVelocity( D3DXVECTOR3( x, y, z ) );
 
 }
 
-// Sets the object's velocity.
+// Sets the object's velocity. Setting the object moving wakes it up.
 void SceneObject::SetVelocity( D3DXVECTOR3 velocity )
 {
 	m_velocity = velocity;
 
+	if( m_velocity != D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) )
+		Wake();
+
 }
 
 // Adds the given velocity to the object's current velocity.
 void SceneObject::AddVelocity( float x, float y, float z )
 {
-	m_velocity.x += x;
-	m_velocity.y += y;
-	m_velocity.z += z;
+	AddVelocity( D3DXVECTOR3( x, y, z ) );
 
 }
 
@@ -321,6 +285,9 @@ void SceneObject::AddVelocity( D3DXVECTOR3 velocity )
 {
 	m_velocity += velocity;
 
+	if( velocity != D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) )
+		Wake();
+
 }
 
 // Returns the object's velocity.
@@ -333,26 +300,25 @@ D3DXVECTOR3 SceneObject::GetVelocity()
 // Sets the object's spin.
 void SceneObject::SetSpin( float x, float y, float z )
 {
-	m_spin.x = x;
-	m_spin.y = y;
-	m_spin.z = z;
+	SetSpin( D3DXVECTOR3( x, y, z ) );
 
 }
 
 
-// Sets the object's spin.
+// Sets the object's spin. Setting the object spinning wakes it up.
 void SceneObject::SetSpin( D3DXVECTOR3 spin )
 {
 	m_spin = spin;
 
+	if( m_spin != D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) )
+		Wake();
+
 }
 
 // Adds the given spin to the object's current spin.
 void SceneObject::AddSpin( float x, float y, float z )
 {
-	m_spin.x += x;
-	m_spin.y += y;
-	m_spin.z += z;
+	AddSpin( D3DXVECTOR3( x, y, z ) );
 
 }
 
@@ -361,6 +327,9 @@ void SceneObject::AddSpin( D3DXVECTOR3 spin )
 {
 	m_spin += spin;
 
+	if( spin != D3DXVECTOR3( 0.0f, 0.0f, 0.0f ) )
+		Wake();
+
 }
 
 // Returns the object's spin.
@@ -373,20 +342,23 @@ D3DXVECTOR3 SceneObject::GetSpin()
 // Returns the object's forward vector.
 D3DXVECTOR3 SceneObject::GetForwardVector()
 {
-	return m_forward;
+	return g_engine->GetTransformSystem()->GetForwardVector( m_transform );
 
 }
 
 // Returns the object's right vector.
 D3DXVECTOR3 SceneObject::GetRightVector()
 {
-	return m_right;
+	return g_engine->GetTransformSystem()->GetRightVector( m_transform );
 
 }
 
 // Returns a pointer to the object's current translation matrix.
 D3DXMATRIX *SceneObject::GetTranslationMatrix()
 {
+	D3DXVECTOR3 translation = GetTranslation();
+	D3DXMatrixTranslation( &m_translationMatrix, translation.x, translation.y, translation.z );
+
 	return &m_translationMatrix;
 
 }
@@ -394,6 +366,10 @@ D3DXMATRIX *SceneObject::GetTranslationMatrix()
 // Returns a pointer to the object's current rotation matrix.
 D3DXMATRIX *SceneObject::GetRotationMatrix()
 {
+	// The rotation is the world matrix without its translation.
+	m_rotationMatrix = *GetWorldMatrix();
+	m_rotationMatrix._41 = m_rotationMatrix._42 = m_rotationMatrix._43 = 0.0f;
+
 	return &m_rotationMatrix;
 
 }
@@ -401,13 +377,31 @@ D3DXMATRIX *SceneObject::GetRotationMatrix()
 // Returns a pointer to the object's current world matrix.
 D3DXMATRIX *SceneObject::GetWorldMatrix()
 {
-	return &m_worldMatrix;
+	return g_engine->GetTransformSystem()->GetWorldMatrix( m_transform );
 
 }
 
-// Returns a pointer to the object's current view matrix.
+// Returns a pointer to the object's current view matrix. It is only rebuilt
+// when the object has moved since it was last asked for.
 D3DXMATRIX *SceneObject::GetViewMatrix()
 {
+	TransformSystem *transforms = g_engine->GetTransformSystem();
+	if( transforms->GetVersion( m_transform ) == m_viewVersion )
+		return &m_viewMatrix;
+
+	m_viewVersion = transforms->GetVersion( m_transform );
+
+	// The world matrix is a rotation followed by a translation, so its inverse
+	// is the transposed rotation followed by the translation rotated back.
+	D3DXMATRIX *world = transforms->GetWorldMatrix( m_transform );
+	m_viewMatrix._11 = world->_11;	m_viewMatrix._12 = world->_21;	m_viewMatrix._13 = world->_31;	m_viewMatrix._14 = 0.0f;
+	m_viewMatrix._21 = world->_12;	m_viewMatrix._22 = world->_22;	m_viewMatrix._23 = world->_32;	m_viewMatrix._24 = 0.0f;
+	m_viewMatrix._31 = world->_13;	m_viewMatrix._32 = world->_23;	m_viewMatrix._33 = world->_33;	m_viewMatrix._34 = 0.0f;
+	m_viewMatrix._41 = -( world->_41 * world->_11 + world->_42 * world->_12 + world->_43 * world->_13 );
+	m_viewMatrix._42 = -( world->_41 * world->_21 + world->_42 * world->_22 + world->_43 * world->_23 );
+	m_viewMatrix._43 = -( world->_41 * world->_31 + world->_42 * world->_32 + world->_43 * world->_33 );
+	m_viewMatrix._44 = 1.0f;
+
 	return &m_viewMatrix;
 
 }
@@ -510,16 +504,62 @@ bool SceneObject::IsTouchingGround()
 
 }
 
+// Wakes the object so the scene manager performs collision detection on it again.
+void SceneObject::Wake()
+{
+	m_sleeping = false;
+	m_restFrames = 0;
+
+}
+
+// Sets the object's sleeping flag.
+void SceneObject::SetSleeping( bool sleeping )
+{
+	m_sleeping = sleeping;
+
+}
+
+// Returns the object's sleeping flag.
+bool SceneObject::GetSleeping()
+{
+	return m_sleeping;
+
+}
+
+// Sets the number of frames in a row the object has been at rest.
+void SceneObject::SetRestFrames( unsigned long restFrames )
+{
+	m_restFrames = restFrames;
+
+}
+
+// Returns the number of frames in a row the object has been at rest.
+unsigned long SceneObject::GetRestFrames()
+{
+	return m_restFrames;
+
+}
+
+// Sets the object's input driven flag. Input driven objects are skipped by
+// the scene manager's update and moved once for each of their input commands.
+void SceneObject::SetInputDriven( bool inputDriven )
+{
+	m_inputDriven = inputDriven;
+
+}
+
+// Returns the object's input driven flag.
+bool SceneObject::GetInputDriven()
+{
+	return m_inputDriven;
+
+}
+
 // Sets the mesh for this scene object.
 void SceneObject::SetMesh( char *meshName, char *meshPath, bool sharedMesh )
 {
 	// Destroy the object's exisiting mesh.
-	if( m_sharedMesh == true )
-		g_engine->GetMeshManager()->Remove( &m_mesh );
-
-	// Remove mesh pointer
-	else
-		SAFE_DELETE( m_mesh );
+	ReleaseMesh( &m_mesh, m_sharedMesh );
 
 	// Indicate if the object is sharing this mesh.
 	m_sharedMesh = sharedMesh;
@@ -538,6 +578,9 @@ void SceneObject::SetMesh( char *meshName, char *meshPath, bool sharedMesh )
 		// Clone the mesh's bounding volume. The bounding volume will be used
 		// to maintain an axis aligned bounding volume in world space.
 		CloneBoundVolume( m_mesh->GetBoundingBox(), m_mesh->GetBoundingSphere() );
+
+		// Move the new bounding volume to the object's translation.
+		SetTranslation( GetTranslation() );
 	}
 
 }
@@ -547,4 +590,87 @@ Mesh *SceneObject::GetMesh()
 {
 	return m_mesh;
 
+}
+
+// Returns true if the object is sharing its mesh through the mesh manager.
+bool SceneObject::GetSharedMesh()
+{
+	return m_sharedMesh;
+
+}
+
+// Releases a reference to a mesh. Shared meshes are given back to the mesh
+// manager, while others are destroyed once nothing refers to them.
+void SceneObject::ReleaseMesh( Mesh **mesh, bool sharedMesh )
+{
+	if( *mesh == NULL )
+		return;
+
+	if( sharedMesh == true )
+		g_engine->GetMeshManager()->Remove( mesh );
+	else
+	{
+		( *mesh )->DecRef();
+		if( ( *mesh )->GetRefCount() == 0 )
+			delete *mesh;
+	}
+
+	*mesh = NULL;
+
+}
+
+// Sets the object's instanced flag. Objects that override Render must clear it.
+void SceneObject::SetInstanced( bool instanced )
+{
+	m_instanced = instanced;
+
+}
+
+// Returns the object's instanced flag.
+bool SceneObject::GetInstanced()
+{
+	return m_instanced;
+
+}
+
+// Sets the level of detail the object's mesh is rendered with.
+void SceneObject::SetLOD( unsigned long lod )
+{
+	m_lod = lod;
+
+}
+
+// Returns the level of detail the object's mesh is rendered with.
+unsigned long SceneObject::GetLOD()
+{
+	return m_lod;
+
+}
+
+// Sets the object's culled flag, set by the scene manager each time it draws the scene.
+void SceneObject::SetCulled( bool culled )
+{
+	m_culled = culled;
+
+}
+
+// Returns the object's culled flag.
+bool SceneObject::GetCulled()
+{
+	return m_culled;
+
+}
+
+// Sets the fraction of the screen height covered by the object.
+void SceneObject::SetScreenSize( float screenSize )
+{
+	m_screenSize = screenSize;
+
+}
+
+// Returns the fraction of the screen height covered by the object the last time it was drawn.
+float SceneObject::GetScreenSize()
+{
+	return m_screenSize;
+
 }
\ No newline at end of file
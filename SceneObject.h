@@ -27,6 +27,8 @@ public:
 
 	virtual void CollisionOccurred( SceneObject *object, unsigned long collisionStamp );
 
+	virtual D3DXMATRIX *GetPose( unsigned long *totalBones );
+
 	void Drive( float force, bool lockYAxis = true );
 	void Strafe( float force, bool lockYAxis = true );
 	void Jump( float force );
@@ -86,26 +88,45 @@ public:
 	void SetTouchingGroundFlag( bool touchingGround );
 	bool IsTouchingGround();
 
+	void Wake();
+	void SetSleeping( bool sleeping );
+	bool GetSleeping();
+	void SetRestFrames( unsigned long restFrames );
+	unsigned long GetRestFrames();
+
+	void SetInputDriven( bool inputDriven );
+	bool GetInputDriven();
+
 	void SetMesh( char *meshName = NULL, char *meshPath = "./", bool sharedMesh = true );
 	Mesh *GetMesh();
+	bool GetSharedMesh();
+	static void ReleaseMesh( Mesh **mesh, bool sharedMesh );
+
+	void SetInstanced( bool instanced );
+	bool GetInstanced();
+
+	void SetLOD( unsigned long lod );
+	unsigned long GetLOD();
+
+	void SetCulled( bool culled );
+	bool GetCulled();
+	void SetScreenSize( float screenSize );
+	float GetScreenSize();
 
 protected:
-	D3DXVECTOR3 m_forward;				// Object's forward vector.
-	D3DXVECTOR3 m_right;					// Object's right vector.
 	D3DXVECTOR3 m_upward;				// Object's upward vector
 
-	D3DXMATRIX m_worldMatrix;			// World matrix.
-	D3DXMATRIX m_viewMatrix;				// View matrix.
+	D3DXMATRIX m_viewMatrix;				// View matrix, only built for objects used as a viewer.
 
 private:
-	D3DXVECTOR3 m_translation;			// Object's translation in 3D space.
-	D3DXVECTOR3 m_rotation;				// Object's rotation in radians.
+	unsigned long m_transform;				// Index of the object's transform in the engine's transform system.
+	unsigned long m_viewVersion;			// Version of the transform the view matrix was built from.
 
 	D3DXVECTOR3 m_velocity;				// Object's velocity in units/second.
 	D3DXVECTOR3 m_spin;					// Object's spin in radians/second.
 
-	D3DXMATRIX m_translationMatrix;	// Translation matrix.
-	D3DXMATRIX m_rotationMatrix;		// Rotation matrix.
+	D3DXMATRIX m_translationMatrix;	// Translation matrix, built when requested.
+	D3DXMATRIX m_rotationMatrix;		// Rotation matrix, built when requested.
 
 	unsigned long m_type;							// Identifies the scene object's parent class.
 	float m_friction;										// Friction applied to the object's velocity and spin.
@@ -115,7 +136,14 @@ private:
 	bool m_ghost;										// Indicates if the object is a ghost. Ghost objects cannot physically collide with anything.
 	bool m_ignoreCollisions;						// Indicates if the object is to ignore collisions. Physical collisions can still occur, they're just not registered.
 	bool m_touchingGround;						// Indicates if the object is touching the ground.
+	bool m_sleeping;									// Indicates if the object is asleep. Sleeping objects skip collision detection until woken.
+	unsigned long m_restFrames;					// Number of frames in a row the object has been at rest.
+	bool m_inputDriven;								// Indicates if the object is moved by its input commands rather than each scene update.
 	bool m_sharedMesh;							// Indicates if the object is sharing the mesh or has exclusive access.
+	bool m_instanced;								// Indicates if the object may be drawn with the other instances of its shared mesh.
+	unsigned long m_lod;								// Level of detail of the mesh the object is rendered with.
+	bool m_culled;										// Indicates if the object was culled the last time the scene was drawn.
+	float m_screenSize;								// Fraction of the screen height the object covered the last time it was drawn.
 	Mesh *m_mesh;									// Pointer to the object's mesh.
 
 };
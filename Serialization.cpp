@@ -0,0 +1,98 @@
+// ************************************************************************
+//
+// File: Serialization.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Encodes and decodes network messages from a schema, and dispatches them by ID
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Message table class constructor
+MessageTable::MessageTable()
+{
+	ZeroMemory( m_handlers, sizeof( m_handlers ) );
+
+}
+
+// Message table class destructor
+MessageTable::~MessageTable()
+{
+
+}
+
+// Registers a handler for a message as it was received
+bool MessageTable::Register( unsigned long msgid, void ( *handler ) ( ReceivedMessage *msg ) )
+{
+	return Add( msgid, &InvokeRaw, ( void (*) () ) handler );
+}
+
+// Removes the handler of a message ID
+void MessageTable::Unregister( unsigned long msgid )
+{
+	MessageHandler *entry = Find( msgid );
+	if( entry != NULL )
+		entry ->handler = NULL;
+
+}
+
+// Gives a message to its handler, returns false if it has none
+bool MessageTable::Dispatch( ReceivedMessage *msg )
+{
+	MessageHandler *entry = Find( msg ->msgid );
+	if( entry == NULL || entry ->handler == NULL )
+		return false;
+
+	entry ->invoke( msg, entry ->handler );
+
+	return true;
+}
+
+// Gives a message to a raw handler
+void MessageTable::InvokeRaw( ReceivedMessage *msg, void ( *handler ) () )
+{
+	( ( void (*) ( ReceivedMessage* ) ) handler )( msg );
+
+}
+
+// Store a handler in the entry for its message ID, returns false if the table is full
+bool MessageTable::Add( unsigned long msgid, void ( *invoke ) ( ReceivedMessage *msg, void ( *handler ) () ), void ( *handler ) () )
+{
+	// Entries are never emptied, so an unregistered ID keeps its entry
+	MessageHandler *entry = Find( msgid );
+
+	for( unsigned long p = 0; entry == NULL && p < MESSAGE_TABLE_SIZE; p++ )
+	{
+		MessageHandler *probe = &m_handlers[( msgid * 2654435761UL + p ) & ( MESSAGE_TABLE_SIZE - 1 )];
+		if( probe ->used == false )
+			entry = probe;
+	}
+
+	if( entry == NULL )
+		return false;
+
+	entry ->msgid = msgid;
+	entry ->invoke = invoke;
+	entry ->handler = handler;
+	entry ->used = true;
+
+	return true;
+}
+
+// Returns the entry for a message ID, or NULL if it has none
+MessageHandler *MessageTable::Find( unsigned long msgid )
+{
+	for( unsigned long p = 0; p < MESSAGE_TABLE_SIZE; p++ )
+	{
+		MessageHandler *probe = &m_handlers[( msgid * 2654435761UL + p ) & ( MESSAGE_TABLE_SIZE - 1 )];
+		if( probe ->used == false )
+			return NULL;
+
+		if( probe ->msgid == msgid )
+			return probe;
+	}
+
+	return NULL;
+}
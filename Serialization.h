@@ -0,0 +1,333 @@
+// ************************************************************************
+//
+// File: Serialization.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Encodes and decodes network messages from a schema, and dispatches them by ID
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef SERIALIZATION_H
+#define SERIALIZATION_H
+
+// Number of message IDs the message table can hold handlers for. Must be a power of two.
+#define MESSAGE_TABLE_SIZE 256
+
+// Number of bits needed to hold every value up to the given one, worked out at compile time.
+template< unsigned long Value > struct BitsRequired
+{
+	enum { bits = BitsRequired< Value / 2 >::bits + 1 };
+};
+
+template<> struct BitsRequired< 0 >
+{
+	enum { bits = 0 };
+};
+
+// Message writer structure. A message's schema is its Serialize template,
+// which lists each field once with how it is packed:
+//
+//	template< class Stream > void Serialize( Stream *stream )
+//	{
+//		stream ->template Range< 0, 100 >( health );
+//		stream ->Vector( translation, -1000.0f, 1000.0f, 0.01f );
+//		stream ->Bool( firing );
+//	}
+//
+// The same template is instantiated with the writer and the reader, so the
+// two can never disagree. Range is a member template, so it is called through
+// "stream ->template" for compilers that require it. Values are written bit by bit from their integer
+// values, which keeps the layout the same whatever the compiler, word size or
+// byte order. The header is always the 32 bit message ID and player ID.
+struct MessageWriter
+{
+	BitStream stream;		// Stream the message is written to
+
+	// Message writer constructor
+	MessageWriter( void *buffer, unsigned long size ) : stream( buffer, size )
+	{
+	}
+
+	// Writes the message ID and player ID
+	void Header( NetworkMessage *message )
+	{
+		stream.WriteBits( message ->msgid, 32 );
+		stream.WriteBits( message ->dpnid, 32 );
+	}
+
+	// Writes the lowest given number of bits of a value
+	void Bits( unsigned long &value, unsigned long bits )
+	{
+		stream.WriteBits( value, bits );
+	}
+
+	// Writes a flag
+	void Bool( bool &value )
+	{
+		stream.WriteBool( value );
+	}
+
+	// Writes a value between the given limits in only as many bits as the range needs
+	template< long Min, long Max > void Range( long &value )
+	{
+		if( value < Min || value > Max )
+			stream.error = true;
+
+		stream.WriteBits( (unsigned long)( value - Min ), BitsRequired< (unsigned long)( Max - Min ) >::bits );
+	}
+
+	// Writes an unsigned value in as few bits as it needs
+	void Unsigned( unsigned long &value )
+	{
+		stream.WriteUnsigned( value );
+	}
+
+	// Writes a signed value in as few bits as it needs
+	void Signed( long &value )
+	{
+		stream.WriteSigned( value );
+	}
+
+	// Writes a value between the given limits, quantized to the given resolution. Values outside the limits are clamped
+	void Float( float &value, float min, float max, float resolution )
+	{
+		unsigned long steps = (unsigned long)( ( max - min ) / resolution + 0.5f );
+		float clamped = value < min ? min : value > max ? max : value;
+
+		stream.WriteBits( (unsigned long)( ( clamped - min ) / resolution + 0.5f ), GetBits( steps ) );
+	}
+
+	// Writes each component of a vector between the given limits, quantized to the given resolution
+	void Vector( D3DXVECTOR3 &value, float min, float max, float resolution )
+	{
+		Float( value.x, min, max, resolution );
+		Float( value.y, min, max, resolution );
+		Float( value.z, min, max, resolution );
+	}
+
+	// Writes a null terminated string held in a buffer of the given size
+	void String( char *value, unsigned long size )
+	{
+		unsigned long length = 0;
+		while( length + 1 < size && value[length] != 0 )
+			length++;
+
+		stream.WriteUnsigned( length );
+		for( unsigned long c = 0; c < length; c++ )
+			stream.WriteBits( (unsigned char)value[c], 8 );
+	}
+
+	// Returns the number of bits needed to hold every value up to the given one
+	static unsigned long GetBits( unsigned long value )
+	{
+		unsigned long bits = 0;
+		while( bits < 32 && ( value >> bits ) != 0 )
+			bits++;
+
+		return bits;
+	}
+
+	// Indicates if everything fit in the buffer and was within its limits
+	bool IsValid()
+	{
+		return stream.error == false;
+	}
+
+};
+
+// Message reader structure, reads the fields a message writer wrote. Reading
+// past the end of the message or a value outside its limits makes the whole
+// message invalid.
+struct MessageReader
+{
+	BitStream stream;		// Stream the message is read from
+
+	// Message reader constructor
+	MessageReader( void *buffer, unsigned long size ) : stream( buffer, size )
+	{
+	}
+
+	// Reads the message ID and player ID
+	void Header( NetworkMessage *message )
+	{
+		message ->msgid = stream.ReadBits( 32 );
+		message ->dpnid = stream.ReadBits( 32 );
+	}
+
+	// Reads the given number of bits
+	void Bits( unsigned long &value, unsigned long bits )
+	{
+		value = stream.ReadBits( bits );
+	}
+
+	// Reads a flag
+	void Bool( bool &value )
+	{
+		value = stream.ReadBool();
+	}
+
+	// Reads a value between the given limits
+	template< long Min, long Max > void Range( long &value )
+	{
+		unsigned long offset = stream.ReadBits( BitsRequired< (unsigned long)( Max - Min ) >::bits );
+		if( offset > (unsigned long)( Max - Min ) )
+			stream.error = true;
+
+		value = Min + (long)offset;
+	}
+
+	// Reads an unsigned value
+	void Unsigned( unsigned long &value )
+	{
+		value = stream.ReadUnsigned();
+	}
+
+	// Reads a signed value
+	void Signed( long &value )
+	{
+		value = stream.ReadSigned();
+	}
+
+	// Reads a quantized value between the given limits
+	void Float( float &value, float min, float max, float resolution )
+	{
+		unsigned long steps = (unsigned long)( ( max - min ) / resolution + 0.5f );
+		unsigned long step = stream.ReadBits( MessageWriter::GetBits( steps ) );
+		if( step > steps )
+			stream.error = true;
+
+		value = min + step * resolution;
+	}
+
+	// Reads each component of a vector between the given limits
+	void Vector( D3DXVECTOR3 &value, float min, float max, float resolution )
+	{
+		Float( value.x, min, max, resolution );
+		Float( value.y, min, max, resolution );
+		Float( value.z, min, max, resolution );
+	}
+
+	// Reads a string into a buffer of the given size, always null terminating
+	// it. The length is checked without adding to it, as it can be anything
+	void String( char *value, unsigned long size )
+	{
+		if( size == 0 )
+		{
+			stream.error = true;
+			return;
+		}
+
+		unsigned long length = stream.ReadUnsigned();
+		if( stream.error == true || length >= size )
+		{
+			stream.error = true;
+			length = 0;
+		}
+
+		unsigned long c = 0;
+		while( c < length && stream.error == false )
+			value[c++] = (char)stream.ReadBits( 8 );
+
+		value[c] = 0;
+	}
+
+	// Indicates if the message was whole and every value within its limits
+	bool IsValid()
+	{
+		return stream.error == false;
+	}
+
+};
+
+// Encodes a message into the given buffer, returns its size or zero if it did not fit
+template< class Type > unsigned long EncodeMessage( Type *message, void *buffer, unsigned long size )
+{
+	MessageWriter writer( buffer, size );
+	writer.Header( message );
+	message ->Serialize( &writer );
+
+	if( writer.IsValid() == false )
+		return 0;
+
+	return writer.stream.GetBytes();
+}
+
+// Decodes a received message, returns false if it is invalid. The decoded
+// message's dpnid is the player it was received from rather than what the
+// sender wrote, so handlers can trust it
+template< class Type > bool DecodeMessage( Type *message, ReceivedMessage *msg )
+{
+	MessageReader reader( msg ->data, msg ->size );
+	reader.Header( message );
+	message ->Serialize( &reader );
+
+	message ->dpnid = msg ->sender;
+
+	return reader.IsValid();
+}
+
+// Encodes a message and sends it. Returns false if it could not be encoded or sent
+template< class Type > bool Network::SendEncoded( Type *message, DPNID dpnid, long flags )
+{
+	char buffer[NETWORK_MAX_BATCH_SIZE];
+
+	unsigned long size = EncodeMessage( message, buffer, NETWORK_MAX_BATCH_SIZE );
+	if( size == 0 )
+		return false;
+
+	return Send( buffer, size, dpnid, flags );
+}
+
+// Message handler structure, an entry in the message table.
+struct MessageHandler
+{
+	unsigned long msgid;														// Message ID the entry is for
+	void ( *invoke ) ( ReceivedMessage *msg, void ( *handler ) () );	// Calls the handler, decoding the message first for typed handlers
+	void ( *handler ) ();														// Handler the message is given to, NULL if unregistered
+	bool used;																		// Indicates if the entry holds a message ID
+
+};
+
+// Message table class. Handlers are registered by message ID and found by
+// hashing it, so dispatching costs the same however many messages there are.
+// A typed handler is given the message already decoded from its schema, and
+// invalid messages are dropped before reaching it. A raw handler is given the
+// received message as it is.
+class MessageTable
+{
+public:
+	MessageTable();
+	virtual ~MessageTable();
+
+	// Registers a handler for a message decoded from its schema
+	template< class Type > bool Register( unsigned long msgid, void ( *handler ) ( Type *message ) )
+	{
+		return Add( msgid, &InvokeDecoded< Type >, ( void (*) () ) handler );
+	}
+
+	bool Register( unsigned long msgid, void ( *handler ) ( ReceivedMessage *msg ) );
+	void Unregister( unsigned long msgid );
+
+	bool Dispatch( ReceivedMessage *msg );
+
+private:
+	// Decodes a message and gives it to a typed handler
+	template< class Type > static void InvokeDecoded( ReceivedMessage *msg, void ( *handler ) () )
+	{
+		Type message;
+		if( DecodeMessage( &message, msg ) == true )
+			( ( void (*) ( Type* ) ) handler )( &message );
+	}
+
+	static void InvokeRaw( ReceivedMessage *msg, void ( *handler ) () );
+
+	bool Add( unsigned long msgid, void ( *invoke ) ( ReceivedMessage *msg, void ( *handler ) () ), void ( *handler ) () );
+	MessageHandler *Find( unsigned long msgid );
+
+private:
+	MessageHandler m_handlers[MESSAGE_TABLE_SIZE];		// Handlers, by the hash of their message ID
+
+};
+
+#endif
@@ -0,0 +1,284 @@
+// ************************************************************************
+//
+// File: TransformSystem.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Stores the transforms of every scene object in flat arrays
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#include "Engine.h"
+
+// Transform system class constructor.
+TransformSystem::TransformSystem( unsigned long capacity )
+{
+	m_translations = NULL;
+	m_rotations = NULL;
+	m_worldMatrices = NULL;
+	m_forwards = NULL;
+	m_rights = NULL;
+	m_dirty = NULL;
+	m_versions = NULL;
+	m_bounds = NULL;
+	m_handles = NULL;
+
+	m_totalTransforms = 0;
+	m_capacity = 0;
+
+	while( m_capacity < capacity )
+		Grow();
+
+}
+
+// Transform system class destructor.
+TransformSystem::~TransformSystem()
+{
+	SAFE_DELETE_ARRAY( m_translations );
+	SAFE_DELETE_ARRAY( m_rotations );
+	SAFE_DELETE_ARRAY( m_worldMatrices );
+	SAFE_DELETE_ARRAY( m_forwards );
+	SAFE_DELETE_ARRAY( m_rights );
+	SAFE_DELETE_ARRAY( m_dirty );
+	SAFE_DELETE_ARRAY( m_versions );
+	SAFE_DELETE_ARRAY( m_bounds );
+	SAFE_DELETE_ARRAY( m_handles );
+
+}
+
+// Adds a transform at the origin with no rotation and returns its index. The
+// index stored at the given handle is kept up to date as transforms are removed.
+unsigned long TransformSystem::Add( BoundVolume *bounds, unsigned long *handle )
+{
+	if( m_totalTransforms == m_capacity )
+		Grow();
+
+	unsigned long transform = m_totalTransforms++;
+	m_translations[transform] = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	m_rotations[transform] = D3DXVECTOR3( 0.0f, 0.0f, 0.0f );
+	m_dirty[transform] = TRANSFORM_TRANSLATION_DIRTY | TRANSFORM_ROTATION_DIRTY;
+	m_versions[transform] = 0;
+	m_bounds[transform] = bounds;
+	m_handles[transform] = handle;
+
+	*handle = transform;
+
+	return transform;
+}
+
+// Removes the given transform by moving the last transform into its place.
+void TransformSystem::Remove( unsigned long transform )
+{
+	unsigned long last = --m_totalTransforms;
+	if( transform == last )
+		return;
+
+	m_translations[transform] = m_translations[last];
+	m_rotations[transform] = m_rotations[last];
+	m_worldMatrices[transform] = m_worldMatrices[last];
+	m_forwards[transform] = m_forwards[last];
+	m_rights[transform] = m_rights[last];
+	m_dirty[transform] = m_dirty[last];
+	m_versions[transform] = m_versions[last];
+	m_bounds[transform] = m_bounds[last];
+	m_handles[transform] = m_handles[last];
+
+	// Tell the moved transform's owner where it is now.
+	*m_handles[transform] = transform;
+
+}
+
+// Sets the given transform's translation.
+void TransformSystem::SetTranslation( unsigned long transform, D3DXVECTOR3 translation )
+{
+	m_translations[transform] = translation;
+	m_dirty[transform] |= TRANSFORM_TRANSLATION_DIRTY;
+
+}
+
+// Returns the given transform's translation.
+D3DXVECTOR3 TransformSystem::GetTranslation( unsigned long transform )
+{
+	return m_translations[transform];
+}
+
+// Sets the given transform's rotation.
+void TransformSystem::SetRotation( unsigned long transform, D3DXVECTOR3 rotation )
+{
+	m_rotations[transform] = rotation;
+	m_dirty[transform] |= TRANSFORM_ROTATION_DIRTY;
+
+}
+
+// Returns the given transform's rotation.
+D3DXVECTOR3 TransformSystem::GetRotation( unsigned long transform )
+{
+	return m_rotations[transform];
+}
+
+// Returns a pointer to the given transform's world matrix. The pointer is only
+// valid until the next transform is added.
+D3DXMATRIX *TransformSystem::GetWorldMatrix( unsigned long transform )
+{
+	if( m_dirty[transform] != 0 )
+		Resolve( transform );
+
+	return &m_worldMatrices[transform];
+}
+
+// Returns the given transform's forward vector.
+D3DXVECTOR3 TransformSystem::GetForwardVector( unsigned long transform )
+{
+	if( m_dirty[transform] != 0 )
+		Resolve( transform );
+
+	return m_forwards[transform];
+}
+
+// Returns the given transform's right vector.
+D3DXVECTOR3 TransformSystem::GetRightVector( unsigned long transform )
+{
+	if( m_dirty[transform] != 0 )
+		Resolve( transform );
+
+	return m_rights[transform];
+}
+
+// Returns a number that changes whenever the given transform's world matrix does.
+unsigned long TransformSystem::GetVersion( unsigned long transform )
+{
+	if( m_dirty[transform] != 0 )
+		Resolve( transform );
+
+	return m_versions[transform];
+}
+
+// Rebuilds every dirty transform. Transforms that have not changed are skipped
+// after a single test of their flags.
+void TransformSystem::Update()
+{
+	for( unsigned long t = 0; t < m_totalTransforms; t++ )
+		if( m_dirty[t] != 0 )
+			Resolve( t );
+
+}
+
+// Returns the number of transforms in use.
+unsigned long TransformSystem::GetTotalTransforms()
+{
+	return m_totalTransforms;
+}
+
+// Rebuilds the world matrix, direction vectors and bounds of the given transform.
+void TransformSystem::Resolve( unsigned long transform )
+{
+	D3DXMATRIX *world = &m_worldMatrices[transform];
+	D3DXVECTOR3 *translation = &m_translations[transform];
+
+	if( m_dirty[transform] & TRANSFORM_ROTATION_DIRTY )
+	{
+		D3DXVECTOR3 *rotation = &m_rotations[transform];
+		float sx = (float)sin( rotation->x );
+		float cx = (float)cos( rotation->x );
+		float sy = (float)sin( rotation->y );
+		float cy = (float)cos( rotation->y );
+		float sz = (float)sin( rotation->z );
+		float cz = (float)cos( rotation->z );
+
+		// Build the rotation about z, then x, then y directly from the sines
+		// and cosines, rather than multiplying three rotation matrices.
+		world->_11 = cz * cy + sz * sx * sy;
+		world->_12 = sz * cx;
+		world->_13 = sz * sx * cy - cz * sy;
+		world->_14 = 0.0f;
+		world->_21 = cz * sx * sy - sz * cy;
+		world->_22 = cz * cx;
+		world->_23 = sz * sy + cz * sx * cy;
+		world->_24 = 0.0f;
+		world->_31 = cx * sy;
+		world->_32 = -sx;
+		world->_33 = cx * cy;
+		world->_34 = 0.0f;
+
+		// Update the forward vector.
+		D3DXVECTOR3 forward( sy, -sx / cx, cy );
+		D3DXVec3Normalize( &m_forwards[transform], &forward );
+
+		// Update the right vector.
+		D3DXVECTOR3 right( cy, sz / cz, -sy );
+		D3DXVec3Normalize( &m_rights[transform], &right );
+	}
+
+	if( m_dirty[transform] & TRANSFORM_TRANSLATION_DIRTY )
+	{
+		world->_41 = translation->x;
+		world->_42 = translation->y;
+		world->_43 = translation->z;
+		world->_44 = 1.0f;
+
+		// Move the bounding volume using the translation only. This will
+		// maintain an axis aligned bounding box around the object in world
+		// space rather than the object's local space.
+		if( m_bounds[transform] != NULL )
+		{
+			D3DXMATRIX translationMatrix;
+			D3DXMatrixTranslation( &translationMatrix, translation->x, translation->y, translation->z );
+			m_bounds[transform]->RepositionBoundVolume( &translationMatrix );
+		}
+	}
+
+	m_dirty[transform] = 0;
+	m_versions[transform]++;
+
+}
+
+// Doubles the size of the arrays.
+void TransformSystem::Grow()
+{
+	unsigned long capacity = max( m_capacity * 2, 16UL );
+
+	D3DXVECTOR3 *translations = new D3DXVECTOR3[capacity];
+	D3DXVECTOR3 *rotations = new D3DXVECTOR3[capacity];
+	D3DXMATRIX *worldMatrices = new D3DXMATRIX[capacity];
+	D3DXVECTOR3 *forwards = new D3DXVECTOR3[capacity];
+	D3DXVECTOR3 *rights = new D3DXVECTOR3[capacity];
+	unsigned char *dirty = new unsigned char[capacity];
+	unsigned long *versions = new unsigned long[capacity];
+	BoundVolume **bounds = new BoundVolume*[capacity];
+	unsigned long **handles = new unsigned long*[capacity];
+
+	if( m_totalTransforms > 0 )
+	{
+		memcpy( translations, m_translations, sizeof( D3DXVECTOR3 ) * m_totalTransforms );
+		memcpy( rotations, m_rotations, sizeof( D3DXVECTOR3 ) * m_totalTransforms );
+		memcpy( worldMatrices, m_worldMatrices, sizeof( D3DXMATRIX ) * m_totalTransforms );
+		memcpy( forwards, m_forwards, sizeof( D3DXVECTOR3 ) * m_totalTransforms );
+		memcpy( rights, m_rights, sizeof( D3DXVECTOR3 ) * m_totalTransforms );
+		memcpy( dirty, m_dirty, sizeof( unsigned char ) * m_totalTransforms );
+		memcpy( versions, m_versions, sizeof( unsigned long ) * m_totalTransforms );
+		memcpy( bounds, m_bounds, sizeof( BoundVolume* ) * m_totalTransforms );
+		memcpy( handles, m_handles, sizeof( unsigned long* ) * m_totalTransforms );
+	}
+
+	SAFE_DELETE_ARRAY( m_translations );
+	SAFE_DELETE_ARRAY( m_rotations );
+	SAFE_DELETE_ARRAY( m_worldMatrices );
+	SAFE_DELETE_ARRAY( m_forwards );
+	SAFE_DELETE_ARRAY( m_rights );
+	SAFE_DELETE_ARRAY( m_dirty );
+	SAFE_DELETE_ARRAY( m_versions );
+	SAFE_DELETE_ARRAY( m_bounds );
+	SAFE_DELETE_ARRAY( m_handles );
+
+	m_translations = translations;
+	m_rotations = rotations;
+	m_worldMatrices = worldMatrices;
+	m_forwards = forwards;
+	m_rights = rights;
+	m_dirty = dirty;
+	m_versions = versions;
+	m_bounds = bounds;
+	m_handles = handles;
+	m_capacity = capacity;
+
+}
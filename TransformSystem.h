@@ -0,0 +1,71 @@
+// ************************************************************************
+//
+// File: TransformSystem.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Stores the transforms of every scene object in flat arrays
+// Date: 10-19-26
+//
+// ************************************************************************
+
+#ifndef TRANSFORM_SYSTEM_H
+#define TRANSFORM_SYSTEM_H
+
+// Number of transforms the system can hold before it first has to grow.
+#define TRANSFORM_SYSTEM_CAPACITY 256
+
+// Flags marking the parts of a transform that have changed since it was last resolved.
+#define TRANSFORM_TRANSLATION_DIRTY 1
+#define TRANSFORM_ROTATION_DIRTY 2
+
+// Transform system class. Each transform's translation and rotation are stored
+// in separate arrays, along with the world matrix and direction vectors derived
+// from them. Changing a transform only marks it dirty. The derived values are
+// rebuilt for every dirty transform in one pass by Update, or for a single
+// transform when they are asked for before then.
+class TransformSystem
+{
+public:
+	TransformSystem( unsigned long capacity = TRANSFORM_SYSTEM_CAPACITY );
+	virtual ~TransformSystem();
+
+	unsigned long Add( BoundVolume *bounds, unsigned long *handle );
+	void Remove( unsigned long transform );
+
+	void SetTranslation( unsigned long transform, D3DXVECTOR3 translation );
+	D3DXVECTOR3 GetTranslation( unsigned long transform );
+
+	void SetRotation( unsigned long transform, D3DXVECTOR3 rotation );
+	D3DXVECTOR3 GetRotation( unsigned long transform );
+
+	D3DXMATRIX *GetWorldMatrix( unsigned long transform );
+	D3DXVECTOR3 GetForwardVector( unsigned long transform );
+	D3DXVECTOR3 GetRightVector( unsigned long transform );
+	unsigned long GetVersion( unsigned long transform );
+
+	void Update();
+
+	unsigned long GetTotalTransforms();
+
+private:
+	void Resolve( unsigned long transform );
+	void Grow();
+
+private:
+	D3DXVECTOR3 *m_translations;							// Translation of each transform
+	D3DXVECTOR3 *m_rotations;								// Rotation of each transform in radians
+	D3DXMATRIX *m_worldMatrices;							// World matrix of each transform
+	D3DXVECTOR3 *m_forwards;								// Forward vector of each transform
+	D3DXVECTOR3 *m_rights;									// Right vector of each transform
+	unsigned char *m_dirty;										// Dirty flags of each transform
+	unsigned long *m_versions;								// Number of times each transform has been resolved
+
+	BoundVolume **m_bounds;									// Bounding volume moved with each transform
+	unsigned long **m_handles;								// Where each transform's owner keeps its index
+
+	unsigned long m_totalTransforms;						// Number of transforms in use
+	unsigned long m_capacity;									// Number of transforms the arrays can hold
+
+};
+
+#endif
@@ -0,0 +1,1189 @@
+// ***********************************************************************
+//
+// File: UdpTransport.cpp
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Client/server network transport over non-blocking UDP sockets
+// Date: 10-19-26
+//
+// ***********************************************************************
+
+#include "Engine.h"
+
+// UDP transport class constructor
+UdpTransport::UdpTransport( Network *network ) : NetworkTransport( network )
+{
+	// Start winsock
+	WSADATA wsaData;
+	WSAStartup( MAKEWORD( 1, 1 ), &wsaData );
+
+	m_socket = INVALID_SOCKET;
+	m_thread = NULL;
+	m_exit = false;
+
+	InitializeCriticalSection( &m_connectionCS );
+	m_connections = new LinkedList< UdpConnection >;
+
+	m_hosting = false;
+	m_session = NULL;
+	m_maxPlayers = 0;
+	m_nextID = 1;
+	m_joinResult = 0;
+
+	m_dpnid = 0;
+	m_name = NULL;
+	m_data = NULL;
+	m_dataSize = 0;
+
+}
+
+// UDP transport class destructor
+UdpTransport::~UdpTransport()
+{
+	Terminate();
+	Close();
+
+	SAFE_DELETE( m_connections );
+	DeleteCriticalSection( &m_connectionCS );
+
+	SAFE_DELETE_ARRAY( m_name );
+	SAFE_DELETE_ARRAY( m_data );
+
+	WSACleanup();
+
+}
+
+// Broadcast a request for sessions on the local network and wait for the hosts to answer
+void UdpTransport::EnumerateSessions()
+{
+	// The socket stays open to join one of the sessions found
+	if( m_socket == INVALID_SOCKET && Open( 0 ) == false )
+		return;
+
+	GUID guid = m_network ->GetGUID();
+	UdpPacket request( UDP_PACKET_ENUMERATE );
+	request.Write( &guid, sizeof( GUID ) );
+
+	sockaddr_in address;
+	ZeroMemory( &address, sizeof( sockaddr_in ) );
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl( INADDR_BROADCAST );
+	address.sin_port = htons( (unsigned short)m_network ->GetPort() );
+	SendPacket( &request, &address );
+
+	// The receive thread adds the sessions as they answer
+	Sleep( UDP_ENUMERATE_TIME );
+
+}
+
+// Host a session on the network's port
+bool UdpTransport::Host( char *name, char *session, int players, void *playerData, unsigned long dataSize )
+{
+	Terminate();
+	Close();
+
+	if( Open( (unsigned short)m_network ->GetPort() ) == false )
+		return false;
+
+	SetLocalPlayer( name, playerData, dataSize );
+	m_session = new char[strlen( session ) + 1];
+	strcpy( m_session, session );
+	m_maxPlayers = players;
+	m_nextID = 1;
+	m_dpnid = m_nextID++;
+	m_hosting = true;
+
+	m_network ->CreatePlayer( m_dpnid, m_name, m_data, m_dataSize, true, true );
+
+	return true;
+}
+
+// Join an enumerated session, waiting until the host accepts or rejects the player
+bool UdpTransport::Join( char *name, SessionInfo *session, void *playerData, unsigned long dataSize )
+{
+	Terminate();
+
+	if( m_socket == INVALID_SOCKET && Open( 0 ) == false )
+		return false;
+
+	SetLocalPlayer( name, playerData, dataSize );
+
+	// Prepare the request to join
+	GUID guid = m_network ->GetGUID();
+	UdpPacket request( UDP_PACKET_CONNECT );
+	request.Write( &guid, sizeof( GUID ) );
+	request.Write( &m_dataSize, sizeof( unsigned long ) );
+	request.WriteString( m_name );
+	if( request.Write( m_data, m_dataSize ) == false )
+		return false;
+
+	// The host's player ID is not known until it accepts
+	sockaddr_in address = ( ( UdpSession* ) session ) ->address;
+	EnterCriticalSection( &m_connectionCS );
+	m_connections ->Add( new UdpConnection( &address, 0 ) );
+	LeaveCriticalSection( &m_connectionCS );
+
+	// Keep asking until the host answers or the time runs out
+	m_joinResult = 0;
+	unsigned long start = timeGetTime();
+	unsigned long lastRequest = start - UDP_CONNECT_RETRY_TIME;
+
+	while( m_joinResult == 0 && timeGetTime() - start < UDP_CONNECT_TIME )
+	{
+		if( timeGetTime() - lastRequest >= UDP_CONNECT_RETRY_TIME )
+		{
+			SendPacket( &request, &address );
+			lastRequest = timeGetTime();
+		}
+
+		Sleep( UDP_WAIT_TIME );
+	}
+
+	if( m_joinResult != 1 )
+	{
+		Reset();
+		return false;
+	}
+
+	return true;
+
+}
+
+// Leave the current session, ending it for everyone if hosting
+void UdpTransport::Terminate()
+{
+	if( m_socket == INVALID_SOCKET )
+		return;
+
+	DPNID dpnid = m_dpnid;
+
+	// Nothing is retransmitted once the session is left, so the other end
+	// times out if this is lost
+	EnterCriticalSection( &m_connectionCS );
+
+	m_connections ->Iterate( true );
+	while( m_connections ->Iterate() )
+	{
+		if( m_hosting == true )
+		{
+			UdpPacket packet( UDP_PACKET_TERMINATE );
+			SendPacket( &packet, m_connections ->GetCurrent() );
+		}
+		else
+			SendToConnection( m_connections ->GetCurrent(), UDP_PACKET_LEAVE, UDP_UNRELIABLE, &dpnid, sizeof( DPNID ) );
+	}
+
+	LeaveCriticalSection( &m_connectionCS );
+
+	Reset();
+
+}
+
+// Send network message. A client only has a connection to its host, which
+// forwards messages meant for other players.
+void UdpTransport::Send( DPNID dpnid, void *data, unsigned long size, long flags )
+{
+	// Find the delivery class from DirectPlay's flags
+	unsigned char delivery = UDP_UNRELIABLE_SEQUENCED;
+	if( flags & DPNSEND_GUARANTEED )
+		delivery = ( flags & DPNSEND_NONSEQUENTIAL ) ? UDP_RELIABLE_UNORDERED : UDP_RELIABLE_ORDERED;
+	else if( flags & DPNSEND_NONSEQUENTIAL )
+		delivery = UDP_UNRELIABLE;
+
+	// The message is sent along with the player it is for and the player it is
+	// from, which the host checks against the connection. The network never
+	// sends more than GetMaxMessageSize, so a message too large to go in one
+	// packet is only refused here if it came from somewhere else
+	if( size > UDP_MAX_MESSAGE_SIZE )
+		return;
+
+	UdpPacket body;
+	body.Write( &dpnid, sizeof( DPNID ) );
+	body.Write( &m_dpnid, sizeof( DPNID ) );
+	body.Write( data, size );
+
+	if( dpnid != m_dpnid )
+	{
+		EnterCriticalSection( &m_connectionCS );
+
+		m_connections ->Iterate( true );
+		while( m_connections ->Iterate() )
+		{
+			UdpConnection *connection = m_connections ->GetCurrent();
+			if( m_hosting == false || dpnid == DPNID_ALL_PLAYERS_GROUP || connection ->dpnid == dpnid )
+				SendToConnection( connection, UDP_PACKET_DATA, delivery, body.data, body.size );
+		}
+
+		LeaveCriticalSection( &m_connectionCS );
+	}
+
+	// Messages to everyone include the local player, as they do over DirectPlay
+	if( m_dpnid != 0 && ( dpnid == DPNID_ALL_PLAYERS_GROUP || dpnid == m_dpnid ) )
+		m_network ->ReceiveMessage( m_dpnid, data, size );
+
+}
+
+// Returns the largest message Send can carry, which must fit in a single packet
+unsigned long UdpTransport::GetMaxMessageSize()
+{
+	return UDP_MAX_MESSAGE_SIZE;
+
+}
+
+// Entry point of the receive thread
+DWORD WINAPI UdpTransport::ReceiveThread( LPVOID parameter )
+{
+	UdpTransport *transport = ( UdpTransport* ) parameter;
+
+	while( transport ->m_exit == false )
+	{
+		if( transport ->WaitForPackets( UDP_WAIT_TIME ) == true )
+			transport ->ReceivePackets();
+
+		transport ->Service();
+	}
+
+	return 0;
+}
+
+// Open a non-blocking socket on the given port, or any free port if it is zero, and start the receive thread
+bool UdpTransport::Open( unsigned short port )
+{
+	m_socket = socket( AF_INET, SOCK_DGRAM, 0 );
+	if( m_socket == INVALID_SOCKET )
+		return false;
+
+	// Allow session requests to be broadcast
+	int broadcast = 1;
+	setsockopt( m_socket, SOL_SOCKET, SO_BROADCAST, ( char* ) &broadcast, sizeof( int ) );
+
+	sockaddr_in address;
+	ZeroMemory( &address, sizeof( sockaddr_in ) );
+	address.sin_family = AF_INET;
+	address.sin_addr.s_addr = htonl( INADDR_ANY );
+	address.sin_port = htons( port );
+
+	if( bind( m_socket, ( sockaddr* ) &address, sizeof( sockaddr_in ) ) != 0 )
+	{
+		closesocket( m_socket );
+		m_socket = INVALID_SOCKET;
+		return false;
+	}
+
+	unsigned long nonBlocking = 1;
+	ioctlsocket( m_socket, FIONBIO, &nonBlocking );
+
+	m_exit = false;
+	m_thread = CreateThread( NULL, 0, ReceiveThread, this, 0, NULL );
+
+	return true;
+
+}
+
+// Stop the receive thread and close the socket
+void UdpTransport::Close()
+{
+	if( m_thread != NULL )
+	{
+		m_exit = true;
+		WaitForSingleObject( m_thread, INFINITE );
+		CloseHandle( m_thread );
+		m_thread = NULL;
+	}
+
+	if( m_socket != INVALID_SOCKET )
+	{
+		closesocket( m_socket );
+		m_socket = INVALID_SOCKET;
+	}
+
+}
+
+// Forget the current session without telling anyone
+void UdpTransport::Reset()
+{
+	EnterCriticalSection( &m_connectionCS );
+
+	m_connections ->Empty();
+	m_hosting = false;
+	m_dpnid = 0;
+	SAFE_DELETE_ARRAY( m_session );
+	m_maxPlayers = 0;
+
+	LeaveCriticalSection( &m_connectionCS );
+
+}
+
+// Wait for packets to arrive, returns false if the time ran out first
+bool UdpTransport::WaitForPackets( unsigned long timeout )
+{
+	fd_set readable;
+	FD_ZERO( &readable );
+	FD_SET( m_socket, &readable );
+
+	timeval time;
+	time.tv_sec = timeout / 1000;
+	time.tv_usec = ( timeout % 1000 ) * 1000;
+
+	return select( (int)m_socket + 1, &readable, NULL, NULL, &time ) > 0;
+}
+
+// Process every packet waiting on the socket
+void UdpTransport::ReceivePackets()
+{
+	char *buffer = NULL;
+	sockaddr_in from;
+
+	while( true )
+	{
+		// Packets are received straight into a receive buffer, which is used
+		// again for the next packet unless a message kept it
+		if( buffer == NULL )
+			buffer = m_network ->GetReceiveBuffers() ->Allocate( UDP_MAX_PACKET_SIZE );
+
+		socklen_t length = sizeof( sockaddr_in );
+		int received = recvfrom( m_socket, buffer, UDP_MAX_PACKET_SIZE, 0, ( sockaddr* ) &from, &length );
+		if( received <= 0 )
+			break;
+
+		UdpPacket packet( buffer, received );
+		ProcessPacket( &packet, &from );
+		buffer = packet.buffer;
+	}
+
+	ReceiveBufferPool::Release( buffer );
+
+}
+
+// Process a packet received from the given address
+void UdpTransport::ProcessPacket( UdpPacket *packet, sockaddr_in *from )
+{
+	unsigned char type = packet ->ReadHeader();
+	if( type == 0 )
+		return;
+
+	// Note that the sender is still there
+	bool connected = false;
+
+	EnterCriticalSection( &m_connectionCS );
+
+	UdpConnection *connection = FindConnection( from );
+	if( connection != NULL )
+	{
+		connection ->lastReceived = timeGetTime();
+		connected = true;
+	}
+
+	LeaveCriticalSection( &m_connectionCS );
+
+	switch( type )
+	{
+	case UDP_PACKET_ENUMERATE:
+		{
+			// Only a host describes its session, and only to the same game
+			GUID guid;
+			if( m_hosting == false || packet ->Read( &guid, sizeof( GUID ) ) == false || IsEqualGUID( guid, m_network ->GetGUID() ) == false )
+				break;
+
+			EnterCriticalSection( &m_connectionCS );
+			unsigned long totalPlayers = m_connections ->GetTotalElements() + 1;
+			LeaveCriticalSection( &m_connectionCS );
+
+			UdpPacket response( UDP_PACKET_SESSION );
+			response.Write( &totalPlayers, sizeof( unsigned long ) );
+			response.Write( &m_maxPlayers, sizeof( unsigned long ) );
+			response.WriteString( m_session );
+			SendPacket( &response, from );
+
+			break;
+		}
+
+	case UDP_PACKET_SESSION:
+		{
+			if( m_hosting == true )
+				break;
+
+			UdpSession *session = new UdpSession;
+			session ->address = *from;
+
+			char *name = NULL;
+			if( packet ->Read( &session ->totalPlayers, sizeof( unsigned long ) ) == false || packet ->Read( &session ->maxPlayers, sizeof( unsigned long ) ) == false || ( name = packet ->ReadString() ) == NULL )
+			{
+				SAFE_DELETE( session );
+				break;
+			}
+
+			session ->name = new char[strlen( name ) + 1];
+			strcpy( session ->name, name );
+
+			m_network ->AddSession( session );
+
+			break;
+		}
+
+	case UDP_PACKET_CONNECT:
+		{
+			if( m_hosting == true )
+				Accept( packet, from );
+
+			break;
+		}
+
+	case UDP_PACKET_ACCEPT:
+		{
+			// Only accepted by the host being joined, and only once
+			DPNID local, host;
+			if( m_hosting == true || connected == false || m_dpnid != 0 || packet ->Read( &local, sizeof( DPNID ) ) == false || packet ->Read( &host, sizeof( DPNID ) ) == false )
+				break;
+
+			EnterCriticalSection( &m_connectionCS );
+
+			connection = FindConnection( from );
+			if( connection != NULL )
+				connection ->dpnid = host;
+
+			LeaveCriticalSection( &m_connectionCS );
+
+			m_dpnid = local;
+			m_network ->CreatePlayer( m_dpnid, m_name, m_data, m_dataSize, true, false );
+			m_joinResult = 1;
+
+			break;
+		}
+
+	case UDP_PACKET_REJECT:
+		{
+			if( m_hosting == false && connected == true && m_dpnid == 0 )
+				m_joinResult = -1;
+
+			break;
+		}
+
+	case UDP_PACKET_TERMINATE:
+		{
+			if( m_hosting == true || connected == false )
+				break;
+
+			Reset();
+			m_network ->TerminateSession();
+
+			break;
+		}
+
+	case UDP_PACKET_PLAYER:
+	case UDP_PACKET_LEAVE:
+	case UDP_PACKET_DATA:
+	case UDP_PACKET_KEEP_ALIVE:
+		{
+			if( connected == true )
+				ProcessMessage( type, packet, from );
+
+			break;
+		}
+	}
+
+}
+
+// Process a packet received over a connection, delivering its message if its
+// delivery class allows and any reliable ordered messages that were waiting on it
+void UdpTransport::ProcessMessage( unsigned char type, UdpPacket *packet, sockaddr_in *from )
+{
+	unsigned short sequence, ack, id;
+	unsigned long ackBits;
+	unsigned char delivery;
+
+	if( packet ->Read( &sequence, sizeof( unsigned short ) ) == false || packet ->Read( &ack, sizeof( unsigned short ) ) == false ||
+		packet ->Read( &ackBits, sizeof( unsigned long ) ) == false || packet ->Read( &delivery, sizeof( unsigned char ) ) == false ||
+		packet ->Read( &id, sizeof( unsigned short ) ) == false )
+		return;
+
+	bool deliver = false;
+	bool acknowledge = true;
+	bool reliable = delivery == UDP_RELIABLE_UNORDERED || delivery == UDP_RELIABLE_ORDERED;
+	unsigned short previous = 0;
+	DPNID sender = 0;
+
+	EnterCriticalSection( &m_connectionCS );
+
+	UdpConnection *connection = FindConnection( from );
+	if( connection == NULL )
+	{
+		LeaveCriticalSection( &m_connectionCS );
+		return;
+	}
+
+	sender = connection ->dpnid;
+	ProcessAcks( connection, ack, ackBits );
+
+	switch( delivery )
+	{
+	case UDP_UNRELIABLE:
+		deliver = true;
+		break;
+
+	case UDP_UNRELIABLE_SEQUENCED:
+		// Drop anything older than what has already been delivered
+		if( connection ->sequenced == false || IsNewer( id, connection ->lastSequenced ) == true )
+		{
+			connection ->lastSequenced = id;
+			connection ->sequenced = true;
+			deliver = true;
+		}
+		break;
+
+	case UDP_RELIABLE_UNORDERED:
+		// Drop retransmissions of messages already delivered
+		if( connection ->unordered[id & ( UDP_RELIABLE_WINDOW - 1 )] != (unsigned short)( id + 1 ) )
+		{
+			previous = connection ->unordered[id & ( UDP_RELIABLE_WINDOW - 1 )];
+			connection ->unordered[id & ( UDP_RELIABLE_WINDOW - 1 )] = id + 1;
+			deliver = true;
+		}
+		break;
+
+	case UDP_RELIABLE_ORDERED:
+		// Deliver the next message straight away, unless it is already held
+		// after the network refused it, and hold on to any that arrive ahead of
+		// it. Messages already delivered or held are acknowledged again, while
+		// those beyond the window are left for the sender to send again
+		if( id == connection ->nextOrdered && connection ->ordered[id & ( UDP_RELIABLE_WINDOW - 1 )] == NULL )
+		{
+			connection ->nextOrdered++;
+			deliver = true;
+		}
+		else if( IsNewer( id, connection ->nextOrdered ) == true && (unsigned short)( id - connection ->nextOrdered ) >= UDP_RELIABLE_WINDOW )
+		{
+			acknowledge = false;
+		}
+		else if( IsNewer( id, connection ->nextOrdered ) == true && connection ->ordered[id & ( UDP_RELIABLE_WINDOW - 1 )] == NULL )
+		{
+			connection ->ordered[id & ( UDP_RELIABLE_WINDOW - 1 )] = new UdpBufferedMessage( type, packet );
+		}
+		break;
+	}
+
+	// A reliable message about to be delivered is only acknowledged once the
+	// network has taken it, everything else straight away if it is kept
+	if( ( deliver == false || reliable == false ) && acknowledge == true )
+		RecordSequence( connection, sequence );
+
+	LeaveCriticalSection( &m_connectionCS );
+
+	if( deliver == true )
+	{
+		bool delivered = DeliverMessage( type, delivery, packet, sender );
+		if( reliable == true )
+		{
+			EnterCriticalSection( &m_connectionCS );
+
+			// Only this thread processes packets, so nothing else has moved the
+			// connection on. If the network had no room, the message is taken
+			// back as if it never arrived so the retransmission is delivered
+			connection = FindConnection( from );
+			if( connection != NULL && delivered == true )
+				RecordSequence( connection, sequence );
+			else if( connection != NULL && delivery == UDP_RELIABLE_UNORDERED )
+				connection ->unordered[id & ( UDP_RELIABLE_WINDOW - 1 )] = previous;
+			else if( connection != NULL )
+				connection ->nextOrdered--;
+
+			LeaveCriticalSection( &m_connectionCS );
+		}
+	}
+
+	// Deliver the ordered messages that were waiting, which also retries any
+	// the network had no room for when they were next in line
+	while( true )
+	{
+		UdpBufferedMessage *buffered = NULL;
+
+		EnterCriticalSection( &m_connectionCS );
+
+		connection = FindConnection( from );
+		if( connection != NULL )
+		{
+			buffered = connection ->ordered[connection ->nextOrdered & ( UDP_RELIABLE_WINDOW - 1 )];
+			if( buffered != NULL )
+			{
+				connection ->ordered[connection ->nextOrdered & ( UDP_RELIABLE_WINDOW - 1 )] = NULL;
+				connection ->nextOrdered++;
+			}
+		}
+
+		LeaveCriticalSection( &m_connectionCS );
+
+		if( buffered == NULL )
+			break;
+
+		UdpPacket packet( buffered ->buffer, buffered ->size );
+		packet.position = buffered ->position;
+
+		bool delivered = DeliverMessage( buffered ->type, UDP_RELIABLE_ORDERED, &packet, sender );
+		buffered ->buffer = packet.buffer;
+
+		if( delivered == true )
+		{
+			SAFE_DELETE( buffered );
+			continue;
+		}
+
+		// Put the message back to wait for the next packet from the connection,
+		// which it has already acknowledged
+		EnterCriticalSection( &m_connectionCS );
+
+		connection = FindConnection( from );
+		if( connection != NULL )
+		{
+			connection ->nextOrdered--;
+			connection ->ordered[connection ->nextOrdered & ( UDP_RELIABLE_WINDOW - 1 )] = buffered;
+			buffered = NULL;
+		}
+
+		LeaveCriticalSection( &m_connectionCS );
+
+		SAFE_DELETE( buffered );
+		break;
+	}
+
+}
+
+// Act on a message received over a connection. Returns false if it was data
+// the network had no room to queue
+bool UdpTransport::DeliverMessage( unsigned char type, unsigned char delivery, UdpPacket *packet, DPNID sender )
+{
+	switch( type )
+	{
+	case UDP_PACKET_PLAYER:
+		{
+			DPNID dpnid;
+			unsigned char host;
+			unsigned long size;
+			char *name = NULL;
+
+			if( m_hosting == true || packet ->Read( &dpnid, sizeof( DPNID ) ) == false || packet ->Read( &host, sizeof( unsigned char ) ) == false ||
+				packet ->Read( &size, sizeof( unsigned long ) ) == false || ( name = packet ->ReadString() ) == NULL || packet ->size - packet ->position < size )
+				break;
+
+			m_network ->CreatePlayer( dpnid, name, packet ->data + packet ->position, size, false, host != 0 );
+
+			break;
+		}
+
+	case UDP_PACKET_LEAVE:
+		{
+			// A client leaving the hosted session
+			if( m_hosting == true )
+			{
+				Disconnect( sender );
+				break;
+			}
+
+			// The host saying another player has left
+			DPNID dpnid;
+			if( packet ->Read( &dpnid, sizeof( DPNID ) ) == true )
+				m_network ->DestroyPlayer( dpnid );
+
+			break;
+		}
+
+	case UDP_PACKET_DATA:
+		{
+			return Route( packet, sender, delivery );
+		}
+	}
+
+	return true;
+}
+
+// Service every connection, dropping any that have timed out
+void UdpTransport::Service()
+{
+	unsigned long now = timeGetTime();
+	bool timedOut = false;
+	DPNID dpnid = 0;
+
+	EnterCriticalSection( &m_connectionCS );
+
+	m_connections ->Iterate( true );
+	while( m_connections ->Iterate() )
+	{
+		UdpConnection *connection = m_connections ->GetCurrent();
+
+		// Only one connection is dropped at a time, so the network can be told outside the lock
+		if( now - connection ->lastReceived > UDP_TIME_OUT )
+		{
+			timedOut = true;
+			dpnid = connection ->dpnid;
+			break;
+		}
+
+		ServiceConnection( connection, now );
+	}
+
+	LeaveCriticalSection( &m_connectionCS );
+
+	if( timedOut == false )
+		return;
+
+	// A host loses the client, a client loses the whole session
+	if( m_hosting == true )
+		Disconnect( dpnid );
+	else
+	{
+		Reset();
+		m_network ->TerminateSession();
+	}
+
+}
+
+// Send the reliable messages that are due on a connection, and a keep alive if
+// received packets need acknowledging or the connection has been quiet. Must be
+// called inside the connection critical section
+void UdpTransport::ServiceConnection( UdpConnection *connection, unsigned long now )
+{
+	// Forget the acknowledged messages at the front of the list. Any behind an
+	// unacknowledged one wait until it is acknowledged too
+	UdpReliableMessage *message = connection ->reliable ->GetFirst();
+	while( message != NULL && message ->acked == true )
+	{
+		connection ->reliable ->Remove( &message );
+		message = connection ->reliable ->GetFirst();
+	}
+
+	// Find the oldest unacknowledged message of each class
+	unsigned short oldest[UDP_RELIABLE_ORDERED + 1];
+	bool found[UDP_RELIABLE_ORDERED + 1] = { false };
+
+	connection ->reliable ->Iterate( true );
+	while( connection ->reliable ->Iterate() )
+	{
+		message = connection ->reliable ->GetCurrent();
+		if( message ->acked == false && found[message ->delivery] == false )
+		{
+			oldest[message ->delivery] = message ->id;
+			found[message ->delivery] = true;
+		}
+	}
+
+	connection ->reliable ->Iterate( true );
+	while( connection ->reliable ->Iterate() )
+	{
+		message = connection ->reliable ->GetCurrent();
+		if( message ->acked == true )
+			continue;
+
+		// Send messages waiting for room in the window, and resend those that have
+		// not been acknowledged in time, backing off with each attempt
+		if( message ->sentTime == 0 )
+		{
+			if( (unsigned short)( message ->id - oldest[message ->delivery] ) >= UDP_RELIABLE_WINDOW )
+				continue;
+		}
+		else if( now - message ->sentTime < connection ->retransmitTime << min( message ->attempts - 1, (unsigned long)UDP_MAX_BACKOFF ) )
+			continue;
+
+		// A message that cannot be transmitted is never queued, but should one
+		// be it is dropped rather than left to hold up the window
+		if( Transmit( connection, message ->type, message ->delivery, message ->id, message ->body, message ->size, &message ->sequence ) == false )
+		{
+			message ->acked = true;
+			continue;
+		}
+
+		message ->sentTime = now;
+		message ->attempts++;
+	}
+
+	if( ( connection ->ackPending == true && now - connection ->lastSent >= UDP_ACK_TIME ) || now - connection ->lastSent > UDP_KEEP_ALIVE_TIME )
+		Transmit( connection, UDP_PACKET_KEEP_ALIVE, UDP_UNRELIABLE, 0, NULL, 0 );
+
+}
+
+// Accept a request to join the hosted session
+void UdpTransport::Accept( UdpPacket *packet, sockaddr_in *from )
+{
+	GUID guid;
+	unsigned long size;
+	char *name = NULL;
+
+	if( packet ->Read( &guid, sizeof( GUID ) ) == false || IsEqualGUID( guid, m_network ->GetGUID() ) == false || packet ->Read( &size, sizeof( unsigned long ) ) == false ||
+		( name = packet ->ReadString() ) == NULL || packet ->size - packet ->position < size )
+		return;
+
+	void *data = packet ->data + packet ->position;
+
+	EnterCriticalSection( &m_connectionCS );
+
+	UdpConnection *connection = FindConnection( from );
+	bool repeated = connection != NULL;
+
+	if( repeated == false )
+	{
+		// Turn the player away if the session is full, or the network has no
+		// slot for it, which it may not while departed players are reclaimed.
+		// The host takes a place as well as the connections
+		unsigned long limit = NETWORK_MAX_PLAYERS;
+		if( m_maxPlayers != 0 && m_maxPlayers < limit )
+			limit = m_maxPlayers;
+
+		if( m_connections ->GetTotalElements() + 1 >= limit || m_network ->CreatePlayer( m_nextID, name, data, size, false, false ) == false )
+		{
+			LeaveCriticalSection( &m_connectionCS );
+
+			UdpPacket reject( UDP_PACKET_REJECT );
+			SendPacket( &reject, from );
+			return;
+		}
+
+		connection = m_connections ->Add( new UdpConnection( from, m_nextID++ ) );
+	}
+
+	// A repeated request means the acceptance was lost, so it is simply sent again
+	DPNID dpnid = connection ->dpnid;
+	DPNID host = m_dpnid;
+	UdpPacket accept( UDP_PACKET_ACCEPT );
+	accept.Write( &dpnid, sizeof( DPNID ) );
+	accept.Write( &host, sizeof( DPNID ) );
+	SendPacket( &accept, connection );
+
+	if( repeated == false )
+	{
+		// The new player learns of the host and everyone already in the session,
+		// and they all learn of the new player
+		SendPlayer( connection, m_dpnid, m_name, m_data, m_dataSize, true );
+
+		m_connections ->Iterate( true );
+		while( m_connections ->Iterate() )
+		{
+			UdpConnection *other = m_connections ->GetCurrent();
+			if( other == connection )
+				continue;
+
+			// This is the receive thread, so the player is copied out rather than read where the network keeps it
+			PlayerInfo player;
+			if( m_network ->CopyPlayer( other ->dpnid, &player ) == true )
+				SendPlayer( connection, player.dpnid, player.name, player.data, player.size, false );
+
+			SendPlayer( other, dpnid, name, data, size, false );
+		}
+	}
+
+	LeaveCriticalSection( &m_connectionCS );
+
+}
+
+// Drop a client from the hosted session and tell everyone else
+void UdpTransport::Disconnect( DPNID dpnid )
+{
+	EnterCriticalSection( &m_connectionCS );
+
+	UdpConnection *connection = FindConnection( dpnid );
+	if( connection == NULL )
+	{
+		LeaveCriticalSection( &m_connectionCS );
+		return;
+	}
+
+	m_connections ->Remove( &connection );
+
+	m_connections ->Iterate( true );
+	while( m_connections ->Iterate() )
+		SendToConnection( m_connections ->GetCurrent(), UDP_PACKET_LEAVE, UDP_RELIABLE_ORDERED, &dpnid, sizeof( DPNID ) );
+
+	LeaveCriticalSection( &m_connectionCS );
+
+	m_network ->DestroyPlayer( dpnid );
+
+}
+
+// Deliver a message to the local player and, when hosting, forward it in the
+// same delivery class to the other players it is for. Returns false if the
+// network had no room for the local player's copy, in which case nothing is
+// forwarded either, so the retransmission is not forwarded twice
+bool UdpTransport::Route( UdpPacket *packet, DPNID sender, unsigned char delivery )
+{
+	char *body = packet ->data + packet ->position;
+	DPNID destination, origin;
+	if( packet ->Read( &destination, sizeof( DPNID ) ) == false || packet ->Read( &origin, sizeof( DPNID ) ) == false )
+		return true;
+
+	// The host knows which player sent the message from its connection, and
+	// writes that over whatever the message claims before it goes any further.
+	// A client's only connection is to the host, so it takes the host's word
+	if( m_hosting == true )
+		memcpy( packet ->data + packet ->position - sizeof( DPNID ), &sender, sizeof( DPNID ) );
+	else
+		sender = origin;
+
+	// The local player reads the message in place, so the network is given a
+	// reference to the receive buffer, while the packet keeps its own until
+	// the message has been forwarded
+	bool local = destination == DPNID_ALL_PLAYERS_GROUP || destination == m_dpnid;
+	if( local == true )
+	{
+		ReceiveBufferPool::AddReference( packet ->buffer );
+		if( m_network ->ReceiveMessage( sender, packet ->buffer, packet ->data + packet ->position, packet ->size - packet ->position ) == false )
+			return false;
+	}
+
+	if( m_hosting == true && destination != m_dpnid )
+	{
+		EnterCriticalSection( &m_connectionCS );
+
+		m_connections ->Iterate( true );
+		while( m_connections ->Iterate() )
+		{
+			UdpConnection *connection = m_connections ->GetCurrent();
+			if( connection ->dpnid != sender && ( destination == DPNID_ALL_PLAYERS_GROUP || connection ->dpnid == destination ) )
+				SendToConnection( connection, UDP_PACKET_DATA, delivery, body, packet ->size - ( body - packet ->data ) );
+		}
+
+		LeaveCriticalSection( &m_connectionCS );
+	}
+
+	// The network keeps the receive buffer, so the packet gives up its own
+	if( local == true )
+	{
+		ReceiveBufferPool::Release( packet ->buffer );
+		packet ->buffer = NULL;
+	}
+
+	return true;
+}
+
+// Tell the given connection about a player. Must be called inside the connection critical section
+void UdpTransport::SendPlayer( UdpConnection *connection, DPNID dpnid, char *name, void *data, unsigned long size, bool host )
+{
+	unsigned char isHost = host == true ? 1 : 0;
+	if( data == NULL )
+		size = 0;
+
+	UdpPacket body;
+	body.Write( &dpnid, sizeof( DPNID ) );
+	body.Write( &isHost, sizeof( unsigned char ) );
+	body.Write( &size, sizeof( unsigned long ) );
+	body.WriteString( name != NULL ? name : "" );
+
+	if( body.Write( data, size ) == true )
+		SendToConnection( connection, UDP_PACKET_PLAYER, UDP_RELIABLE_ORDERED, body.data, body.size );
+
+}
+
+// Send a message over a connection in the given delivery class. Reliable
+// messages are kept until they are acknowledged, and wait to be sent by the
+// receive thread if the window is full. Returns false, without queuing the
+// message or using up an ID, if it is too large for a packet. Must be called
+// inside the connection critical section
+bool UdpTransport::SendToConnection( UdpConnection *connection, unsigned char type, unsigned char delivery, void *body, unsigned long size )
+{
+	if( size > UDP_MAX_BODY_SIZE )
+		return false;
+
+	unsigned short id = connection ->nextID[delivery]++;
+
+	if( delivery == UDP_RELIABLE_ORDERED || delivery == UDP_RELIABLE_UNORDERED )
+	{
+		UdpReliableMessage *message = connection ->reliable ->Add( new UdpReliableMessage( type, delivery, id, body, size ) );
+		if( InWindow( connection, message ) == false )
+			return true;
+
+		Transmit( connection, type, delivery, id, body, size, &message ->sequence );
+		message ->sentTime = timeGetTime();
+		message ->attempts = 1;
+	}
+	else
+		Transmit( connection, type, delivery, id, body, size );
+
+	return true;
+}
+
+// Send a message over a connection in a new packet, carrying the connection's
+// acknowledgements, and return the packet's sequence number if asked for.
+// Returns false, without sending anything or using up a sequence number, if
+// the message is too large for the packet. Must be called inside the
+// connection critical section
+bool UdpTransport::Transmit( UdpConnection *connection, unsigned char type, unsigned char delivery, unsigned short id, void *body, unsigned long size, unsigned short *sequence )
+{
+	if( size > UDP_MAX_BODY_SIZE )
+		return false;
+
+	unsigned short next = connection ->localSequence++;
+
+	UdpPacket packet( type );
+	packet.Write( &next, sizeof( unsigned short ) );
+	packet.Write( &connection ->remoteSequence, sizeof( unsigned short ) );
+	packet.Write( &connection ->receivedBits, sizeof( unsigned long ) );
+	packet.Write( &delivery, sizeof( unsigned char ) );
+	packet.Write( &id, sizeof( unsigned short ) );
+	packet.Write( body, size );
+
+	UdpSentPacket *sent = &connection ->sent[next & ( UDP_SENT_HISTORY - 1 )];
+	sent ->sequence = next;
+	sent ->time = timeGetTime();
+	sent ->acked = false;
+
+	connection ->ackPending = false;
+	SendPacket( &packet, connection );
+
+	if( sequence != NULL )
+		*sequence = next;
+
+	return true;
+}
+
+// Send a packet over the given connection. Must be called inside the connection critical section
+void UdpTransport::SendPacket( UdpPacket *packet, UdpConnection *connection )
+{
+	SendPacket( packet, &connection ->address );
+	connection ->lastSent = timeGetTime();
+
+}
+
+// Send a packet to the given address
+void UdpTransport::SendPacket( UdpPacket *packet, sockaddr_in *address )
+{
+	sendto( m_socket, packet ->data, packet ->size, 0, ( sockaddr* ) address, sizeof( sockaddr_in ) );
+
+}
+
+// Mark the packets the other end has acknowledged, measuring the round trip
+// time from each and marking any reliable message whose last packet was
+// among them. Must be called inside the connection critical section
+void UdpTransport::ProcessAcks( UdpConnection *connection, unsigned short ack, unsigned long ackBits )
+{
+	unsigned long now = timeGetTime();
+	bool acked = false;
+
+	for( unsigned long b = 0; b <= 32; b++ )
+	{
+		if( b > 0 && ( ackBits & ( 1UL << ( b - 1 ) ) ) == 0 )
+			continue;
+
+		UdpSentPacket *sent = &connection ->sent[(unsigned short)( ack - b ) & ( UDP_SENT_HISTORY - 1 )];
+		if( sent ->sequence != (unsigned short)( ack - b ) || sent ->acked == true )
+			continue;
+
+		sent ->acked = true;
+		acked = true;
+
+		// Smooth the round trip time and its variation, and retransmit after the
+		// time plus four times the variation
+		float sample = (float)( now - sent ->time );
+		if( connection ->roundTrip == 0.0f )
+		{
+			connection ->roundTrip = max( sample, 1.0f );
+			connection ->roundTripVariance = sample / 2.0f;
+		}
+		else
+		{
+			connection ->roundTripVariance = connection ->roundTripVariance * 0.75f + fabs( connection ->roundTrip - sample ) * 0.25f;
+			connection ->roundTrip = connection ->roundTrip * 0.875f + sample * 0.125f;
+		}
+
+		connection ->retransmitTime = (unsigned long)( connection ->roundTrip + connection ->roundTripVariance * 4.0f );
+		connection ->retransmitTime = max( (unsigned long)UDP_MIN_RETRANSMIT_TIME, min( connection ->retransmitTime, (unsigned long)UDP_MAX_RETRANSMIT_TIME ) );
+	}
+
+	if( acked == false )
+		return;
+
+	connection ->reliable ->Iterate( true );
+	while( connection ->reliable ->Iterate() )
+	{
+		UdpReliableMessage *message = connection ->reliable ->GetCurrent();
+		UdpSentPacket *sent = &connection ->sent[message ->sequence & ( UDP_SENT_HISTORY - 1 )];
+		if( message ->sentTime != 0 && sent ->sequence == message ->sequence && sent ->acked == true )
+			message ->acked = true;
+	}
+
+}
+
+// Note a packet received over a connection so it is acknowledged. Must be
+// called inside the connection critical section
+void UdpTransport::RecordSequence( UdpConnection *connection, unsigned short sequence )
+{
+	if( IsNewer( sequence, connection ->remoteSequence ) == true )
+	{
+		// Shift the bits along, with the previous latest packet becoming the first
+		unsigned short shift = sequence - connection ->remoteSequence;
+		connection ->receivedBits = shift >= 32 ? 0 : connection ->receivedBits << shift;
+		if( shift <= 32 )
+			connection ->receivedBits |= 1UL << ( shift - 1 );
+
+		connection ->remoteSequence = sequence;
+	}
+	else
+	{
+		unsigned short behind = connection ->remoteSequence - sequence;
+		if( behind >= 1 && behind <= 32 )
+			connection ->receivedBits |= 1UL << ( behind - 1 );
+	}
+
+	connection ->ackPending = true;
+
+}
+
+// Returns true if a reliable message is close enough to the oldest
+// unacknowledged message of its class for the other end to accept it. Must be
+// called inside the connection critical section
+bool UdpTransport::InWindow( UdpConnection *connection, UdpReliableMessage *message )
+{
+	connection ->reliable ->Iterate( true );
+	while( connection ->reliable ->Iterate() )
+	{
+		UdpReliableMessage *oldest = connection ->reliable ->GetCurrent();
+		if( oldest ->delivery == message ->delivery && oldest ->acked == false )
+			return (unsigned short)( message ->id - oldest ->id ) < UDP_RELIABLE_WINDOW;
+	}
+
+	return true;
+}
+
+// Returns true if sequence number a is more recent than b, allowing for wrap around
+bool UdpTransport::IsNewer( unsigned short a, unsigned short b )
+{
+	return a != b && (unsigned short)( a - b ) < 0x8000;
+}
+
+// Find the connection to the given address. Must be called inside the connection critical section
+UdpConnection *UdpTransport::FindConnection( sockaddr_in *address )
+{
+	m_connections ->Iterate( true );
+	while( m_connections ->Iterate() )
+	{
+		UdpConnection *connection = m_connections ->GetCurrent();
+		if( connection ->address.sin_addr.s_addr == address ->sin_addr.s_addr && connection ->address.sin_port == address ->sin_port )
+			return connection;
+	}
+
+	return NULL;
+}
+
+// Find the connection to the given player. Must be called inside the connection critical section
+UdpConnection *UdpTransport::FindConnection( DPNID dpnid )
+{
+	m_connections ->Iterate( true );
+	while( m_connections ->Iterate() )
+		if( m_connections ->GetCurrent() ->dpnid == dpnid )
+			return m_connections ->GetCurrent();
+
+	return NULL;
+}
+
+// Store the local player's name and data so they can be given to the other players
+void UdpTransport::SetLocalPlayer( char *name, void *playerData, unsigned long dataSize )
+{
+	SAFE_DELETE_ARRAY( m_name );
+	SAFE_DELETE_ARRAY( m_data );
+
+	m_name = new char[strlen( name ) + 1];
+	strcpy( m_name, name );
+
+	m_dataSize = playerData != NULL ? dataSize : 0;
+	if( m_dataSize > 0 )
+	{
+		m_data = new char[m_dataSize];
+		memcpy( m_data, playerData, m_dataSize );
+	}
+
+}
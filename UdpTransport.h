@@ -0,0 +1,415 @@
+// ***********************************************************************
+//
+// File: UdpTransport.h
+// Programmer: T.J. Eason
+// Project: Game Engine
+// Description: Client/server network transport over non-blocking UDP sockets
+// Date: 10-19-26
+//
+// ***********************************************************************
+
+#ifndef UDP_TRANSPORT_H
+#define UDP_TRANSPORT_H
+
+// Winsock takes the length of an address as a plain int.
+typedef int socklen_t;
+
+// Identifies the transport's packets
+#define UDP_PROTOCOL_ID 0x4745
+
+// Largest packet sent, small enough to avoid fragmentation on any route.
+#define UDP_MAX_PACKET_SIZE 1200
+
+// Bytes taken at the start of a packet sent over a connection by its header,
+// sequence numbers, acknowledgements, delivery class and message ID.
+#define UDP_CONNECTION_HEADER_SIZE 14
+
+// Largest message body a packet sent over a connection can carry, and the
+// largest message Send can carry once the player it is for and the player it
+// is from are added to it.
+// Nothing larger is ever queued, as it could never be transmitted.
+#define UDP_MAX_BODY_SIZE ( UDP_MAX_PACKET_SIZE - UDP_CONNECTION_HEADER_SIZE )
+#define UDP_MAX_MESSAGE_SIZE ( UDP_MAX_BODY_SIZE - 2 * sizeof( DPNID ) )
+
+// Times in milliseconds. The receive thread services its connections at least
+// once every wait time.
+#define UDP_WAIT_TIME 10
+#define UDP_ENUMERATE_TIME 1000
+#define UDP_CONNECT_TIME 5000
+#define UDP_CONNECT_RETRY_TIME 250
+#define UDP_KEEP_ALIVE_TIME 1000
+#define UDP_TIME_OUT 10000
+
+// Longest a received packet waits for its acknowledgement to be carried by
+// another packet before one is sent just for it, in milliseconds.
+#define UDP_ACK_TIME 20
+
+// Retransmission times in milliseconds. The time starts at the initial value
+// and follows the measured round trip time within the limits, doubling for
+// each attempt a message has already had up to the maximum backoff.
+#define UDP_INITIAL_RETRANSMIT_TIME 200
+#define UDP_MIN_RETRANSMIT_TIME 30
+#define UDP_MAX_RETRANSMIT_TIME 2000
+#define UDP_MAX_BACKOFF 4
+
+// Number of reliable messages of each delivery class that can be in flight
+// over a connection, which is also how far ahead of the next ordered message
+// the receiver will buffer. Must be a power of two.
+#define UDP_RELIABLE_WINDOW 64
+
+// Number of sent packets remembered for acknowledgement. Must be a power of two.
+#define UDP_SENT_HISTORY 256
+
+// Types of packet. Player, leave, data and keep alive packets are sent over a
+// connection and start with its sequence header.
+enum { UDP_PACKET_ENUMERATE = 1, UDP_PACKET_SESSION, UDP_PACKET_CONNECT, UDP_PACKET_ACCEPT, UDP_PACKET_REJECT,
+UDP_PACKET_PLAYER, UDP_PACKET_LEAVE, UDP_PACKET_TERMINATE, UDP_PACKET_DATA, UDP_PACKET_KEEP_ALIVE };
+
+// Delivery classes of the messages sent over a connection
+enum { UDP_UNRELIABLE, UDP_UNRELIABLE_SEQUENCED, UDP_RELIABLE_UNORDERED, UDP_RELIABLE_ORDERED };
+
+// UDP packet structure, a packet being written or read. Packets are written
+// into their own storage, while received packets are read in place from the
+// receive buffer they arrived in. A message that keeps the receive buffer
+// takes it from the packet and leaves buffer NULL.
+struct UdpPacket
+{
+	char storage[UDP_MAX_PACKET_SIZE];		// Contents of a packet being written
+	char *data;										// Packet contents
+	char *buffer;										// Receive buffer holding a received packet's contents
+	unsigned long size;								// Number of bytes written or received
+	unsigned long position;							// Next byte to read
+
+	// UDP packet constructor, starts the packet with its header when given a type
+	UdpPacket( unsigned char type = 0 )
+	{
+		data = storage;
+		buffer = NULL;
+		size = 0;
+		position = 0;
+
+		if( type != 0 )
+		{
+			unsigned short protocol = UDP_PROTOCOL_ID;
+			Write( &protocol, sizeof( unsigned short ) );
+			Write( &type, sizeof( unsigned char ) );
+		}
+	}
+
+	// UDP packet constructor, reads a packet received into the given receive buffer
+	UdpPacket( char *received, unsigned long length )
+	{
+		data = received;
+		buffer = received;
+		size = length;
+		position = 0;
+	}
+
+	// Adds the given bytes, returns false if they do not fit
+	bool Write( const void *value, unsigned long length )
+	{
+		if( size + length > UDP_MAX_PACKET_SIZE )
+			return false;
+
+		memcpy( data + size, value, length );
+		size += length;
+
+		return true;
+	}
+
+	// Adds a null terminated string
+	bool WriteString( const char *value )
+	{
+		return Write( value, (unsigned long)strlen( value ) + 1 );
+	}
+
+	// Reads the given number of bytes, returns false if the packet is too short
+	bool Read( void *value, unsigned long length )
+	{
+		if( position + length > size )
+			return false;
+
+		memcpy( value, data + position, length );
+		position += length;
+
+		return true;
+	}
+
+	// Returns a string from the packet, or NULL if it is not terminated
+	char *ReadString()
+	{
+		for( unsigned long c = position; c < size; c++ )
+		{
+			if( data[c] == 0 )
+			{
+				char *value = data + position;
+				position = c + 1;
+				return value;
+			}
+		}
+
+		return NULL;
+	}
+
+	// Returns the type of a received packet, or zero if it is not one of the transport's
+	unsigned char ReadHeader()
+	{
+		unsigned short protocol;
+		unsigned char type;
+
+		position = 0;
+		if( Read( &protocol, sizeof( unsigned short ) ) == false || protocol != UDP_PROTOCOL_ID || Read( &type, sizeof( unsigned char ) ) == false )
+			return 0;
+
+		return type;
+	}
+
+};
+
+// UDP sent packet structure, a packet waiting to be acknowledged.
+struct UdpSentPacket
+{
+	unsigned short sequence;		// Sequence number of the packet
+	unsigned long time;				// Time the packet was sent
+	bool acked;							// Indicates if the packet has been acknowledged
+
+};
+
+// UDP reliable message structure, a message kept until the other end
+// acknowledges the last packet it was sent in.
+struct UdpReliableMessage
+{
+	unsigned char type;				// Type of packet the message is sent as
+	unsigned char delivery;			// Delivery class of the message
+	unsigned short id;				// Position of the message within its delivery class
+	char *body;							// Contents of the message
+	unsigned long size;				// Size of the contents
+	unsigned short sequence;		// Sequence number of the packet the message was last sent in
+	unsigned long sentTime;		// Time the message was last sent, or zero if it has not been sent yet
+	unsigned long attempts;		// Number of times the message has been sent
+	bool acked;							// Indicates if the message has been acknowledged
+
+	// UDP reliable message constructor
+	UdpReliableMessage( unsigned char packetType, unsigned char deliveryClass, unsigned short messageID, void *data, unsigned long dataSize )
+	{
+		type = packetType;
+		delivery = deliveryClass;
+		id = messageID;
+		body = new char[max( dataSize, 1UL )];
+		memcpy( body, data, dataSize );
+		size = dataSize;
+		sequence = 0;
+		sentTime = 0;
+		attempts = 0;
+		acked = false;
+	}
+
+	// UDP reliable message destructor
+	~UdpReliableMessage()
+	{
+		SAFE_DELETE_ARRAY( body );
+	}
+
+};
+
+// UDP buffered message structure, a reliable ordered message that arrived
+// before the ones ahead of it. It keeps the receive buffer the packet arrived in.
+struct UdpBufferedMessage
+{
+	unsigned char type;				// Type of packet the message arrived in
+	char *buffer;						// Receive buffer holding the packet
+	unsigned long size;				// Size of the packet
+	unsigned long position;			// Position of the message's contents in the packet
+
+	// UDP buffered message constructor, takes the receive buffer from the packet
+	UdpBufferedMessage( unsigned char packetType, UdpPacket *packet )
+	{
+		type = packetType;
+		buffer = packet ->buffer;
+		size = packet ->size;
+		position = packet ->position;
+
+		packet ->buffer = NULL;
+	}
+
+	// UDP buffered message destructor
+	~UdpBufferedMessage()
+	{
+		ReceiveBufferPool::Release( buffer );
+	}
+
+};
+
+// UDP connection structure, the other end of a session. A host has one for
+// every client, a client only has one for its host. Every packet sent over a
+// connection carries a sequence number along with an acknowledgement of the
+// latest packet received and a bit for each of the 32 before it, from which
+// the round trip time is measured and reliable messages are retransmitted.
+// A packet holding a reliable message is only acknowledged once the message
+// has been queued by the network, or held to be delivered in order. Unreliable
+// sequenced messages share one sequence per connection, so a late one is
+// dropped whatever messages either of them carried.
+struct UdpConnection
+{
+	sockaddr_in address;																		// Address of the other end
+	DPNID dpnid;																					// Player at the other end
+	unsigned long lastReceived;																// Time the last packet was received
+	unsigned long lastSent;																		// Time the last packet was sent
+
+	unsigned short localSequence;														// Sequence number of the next packet sent
+	unsigned short remoteSequence;														// Latest sequence number received
+	unsigned long receivedBits;																// Bit n set if the packet n + 1 before the latest was received
+	bool ackPending;																				// Indicates if received packets are waiting to be acknowledged
+	UdpSentPacket sent[UDP_SENT_HISTORY];										// Recently sent packets
+
+	float roundTrip;																				// Smoothed round trip time, or zero before it has been measured
+	float roundTripVariance;																	// Smoothed variation in the round trip time
+	unsigned long retransmitTime;														// Time to wait for a reliable message to be acknowledged
+
+	unsigned short nextID[UDP_RELIABLE_ORDERED + 1];						// ID of the next message sent in each delivery class
+	LinkedList< UdpReliableMessage > *reliable;									// Reliable messages waiting to be acknowledged
+
+	unsigned short nextOrdered;															// ID of the next reliable ordered message to deliver
+	UdpBufferedMessage *ordered[UDP_RELIABLE_WINDOW];					// Reliable ordered messages that arrived early
+	unsigned short unordered[UDP_RELIABLE_WINDOW];						// ID of the last reliable unordered message received in each slot, plus one
+	unsigned short lastSequenced;														// ID of the latest unreliable sequenced message delivered, whatever it held
+	bool sequenced;																				// Indicates if any unreliable sequenced message has been delivered
+
+	// UDP connection constructor
+	UdpConnection( sockaddr_in *to, DPNID id )
+	{
+		address = *to;
+		dpnid = id;
+		lastReceived = lastSent = timeGetTime();
+
+		// Sequence zero is never sent, so an acknowledgement from an end that
+		// has received nothing yet matches nothing
+		localSequence = 1;
+		remoteSequence = 0;
+		receivedBits = 0;
+		ackPending = false;
+		for( unsigned long s = 0; s < UDP_SENT_HISTORY; s++ )
+		{
+			sent[s].sequence = 0;
+			sent[s].time = 0;
+			sent[s].acked = true;
+		}
+
+		roundTrip = 0.0f;
+		roundTripVariance = 0.0f;
+		retransmitTime = UDP_INITIAL_RETRANSMIT_TIME;
+
+		for( unsigned long d = 0; d <= UDP_RELIABLE_ORDERED; d++ )
+			nextID[d] = 0;
+		reliable = new LinkedList< UdpReliableMessage >;
+
+		nextOrdered = 0;
+		for( unsigned long m = 0; m < UDP_RELIABLE_WINDOW; m++ )
+		{
+			ordered[m] = NULL;
+			unordered[m] = 0;
+		}
+		lastSequenced = 0;
+		sequenced = false;
+	}
+
+	// UDP connection destructor
+	~UdpConnection()
+	{
+		SAFE_DELETE( reliable );
+
+		for( unsigned long m = 0; m < UDP_RELIABLE_WINDOW; m++ )
+			SAFE_DELETE( ordered[m] );
+	}
+
+};
+
+// UDP session structure
+struct UdpSession : public SessionInfo
+{
+	sockaddr_in address;		// Address of the host
+
+};
+
+// UDP transport class. Sessions are client/server, with the host forwarding
+// messages clients send to each other. The socket never blocks, it is read by
+// a thread that waits for packets and also keeps the connections alive,
+// dropping any that go quiet and retransmitting unacknowledged reliable
+// messages. Send maps DirectPlay's flags to a delivery class, so unreliable
+// messages such as position updates never wait behind a lost reliable one.
+// Apart from copying players out with CopyPlayer, which takes no lock, the
+// network is never called while the connection lock is held.
+class UdpTransport : public NetworkTransport
+{
+public:
+	UdpTransport( Network *network );
+	virtual ~UdpTransport();
+
+	virtual void EnumerateSessions();
+
+	virtual bool Host( char *name, char *session, int players, void *playerData, unsigned long dataSize );
+	virtual bool Join( char *name, SessionInfo *session, void *playerData, unsigned long dataSize );
+
+	virtual void Terminate();
+
+	virtual void Send( DPNID dpnid, void *data, unsigned long size, long flags );
+
+	virtual unsigned long GetMaxMessageSize();
+
+private:
+	static DWORD WINAPI ReceiveThread( LPVOID parameter );
+	static bool IsNewer( unsigned short a, unsigned short b );
+
+	bool Open( unsigned short port );
+	void Close();
+	void Reset();
+
+	bool WaitForPackets( unsigned long timeout );
+	void ReceivePackets();
+	void ProcessPacket( UdpPacket *packet, sockaddr_in *from );
+	void ProcessMessage( unsigned char type, UdpPacket *packet, sockaddr_in *from );
+	bool DeliverMessage( unsigned char type, unsigned char delivery, UdpPacket *packet, DPNID sender );
+	void Service();
+	void ServiceConnection( UdpConnection *connection, unsigned long now );
+
+	void Accept( UdpPacket *packet, sockaddr_in *from );
+	void Disconnect( DPNID dpnid );
+	bool Route( UdpPacket *packet, DPNID sender, unsigned char delivery );
+
+	void SendPlayer( UdpConnection *connection, DPNID dpnid, char *name, void *data, unsigned long size, bool host );
+	bool SendToConnection( UdpConnection *connection, unsigned char type, unsigned char delivery, void *body, unsigned long size );
+	bool Transmit( UdpConnection *connection, unsigned char type, unsigned char delivery, unsigned short id, void *body, unsigned long size, unsigned short *sequence = NULL );
+	void SendPacket( UdpPacket *packet, UdpConnection *connection );
+	void SendPacket( UdpPacket *packet, sockaddr_in *address );
+
+	void ProcessAcks( UdpConnection *connection, unsigned short ack, unsigned long ackBits );
+	void RecordSequence( UdpConnection *connection, unsigned short sequence );
+	bool InWindow( UdpConnection *connection, UdpReliableMessage *message );
+
+	UdpConnection *FindConnection( sockaddr_in *address );
+	UdpConnection *FindConnection( DPNID dpnid );
+
+	void SetLocalPlayer( char *name, void *playerData, unsigned long dataSize );
+
+private:
+	SOCKET m_socket;													// Socket every packet is sent and received through
+	HANDLE m_thread;													// Receive thread
+	volatile bool m_exit;												// Tells the receive thread to stop
+
+	CRITICAL_SECTION m_connectionCS;						// Guards the connections
+	LinkedList< UdpConnection > *m_connections;		// Connections to the other players
+
+	volatile bool m_hosting;										// Indicates if the local player is hosting
+	char *m_session;													// Name of the session being hosted
+	unsigned long m_maxPlayers;									// Most players the hosted session allows, or zero for no limit
+	DPNID m_nextID;													// ID given to the next player to join the hosted session
+	volatile long m_joinResult;									// One once a join is accepted, minus one if it is rejected
+
+	volatile DPNID m_dpnid;										// ID of the local player, or zero when not in a session
+	char *m_name;														// Name of the local player
+	char *m_data;														// Data of the local player
+	unsigned long m_dataSize;										// Size of the local player's data
+
+};
+
+#endif
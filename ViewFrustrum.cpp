@@ -103,3 +103,9 @@ bool ViewFrustum::IsSphereInside( D3DXVECTOR3 translation, float radius )
 
 	return true;
 }
+
+// Returns the view frustum's planes.
+D3DXPLANE *ViewFrustum::GetPlanes()
+{
+	return m_planes;
+}
\ No newline at end of file
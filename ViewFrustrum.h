@@ -11,6 +11,9 @@
 #ifndef VIEW_FRUSTUM_H
 #define VIEW_FRUSTUM_H
 
+// Number of planes in the view frustum.
+#define VIEW_FRUSTUM_PLANES 5
+
 // View Frustum Class
 class ViewFrustum
 {
@@ -23,9 +26,11 @@ public:
 	bool IsBoxInside( D3DXVECTOR3 translation, D3DXVECTOR3 min, D3DXVECTOR3 max );
 	bool IsSphereInside( D3DXVECTOR3 translation, float radius );
 
+	D3DXPLANE *GetPlanes();
+
 private:
 	D3DXMATRIX m_projection;		// Pointer to a projection matrix.
-	D3DXPLANE m_planes[5];			// Five planes of the view frustum (near plane is ignored).
+	D3DXPLANE m_planes[VIEW_FRUSTUM_PLANES];			// Five planes of the view frustum (near plane is ignored).
 };
 
 #endif
\ No newline at end of file